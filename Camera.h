@@ -115,6 +115,17 @@ public:
         
     }
     
+    // Places the camera at position looking at target, e.g. for a scripted path
+    void LookAt( glm::vec3 position, glm::vec3 target )
+    {
+        glm::vec3 direction = glm::normalize( target - position );
+        
+        this->position = position;
+        this->pitch = glm::degrees( asin( direction.y ) );
+        this->yaw = glm::degrees( atan2( direction.z, direction.x ) );
+        this->updateCameraVectors( );
+    }
+    
     GLfloat GetZoom( )
     {
         return this->zoom;
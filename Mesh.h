@@ -1,15 +1,22 @@
 #pragma once
 
 #include <string>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <algorithm>
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "gl_trace.h"
+#include "profiler.h"
+#include "texture_array.h"
+
 using namespace std;
 
 struct Vertex
@@ -27,6 +34,9 @@ struct Texture
     GLuint id;
     string type;
     aiString path;
+    // Page and layer when id is a texture array page (see TextureArrayAllocator), -1 for a plain 2D texture
+    GLint page = -1;
+    GLint layer = -1;
 };
 
 class Mesh
@@ -39,49 +49,86 @@ public:
     
     /*  Functions  */
     // Constructor
-    Mesh( vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures )
+    // With upload off the buffers are created later by Upload (see FrameScheduler), the mesh isn't drawn until then
+    Mesh( vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures, bool upload = true )
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
         
         // Now that we have all the required data, set the vertex buffers and its attribute pointers.
-        this->setupMesh( );
+        if ( upload )
+        {
+            this->setupMesh( );
+        }
+    }
+    
+    void Upload( )
+    {
+        if ( 0 == this->VAO )
+        {
+            this->setupMesh( );
+        }
+    }
+    
+    bool Uploaded( ) const
+    {
+        return 0 != this->VAO;
+    }
+    
+    // Bytes of vertex and index data handed to GL by Upload
+    size_t Size( ) const
+    {
+        return this->vertices.size( ) * sizeof( Vertex ) + this->indices.size( ) * sizeof( GLuint );
     }
     
     // Render the mesh
-    void Draw( Shader shader )
+    void Draw( const Shader &shader )
     {
-        // Bind appropriate textures
-        GLuint diffuseNr = 1;
-        GLuint specularNr = 1;
+        PROFILE_SCOPE( "Mesh::Draw" );
+
+        if ( 0 == this->VAO )
+        {
+            return;
+        }
         
+        const ProgramUniforms &uniforms = this->FindUniforms( shader.Program );
+
+        // Array pages are already bound by TextureArrayAllocator::Bind, only the page and layer change per draw. Page
+        // uniforms this mesh has no texture for still hold the last mesh's, they go back to -1 (no page)
+        if ( TextureArrayAllocator::enabled )
+        {
+            for ( GLint location : uniforms.unusedPages )
+            {
+                glUniform1i( location, -1 );
+            }
+        }
+
+        // Bind appropriate textures
         for( GLuint i = 0; i < this->textures.size( ); i++ )
         {
             glActiveTexture( GL_TEXTURE0 + i ); // Active proper texture unit before binding
-            // Retrieve texture number (the N in diffuse_textureN)
-            stringstream ss;
-            string number;
-            string name = this->textures[i].type;
-            
-            if( name == "texture_diffuse" )
+            const TextureUniforms &locations = uniforms.textures[i];
+
+            if ( TextureArrayAllocator::enabled )
             {
-                ss << diffuseNr++; // Transfer GLuint to stream
+                glUniform1i( locations.page, this->textures[i].page );
+                glUniform1f( locations.layer, ( GLfloat )this->textures[i].layer );
             }
-            else if( name == "texture_specular" )
+
+            if ( this->textures[i].page >= 0 )
             {
-                ss << specularNr++; // Transfer GLuint to stream
+                continue;
             }
-            
-            number = ss.str( );
+
             // Now set the sampler to the correct texture unit
-            glUniform1i( glGetUniformLocation( shader.Program, ( name + number ).c_str( ) ), i );
+            glUniform1i( locations.sampler, i );
             // And finally bind the texture
             glBindTexture( GL_TEXTURE_2D, this->textures[i].id );
         }
         
         // Also set each mesh's shininess property to a default value (if you want you could extend this to another mesh property and possibly change this value)
-        glUniform1f( glGetUniformLocation( shader.Program, "material.shininess" ), 16.0f );
+        glUniform1f( uniforms.shininess, 16.0f );
         
         // Draw mesh
         glBindVertexArray( this->VAO );
@@ -97,8 +144,93 @@ public:
     }
     
 private:
+    // Where one texture goes in a shader: its sampler, and its page and layer when in a texture array
+    struct TextureUniforms
+    {
+        GLint sampler = -1;
+        GLint page = -1;
+        GLint layer = -1;
+    };
+
+    // Uniform locations in one shader program, looked up the first time the mesh is drawn with it
+    struct ProgramUniforms
+    {
+        GLuint program = 0;
+        vector<TextureUniforms> textures;
+        // The program's <name>_page uniforms for textures this mesh doesn't have
+        vector<GLint> unusedPages;
+        GLint shininess = -1;
+    };
+
     /*  Render data  */
-    GLuint VAO, VBO, EBO;
+    GLuint VAO = 0, VBO = 0, EBO = 0;
+    // A mesh is drawn with a couple of programs at most (its own shader, feedback passes)
+    vector<ProgramUniforms> programUniforms;
+    
+    const ProgramUniforms &FindUniforms( GLuint program )
+    {
+        for ( const ProgramUniforms &uniforms : this->programUniforms )
+        {
+            if ( uniforms.program == program )
+            {
+                return uniforms;
+            }
+        }
+
+        ProgramUniforms uniforms;
+        uniforms.program = program;
+        uniforms.shininess = glGetUniformLocation( program, "material.shininess" );
+
+        GLuint diffuseNr = 1;
+        GLuint specularNr = 1;
+        vector<string> pages;
+
+        for ( const Texture &texture : this->textures )
+        {
+            // Retrieve texture number (the N in diffuse_textureN)
+            const string &name = texture.type;
+            string uniform = name;
+
+            if( name == "texture_diffuse" )
+            {
+                uniform += to_string( diffuseNr++ );
+            }
+            else if( name == "texture_specular" )
+            {
+                uniform += to_string( specularNr++ );
+            }
+
+            TextureUniforms locations;
+            locations.sampler = glGetUniformLocation( program, uniform.c_str( ) );
+            locations.page = glGetUniformLocation( program, ( uniform + "_page" ).c_str( ) );
+            locations.layer = glGetUniformLocation( program, ( uniform + "_layer" ).c_str( ) );
+            uniforms.textures.push_back( locations );
+            pages.push_back( uniform + "_page" );
+        }
+
+        GLint count = 0;
+        glGetProgramiv( program, GL_ACTIVE_UNIFORMS, &count );
+
+        for ( GLint i = 0; i < count; i++ )
+        {
+            char name[128];
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform( program, ( GLuint )i, sizeof( name ), &length, &size, &type, name );
+            string uniform( name, length );
+
+            if ( uniform.size( ) > 5 && 0 == uniform.compare( uniform.size( ) - 5, 5, "_page" )
+                 && pages.end( ) == std::find( pages.begin( ), pages.end( ), uniform ) )
+            {
+                uniforms.unusedPages.push_back( glGetUniformLocation( program, name ) );
+            }
+        }
+
+        this->programUniforms.push_back( uniforms );
+
+        return this->programUniforms.back( );
+    }
     
     /*  Functions    */
     // Initializes all the buffer objects/arrays
@@ -13,12 +13,19 @@
 #endi*/
 
 #include "mesh.h"
+#include "texture_cache.h"
+#include "texture_streaming.h"
+#include "texture_array.h"
+#include "frame_scheduler.h"
+#include "profiler.h"
+#include "startup_trace.h"
 
 #include <iostream>
 #include <vector>
 #include <string>
+#include <map>
 
-unsigned int TextureFromFile(const char *path, const std::string &directory);
+unsigned int TextureFromFile(const char *path, const std::string &directory, Texture &material);
 
 class Model
 {
@@ -27,29 +34,80 @@ class Model
 
         Model(const char * path)
         {
+            STARTUP_SCOPE(std::string("Model ") + path);
             loadModel(path);
         }
 
-        void Draw(Shader shader)
+        void Draw(const Shader& shader)
         {
+            PROFILE_SCOPE("Model::Draw");
+
             for (unsigned int i = 0; i < meshes.size(); i++)
             {
                 meshes[i].Draw(shader);
             }
         }
 
+        // Distance of the farthest vertex from the model's origin
+        float BoundingRadius() const
+        {
+            return boundingRadius;
+        }
+
+        // Triangles drawn by Draw (meshes whose buffers don't exist yet are skipped)
+        size_t TriangleCount() const
+        {
+            size_t triangles = 0;
+
+            for (unsigned int i = 0; i < meshes.size(); i++)
+            {
+                if (meshes[i].Uploaded())
+                {
+                    triangles += meshes[i].indices.size() / 3;
+                }
+            }
+
+            return triangles;
+        }
+
+        // Asks the texture streamer for the detail this model needs when it covers this many pixels across. The size
+        // also ranks the model's buffers and textures still waiting in the FrameScheduler
+        void StreamTextures(float projectedPixels)
+        {
+            projectedSize = projectedPixels;
+
+            for (unsigned int i = 0; i < textures_loaded.size(); i++)
+            {
+                TextureStreamer::Get().Request(textures_loaded[i].id, projectedPixels);
+            }
+        }
+
+        // Reads the file with the post processing models get, without creating anything from it
+        static const aiScene * Import(Assimp::Importer &importer, const std::string &path)
+        {
+            return importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+        }
+
     private:
         // Model Data
         std::vector<Mesh> meshes;
         std::vector<Texture> textures_loaded;
         std::string directory;
+        float boundingRadius = 0.0f;
+        float projectedSize = 0.0f;
+
+        // Every texture of the model, prepared in the background while the meshes are processed
+        std::shared_ptr<CacheBatch> pendingImages;
+        std::map<std::string, size_t> pendingIndex;
         
 
         // Methods
         void loadModel(std::string path)
         {
             Assimp::Importer importer;
-            const aiScene * scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+            StartupTrace::Get().Begin("Import");
+            const aiScene * scene = Import(importer, path);
+            StartupTrace::Get().End();
 
             if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
             {
@@ -59,7 +117,56 @@ class Model
 
             directory = path.substr(0, path.find_last_of('/'));
 
+            prefetchTextures(scene);
+
+            StartupTrace::Get().Begin("Process meshes");
             processNode(scene->mRootNode, scene);
+            StartupTrace::Get().End();
+
+            // The buffers are created in the render loop, for whatever is largest on screen first. The model must stay
+            // where it is until they are
+            if (FrameScheduler::enabled)
+            {
+                for (unsigned int i = 0; i < meshes.size(); i++)
+                {
+                    FrameTask task;
+                    task.kind = "mesh";
+                    task.estimate = FrameScheduler::EstimateUpload(meshes[i].Size());
+                    task.priority = [this]() { return projectedSize; };
+                    task.work = [this, i]() { meshes[i].Upload(); };
+                    FrameScheduler::Get().Submit(std::move(task));
+                }
+            }
+
+            pendingImages.reset();
+            pendingIndex.clear();
+        }
+
+        // Starts preparing the diffuse and specular textures of every material at once
+        void prefetchTextures(const aiScene * scene)
+        {
+            std::vector<std::string> paths;
+
+            for (unsigned int m = 0; m < scene->mNumMaterials; m++)
+            {
+                for (aiTextureType type : { aiTextureType_DIFFUSE, aiTextureType_SPECULAR })
+                {
+                    for (unsigned int i = 0; i < scene->mMaterials[m]->GetTextureCount(type); i++)
+                    {
+                        aiString str;
+                        scene->mMaterials[m]->GetTexture(type, i, &str);
+                        std::string filename = directory + '/' + std::string(str.C_Str());
+
+                        if (pendingIndex.find(filename) == pendingIndex.end())
+                        {
+                            pendingIndex[filename] = paths.size();
+                            paths.push_back(filename);
+                        }
+                    }
+                }
+            }
+
+            pendingImages = TextureCache::PrepareAsync(paths);
         }
 
         void processNode(aiNode * node, const aiScene * scene)
@@ -95,6 +202,7 @@ class Model
                 v.y = mesh->mVertices[i].y;
                 v.z = mesh->mVertices[i].z;
                 vertex.Position = v;
+                boundingRadius = std::max(boundingRadius, glm::length(v));
 
                 v.x = mesh->mNormals[i].x;
                 v.y = mesh->mNormals[i].y;
@@ -139,7 +247,7 @@ class Model
                 textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
             }
 
-            return Mesh(vertices, indices, textures);
+            return Mesh(vertices, indices, textures, !FrameScheduler::enabled);
         }
 
         std::vector<Texture> loadMaterialTextures(aiMaterial * mat, aiTextureType type, std::string typeName)
@@ -169,7 +277,7 @@ class Model
 
                 Texture texture;
 
-                texture.id = TextureFromFile(str.C_Str(), directory);
+                texture.id = TextureFromFile(str.C_Str(), directory, texture);
                 texture.type = typeName;
                 texture.path = str.C_Str();
                 textures.push_back(texture);
@@ -180,41 +288,86 @@ class Model
             return textures;
         }
 
-        unsigned int TextureFromFile(const char *path, const std::string &directory)
+        // Returns the GL texture. For a texture placed in an array page that is the page, and material gets its layer
+        unsigned int TextureFromFile(const char *path, const std::string &directory, Texture &material)
         {
             std::string filename = std::string(path);
             filename = directory + '/' + filename;
 
+            // Normally prepared already by prefetchTextures
+            std::shared_ptr<CacheBatch> batch;
+            size_t index = 0;
+
+            if (pendingImages && pendingIndex.count(filename))
+            {
+                batch = pendingImages;
+                index = pendingIndex[filename];
+            }
+            else
+            {
+                batch = TextureCache::PrepareAll({ filename });
+            }
+
+            batch->Wait();
+            CachedTexture &texture = batch->textures[index];
+
+            // Same size textures share array pages, so meshes of different models share their bindings
+            if (TextureArrayAllocator::enabled && texture.Valid())
+            {
+                TextureArraySlot slot = TextureArrayAllocator::Get().Allocate(texture);
+
+                if (slot.page >= 0)
+                {
+                    material.page = slot.page;
+                    material.layer = slot.layer;
+                    return slot.array;
+                }
+            }
+
             unsigned int textureID;
             glGenTextures(1, &textureID);
 
-            int width, height, nrComponents;
-            unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-            if (data)
+            if (texture.Valid())
             {
-                GLenum format;
-                if (nrComponents == 1)
-                    format = GL_RED;
-                else if (nrComponents == 3)
-                    format = GL_RGB;
-                else if (nrComponents == 4)
-                    format = GL_RGBA;
-
                 glBindTexture(GL_TEXTURE_2D, textureID);
-                glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-                glGenerateMipmap(GL_TEXTURE_2D);
+
+                // Streamed textures start with only their mip tail resident
+                if (TextureStreamer::enabled && texture.header.mipCount > 1)
+                {
+                    TextureStreamer::Get().Add(textureID, std::move(texture));
+                }
+                else if (FrameScheduler::enabled)
+                {
+                    // Uploaded in the render loop, the texture has no storage (samples black) until then
+                    std::shared_ptr<CachedTexture> pending = std::make_shared<CachedTexture>(std::move(texture));
+
+                    FrameTask task;
+                    task.kind = "texture";
+                    task.estimate = FrameScheduler::EstimateUpload(pending->size);
+                    task.priority = [this]() { return projectedSize; };
+                    task.work = [pending, textureID]()
+                    {
+                        glBindTexture(GL_TEXTURE_2D, textureID);
+                        GLuint levels = TextureCache::Upload(*pending, GL_TEXTURE_2D);
+                        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels > 0 ? levels - 1 : 0);
+                        glBindTexture(GL_TEXTURE_2D, 0);
+                    };
+                    FrameScheduler::Get().Submit(std::move(task));
+                }
+                else
+                {
+                    GLuint levels = TextureCache::Upload(texture, GL_TEXTURE_2D);
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels > 0 ? levels - 1 : 0);
+                }
 
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-                stbi_image_free(data);
             }
             else
             {
                 std::cout << "Texture failed to load at path: " << path << std::endl;
-                stbi_image_free(data);
             }
 
             return textureID;
@@ -8,6 +8,8 @@
 
 #include <GL/glew.h>
 
+#include "gl_trace.h"
+
 class Shader
 {
 public:
@@ -96,61 +98,62 @@ public:
         glUseProgram( this->Program );
     }
 
-    void setBool(const std::string& name, bool value) const
+    // Names are taken as C strings so setting a uniform every frame doesn't build a std::string each time
+    void setBool(const GLchar *name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(Program, name.c_str()), (int)value);
+        glUniform1i(glGetUniformLocation(Program, name), (int)value);
     }
 
-    void setInt(const std::string& name, int value) const
+    void setInt(const GLchar *name, int value) const
     {
-        glUniform1i(glGetUniformLocation(Program, name.c_str()), value);
+        glUniform1i(glGetUniformLocation(Program, name), value);
     }
 
-    void setFloat(const std::string& name, float value) const
+    void setFloat(const GLchar *name, float value) const
     {
-        glUniform1f(glGetUniformLocation(Program, name.c_str()), value);
+        glUniform1f(glGetUniformLocation(Program, name), value);
     }
 
-    void setVec2(const std::string& name, const glm::vec2& value) const
+    void setVec2(const GLchar *name, const glm::vec2& value) const
     {
-        glUniform2fv(glGetUniformLocation(Program, name.c_str()), 1, &value[0]);
+        glUniform2fv(glGetUniformLocation(Program, name), 1, &value[0]);
     }
-    void setVec2(const std::string& name, float x, float y) const
+    void setVec2(const GLchar *name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(Program, name.c_str()), x, y);
+        glUniform2f(glGetUniformLocation(Program, name), x, y);
     }
 
-    void setVec3(const std::string& name, const glm::vec3& value) const
+    void setVec3(const GLchar *name, const glm::vec3& value) const
     {
-        glUniform3fv(glGetUniformLocation(Program, name.c_str()), 1, &value[0]);
+        glUniform3fv(glGetUniformLocation(Program, name), 1, &value[0]);
     }
-    void setVec3(const std::string& name, float x, float y, float z) const
+    void setVec3(const GLchar *name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(Program, name.c_str()), x, y, z);
+        glUniform3f(glGetUniformLocation(Program, name), x, y, z);
     }
 
-    void setVec4(const std::string& name, const glm::vec4& value) const
+    void setVec4(const GLchar *name, const glm::vec4& value) const
     {
-        glUniform4fv(glGetUniformLocation(Program, name.c_str()), 1, &value[0]);
+        glUniform4fv(glGetUniformLocation(Program, name), 1, &value[0]);
     }
-    void setVec4(const std::string& name, float x, float y, float z, float w)
+    void setVec4(const GLchar *name, float x, float y, float z, float w) const
     {
-        glUniform4f(glGetUniformLocation(Program, name.c_str()), x, y, z, w);
+        glUniform4f(glGetUniformLocation(Program, name), x, y, z, w);
     }
 
-    void setMat2(const std::string& name, const glm::mat2& mat) const
+    void setMat2(const GLchar *name, const glm::mat2& mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(Program, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(glGetUniformLocation(Program, name), 1, GL_FALSE, &mat[0][0]);
     }
 
-    void setMat3(const std::string& name, const glm::mat3& mat) const
+    void setMat3(const GLchar *name, const glm::mat3& mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(Program, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(glGetUniformLocation(Program, name), 1, GL_FALSE, &mat[0][0]);
     }
 
-    void setMat4(const std::string& name, const glm::mat4& mat) const
+    void setMat4(const GLchar *name, const glm::mat4& mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(Program, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(Program, name), 1, GL_FALSE, &mat[0][0]);
     }
  
 };
@@ -6,25 +6,30 @@
 
 #include <vector>
 #include "graphics_headers.h"
-#include <SOIL2/SOIL2.h>
+#include "texture_cache.h"
+#include "frame_scheduler.h"
 
 class TextureLoading
 {
 public:
     static GLuint LoadTexture(const GLchar* path)
+    {
+        std::shared_ptr<CacheBatch> batch = TextureCache::PrepareAll({ path }, 3);
+
+        return LoadTexture(batch->textures[0]);
+    }
+
+    // Uploads a texture that was already prepared (see TextureCache::PrepareAsync), mip chain included
+    static GLuint LoadTexture(const CachedTexture& texture)
     {
         //Generate texture ID and load texture data
         GLuint textureID;
         glGenTextures(1, &textureID);
 
-        int imageWidth, imageHeight;
-
-        unsigned char* image = SOIL_load_image(path, &imageWidth, &imageHeight, 0, SOIL_LOAD_RGB);
-
         // Assign texture to ID
         glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        GLuint levels = TextureCache::Upload(texture, GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels > 0 ? levels - 1 : 0);
 
         // Parameters
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -33,26 +38,110 @@ public:
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glBindTexture(GL_TEXTURE_2D, 0);
 
-        SOIL_free_image_data(image);
+        return textureID;
+    }
+
+    // Creates the texture now and uploads it from the FrameScheduler once the batch is prepared, ranked by priority.
+    // Without the scheduler this is LoadTexture
+    static GLuint ScheduleTexture(std::shared_ptr<CacheBatch> batch, std::function<float()> priority)
+    {
+        if (!FrameScheduler::enabled)
+        {
+            batch->Wait();
+            return LoadTexture(batch->textures[0]);
+        }
+
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        SubmitWhenReady(batch, priority, [batch, priority, textureID]()
+        {
+            FrameTask upload;
+            upload.kind = "texture";
+            upload.estimate = FrameScheduler::EstimateUpload(batch->textures[0].size);
+            upload.priority = priority;
+            upload.work = [batch, textureID]()
+            {
+                glBindTexture(GL_TEXTURE_2D, textureID);
+                GLuint levels = TextureCache::Upload(batch->textures[0], GL_TEXTURE_2D);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels > 0 ? levels - 1 : 0);
+                glBindTexture(GL_TEXTURE_2D, 0);
+            };
+            FrameScheduler::Get().Submit(std::move(upload));
+        });
 
         return textureID;
     }
 
+    // Same for a cubemap, one task per face. Faces not uploaded yet sample black
+    static GLuint ScheduleCubemap(std::shared_ptr<CacheBatch> faces, std::function<float()> priority)
+    {
+        if (!FrameScheduler::enabled)
+        {
+            return LoadCubemap(*faces);
+        }
+
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+
+        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        SubmitWhenReady(faces, priority, [faces, priority, textureID]()
+        {
+            for (GLuint i = 0; i < faces->textures.size(); i++)
+            {
+                FrameTask upload;
+                upload.kind = "cubemap face";
+                upload.estimate = FrameScheduler::EstimateUpload(faces->textures[i].size);
+                upload.priority = priority;
+                upload.work = [faces, i, textureID]()
+                {
+                    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+                    TextureCache::Upload(faces->textures[i], GL_TEXTURE_CUBE_MAP_POSITIVE_X + i);
+                    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+                };
+                FrameScheduler::Get().Submit(std::move(upload));
+            }
+        });
+
+        return textureID;
+    }
+
+    // The six faces are prepared concurrently, then uploaded in order
     static GLuint LoadCubemap(vector<const GLchar* > faces)
+    {
+        std::shared_ptr<CacheBatch> batch = TextureCache::PrepareAll(std::vector<std::string>(faces.begin(), faces.end()), 3, false);
+        batch->PrintTimings("Cubemap");
+
+        return LoadCubemap(*batch);
+    }
+
+    // Uploads faces that were already prepared without mipmaps, in +X, -X, +Y, -Y, +Z, -Z order
+    static GLuint LoadCubemap(CacheBatch& faces)
     {
         GLuint textureID;
         glGenTextures(1, &textureID);
 
-        int imageWidth, imageHeight;
-        unsigned char* image;
+        faces.Wait();
 
         glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-        for (GLuint i = 0; i < faces.size(); i++)
+        for (GLuint i = 0; i < faces.textures.size(); i++)
         {
-            image = SOIL_load_image(faces[i], &imageWidth, &imageHeight, 0, SOIL_LOAD_RGB);
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-            SOIL_free_image_data(image);
+            TextureCache::Upload(faces.textures[i], GL_TEXTURE_CUBE_MAP_POSITIVE_X + i);
         }
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -63,4 +152,18 @@ public:
 
         return textureID;
     }
+
+private:
+    // The sizes of the uploads are only known once the batch is prepared, so a cheap task waits for it and then
+    // submits them with their estimates
+    static void SubmitWhenReady(std::shared_ptr<CacheBatch> batch, std::function<float()> priority, std::function<void()> submit)
+    {
+        FrameTask task;
+        task.kind = "prepared";
+        task.estimate = FRAME_SCHEDULER_TASK_MS;
+        task.priority = priority;
+        task.ready = [batch]() { return batch->Ready(); };
+        task.work = submit;
+        FrameScheduler::Get().Submit(std::move(task));
+    }
 };
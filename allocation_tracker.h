@@ -0,0 +1,370 @@
+#pragma once
+
+// Std. Includes
+#include <new>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <execinfo.h>
+#endif
+
+#ifdef _MSC_VER
+    #define ALLOCATION_TRACKER_NOINLINE __declspec( noinline )
+#else
+    #define ALLOCATION_TRACKER_NOINLINE __attribute__( ( noinline ) )
+#endif
+
+// Call sites told apart, each by the stack above the allocation. Once the table is full the rest share the last entry
+const int ALLOCATION_TRACKER_SITES = 1024;
+const int ALLOCATION_TRACKER_DEPTH = 6;
+
+// Frames after loading is done before allocations count against the steady state, for containers reaching their size
+const int ALLOCATION_TRACKER_WARMUP_FRAMES = 60;
+
+// Where allocations come from: the stack above operator new, with what was allocated from there
+struct AllocationSite
+{
+    uint64_t key = 0;
+    void *stack[ALLOCATION_TRACKER_DEPTH] = { };
+    int depth = 0;
+    long long count = 0;
+    long long bytes = 0;
+    long long frameCount = 0;
+    long long lastFrame = -1;
+};
+
+// Heap allocations made by the frame loop, from the global operator new (--alloc-track): how many and how many bytes
+// each frame, and where from. Only the thread between BeginFrame and EndFrame is counted, so loading on the job system
+// threads isn't, nor is anything allocated with malloc directly (drivers, stb_image). With check on (--alloc-check) the
+// frames once loading is done and the warm-up has passed must not allocate at all; the first one that does prints its
+// call sites and the run fails.
+//
+// Everything is static because operator new runs before main. main.cpp defines ALLOCATION_TRACKER_IMPLEMENTATION before
+// including this, which replaces the global operator new and delete. Call sites are stack addresses; link with -rdynamic
+// to get function names.
+class AllocationTracker
+{
+public:
+    // Count the frames' allocations. Set before the first frame
+    static inline bool enabled = false;
+
+    // Fail the run if a steady state frame allocates
+    static inline bool check = false;
+    static inline int warmupFrames = ALLOCATION_TRACKER_WARMUP_FRAMES;
+
+    // Called by operator new. Not inlined so the stack above it always starts the same way
+    ALLOCATION_TRACKER_NOINLINE static void Allocated( size_t bytes )
+    {
+        if ( !inFrame || inHook )
+        {
+            return;
+        }
+
+        // Capturing the stack may allocate the first time
+        inHook = true;
+
+        void *stack[ALLOCATION_TRACKER_DEPTH + 2] = { };
+#ifdef _WIN32
+        int depth = CaptureStackBackTrace( 0, ALLOCATION_TRACKER_DEPTH + 2, stack, NULL );
+#else
+        int depth = backtrace( stack, ALLOCATION_TRACKER_DEPTH + 2 );
+#endif
+
+        // Skip this function and operator new
+        Site &site = FindSite( stack + 2, std::max( 0, depth - 2 ) );
+
+        if ( site.lastFrame != frames )
+        {
+            site.lastFrame = frames;
+            site.frameCount = 0;
+        }
+
+        site.frameCount++;
+        site.count++;
+        site.bytes += bytes;
+        frameAllocations++;
+        frameBytes += bytes;
+
+        inHook = false;
+    }
+
+    // Starts counting on the calling thread
+    static void BeginFrame( )
+    {
+        if ( !enabled )
+        {
+            return;
+        }
+
+        frameAllocations = 0;
+        frameBytes = 0;
+        inFrame = true;
+    }
+
+    // Call with whether loading still has work queued, frames before it is done aren't the steady state
+    static void EndFrame( bool loading )
+    {
+        if ( !inFrame )
+        {
+            return;
+        }
+
+        inFrame = false;
+        settledFrames = loading ? 0 : settledFrames + 1;
+
+        allocations += frameAllocations;
+        bytes += frameBytes;
+        maxFrameAllocations = std::max( maxFrameAllocations, frameAllocations );
+
+        if ( settledFrames > warmupFrames )
+        {
+            steadyFrames++;
+
+            if ( frameAllocations > 0 )
+            {
+                allocatingFrames++;
+                steadyAllocations += frameAllocations;
+
+                if ( check && 1 == allocatingFrames )
+                {
+                    std::cerr << "ERROR: Steady state frame " << frames << " allocated " << frameAllocations << " times (" << frameBytes
+                              << " bytes):" << std::endl;
+                    PrintSites( std::cerr, frames );
+                }
+            }
+        }
+
+        frames++;
+    }
+
+    // Whether the check was on and failed, or never got to the steady state
+    static bool Failed( )
+    {
+        return check && ( allocatingFrames > 0 || 0 == steadyFrames );
+    }
+
+    static void PrintStats( )
+    {
+        if ( 0 == frames )
+        {
+            return;
+        }
+
+        std::cout << "Allocations over " << frames << " frames: " << ( double )allocations / frames << " per frame ("
+                  << ( double )bytes / frames << " bytes), at most " << maxFrameAllocations << "; " << allocatingFrames << " of "
+                  << steadyFrames << " steady state frames allocated" << std::endl;
+
+        if ( check && 0 == steadyFrames )
+        {
+            std::cerr << "ERROR: Allocation check: loading never finished, or fewer than " << warmupFrames
+                      << " frames after it" << std::endl;
+        }
+
+        PrintSites( std::cout, -1 );
+    }
+
+    // Per frame counts as a JSON object
+    static std::string Json( )
+    {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision( 4 ) << "{ \"frames\": " << frames << ", \"allocations_per_frame\": "
+            << ( frames > 0 ? ( double )allocations / frames : 0.0 ) << ", \"bytes_per_frame\": "
+            << ( frames > 0 ? ( double )bytes / frames : 0.0 ) << ", \"max_frame_allocations\": " << maxFrameAllocations
+            << ", \"steady_frames\": " << steadyFrames << ", \"steady_allocating_frames\": " << allocatingFrames
+            << ", \"steady_allocations\": " << steadyAllocations << ", \"sites\": " << usedSites << " }";
+
+        return out.str( );
+    }
+
+private:
+    typedef AllocationSite Site;
+
+    static inline thread_local bool inFrame = false;
+    static inline thread_local bool inHook = false;
+
+    static inline Site sites[ALLOCATION_TRACKER_SITES];
+    static inline int usedSites = 0;
+
+    static inline long long frames = 0;
+    static inline long long frameAllocations = 0;
+    static inline long long frameBytes = 0;
+    static inline long long allocations = 0;
+    static inline long long bytes = 0;
+    static inline long long maxFrameAllocations = 0;
+    static inline long long settledFrames = 0;
+    static inline long long steadyFrames = 0;
+    static inline long long allocatingFrames = 0;
+    static inline long long steadyAllocations = 0;
+
+    // Open addressing on a hash of the stack. Never allocates
+    static Site &FindSite( void **stack, int depth )
+    {
+        uint64_t key = 14695981039346656037ull;
+
+        for ( int i = 0; i < depth; i++ )
+        {
+            key = ( key ^ ( uint64_t )( uintptr_t )stack[i] ) * 1099511628211ull;
+        }
+
+        key = std::max( key, ( uint64_t )1 );
+
+        for ( int probe = 0; probe < ALLOCATION_TRACKER_SITES; probe++ )
+        {
+            Site &site = sites[( key + probe ) % ALLOCATION_TRACKER_SITES];
+
+            if ( site.key == key )
+            {
+                return site;
+            }
+
+            if ( 0 == site.key && usedSites + 1 < ALLOCATION_TRACKER_SITES )
+            {
+                site.key = key;
+                site.depth = depth;
+                std::copy( stack, stack + depth, site.stack );
+                usedSites++;
+
+                return site;
+            }
+        }
+
+        return sites[ALLOCATION_TRACKER_SITES - 1];
+    }
+
+    // The busiest sites overall, or those that allocated in one frame
+    static void PrintSites( std::ostream &out, long long frame )
+    {
+        inHook = true;
+
+        std::vector<const Site *> busiest;
+
+        for ( const Site &site : sites )
+        {
+            if ( site.count > 0 && ( frame < 0 || site.lastFrame == frame ) )
+            {
+                busiest.push_back( &site );
+            }
+        }
+
+        std::sort( busiest.begin( ), busiest.end( ), [frame]( const Site *a, const Site *b )
+        {
+            return frame < 0 ? a->count > b->count : a->frameCount > b->frameCount;
+        } );
+
+        for ( size_t i = 0; i < busiest.size( ) && i < 10; i++ )
+        {
+            const Site &site = *busiest[i];
+            out << "  " << ( frame < 0 ? site.count : site.frameCount ) << " allocations, " << site.bytes << " bytes in all, from:" << std::endl;
+            PrintStack( out, site );
+        }
+
+        inHook = false;
+    }
+
+    static void PrintStack( std::ostream &out, const Site &site )
+    {
+#ifdef _WIN32
+        for ( int i = 0; i < site.depth; i++ )
+        {
+            out << "    " << site.stack[i] << std::endl;
+        }
+#else
+        char **symbols = backtrace_symbols( ( void *const * )site.stack, site.depth );
+
+        for ( int i = 0; i < site.depth; i++ )
+        {
+            out << "    " << ( symbols ? symbols[i] : "?" ) << std::endl;
+        }
+
+        free( symbols );
+#endif
+    }
+};
+
+#ifdef ALLOCATION_TRACKER_IMPLEMENTATION
+
+// Replacements for the global allocation functions, counting on the way through. Kept out of line so Allocated always
+// has exactly one of them above it. The aligned (over-aligned type) variants are left to the library and not counted
+
+ALLOCATION_TRACKER_NOINLINE void *operator new( size_t size )
+{
+    AllocationTracker::Allocated( size );
+    void *pointer = malloc( size > 0 ? size : 1 );
+
+    if ( nullptr == pointer )
+    {
+        throw std::bad_alloc( );
+    }
+
+    return pointer;
+}
+
+ALLOCATION_TRACKER_NOINLINE void *operator new[]( size_t size )
+{
+    AllocationTracker::Allocated( size );
+    void *pointer = malloc( size > 0 ? size : 1 );
+
+    if ( nullptr == pointer )
+    {
+        throw std::bad_alloc( );
+    }
+
+    return pointer;
+}
+
+ALLOCATION_TRACKER_NOINLINE void *operator new( size_t size, const std::nothrow_t & ) noexcept
+{
+    AllocationTracker::Allocated( size );
+
+    return malloc( size > 0 ? size : 1 );
+}
+
+ALLOCATION_TRACKER_NOINLINE void *operator new[]( size_t size, const std::nothrow_t & ) noexcept
+{
+    AllocationTracker::Allocated( size );
+
+    return malloc( size > 0 ? size : 1 );
+}
+
+void operator delete( void *pointer ) noexcept
+{
+    free( pointer );
+}
+
+void operator delete[]( void *pointer ) noexcept
+{
+    free( pointer );
+}
+
+void operator delete( void *pointer, size_t ) noexcept
+{
+    free( pointer );
+}
+
+void operator delete[]( void *pointer, size_t ) noexcept
+{
+    free( pointer );
+}
+
+void operator delete( void *pointer, const std::nothrow_t & ) noexcept
+{
+    free( pointer );
+}
+
+void operator delete[]( void *pointer, const std::nothrow_t & ) noexcept
+{
+    free( pointer );
+}
+
+#endif
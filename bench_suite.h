@@ -0,0 +1,536 @@
+#pragma once
+
+// Std. Includes
+#include <map>
+#include <cmath>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+// Runs of every case, after as many unmeasured ones
+const int BENCH_SUITE_RUNS = 15;
+const int BENCH_SUITE_WARMUP_RUNS = 3;
+
+// How much slower than the baseline's median a case may get before it counts as a regression, unless the baseline
+// gives the case its own threshold_percent
+const double BENCH_SUITE_THRESHOLD_PERCENT = 10.0;
+
+// A change also has to be this many median absolute deviations (of the noisier of the two runs) to count, so a case
+// that is noisy on this machine doesn't flag on noise alone
+const double BENCH_SUITE_NOISE_MADS = 3.0;
+
+// Performance regression suite (--bench-suite): named cases each timed over repeated runs after a warm-up, summarised
+// by statistics that a few outliers don't move (median, median absolute deviation, minimum, p95), then compared with
+// the medians of a stored baseline. A case is a regression when it is slower than the baseline by more than its
+// threshold and by more than the noise; Compare returns how many there are, for the exit status. Without a baseline
+// file the run becomes the baseline. The results file has the same layout, so a run can be promoted by copying it.
+class BenchSuite
+{
+public:
+    bool enabled = false;
+    int runs = BENCH_SUITE_RUNS;
+    int warmupRuns = BENCH_SUITE_WARMUP_RUNS;
+    double thresholdPercent = BENCH_SUITE_THRESHOLD_PERCENT;
+
+    std::string baselinePath = "bench_baseline.json";
+    std::string outputPath = "bench_suite.json";
+
+    // Overwrite the baseline with this run, keeping the thresholds it set per case
+    bool updateBaseline = false;
+
+    // Times run warmupRuns + runs times and keeps the last runs. prepare runs before each, outside the timing
+    void Measure( const std::string &name, const std::function<void( )> &run, const std::function<void( )> &prepare = nullptr )
+    {
+        std::vector<double> samples;
+        samples.reserve( runs );
+
+        for ( int i = 0; i < warmupRuns + runs; i++ )
+        {
+            if ( prepare )
+            {
+                prepare( );
+            }
+
+            Clock::time_point start = Clock::now( );
+            run( );
+            double ms = std::chrono::duration<double, std::milli>( Clock::now( ) - start ).count( );
+
+            if ( i >= warmupRuns )
+            {
+                samples.push_back( ms );
+            }
+        }
+
+        AddSamples( name, samples );
+    }
+
+    // A case measured elsewhere, e.g. the frames of the scripted run. Its warm-up is the caller's
+    void AddSamples( const std::string &name, std::vector<double> samples )
+    {
+        if ( samples.empty( ) )
+        {
+            std::cerr << "ERROR: Benchmark suite case " << name << " has no samples" << std::endl;
+            return;
+        }
+
+        std::sort( samples.begin( ), samples.end( ) );
+
+        Result result;
+        result.name = name;
+        result.samples = samples.size( );
+        result.median = Median( samples );
+        result.min = samples.front( );
+        result.p95 = samples[std::min( samples.size( ), ( size_t )std::ceil( 0.95 * samples.size( ) ) ) - 1];
+
+        for ( double &sample : samples )
+        {
+            sample = std::fabs( sample - result.median );
+        }
+
+        std::sort( samples.begin( ), samples.end( ) );
+        result.mad = Median( samples );
+        results.push_back( result );
+
+        std::cout << "Benchmark suite: " << name << " " << result.median << " ms" << std::endl;
+    }
+
+    // A pass or fail gate reported and counted with the regressions, e.g. the golden image comparison
+    void AddCheck( const std::string &name, bool passed, const std::string &detail )
+    {
+        Check check = { name, passed, detail };
+        checks.push_back( check );
+    }
+
+    // Compares every case with the baseline, prints them and the checks, writes the results (and the baseline if there
+    // was none or it is to be updated) and returns the number of regressions and failed checks
+    int Compare( const std::string &renderer )
+    {
+        std::map<std::string, Result> baseline;
+        std::string baselineRenderer;
+        bool present = false;
+        bool haveBaseline = ReadBaseline( baseline, baselineRenderer, present );
+
+        // A baseline that can't be read is neither compared with nor replaced, and fails the run
+        if ( present && !haveBaseline )
+        {
+            Write( outputPath, renderer, false );
+            return 1;
+        }
+
+        if ( haveBaseline && baselineRenderer != renderer )
+        {
+            std::cout << "Benchmark suite: the baseline was recorded on " << baselineRenderer << ", not " << renderer
+                      << "; differences may be the machine's" << std::endl;
+        }
+
+        int regressions = 0;
+        std::cout << std::fixed << std::setprecision( 3 );
+        std::cout << "Benchmark suite on " << renderer << ": median of " << runs << " runs after " << warmupRuns << " warm-up, against "
+                  << ( haveBaseline ? baselinePath : "no baseline" ) << std::endl;
+
+        for ( Result &result : results )
+        {
+            std::map<std::string, Result>::const_iterator base = baseline.find( result.name );
+            result.threshold = thresholdPercent;
+            result.thresholdOverride = base != baseline.end( ) ? base->second.thresholdOverride : 0.0;
+
+            std::cout << "  " << std::left << std::setw( 44 ) << result.name << std::right << std::setw( 10 ) << result.median << " ms +- "
+                      << std::setw( 7 ) << result.mad;
+
+            if ( base == baseline.end( ) )
+            {
+                result.status = haveBaseline ? "new" : "";
+                std::cout << ( haveBaseline ? "  new" : "" ) << std::endl;
+                continue;
+            }
+
+            if ( result.thresholdOverride > 0.0 )
+            {
+                result.threshold = result.thresholdOverride;
+            }
+
+            result.baselineMedian = base->second.median;
+            result.change = base->second.median > 0.0 ? 100.0 * ( result.median - base->second.median ) / base->second.median : 0.0;
+            double noise = BENCH_SUITE_NOISE_MADS * std::max( result.mad, base->second.mad );
+            double difference = result.median - base->second.median;
+
+            if ( result.change > result.threshold && difference > noise )
+            {
+                result.status = "regression";
+                regressions++;
+            }
+            else if ( -result.change > result.threshold && -difference > noise )
+            {
+                result.status = "faster";
+            }
+            else
+            {
+                result.status = "ok";
+            }
+
+            std::cout << "  baseline " << std::setw( 10 ) << base->second.median << " ms " << std::showpos << std::setw( 8 ) << result.change
+                      << std::noshowpos << "%  " << ( "regression" == result.status ? "REGRESSION" : result.status ) << std::endl;
+        }
+
+        std::cout << std::defaultfloat;
+
+        for ( const Check &check : checks )
+        {
+            std::cout << "  " << std::left << std::setw( 44 ) << check.name << std::right << ( check.passed ? "  ok  " : "  FAILED  " )
+                      << check.detail << std::endl;
+            regressions += check.passed ? 0 : 1;
+        }
+
+        Write( outputPath, renderer, true );
+
+        // Thresholds set by hand in the old baseline stay, as they are written with every case
+        if ( !haveBaseline || updateBaseline )
+        {
+            Write( baselinePath, renderer, false );
+            std::cout << "Benchmark suite: baseline written to " << baselinePath << std::endl;
+        }
+
+        if ( regressions > 0 )
+        {
+            std::cerr << "ERROR: " << regressions << " benchmark suite regressions or failed checks against " << baselinePath << std::endl;
+        }
+
+        return regressions;
+    }
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    // Statistics of one case in ms, with the comparison filled in by Compare
+    struct Result
+    {
+        std::string name;
+        size_t samples = 0;
+        double median = 0.0;
+        double mad = 0.0;
+        double min = 0.0;
+        double p95 = 0.0;
+
+        // The threshold the case was compared with, and the one its baseline sets for it (0 for the default). Only
+        // the override is written, so copying results over the baseline doesn't pin today's default
+        double threshold = 0.0;
+        double thresholdOverride = 0.0;
+        double baselineMedian = 0.0;
+        double change = 0.0;
+        std::string status;
+    };
+
+    struct Check
+    {
+        std::string name;
+        bool passed;
+        std::string detail;
+    };
+
+    std::vector<Result> results;
+    std::vector<Check> checks;
+
+    // Of sorted values
+    static double Median( const std::vector<double> &values )
+    {
+        size_t middle = values.size( ) / 2;
+
+        return values.size( ) % 2 ? values[middle] : 0.5 * ( values[middle - 1] + values[middle] );
+    }
+
+    static std::string Escape( const std::string &text )
+    {
+        std::string escaped;
+
+        for ( char c : text )
+        {
+            if ( '"' == c || '\\' == c )
+            {
+                escaped += '\\';
+            }
+
+            escaped += ( unsigned char )c < 0x20 ? ' ' : c;
+        }
+
+        return escaped;
+    }
+
+    void Write( const std::string &path, const std::string &renderer, bool comparison )
+    {
+        std::ofstream file( path );
+
+        if ( !file )
+        {
+            std::cerr << "ERROR: Can't write benchmark suite results to " << path << std::endl;
+            return;
+        }
+
+        file << std::fixed << std::setprecision( 4 );
+        file << "{\n";
+        file << "  \"renderer\": \"" << Escape( renderer ) << "\",\n";
+        file << "  \"runs\": " << runs << ",\n";
+        file << "  \"warmup_runs\": " << warmupRuns << ",\n";
+        file << "  \"cases\": {\n";
+
+        for ( size_t i = 0; i < results.size( ); i++ )
+        {
+            const Result &result = results[i];
+            file << "    \"" << Escape( result.name ) << "\": { \"median_ms\": " << result.median << ", \"mad_ms\": " << result.mad
+                 << ", \"min_ms\": " << result.min << ", \"p95_ms\": " << result.p95 << ", \"samples\": " << result.samples;
+
+            if ( result.thresholdOverride > 0.0 )
+            {
+                file << ", \"threshold_percent\": " << result.thresholdOverride;
+            }
+
+            if ( comparison && !result.status.empty( ) && "new" != result.status )
+            {
+                file << ", \"baseline_median_ms\": " << result.baselineMedian << ", \"change_percent\": " << result.change << ", \"status\": \""
+                     << result.status << "\"";
+            }
+
+            file << " }" << ( i + 1 < results.size( ) ? "," : "" ) << "\n";
+        }
+
+        file << "  }";
+
+        if ( comparison && !checks.empty( ) )
+        {
+            file << ",\n  \"checks\": {\n";
+
+            for ( size_t i = 0; i < checks.size( ); i++ )
+            {
+                file << "    \"" << Escape( checks[i].name ) << "\": { \"passed\": " << ( checks[i].passed ? "true" : "false" ) << ", \"detail\": \""
+                     << Escape( checks[i].detail ) << "\" }" << ( i + 1 < checks.size( ) ? "," : "" ) << "\n";
+            }
+
+            file << "  }";
+        }
+
+        file << "\n}\n";
+    }
+
+    // Reads the renderer and the cases' median_ms, mad_ms and threshold_percent back from a file Write made (or one
+    // edited by hand). Anything else is skipped. present tells a missing file from one that doesn't parse
+    bool ReadBaseline( std::map<std::string, Result> &baseline, std::string &renderer, bool &present )
+    {
+        std::ifstream file( baselinePath );
+        present = !!file;
+
+        if ( !file )
+        {
+            return false;
+        }
+
+        std::stringstream contents;
+        contents << file.rdbuf( );
+        JsonReader reader( contents.str( ) );
+        std::string key;
+        bool valid = reader.Consume( '{' );
+
+        while ( valid && !reader.Consume( '}' ) )
+        {
+            valid = reader.String( key ) && reader.Consume( ':' );
+
+            if ( valid && "renderer" == key )
+            {
+                valid = reader.String( renderer );
+            }
+            else if ( valid && "cases" == key )
+            {
+                valid = reader.Consume( '{' );
+
+                while ( valid && !reader.Consume( '}' ) )
+                {
+                    Result result;
+                    valid = reader.String( result.name ) && reader.Consume( ':' ) && reader.Consume( '{' );
+
+                    while ( valid && !reader.Consume( '}' ) )
+                    {
+                        valid = reader.String( key ) && reader.Consume( ':' );
+
+                        if ( valid && "median_ms" == key )
+                        {
+                            valid = reader.Number( result.median );
+                        }
+                        else if ( valid && "mad_ms" == key )
+                        {
+                            valid = reader.Number( result.mad );
+                        }
+                        else if ( valid && "threshold_percent" == key )
+                        {
+                            valid = reader.Number( result.thresholdOverride );
+                        }
+                        else if ( valid )
+                        {
+                            valid = reader.Skip( );
+                        }
+
+                        reader.Consume( ',' );
+                    }
+
+                    baseline[result.name] = result;
+                    reader.Consume( ',' );
+                }
+            }
+            else if ( valid )
+            {
+                valid = reader.Skip( );
+            }
+
+            reader.Consume( ',' );
+        }
+
+        if ( !valid )
+        {
+            std::cerr << "ERROR: Can't parse the benchmark baseline " << baselinePath << " near offset " << reader.Offset( ) << std::endl;
+            baseline.clear( );
+
+            return false;
+        }
+
+        return true;
+    }
+
+    // Just enough JSON for the files above: objects, arrays, strings with simple escapes, numbers and literals
+    class JsonReader
+    {
+    public:
+        explicit JsonReader( const std::string &text ) : text( text )
+        {
+        }
+
+        size_t Offset( ) const
+        {
+            return position;
+        }
+
+        // Takes c if it is next
+        bool Consume( char c )
+        {
+            Space( );
+
+            if ( position < text.size( ) && text[position] == c )
+            {
+                position++;
+                return true;
+            }
+
+            return false;
+        }
+
+        bool String( std::string &value )
+        {
+            value.clear( );
+
+            if ( !Consume( '"' ) )
+            {
+                return false;
+            }
+
+            while ( position < text.size( ) && '"' != text[position] )
+            {
+                if ( '\\' == text[position] && position + 1 < text.size( ) )
+                {
+                    position++;
+                }
+
+                value += text[position++];
+            }
+
+            return Consume( '"' );
+        }
+
+        bool Number( double &value )
+        {
+            Space( );
+            const char *start = text.c_str( ) + position;
+            char *end = nullptr;
+            value = strtod( start, &end );
+            position += end - start;
+
+            return end != start;
+        }
+
+        // Steps over the next value, whatever it is
+        bool Skip( )
+        {
+            std::string ignored;
+            double number;
+            Space( );
+
+            if ( position >= text.size( ) )
+            {
+                return false;
+            }
+
+            if ( '"' == text[position] )
+            {
+                return String( ignored );
+            }
+
+            if ( Consume( '{' ) )
+            {
+                while ( !Consume( '}' ) )
+                {
+                    if ( !String( ignored ) || !Consume( ':' ) || !Skip( ) )
+                    {
+                        return false;
+                    }
+
+                    Consume( ',' );
+                }
+
+                return true;
+            }
+
+            if ( Consume( '[' ) )
+            {
+                while ( !Consume( ']' ) )
+                {
+                    if ( !Skip( ) )
+                    {
+                        return false;
+                    }
+
+                    Consume( ',' );
+                }
+
+                return true;
+            }
+
+            // true, false, null
+            if ( isalpha( ( unsigned char )text[position] ) )
+            {
+                while ( position < text.size( ) && isalpha( ( unsigned char )text[position] ) )
+                {
+                    position++;
+                }
+
+                return true;
+            }
+
+            return Number( number );
+        }
+
+    private:
+        std::string text;
+        size_t position = 0;
+
+        void Space( )
+        {
+            while ( position < text.size( ) && isspace( ( unsigned char )text[position] ) )
+            {
+                position++;
+            }
+        }
+    };
+};
@@ -0,0 +1,384 @@
+#pragma once
+
+// Std. Includes
+#include <map>
+#include <cmath>
+#include <ctime>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Frames drawn by default, the first few of which are left out of the statistics
+const int BENCHMARK_FRAMES = 600;
+const int BENCHMARK_WARMUP_FRAMES = 10;
+
+// Simulation time advanced per frame, whatever the frame actually took
+const double BENCHMARK_FRAME_SECONDS = 1.0 / 60.0;
+
+// Offscreen GL 3.3 core context without a window or display server: EGL on Mesa's surfaceless platform (llvmpipe
+// when there is no GPU), drawing into a framebuffer object the size of the window it replaces. The GL objects and
+// the context are left to process exit
+class HeadlessContext
+{
+public:
+    bool Create( int width, int height )
+    {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = ( PFNEGLGETPLATFORMDISPLAYEXTPROC )eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+        display = getPlatformDisplay ? getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr ) : eglGetDisplay( EGL_DEFAULT_DISPLAY );
+
+        EGLint major, minor;
+
+        if ( EGL_NO_DISPLAY == display || !eglInitialize( display, &major, &minor ) )
+        {
+            std::cerr << "ERROR: No EGL display for the headless context" << std::endl;
+            return false;
+        }
+
+        EGLint configAttributes[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        EGLConfig config = nullptr;
+        EGLint configCount = 0;
+        eglChooseConfig( display, configAttributes, &config, 1, &configCount );
+
+        EGLint contextAttributes[] = { EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+                                       EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                       EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE, EGL_TRUE, EGL_NONE };
+
+        // Surfaceless displays may have no configs at all, the context doesn't need one (KHR_no_config_context)
+        eglBindAPI( EGL_OPENGL_API );
+        context = eglCreateContext( display, configCount > 0 ? config : ( EGLConfig )0, EGL_NO_CONTEXT, contextAttributes );
+
+        if ( EGL_NO_CONTEXT == context || !eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, context ) )
+        {
+            std::cerr << "ERROR: Failed to create the headless GL context (EGL error 0x" << std::hex << eglGetError( ) << std::dec << ")" << std::endl;
+            return false;
+        }
+
+        this->width = width;
+        this->height = height;
+
+        return true;
+    }
+
+    // Creates the framebuffer everything is drawn into and binds it. Needs the GL functions to be loaded
+    bool CreateFramebuffer( )
+    {
+        glGenRenderbuffers( 1, &color );
+        glBindRenderbuffer( GL_RENDERBUFFER, color );
+        glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, width, height );
+
+        glGenRenderbuffers( 1, &depth );
+        glBindRenderbuffer( GL_RENDERBUFFER, depth );
+        glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height );
+        glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+        glGenFramebuffers( 1, &framebuffer );
+        glBindFramebuffer( GL_FRAMEBUFFER, framebuffer );
+        glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color );
+        glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth );
+
+        if ( GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus( GL_FRAMEBUFFER ) )
+        {
+            std::cerr << "ERROR: Headless framebuffer is incomplete" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    // What passes render into when they are done with their own targets
+    GLuint Framebuffer( ) const
+    {
+        return framebuffer;
+    }
+
+private:
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+    GLuint framebuffer = 0;
+    GLuint color = 0;
+    GLuint depth = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// Measurements of a scripted run (--bench): per frame the wall and thread CPU time of every phase between Marks and
+// the triangles submitted, plus a hash of everything that decides the workload (camera, body positions, triangle
+// counts). Two runs with the same hash drew exactly the same frames, so their timings can be compared directly.
+class Benchmark
+{
+public:
+    // Set by --bench. Everything below does nothing when off, so the render loop can mark its phases unconditionally
+    bool enabled = false;
+    int frames = BENCHMARK_FRAMES;
+    std::string outputPath = "bench.json";
+
+    // Camera position and target at t in [0, 1): a full turn around the sun that closes in on the inner orbits and
+    // moves out again, rising above and dipping below the orbital plane
+    static void CameraPath( float t, glm::vec3 &eye, glm::vec3 &target )
+    {
+        const float twoPi = 6.28318530718f;
+        float angle = twoPi * t;
+        float radius = 3.0f - 1.2f * sinf( 0.5f * angle );
+
+        eye = glm::vec3( radius * sinf( angle ), 0.8f * sinf( 2.0f * angle ), radius * cosf( angle ) );
+        target = glm::vec3( 0.0f );
+    }
+
+    void BeginFrame( )
+    {
+        if ( !enabled )
+        {
+            return;
+        }
+
+        // Room for the whole run up front, so recording doesn't allocate in the frames being measured
+        if ( 0 == frameMs.capacity( ) )
+        {
+            frameMs.reserve( frames );
+            frameCpuMs.reserve( frames );
+            triangles.reserve( frames );
+        }
+
+        frameTriangles = 0;
+        frameStart = Clock::now( );
+        phaseStart = frameStart;
+        phaseCpuStart = ThreadCpuSeconds( );
+        frameCpuStart = phaseCpuStart;
+
+        for ( Phase &phase : phases )
+        {
+            phase.wallMs.push_back( 0.0 );
+            phase.cpuMs.push_back( 0.0 );
+        }
+    }
+
+    // Ends the phase running since the previous Mark (or BeginFrame). A name may be marked several times a frame, the
+    // times add up
+    void Mark( const char *name )
+    {
+        if ( !enabled )
+        {
+            return;
+        }
+
+        Clock::time_point now = Clock::now( );
+        double cpu = ThreadCpuSeconds( );
+
+        Phase &phase = FindPhase( name );
+        phase.wallMs.back( ) += std::chrono::duration<double, std::milli>( now - phaseStart ).count( );
+        phase.cpuMs.back( ) += ( cpu - phaseCpuStart ) * 1000.0;
+
+        phaseStart = now;
+        phaseCpuStart = cpu;
+    }
+
+    void AddTriangles( size_t count )
+    {
+        if ( !enabled )
+        {
+            return;
+        }
+
+        frameTriangles += count;
+    }
+
+    // Folds data that decides what the frame draws into the workload hash (FNV-1a)
+    void AddWorkload( const void *data, size_t size )
+    {
+        if ( !enabled )
+        {
+            return;
+        }
+
+        const unsigned char *bytes = ( const unsigned char * )data;
+
+        for ( size_t i = 0; i < size; i++ )
+        {
+            workload = ( workload ^ bytes[i] ) * 1099511628211ull;
+        }
+    }
+
+    void EndFrame( )
+    {
+        if ( !enabled )
+        {
+            return;
+        }
+
+        frameMs.push_back( std::chrono::duration<double, std::milli>( Clock::now( ) - frameStart ).count( ) );
+        frameCpuMs.push_back( ( ThreadCpuSeconds( ) - frameCpuStart ) * 1000.0 );
+        triangles.push_back( frameTriangles );
+        AddWorkload( &frameTriangles, sizeof( frameTriangles ) );
+    }
+
+    int FramesDrawn( ) const
+    {
+        return ( int )frameMs.size( );
+    }
+
+    // Wall time of every frame drawn so far, the warm-up included
+    const std::vector<double> &FrameMs( ) const
+    {
+        return frameMs;
+    }
+
+    // Adds a top level entry to the results, e.g. the statistics of another measurement running alongside
+    void AddSection( const std::string &name, const std::string &json )
+    {
+        sections.push_back( std::make_pair( name, json ) );
+    }
+
+    // Writes the statistics of every frame after the warm up, and prints the headline numbers
+    bool Write( const std::string &renderer, int width, int height )
+    {
+        std::ofstream file( outputPath );
+
+        if ( !file )
+        {
+            std::cerr << "ERROR: Can't write benchmark results to " << outputPath << std::endl;
+            return false;
+        }
+
+        size_t first = std::min( ( size_t )BENCHMARK_WARMUP_FRAMES, frameMs.size( ) );
+        size_t totalTriangles = 0;
+
+        for ( size_t triangleCount : triangles )
+        {
+            totalTriangles += triangleCount;
+        }
+
+        file << std::fixed << std::setprecision( 4 );
+        file << "{\n";
+        file << "  \"renderer\": \"" << renderer << "\",\n";
+        file << "  \"width\": " << width << ",\n";
+        file << "  \"height\": " << height << ",\n";
+        file << "  \"frames\": " << frameMs.size( ) << ",\n";
+        file << "  \"warmup_frames\": " << first << ",\n";
+        file << "  \"workload_hash\": \"" << std::hex << std::setw( 16 ) << std::setfill( '0' ) << workload << std::dec << std::setfill( ' ' ) << "\",\n";
+        file << "  \"frame_ms\": " << Summary( frameMs, first ) << ",\n";
+        file << "  \"frame_cpu_ms\": " << Summary( frameCpuMs, first ) << ",\n";
+        file << "  \"phases\": {\n";
+
+        for ( size_t i = 0; i < phases.size( ); i++ )
+        {
+            file << "    \"" << phases[i].name << "\": { \"wall_ms\": " << Summary( phases[i].wallMs, first ) << ", \"cpu_ms\": "
+                 << Summary( phases[i].cpuMs, first ) << " }" << ( i + 1 < phases.size( ) ? "," : "" ) << "\n";
+        }
+
+        file << "  },\n";
+        file << "  \"triangles\": { \"total\": " << totalTriangles << ", \"per_frame_max\": "
+             << ( triangles.empty( ) ? 0 : *std::max_element( triangles.begin( ), triangles.end( ) ) ) << ", \"per_frame_mean\": "
+             << ( triangles.empty( ) ? 0.0 : ( double )totalTriangles / triangles.size( ) ) << " }";
+
+        for ( const std::pair<std::string, std::string> &section : sections )
+        {
+            file << ",\n  \"" << section.first << "\": " << section.second;
+        }
+
+        file << "\n}\n";
+
+        std::vector<double> measured( frameMs.begin( ) + first, frameMs.end( ) );
+        std::cout << "Benchmark: " << frameMs.size( ) << " frames on " << renderer << ", p50 " << Percentile( measured, 50.0 ) << " ms, p95 "
+                  << Percentile( measured, 95.0 ) << " ms, p99 " << Percentile( measured, 99.0 ) << " ms, workload " << std::hex
+                  << workload << std::dec << ", written to " << outputPath << std::endl;
+
+        return true;
+    }
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    struct Phase
+    {
+        std::string name;
+        std::vector<double> wallMs;
+        std::vector<double> cpuMs;
+    };
+
+    std::vector<Phase> phases;
+    std::vector<double> frameMs;
+    std::vector<double> frameCpuMs;
+    std::vector<size_t> triangles;
+    std::vector<std::pair<std::string, std::string>> sections;
+    uint64_t workload = 14695981039346656037ull;
+
+    Clock::time_point frameStart;
+    Clock::time_point phaseStart;
+    double frameCpuStart = 0.0;
+    double phaseCpuStart = 0.0;
+    size_t frameTriangles = 0;
+
+    Phase &FindPhase( const char *name )
+    {
+        for ( Phase &phase : phases )
+        {
+            if ( phase.name == name )
+            {
+                return phase;
+            }
+        }
+
+        // First seen this frame: zeros for the frames before
+        Phase phase;
+        phase.name = name;
+        phase.wallMs.reserve( frames );
+        phase.cpuMs.reserve( frames );
+        phase.wallMs.assign( frameMs.size( ) + 1, 0.0 );
+        phase.cpuMs.assign( frameMs.size( ) + 1, 0.0 );
+        phases.push_back( phase );
+
+        return phases.back( );
+    }
+
+    // CPU time of the calling thread only, so driver and job system threads don't count
+    static double ThreadCpuSeconds( )
+    {
+        timespec now;
+        clock_gettime( CLOCK_THREAD_CPUTIME_ID, &now );
+
+        return now.tv_sec + now.tv_nsec * 1e-9;
+    }
+
+    // Nearest rank percentile
+    static double Percentile( std::vector<double> values, double percent )
+    {
+        if ( values.empty( ) )
+        {
+            return 0.0;
+        }
+
+        std::sort( values.begin( ), values.end( ) );
+        size_t rank = ( size_t )std::ceil( percent / 100.0 * values.size( ) );
+
+        return values[std::min( std::max( rank, ( size_t )1 ), values.size( ) ) - 1];
+    }
+
+    static std::string Summary( const std::vector<double> &samples, size_t first )
+    {
+        std::vector<double> values( samples.begin( ) + std::min( first, samples.size( ) ), samples.end( ) );
+        double sum = 0.0;
+
+        for ( double value : values )
+        {
+            sum += value;
+        }
+
+        std::ostringstream out;
+        out << std::fixed << std::setprecision( 4 ) << "{ \"mean\": " << ( values.empty( ) ? 0.0 : sum / values.size( ) ) << ", \"p50\": "
+            << Percentile( values, 50.0 ) << ", \"p95\": " << Percentile( values, 95.0 ) << ", \"p99\": " << Percentile( values, 99.0 )
+            << ", \"max\": " << ( values.empty( ) ? 0.0 : *std::max_element( values.begin( ), values.end( ) ) ) << " }";
+
+        return out.str( );
+    }
+};
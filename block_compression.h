@@ -0,0 +1,469 @@
+#pragma once
+
+// Std. Includes
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define BLOCK_COMPRESSION_USE_SSE2
+#endif
+
+#include "job_system.h"
+
+// Block rows handed to one job
+const size_t BLOCK_COMPRESSION_ROWS_PER_TASK = 4;
+
+// CPU encoder (and reference decoder) for the 4x4 block formats GL samples directly: BC1 for RGB and BC3 for RGBA
+// (grey + alpha images are cached as RGBA). Colors are fitted the classic real-time way: the inset bounding box of the
+// block gives the endpoints, every pixel is projected onto the line between them to pick its index (4 pixels at a time
+// with SSE2), then one least squares pass refits the endpoints to those indices and is kept if it lowers the error.
+// Alpha uses the BC4 8-value mode between the block's min and max.
+class BlockCompressor
+{
+public:
+    // Compressed GL format used for an image with this many channels, or 0 if it stays uncompressed
+    static GLenum FormatFor( int channels )
+    {
+        if ( 3 == channels )
+            return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        else if ( 4 == channels )
+            return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+
+        return 0;
+    }
+
+    static const char *FormatName( GLenum format )
+    {
+        if ( GL_COMPRESSED_RGB_S3TC_DXT1_EXT == format )
+            return "BC1";
+        else if ( GL_COMPRESSED_RGBA_S3TC_DXT5_EXT == format )
+            return "BC3";
+
+        return "raw";
+    }
+
+    static size_t BlockSize( GLenum format )
+    {
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT == format ? 8 : 16;
+    }
+
+    static size_t CompressedSize( GLenum format, int width, int height )
+    {
+        return ( size_t )( ( width + 3 ) / 4 ) * ( ( height + 3 ) / 4 ) * BlockSize( format );
+    }
+
+    // Compresses a tightly packed image into out (CompressedSize bytes), block rows spread over the job system.
+    // Edge blocks of sizes that aren't a multiple of 4 repeat the last row/column
+    static void Compress( GLenum format, const unsigned char *pixels, int width, int height, int channels, unsigned char *out )
+    {
+        size_t blocksWide = ( width + 3 ) / 4;
+        size_t blocksHigh = ( height + 3 ) / 4;
+        size_t blockSize = BlockSize( format );
+
+        JobSystem::Get( ).ParallelFor( blocksHigh, BLOCK_COMPRESSION_ROWS_PER_TASK, [=]( size_t begin, size_t end )
+        {
+            unsigned char rgba[64];
+
+            for ( size_t by = begin; by < end; by++ )
+            {
+                for ( size_t bx = 0; bx < blocksWide; bx++ )
+                {
+                    FetchBlock( pixels, width, height, channels, ( int )bx * 4, ( int )by * 4, rgba );
+                    unsigned char *block = out + ( by * blocksWide + bx ) * blockSize;
+
+                    if ( GL_COMPRESSED_RGB_S3TC_DXT1_EXT == format )
+                    {
+                        EncodeColor( rgba, block );
+                    }
+                    else
+                    {
+                        EncodeChannel( rgba + 3, block );
+                        EncodeColor( rgba, block + 8 );
+                    }
+                }
+            }
+        } );
+    }
+
+    // Expands compressed data back to a tightly packed image, e.g. to measure the encoding error
+    static void Decompress( GLenum format, const unsigned char *data, int width, int height, int channels, unsigned char *out )
+    {
+        size_t blocksWide = ( width + 3 ) / 4;
+        size_t blockSize = BlockSize( format );
+
+        for ( int y = 0; y < height; y++ )
+        {
+            for ( int x = 0; x < width; x++ )
+            {
+                const unsigned char *block = data + ( ( y / 4 ) * blocksWide + x / 4 ) * blockSize;
+                int pixel = ( y % 4 ) * 4 + x % 4;
+                unsigned char rgba[4] = { 0, 0, 0, 255 };
+
+                if ( GL_COMPRESSED_RGB_S3TC_DXT1_EXT == format )
+                {
+                    DecodeColor( block, pixel, rgba );
+                }
+                else
+                {
+                    DecodeColor( block + 8, pixel, rgba );
+                    rgba[3] = DecodeChannel( block, pixel );
+                }
+
+                memcpy( out + ( ( size_t )y * width + x ) * channels, rgba, channels );
+            }
+        }
+    }
+
+    // Peak signal to noise ratio between two images of count bytes, in dB (higher is better, 99 for identical)
+    static double Psnr( const unsigned char *a, const unsigned char *b, size_t count )
+    {
+        double sum = 0.0;
+
+        for ( size_t i = 0; i < count; i++ )
+        {
+            double d = ( double )a[i] - b[i];
+            sum += d * d;
+        }
+
+        return sum > 0.0 ? 10.0 * log10( 255.0 * 255.0 * count / sum ) : 99.0;
+    }
+
+private:
+    // Gathers a 4x4 block as RGBA. Missing channels are 0 (alpha 255)
+    static void FetchBlock( const unsigned char *pixels, int width, int height, int channels, int x0, int y0, unsigned char *rgba )
+    {
+        for ( int y = 0; y < 4; y++ )
+        {
+            const unsigned char *row = pixels + ( size_t )std::min( y0 + y, height - 1 ) * width * channels;
+
+            for ( int x = 0; x < 4; x++ )
+            {
+                const unsigned char *source = row + ( size_t )std::min( x0 + x, width - 1 ) * channels;
+                unsigned char *target = rgba + ( y * 4 + x ) * 4;
+
+                target[0] = source[0];
+                target[1] = channels > 1 ? source[1] : 0;
+                target[2] = channels > 2 ? source[2] : 0;
+                target[3] = channels > 3 ? source[3] : 255;
+            }
+        }
+    }
+
+    static uint16_t To565( int r, int g, int b )
+    {
+        return ( uint16_t )( ( ( r * 31 + 127 ) / 255 ) << 11 | ( ( g * 63 + 127 ) / 255 ) << 5 | ( ( b * 31 + 127 ) / 255 ) );
+    }
+
+    static void From565( uint16_t c, int *rgb )
+    {
+        int r = ( c >> 11 ) & 31, g = ( c >> 5 ) & 63, b = c & 31;
+        rgb[0] = ( r << 3 ) | ( r >> 2 );
+        rgb[1] = ( g << 2 ) | ( g >> 4 );
+        rgb[2] = ( b << 3 ) | ( b >> 2 );
+    }
+
+    // The four colors of a 4-color block
+    static void Palette( uint16_t c0, uint16_t c1, int palette[4][3] )
+    {
+        From565( c0, palette[0] );
+        From565( c1, palette[1] );
+
+        for ( int i = 0; i < 3; i++ )
+        {
+            palette[2][i] = ( 2 * palette[0][i] + palette[1][i] ) / 3;
+            palette[3][i] = ( palette[0][i] + 2 * palette[1][i] ) / 3;
+        }
+    }
+
+    // Picks each pixel's index by projecting it onto the c1 -> c0 line. Returns the packed indices
+    static uint32_t SelectIndices( const unsigned char *rgba, uint16_t c0, uint16_t c1 )
+    {
+        if ( c0 == c1 )
+        {
+            return 0;
+        }
+
+        int palette[4][3];
+        Palette( c0, c1, palette );
+
+        int direction[3] = { palette[0][0] - palette[1][0], palette[0][1] - palette[1][1], palette[0][2] - palette[1][2] };
+        int length = direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2];
+        int origin = palette[1][0] * direction[0] + palette[1][1] * direction[1] + palette[1][2] * direction[2];
+
+        // Steps along the line from c1, rounded: 0 -> c1, 1 -> 1/3, 2 -> 2/3, 3 -> c0
+        static const uint32_t indexOfStep[4] = { 1, 3, 2, 0 };
+        int steps[16];
+
+#ifdef BLOCK_COMPRESSION_USE_SSE2
+        __m128i zero = _mm_setzero_si128( );
+        __m128i axis = _mm_setr_epi16( direction[0], direction[1], direction[2], 0, direction[0], direction[1], direction[2], 0 );
+        __m128i threshold1 = _mm_set1_epi32( length ), threshold2 = _mm_set1_epi32( 3 * length ), threshold3 = _mm_set1_epi32( 5 * length );
+        __m128i base = _mm_set1_epi32( origin );
+
+        for ( int i = 0; i < 16; i += 4 )
+        {
+            __m128i pixels = _mm_loadu_si128( ( const __m128i * )( rgba + i * 4 ) );
+
+            // Dot products as pairs of partial sums, then the pairs added up
+            __m128 low = _mm_castsi128_ps( _mm_madd_epi16( _mm_unpacklo_epi8( pixels, zero ), axis ) );
+            __m128 high = _mm_castsi128_ps( _mm_madd_epi16( _mm_unpackhi_epi8( pixels, zero ), axis ) );
+            __m128i dot = _mm_add_epi32( _mm_castps_si128( _mm_shuffle_ps( low, high, _MM_SHUFFLE( 2, 0, 2, 0 ) ) ),
+                                         _mm_castps_si128( _mm_shuffle_ps( low, high, _MM_SHUFFLE( 3, 1, 3, 1 ) ) ) );
+
+            // 6 * t compared against the midpoints between steps; each true comparison is -1
+            __m128i t = _mm_sub_epi32( dot, base );
+            __m128i t6 = _mm_add_epi32( _mm_slli_epi32( t, 2 ), _mm_slli_epi32( t, 1 ) );
+            __m128i step = _mm_add_epi32( _mm_add_epi32( _mm_cmpgt_epi32( threshold1, t6 ), _mm_cmpgt_epi32( threshold2, t6 ) ),
+                                          _mm_cmpgt_epi32( threshold3, t6 ) );
+            _mm_storeu_si128( ( __m128i * )( steps + i ), _mm_add_epi32( step, _mm_set1_epi32( 3 ) ) );
+        }
+#else
+        for ( int i = 0; i < 16; i++ )
+        {
+            const unsigned char *p = rgba + i * 4;
+            int t6 = 6 * ( p[0] * direction[0] + p[1] * direction[1] + p[2] * direction[2] - origin );
+            steps[i] = ( t6 >= length ) + ( t6 >= 3 * length ) + ( t6 >= 5 * length );
+        }
+#endif
+
+        uint32_t indices = 0;
+
+        for ( int i = 0; i < 16; i++ )
+        {
+            indices |= indexOfStep[steps[i]] << ( 2 * i );
+        }
+
+        return indices;
+    }
+
+    static int ColorError( const unsigned char *rgba, uint16_t c0, uint16_t c1, uint32_t indices )
+    {
+        int palette[4][3];
+        Palette( c0, c1, palette );
+
+        int error = 0;
+
+        for ( int i = 0; i < 16; i++ )
+        {
+            const int *color = palette[( indices >> ( 2 * i ) ) & 3];
+
+            for ( int c = 0; c < 3; c++ )
+            {
+                int d = rgba[i * 4 + c] - color[c];
+                error += d * d;
+            }
+        }
+
+        return error;
+    }
+
+    // Least squares endpoints for fixed indices. Returns false if the indices don't constrain both ends
+    static bool RefineEndpoints( const unsigned char *rgba, uint32_t indices, uint16_t &c0, uint16_t &c1 )
+    {
+        static const float weightOfIndex[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+        float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+
+        for ( int i = 0; i < 16; i++ )
+        {
+            float a = weightOfIndex[( indices >> ( 2 * i ) ) & 3], b = 1.0f - a;
+            aa += a * a;
+            bb += b * b;
+            ab += a * b;
+
+            for ( int c = 0; c < 3; c++ )
+            {
+                ax[c] += a * rgba[i * 4 + c];
+                bx[c] += b * rgba[i * 4 + c];
+            }
+        }
+
+        float determinant = aa * bb - ab * ab;
+
+        if ( fabsf( determinant ) < 1e-6f )
+        {
+            return false;
+        }
+
+        int end0[3], end1[3];
+
+        for ( int c = 0; c < 3; c++ )
+        {
+            end0[c] = std::min( 255, std::max( 0, ( int )lroundf( ( ax[c] * bb - bx[c] * ab ) / determinant ) ) );
+            end1[c] = std::min( 255, std::max( 0, ( int )lroundf( ( bx[c] * aa - ax[c] * ab ) / determinant ) ) );
+        }
+
+        c0 = To565( end0[0], end0[1], end0[2] );
+        c1 = To565( end1[0], end1[1], end1[2] );
+
+        return true;
+    }
+
+    static void WriteColorBlock( unsigned char *out, uint16_t c0, uint16_t c1, uint32_t indices )
+    {
+        out[0] = c0 & 0xff;
+        out[1] = c0 >> 8;
+        out[2] = c1 & 0xff;
+        out[3] = c1 >> 8;
+        memcpy( out + 4, &indices, 4 );
+    }
+
+    // One BC1 color block (always the 4-color mode, so it is also valid as the color half of BC3)
+    static void EncodeColor( const unsigned char *rgba, unsigned char *out )
+    {
+        unsigned char low[4], high[4];
+
+#ifdef BLOCK_COMPRESSION_USE_SSE2
+        __m128i p0 = _mm_loadu_si128( ( const __m128i * )rgba ), p1 = _mm_loadu_si128( ( const __m128i * )( rgba + 16 ) );
+        __m128i p2 = _mm_loadu_si128( ( const __m128i * )( rgba + 32 ) ), p3 = _mm_loadu_si128( ( const __m128i * )( rgba + 48 ) );
+        __m128i minimum = _mm_min_epu8( _mm_min_epu8( p0, p1 ), _mm_min_epu8( p2, p3 ) );
+        __m128i maximum = _mm_max_epu8( _mm_max_epu8( p0, p1 ), _mm_max_epu8( p2, p3 ) );
+        minimum = _mm_min_epu8( minimum, _mm_shuffle_epi32( minimum, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+        minimum = _mm_min_epu8( minimum, _mm_shuffle_epi32( minimum, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+        maximum = _mm_max_epu8( maximum, _mm_shuffle_epi32( maximum, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+        maximum = _mm_max_epu8( maximum, _mm_shuffle_epi32( maximum, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+        int minimumBits = _mm_cvtsi128_si32( minimum ), maximumBits = _mm_cvtsi128_si32( maximum );
+        memcpy( low, &minimumBits, 4 );
+        memcpy( high, &maximumBits, 4 );
+#else
+        memcpy( low, rgba, 4 );
+        memcpy( high, rgba, 4 );
+
+        for ( int i = 1; i < 16; i++ )
+        {
+            for ( int c = 0; c < 4; c++ )
+            {
+                low[c] = std::min( low[c], rgba[i * 4 + c] );
+                high[c] = std::max( high[c], rgba[i * 4 + c] );
+            }
+        }
+#endif
+
+        // Pull the box in by 1/16 of its size, the extremes are rarely the best endpoints
+        int end0[3], end1[3];
+
+        for ( int c = 0; c < 3; c++ )
+        {
+            int inset = ( high[c] - low[c] ) >> 4;
+            end0[c] = high[c] - inset;
+            end1[c] = low[c] + inset;
+        }
+
+        uint16_t c0 = To565( end0[0], end0[1], end0[2] ), c1 = To565( end1[0], end1[1], end1[2] );
+        OrderEndpoints( c0, c1 );
+        uint32_t indices = SelectIndices( rgba, c0, c1 );
+
+        if ( c0 != c1 )
+        {
+            uint16_t r0 = c0, r1 = c1;
+
+            if ( RefineEndpoints( rgba, indices, r0, r1 ) )
+            {
+                OrderEndpoints( r0, r1 );
+                uint32_t refined = SelectIndices( rgba, r0, r1 );
+
+                if ( ColorError( rgba, r0, r1, refined ) < ColorError( rgba, c0, c1, indices ) )
+                {
+                    c0 = r0;
+                    c1 = r1;
+                    indices = refined;
+                }
+            }
+        }
+
+        WriteColorBlock( out, c0, c1, indices );
+    }
+
+    // c0 > c1 selects the 4-color mode
+    static void OrderEndpoints( uint16_t &c0, uint16_t &c1 )
+    {
+        if ( c0 < c1 )
+        {
+            std::swap( c0, c1 );
+        }
+    }
+
+    // One BC4 block from every 4th byte of rgba
+    static void EncodeChannel( const unsigned char *values, unsigned char *out )
+    {
+        int low = 255, high = 0;
+
+        for ( int i = 0; i < 16; i++ )
+        {
+            low = std::min( low, ( int )values[i * 4] );
+            high = std::max( high, ( int )values[i * 4] );
+        }
+
+        out[0] = ( unsigned char )high;
+        out[1] = ( unsigned char )low;
+        uint64_t indices = 0;
+
+        if ( high > low )
+        {
+            int range = high - low;
+
+            for ( int i = 0; i < 16; i++ )
+            {
+                // Nearest of the 8 evenly spaced values, as a step up from low, then mapped to the index order
+                int step = ( ( values[i * 4] - low ) * 14 + range ) / ( 2 * range );
+                uint64_t index = 0 == step ? 1 : ( 7 == step ? 0 : 8 - step );
+                indices |= index << ( 3 * i );
+            }
+        }
+
+        for ( int i = 0; i < 6; i++ )
+        {
+            out[2 + i] = ( unsigned char )( indices >> ( 8 * i ) );
+        }
+    }
+
+    static void DecodeColor( const unsigned char *block, int pixel, unsigned char *rgb )
+    {
+        uint16_t c0 = block[0] | ( block[1] << 8 ), c1 = block[2] | ( block[3] << 8 );
+        int index = ( block[4 + pixel / 4] >> ( 2 * ( pixel % 4 ) ) ) & 3;
+        int palette[4][3];
+        Palette( c0, c1, palette );
+
+        // The 3-color mode, never written by EncodeColor
+        if ( c0 <= c1 )
+        {
+            for ( int i = 0; i < 3; i++ )
+            {
+                palette[2][i] = ( palette[0][i] + palette[1][i] ) / 2;
+                palette[3][i] = 0;
+            }
+        }
+
+        for ( int i = 0; i < 3; i++ )
+        {
+            rgb[i] = ( unsigned char )palette[index][i];
+        }
+    }
+
+    static unsigned char DecodeChannel( const unsigned char *block, int pixel )
+    {
+        int v0 = block[0], v1 = block[1];
+        uint64_t bits = 0;
+
+        for ( int i = 0; i < 6; i++ )
+        {
+            bits |= ( uint64_t )block[2 + i] << ( 8 * i );
+        }
+
+        int index = ( int )( ( bits >> ( 3 * pixel ) ) & 7 );
+
+        if ( index < 2 )
+            return ( unsigned char )( 0 == index ? v0 : v1 );
+        else if ( v0 > v1 )
+            return ( unsigned char )( ( ( 8 - index ) * v0 + ( index - 1 ) * v1 ) / 7 );
+        else if ( index < 6 )
+            return ( unsigned char )( ( ( 6 - index ) * v0 + ( index - 1 ) * v1 ) / 5 );
+
+        return 6 == index ? 0 : 255;
+    }
+};
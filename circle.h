@@ -5,6 +5,7 @@
 #include "shader.h"
 
 #include "graphics_headers.h"
+#include "profiler.h"
 
 #ifndef M_PI
     #define M_PI 3.14159
@@ -88,6 +89,8 @@ namespace Learus_Circle
 
             void Draw()
             {
+                PROFILE_SCOPE("Circle::Draw");
+
                 shader.Use();
                 shader.setMat4("projection", projection);
                 shader.setMat4("view", view);
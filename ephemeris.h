@@ -0,0 +1,353 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+
+#include "orbit.h"
+#include "mapped_file.h"
+
+const char EPHEMERIS_MAGIC[4] = { 'E', 'P', 'H', 'M' };
+const uint32_t EPHEMERIS_VERSION = 2;
+
+// Default fit: degree of each polynomial, and segments per period of the fastest body
+const int EPHEMERIS_DEGREE = 10;
+const int EPHEMERIS_SEGMENTS_PER_ORBIT = 8;
+
+// File header. Followed (at coefficientOffset) by float coefficients laid out as [segment][axis][k][body], bodies padded
+// to a multiple of 4 so one SIMD load covers the same coefficient of 4 bodies
+struct EphemerisHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t bodyCount;
+    uint32_t paddedBodyCount;
+    uint32_t degree;
+    uint32_t segmentCount;
+    double startTime;
+    double segmentLength;
+    uint64_t coefficientOffset;
+    // SourceHash of the orbit elements and span the table was fitted to
+    uint64_t sourceHash;
+};
+
+// Piecewise Chebyshev tables of body positions, the way JPL ephemerides work. Time is cut into equal segments and each
+// body's root-frame x, y and z over a segment are fitted with a polynomial, so the position at any time is found by
+// indexing the segment directly and evaluating one short polynomial. Seeking across a long span costs the same as
+// stepping one frame ahead. The tables live in a memory-mapped file, so only the segments actually visited get paged in.
+class Ephemeris
+{
+public:
+    // Fits the propagation model over [startTime, startTime + span] and writes the tables to path
+    static bool Build( const OrbitElements &elements, double startTime, double span, const std::string &path,
+                       double segmentLength = 0.0, int degree = EPHEMERIS_DEGREE )
+    {
+        if ( segmentLength <= 0.0 )
+        {
+            double fastest = *std::max_element( elements.meanMotion.begin( ), elements.meanMotion.end( ) );
+            segmentLength = ORBIT_TWO_PI / fastest / EPHEMERIS_SEGMENTS_PER_ORBIT;
+        }
+
+        EphemerisHeader header = { };
+        memcpy( header.magic, EPHEMERIS_MAGIC, 4 );
+        header.version = EPHEMERIS_VERSION;
+        header.bodyCount = ( uint32_t )elements.Size( );
+        header.paddedBodyCount = ( header.bodyCount + 3 ) & ~3u;
+        header.degree = ( uint32_t )degree;
+        header.segmentCount = ( uint32_t )std::max( 1.0, ceil( span / segmentLength ) );
+        header.startTime = startTime;
+        header.segmentLength = segmentLength;
+        header.coefficientOffset = ( sizeof( EphemerisHeader ) + 15 ) & ~( uint64_t )15;
+        header.sourceHash = SourceHash( elements, startTime, span );
+
+        std::ofstream file( path, std::ios::binary );
+
+        if ( !file )
+        {
+            std::cout << "ERROR::EPHEMERIS::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+
+        file.write( ( const char * )&header, sizeof( header ) );
+        file.write( "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", header.coefficientOffset - sizeof( header ) );
+
+        int nodes = degree + 1;
+        size_t padded = header.paddedBodyCount;
+        std::vector<OrbitPositions> samples( nodes );
+        std::vector<float> coefficients( 3 * nodes * padded );
+
+        // cos(pi * k * (j + 1/2) / nodes), the same for every segment
+        std::vector<double> basis( nodes * nodes );
+
+        for ( int k = 0; k < nodes; k++ )
+        {
+            for ( int j = 0; j < nodes; j++ )
+            {
+                basis[k * nodes + j] = cos( M_PI * k * ( j + 0.5 ) / nodes );
+            }
+        }
+
+        for ( uint32_t segment = 0; segment < header.segmentCount; segment++ )
+        {
+            double segmentStart = startTime + segment * segmentLength;
+
+            // Sample at the Chebyshev nodes of the segment
+            for ( int j = 0; j < nodes; j++ )
+            {
+                double x = cos( M_PI * ( j + 0.5 ) / nodes );
+                OrbitPropagator::Propagate( elements, segmentStart + ( x + 1.0 ) * 0.5 * segmentLength, samples[j] );
+                OrbitPropagator::ResolveToRootFrame( elements, samples[j] );
+            }
+
+            std::fill( coefficients.begin( ), coefficients.end( ), 0.0f );
+
+            for ( int axis = 0; axis < 3; axis++ )
+            {
+                for ( int k = 0; k < nodes; k++ )
+                {
+                    for ( size_t body = 0; body < header.bodyCount; body++ )
+                    {
+                        double sum = 0.0;
+
+                        for ( int j = 0; j < nodes; j++ )
+                        {
+                            const std::vector<float> &values = 0 == axis ? samples[j].x : ( 1 == axis ? samples[j].y : samples[j].z );
+                            sum += values[body] * basis[k * nodes + j];
+                        }
+
+                        // c0 is stored halved so evaluation is a plain sum
+                        coefficients[( axis * nodes + k ) * padded + body] = ( float )( sum * ( 0 == k ? 1.0 : 2.0 ) / nodes );
+                    }
+                }
+            }
+
+            file.write( ( const char * )coefficients.data( ), coefficients.size( ) * sizeof( float ) );
+        }
+
+        return ( bool )file;
+    }
+
+    // Maps an ephemeris file. Returns false if it is missing or not a valid table
+    bool Open( const std::string &path )
+    {
+        if ( !file.Open( path ) || file.Size( ) < sizeof( EphemerisHeader ) )
+        {
+            return false;
+        }
+
+        memcpy( &header, file.Data( ), sizeof( header ) );
+
+        size_t expected = header.coefficientOffset + ( size_t )header.segmentCount * 3 * ( header.degree + 1 ) * header.paddedBodyCount * sizeof( float );
+
+        if ( 0 != memcmp( header.magic, EPHEMERIS_MAGIC, 4 ) || EPHEMERIS_VERSION != header.version || file.Size( ) < expected )
+        {
+            std::cout << "ERROR::EPHEMERIS::INVALID_FILE " << path << std::endl;
+            file.Close( );
+            return false;
+        }
+
+        coefficients = ( const float * )( file.Data( ) + header.coefficientOffset );
+
+        return true;
+    }
+
+    // Maps an ephemeris file fitted to these elements over [startTime, startTime + span]. Returns false if it is
+    // missing, invalid or was built from anything else, so the caller rebuilds it
+    bool Open( const std::string &path, const OrbitElements &elements, double startTime, double span )
+    {
+        if ( !Open( path ) )
+        {
+            return false;
+        }
+
+        if ( header.sourceHash != SourceHash( elements, startTime, span ) )
+        {
+            std::cout << "Ephemeris " << path << " was built from other orbits or another span, rebuilding" << std::endl;
+            file.Close( );
+            return false;
+        }
+
+        return true;
+    }
+
+    bool IsOpen( ) const
+    {
+        return file.IsOpen( );
+    }
+
+    // FNV-1a over every element and the span, identifying what a table was fitted to
+    static uint64_t SourceHash( const OrbitElements &elements, double startTime, double span )
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&hash]( const void *data, size_t size )
+        {
+            const unsigned char *bytes = ( const unsigned char * )data;
+
+            for ( size_t i = 0; i < size; i++ )
+            {
+                hash = ( hash ^ bytes[i] ) * 1099511628211ull;
+            }
+        };
+        auto addVector = [&add]( const auto &values ) { add( values.data( ), values.size( ) * sizeof( values[0] ) ); };
+
+        addVector( elements.semiMajorAxis );
+        addVector( elements.eccentricity );
+        addVector( elements.meanAnomalyAtEpoch );
+        addVector( elements.meanMotion );
+        addVector( elements.px );
+        addVector( elements.py );
+        addVector( elements.pz );
+        addVector( elements.qx );
+        addVector( elements.qy );
+        addVector( elements.qz );
+        addVector( elements.parent );
+        add( &startTime, sizeof( startTime ) );
+        add( &span, sizeof( span ) );
+
+        return hash;
+    }
+
+    size_t BodyCount( ) const
+    {
+        return IsOpen( ) ? header.bodyCount : 0;
+    }
+
+    bool Covers( double t ) const
+    {
+        return IsOpen( ) && t >= header.startTime && t <= header.startTime + header.segmentCount * header.segmentLength;
+    }
+
+    // Root-frame positions of every body at time t (clamped to the span of the table)
+    void Evaluate( double t, OrbitPositions &out ) const
+    {
+        out.Resize( header.bodyCount );
+
+        double local = ( t - header.startTime ) / header.segmentLength;
+        long long segment = std::min<long long>( std::max<long long>( 0, ( long long )floor( local ) ), header.segmentCount - 1 );
+        float tau = ( float )std::min( 1.0, std::max( -1.0, 2.0 * ( local - segment ) - 1.0 ) );
+
+        size_t padded = header.paddedBodyCount;
+        int nodes = header.degree + 1;
+        const float *segmentCoefficients = coefficients + ( size_t )segment * 3 * nodes * padded;
+
+        for ( int axis = 0; axis < 3; axis++ )
+        {
+            const float *axisCoefficients = segmentCoefficients + ( size_t )axis * nodes * padded;
+            float *result = 0 == axis ? out.x.data( ) : ( 1 == axis ? out.y.data( ) : out.z.data( ) );
+            size_t body = 0;
+
+#ifdef ORBIT_USE_SSE2
+            for ( ; body + 4 <= header.bodyCount; body += 4 )
+            {
+                _mm_storeu_ps( result + body, Clenshaw4( axisCoefficients + body, padded, nodes, tau ) );
+            }
+#endif
+
+            for ( ; body < header.bodyCount; body++ )
+            {
+                result[body] = Clenshaw( axisCoefficients + body, padded, nodes, tau );
+            }
+        }
+    }
+
+    // Compares random seeks against the propagation model and prints the error and the cost of each
+    static void RunBenchmark( const OrbitElements &elements, double span = 3600.0, int seeks = 10000 )
+    {
+        const std::string path = ( std::filesystem::temp_directory_path( ) / "ephemeris_benchmark.bin" ).string( );
+
+        auto buildStart = std::chrono::high_resolution_clock::now( );
+        Build( elements, 0.0, span, path );
+        std::chrono::duration<double, std::milli> buildTime = std::chrono::high_resolution_clock::now( ) - buildStart;
+
+        Ephemeris ephemeris;
+
+        if ( !ephemeris.Open( path ) )
+        {
+            std::error_code error;
+            std::filesystem::remove( path, error );
+            return;
+        }
+
+        unsigned int seed = 777;
+        auto random = [&seed]( ) { seed = seed * 1664525u + 1013904223u; return ( seed >> 8 ) / 16777216.0; };
+
+        OrbitPositions table, model;
+        double maxError = 0.0, tableSeconds = 0.0, modelSeconds = 0.0;
+
+        for ( int i = 0; i < seeks; i++ )
+        {
+            double t = span * random( );
+
+            auto start = std::chrono::high_resolution_clock::now( );
+            ephemeris.Evaluate( t, table );
+            auto middle = std::chrono::high_resolution_clock::now( );
+            OrbitPropagator::Propagate( elements, t, model );
+            OrbitPropagator::ResolveToRootFrame( elements, model );
+            auto end = std::chrono::high_resolution_clock::now( );
+
+            tableSeconds += std::chrono::duration<double>( middle - start ).count( );
+            modelSeconds += std::chrono::duration<double>( end - middle ).count( );
+
+            for ( size_t body = 0; body < elements.Size( ); body++ )
+            {
+                double dx = table.x[body] - model.x[body], dy = table.y[body] - model.y[body], dz = table.z[body] - model.z[body];
+                maxError = std::max( maxError, sqrt( dx * dx + dy * dy + dz * dz ) );
+            }
+        }
+
+        std::cout << "Ephemeris: " << elements.Size( ) << " bodies, " << ephemeris.header.segmentCount << " segments, "
+                  << ephemeris.file.Size( ) / 1024 << " KB, built in " << buildTime.count( ) << " ms" << std::endl;
+        std::cout << "Seek: " << 1e6 * tableSeconds / seeks << " us from tables, " << 1e6 * modelSeconds / seeks
+                  << " us from the propagator, max error " << maxError << std::endl;
+
+        ephemeris.file.Close( );
+        std::error_code error;
+        std::filesystem::remove( path, error );
+    }
+
+private:
+    MappedFile file;
+    EphemerisHeader header;
+    const float *coefficients = nullptr;
+
+    // Sum of c[k * stride] * T_k(x) by Clenshaw's recurrence
+    static float Clenshaw( const float *c, size_t stride, int nodes, float x )
+    {
+        float b1 = 0.0f, b2 = 0.0f;
+
+        for ( int k = nodes - 1; k >= 1; k-- )
+        {
+            float b = 2.0f * x * b1 - b2 + c[k * stride];
+            b2 = b1;
+            b1 = b;
+        }
+
+        return x * b1 - b2 + c[0];
+    }
+
+#ifdef ORBIT_USE_SSE2
+    static inline __m128 Clenshaw4( const float *c, size_t stride, int nodes, float x )
+    {
+        __m128 x1 = _mm_set1_ps( x );
+        __m128 x2 = _mm_set1_ps( 2.0f * x );
+        __m128 b1 = _mm_setzero_ps( ), b2 = _mm_setzero_ps( );
+
+        for ( int k = nodes - 1; k >= 1; k-- )
+        {
+            __m128 b = _mm_add_ps( _mm_sub_ps( _mm_mul_ps( x2, b1 ), b2 ), _mm_loadu_ps( c + k * stride ) );
+            b2 = b1;
+            b1 = b;
+        }
+
+        return _mm_add_ps( _mm_sub_ps( _mm_mul_ps( x1, b1 ), b2 ), _mm_loadu_ps( c ) );
+    }
+#endif
+};
@@ -0,0 +1,349 @@
+#pragma once
+
+// Std. Includes
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "job_system.h"
+
+// Frames kept, and how many of them come after the slow frame in a dump
+const int FLIGHT_RECORDER_FRAMES = 240;
+const int FLIGHT_RECORDER_FRAMES_AFTER = 30;
+
+// Scopes kept per frame and how deep they nest. Scopes past either limit are counted but not kept
+const int FLIGHT_RECORDER_SCOPES = 64;
+const int FLIGHT_RECORDER_DEPTH = 16;
+
+// Named counters per frame (GL calls, uploads, simulation steps)
+const int FLIGHT_RECORDER_COUNTERS = 8;
+
+// Default frame time that triggers a dump, and frames at startup that never do (loading the first frame)
+const double FLIGHT_RECORDER_THRESHOLD_MS = 33.0;
+const long long FLIGHT_RECORDER_WARMUP_FRAMES = 10;
+
+// Dumps written in one run at most, so a sustained slowdown doesn't fill the disk
+const int FLIGHT_RECORDER_MAX_DUMPS = 16;
+
+// Always-on record of the last frames (--flight-recorder): the CPU time of every profiler scope, whether the profiler
+// itself is on or not, and a few counters per frame, in fixed rings allocated once. When a frame takes longer than the
+// threshold the recorder keeps going for FLIGHT_RECORDER_FRAMES_AFTER more frames, then writes the whole window around
+// it as a Chrome trace (prefix + frame number + .json) on the job system. Recording a scope is two clock reads and a
+// couple of stores, with no GL queries and no allocation. Used from the GL thread only.
+class FlightRecorder
+{
+public:
+    // Takes effect at the next BeginFrame
+    static inline bool enabled = false;
+
+    double thresholdMs = FLIGHT_RECORDER_THRESHOLD_MS;
+
+    // Dumps are written to this plus the slow frame's number plus .json
+    std::string pathPrefix = "flight_";
+
+    static FlightRecorder &Get( )
+    {
+        static FlightRecorder instance;
+
+        return instance;
+    }
+
+    void BeginFrame( )
+    {
+        inFrame = false;
+
+        if ( !enabled )
+        {
+            return;
+        }
+
+        if ( frames.empty( ) )
+        {
+            Create( );
+        }
+
+        Frame &record = frames[frame % FLIGHT_RECORDER_FRAMES];
+        record.number = frame;
+        record.begin = Now( );
+        record.scopes = 0;
+        record.dropped = 0;
+        std::fill( record.counters, record.counters + FLIGHT_RECORDER_COUNTERS, 0.0 );
+
+        depth = 0;
+        inFrame = true;
+    }
+
+    // Opens a scope. name must outlive the recorder (a string literal). Returns whether the matching Pop is needed
+    bool Push( const char *name )
+    {
+        if ( !inFrame )
+        {
+            return false;
+        }
+
+        Frame &record = frames[frame % FLIGHT_RECORDER_FRAMES];
+        int index = -1;
+
+        if ( record.scopes < FLIGHT_RECORDER_SCOPES && depth < FLIGHT_RECORDER_DEPTH )
+        {
+            index = ( int )( frame % FLIGHT_RECORDER_FRAMES ) * FLIGHT_RECORDER_SCOPES + record.scopes++;
+            Scope &scope = scopes[index];
+            scope.name = name;
+            scope.begin = Now( );
+            scope.end = scope.begin;
+        }
+        else
+        {
+            record.dropped++;
+        }
+
+        if ( depth < FLIGHT_RECORDER_DEPTH )
+        {
+            open[depth] = index;
+        }
+
+        depth++;
+
+        return true;
+    }
+
+    void Pop( )
+    {
+        if ( !inFrame || 0 == depth )
+        {
+            return;
+        }
+
+        depth--;
+
+        if ( depth < FLIGHT_RECORDER_DEPTH && open[depth] >= 0 )
+        {
+            scopes[open[depth]].end = Now( );
+        }
+    }
+
+    // Sets a counter of the current frame. name must be a string literal; the first FLIGHT_RECORDER_COUNTERS names kept
+    void Record( const char *name, double value )
+    {
+        if ( !inFrame )
+        {
+            return;
+        }
+
+        for ( int i = 0; i < FLIGHT_RECORDER_COUNTERS; i++ )
+        {
+            if ( nullptr == counterNames[i] )
+            {
+                counterNames[i] = name;
+            }
+
+            if ( counterNames[i] == name || 0 == strcmp( counterNames[i], name ) )
+            {
+                frames[frame % FLIGHT_RECORDER_FRAMES].counters[i] = value;
+                return;
+            }
+        }
+    }
+
+    // Closes the frame, after it was presented. Starts a dump once enough frames have followed a slow one
+    void EndFrame( )
+    {
+        if ( !inFrame )
+        {
+            return;
+        }
+
+        while ( depth > 0 )
+        {
+            Pop( );
+        }
+
+        Frame &record = frames[frame % FLIGHT_RECORDER_FRAMES];
+        record.end = Now( );
+        inFrame = false;
+
+        double frameMs = record.end - record.begin;
+
+        if ( frameMs > thresholdMs && frame >= FLIGHT_RECORDER_WARMUP_FRAMES )
+        {
+            slowFrames++;
+
+            if ( dumpAt < 0 && dumps < FLIGHT_RECORDER_MAX_DUMPS && 0 == writing.pending )
+            {
+                slowFrame = frame;
+                dumpAt = frame + FLIGHT_RECORDER_FRAMES_AFTER;
+            }
+        }
+
+        if ( frame == dumpAt )
+        {
+            Dump( frame );
+        }
+
+        frame++;
+    }
+
+    // Writes a dump still waiting for its frames after, and waits for the writes. For the end of a run
+    void Finish( )
+    {
+        if ( dumpAt >= 0 )
+        {
+            Dump( frame - 1 );
+        }
+
+        JobSystem::Get( ).Wait( writing );
+    }
+
+    void PrintStats( )
+    {
+        if ( frames.empty( ) )
+        {
+            return;
+        }
+
+        std::cout << "Flight recorder: " << slowFrames << " frames over " << thresholdMs << " ms in " << frame << ", " << dumps
+                  << " dumps written" << std::endl;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // Times in ms since the recorder started
+    struct Scope
+    {
+        const char *name = nullptr;
+        double begin = 0.0;
+        double end = 0.0;
+    };
+
+    struct Frame
+    {
+        long long number = -1;
+        double begin = 0.0;
+        double end = 0.0;
+        int scopes = 0;
+        int dropped = 0;
+        double counters[FLIGHT_RECORDER_COUNTERS] = { };
+    };
+
+    Clock::time_point origin;
+    bool inFrame = false;
+    long long frame = 0;
+    int depth = 0;
+    int open[FLIGHT_RECORDER_DEPTH] = { };
+
+    std::vector<Frame> frames;
+    std::vector<Scope> scopes;
+    const char *counterNames[FLIGHT_RECORDER_COUNTERS] = { };
+
+    // Copied out of the rings for the job writing a dump, so recording carries on meanwhile
+    std::vector<Frame> dumpFrames;
+    std::vector<Scope> dumpScopes;
+    const char *dumpCounterNames[FLIGHT_RECORDER_COUNTERS] = { };
+    long long dumpFirst = 0;
+    long long dumpLast = 0;
+    long long dumpSlow = 0;
+    JobSystem::Counter writing;
+
+    long long slowFrame = -1;
+    long long dumpAt = -1;
+    long long slowFrames = 0;
+    int dumps = 0;
+
+    // The job system must outlive the dumps it writes
+    FlightRecorder( )
+    {
+        JobSystem::Get( );
+    }
+
+    ~FlightRecorder( )
+    {
+        JobSystem::Get( ).Wait( writing );
+    }
+
+    // Everything is allocated here, the frames only write into it
+    void Create( )
+    {
+        origin = Clock::now( );
+        frames.resize( FLIGHT_RECORDER_FRAMES );
+        scopes.resize( ( size_t )FLIGHT_RECORDER_FRAMES * FLIGHT_RECORDER_SCOPES );
+        dumpFrames.resize( frames.size( ) );
+        dumpScopes.resize( scopes.size( ) );
+    }
+
+    double Now( ) const
+    {
+        return std::chrono::duration<double, std::milli>( Clock::now( ) - origin ).count( );
+    }
+
+    // Copies out the window up to frame last and writes it in the background
+    void Dump( long long last )
+    {
+        dumpFrames = frames;
+        dumpScopes = scopes;
+        std::copy( counterNames, counterNames + FLIGHT_RECORDER_COUNTERS, dumpCounterNames );
+        dumpFirst = std::max( 0ll, last - FLIGHT_RECORDER_FRAMES + 1 );
+        dumpLast = last;
+        dumpSlow = slowFrame;
+        dumpAt = -1;
+        dumps++;
+
+        JobSystem::Get( ).Submit( [this]( ) { Write( ); }, writing );
+    }
+
+    void Write( )
+    {
+        std::string path = pathPrefix + std::to_string( dumpSlow ) + ".json";
+        std::ofstream file( path );
+
+        if ( !file )
+        {
+            std::cerr << "ERROR: Can't write the flight recorder dump to " << path << std::endl;
+            return;
+        }
+
+        char line[256];
+        file << "{\"traceEvents\":[\n";
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"Frames\"}},\n";
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"Scopes\"}}";
+
+        for ( long long number = dumpFirst; number <= dumpLast; number++ )
+        {
+            const Frame &record = dumpFrames[number % FLIGHT_RECORDER_FRAMES];
+
+            if ( record.number != number )
+            {
+                continue;
+            }
+
+            double frameMs = record.end - record.begin;
+            snprintf( line, sizeof( line ), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%lld,\"dropped_scopes\":%d}}",
+                      frameMs > thresholdMs ? "Slow frame" : "Frame", record.begin * 1000.0, frameMs * 1000.0, number, record.dropped );
+            file << line;
+
+            for ( int i = 0; i < record.scopes; i++ )
+            {
+                const Scope &scope = dumpScopes[( size_t )( number % FLIGHT_RECORDER_FRAMES ) * FLIGHT_RECORDER_SCOPES + i];
+                snprintf( line, sizeof( line ), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%lld}}",
+                          scope.name, scope.begin * 1000.0, ( scope.end - scope.begin ) * 1000.0, number );
+                file << line;
+            }
+
+            for ( int i = 0; i < FLIGHT_RECORDER_COUNTERS && dumpCounterNames[i]; i++ )
+            {
+                snprintf( line, sizeof( line ), ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"value\":%g}}",
+                          dumpCounterNames[i], record.begin * 1000.0, record.counters[i] );
+                file << line;
+            }
+        }
+
+        file << "\n]}\n";
+        std::cout << "Flight recorder: frame " << dumpSlow << " took over " << thresholdMs << " ms, frames " << dumpFirst << " to "
+                  << dumpLast << " written to " << path << std::endl;
+    }
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+// Std. Includes
+#include <new>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+
+// Bytes the arena starts with. A frame that needs more spills to the heap and the block grows at the next Reset
+const size_t FRAME_ARENA_CAPACITY = 256 * 1024;
+
+// Linear allocator for memory that lives until the end of the frame: the scratch lists the per frame updates build and
+// throw away. Allocating moves a pointer, freeing does nothing and Reset at the start of the next frame takes it all
+// back at once, so once the block is big enough the render loop doesn't go to the heap for them. Nothing allocated here
+// may be kept past the frame. Used from the GL thread only.
+class FrameArena
+{
+public:
+    static FrameArena &Get( )
+    {
+        static FrameArena instance;
+
+        return instance;
+    }
+
+    void *Allocate( size_t bytes, size_t alignment )
+    {
+        if ( nullptr == block )
+        {
+            Grow( FRAME_ARENA_CAPACITY );
+        }
+
+        uintptr_t start = ( ( uintptr_t )( block + used ) + alignment - 1 ) & ~( uintptr_t )( alignment - 1 );
+
+        if ( start + bytes <= ( uintptr_t )( block + capacity ) )
+        {
+            used = start + bytes - ( uintptr_t )block;
+            peak = std::max( peak, used );
+
+            return ( void * )start;
+        }
+
+        spilled += bytes;
+
+        return ::operator new( bytes );
+    }
+
+    // Only what spilled to the heap goes back, the rest waits for Reset
+    void Free( void *pointer )
+    {
+        if ( ( unsigned char * )pointer < block || ( unsigned char * )pointer >= block + capacity )
+        {
+            ::operator delete( pointer );
+        }
+    }
+
+    // Once per frame, before anything allocates from the arena
+    void Reset( )
+    {
+        if ( spilled > 0 )
+        {
+            spilledFrames++;
+            Grow( 2 * ( capacity + spilled ) );
+        }
+
+        used = 0;
+        spilled = 0;
+    }
+
+    void PrintStats( )
+    {
+        if ( nullptr == block )
+        {
+            return;
+        }
+
+        std::cout << "Frame arena: " << capacity / 1024 << " KB, peak " << peak / 1024 << " KB, " << spilledFrames
+                  << " frames spilled to the heap" << std::endl;
+    }
+
+private:
+    unsigned char *block = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t peak = 0;
+    size_t spilled = 0;
+    long long spilledFrames = 0;
+
+    FrameArena( )
+    {
+    }
+
+    ~FrameArena( )
+    {
+        delete[] block;
+    }
+
+    void Grow( size_t bytes )
+    {
+        delete[] block;
+        block = new unsigned char[bytes];
+        capacity = bytes;
+    }
+};
+
+// Standard allocator over the frame arena, for containers that are built and dropped within a frame
+template <typename T>
+class FrameAllocator
+{
+public:
+    typedef T value_type;
+
+    FrameAllocator( )
+    {
+    }
+
+    template <typename U>
+    FrameAllocator( const FrameAllocator<U> & )
+    {
+    }
+
+    T *allocate( size_t count )
+    {
+        return ( T * )FrameArena::Get( ).Allocate( count * sizeof( T ), alignof( T ) );
+    }
+
+    void deallocate( T *pointer, size_t )
+    {
+        FrameArena::Get( ).Free( pointer );
+    }
+};
+
+template <typename T, typename U>
+bool operator==( const FrameAllocator<T> &, const FrameAllocator<U> & )
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=( const FrameAllocator<T> &, const FrameAllocator<U> & )
+{
+    return false;
+}
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
@@ -0,0 +1,276 @@
+#pragma once
+
+// Std. Includes
+#include <map>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#include "frame_arena.h"
+
+// Default milliseconds of GL thread work run per frame. At least one task runs per frame whatever its estimate
+const double FRAME_SCHEDULER_BUDGET = 2.0;
+
+// Starting guess for estimates derived from data size: fixed cost of a task plus bytes handed to GL per millisecond
+const double FRAME_SCHEDULER_TASK_MS = 0.02;
+const double FRAME_SCHEDULER_BYTES_PER_MS = 1024.0 * 1024.0;
+
+// Weight of the newest measurement in the per kind correction of the estimates
+const double FRAME_SCHEDULER_LEARNING_RATE = 0.25;
+
+// A piece of work that has to run on the GL thread (buffer creation, texture uploads)
+struct FrameTask
+{
+    // Groups tasks whose estimates are corrected together, e.g. "mesh" or "texture"
+    std::string kind;
+
+    // Expected cost in milliseconds before correction, usually derived from the bytes handed to GL
+    double estimate = 0.1;
+
+    // Higher runs first, evaluated once per frame: the projected size in pixels of what the task belongs to. Tasks
+    // without one run after everything that is visible
+    std::function<float( )> priority;
+
+    // Tasks that aren't ready (data still being prepared on the job system) are skipped until they are
+    std::function<bool( )> ready;
+
+    std::function<void( )> work;
+};
+
+// Spreads GL thread work for assets that arrive after the first frame over many frames, within a time budget per
+// frame, instead of running it all before the render loop. Tasks carry an estimate of their cost; each frame the
+// ready ones run in order of priority while their estimates fit in what is left of the budget, so one expensive asset
+// can't stall a frame and what is on screen gets its data first. The measured time of every task corrects the
+// estimates of its kind. Used from the GL thread only.
+class FrameScheduler
+{
+public:
+    // Defer work to the render loop. When off, Submit runs tasks immediately
+    static inline bool enabled = false;
+
+    double budget = FRAME_SCHEDULER_BUDGET;
+
+    static FrameScheduler &Get( )
+    {
+        static FrameScheduler instance;
+
+        return instance;
+    }
+
+    // Estimate for a task that hands this many bytes to GL, before its kind is corrected by measurements
+    static double EstimateUpload( size_t bytes )
+    {
+        return FRAME_SCHEDULER_TASK_MS + bytes / FRAME_SCHEDULER_BYTES_PER_MS;
+    }
+
+    void Submit( FrameTask &&task )
+    {
+        if ( !enabled )
+        {
+            task.work( );
+            return;
+        }
+
+        pending.push_back( std::move( task ) );
+    }
+
+    // Runs tasks for up to budget milliseconds. Once per frame on the GL thread
+    void Update( )
+    {
+        Clock::time_point now = Clock::now( );
+
+        // Frame times while tasks are pending against those after, the point of the budget is to keep them the same
+        if ( frames > 0 )
+        {
+            double frameMs = std::chrono::duration<double, std::milli>( now - lastUpdate ).count( );
+            ( loadingFrame ? loadingFrames : idleFrames ).Add( frameMs );
+        }
+
+        lastUpdate = now;
+        frames++;
+        loadingFrame = !pending.empty( );
+        frameWorkMs = 0.0;
+
+        if ( pending.empty( ) )
+        {
+            return;
+        }
+
+        // Highest priority first, in submission order among equals. Scratch lists come from the frame arena
+        FrameVector<std::pair<float, size_t>> order( pending.size( ) );
+
+        for ( size_t i = 0; i < pending.size( ); i++ )
+        {
+            order[i] = std::make_pair( pending[i].priority ? -pending[i].priority( ) : 0.0f, i );
+        }
+
+        std::sort( order.begin( ), order.end( ) );
+
+        double spent = 0.0;
+        int run = 0;
+        size_t count = pending.size( );
+        FrameVector<bool> done( count, false );
+
+        for ( const std::pair<float, size_t> &entry : order )
+        {
+            Kind &kind = kinds[pending[entry.second].kind];
+            double estimate = pending[entry.second].estimate;
+            double expected = estimate * kind.correction;
+
+            if ( run > 0 && spent + expected > budget )
+            {
+                continue;
+            }
+
+            if ( pending[entry.second].ready && !pending[entry.second].ready( ) )
+            {
+                continue;
+            }
+
+            // Tasks may submit more tasks, which can move the pending ones
+            std::function<void( )> work = std::move( pending[entry.second].work );
+
+            Clock::time_point start = Clock::now( );
+            work( );
+            double actual = std::chrono::duration<double, std::milli>( Clock::now( ) - start ).count( );
+
+            if ( estimate > 0.0 )
+            {
+                kind.correction += FRAME_SCHEDULER_LEARNING_RATE * ( actual / estimate - kind.correction );
+            }
+
+            kind.tasks++;
+            kind.totalMs += actual;
+            kind.maxMs = std::max( kind.maxMs, actual );
+            kind.errorMs += std::fabs( actual - expected );
+
+            spent += actual;
+            done[entry.second] = true;
+            run++;
+        }
+
+        size_t kept = 0;
+
+        for ( size_t i = 0; i < pending.size( ); i++ )
+        {
+            if ( i < count && done[i] )
+            {
+                continue;
+            }
+
+            if ( kept != i )
+            {
+                pending[kept] = std::move( pending[i] );
+            }
+
+            kept++;
+        }
+
+        pending.resize( kept );
+
+        workFrames++;
+        workMs += spent;
+        frameWorkMs = spent;
+        maxWorkMs = std::max( maxWorkMs, spent );
+
+        if ( spent > budget )
+        {
+            overBudgetFrames++;
+        }
+    }
+
+    size_t Pending( ) const
+    {
+        return pending.size( );
+    }
+
+    // Milliseconds of tasks run by the last Update
+    double FrameWorkMs( ) const
+    {
+        return frameWorkMs;
+    }
+
+    void PrintStats( )
+    {
+        std::cout << "Frame scheduler: " << Pending( ) << " pending, " << workMs << " ms of work over " << workFrames << " frames (max "
+                  << maxWorkMs << " ms, " << overBudgetFrames << " over the budget of " << budget << " ms)" << std::endl;
+
+        for ( const std::pair<const std::string, Kind> &entry : kinds )
+        {
+            const Kind &kind = entry.second;
+
+            if ( kind.tasks > 0 )
+            {
+                std::cout << "  " << entry.first << ": " << kind.tasks << " tasks, mean " << kind.totalMs / kind.tasks << " ms, max "
+                          << kind.maxMs << " ms, mean estimate error " << kind.errorMs / kind.tasks << " ms, correction "
+                          << kind.correction << std::endl;
+            }
+        }
+
+        loadingFrames.Print( "  frame time while loading" );
+        idleFrames.Print( "  frame time after loading" );
+    }
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    struct Kind
+    {
+        // Measured over estimated time, applied to the next estimates
+        double correction = 1.0;
+        long long tasks = 0;
+        double totalMs = 0.0;
+        double maxMs = 0.0;
+        double errorMs = 0.0;
+    };
+
+    // Running mean and variance (Welford)
+    struct FrameTimes
+    {
+        long long count = 0;
+        double mean = 0.0;
+        double m2 = 0.0;
+        double max = 0.0;
+
+        void Add( double ms )
+        {
+            count++;
+            double delta = ms - mean;
+            mean += delta / count;
+            m2 += delta * ( ms - mean );
+            max = std::max( max, ms );
+        }
+
+        void Print( const char *name ) const
+        {
+            if ( count > 0 )
+            {
+                std::cout << name << ": " << count << " frames, mean " << mean << " ms, std dev " << std::sqrt( m2 / count ) << " ms, max "
+                          << max << " ms" << std::endl;
+            }
+        }
+    };
+
+    std::vector<FrameTask> pending;
+    std::map<std::string, Kind> kinds;
+
+    Clock::time_point lastUpdate;
+    bool loadingFrame = false;
+    long long frames = 0;
+    FrameTimes loadingFrames;
+    FrameTimes idleFrames;
+
+    long long workFrames = 0;
+    double frameWorkMs = 0.0;
+    long long overBudgetFrames = 0;
+    double workMs = 0.0;
+    double maxWorkMs = 0.0;
+
+    FrameScheduler( )
+    {
+    }
+};
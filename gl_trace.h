@@ -0,0 +1,578 @@
+#pragma once
+
+// Counting layer over the GL entry points the renderer calls every frame: draws, program/vertex array/buffer/texture
+// binds, uniform uploads, uniform location lookups, fixed function state and state queries. Built in only when
+// GL_TRACE is defined (-DGL_TRACE); otherwise this header defines two empty macros and the GL calls are untouched.
+//
+// Each traced entry point is replaced by a wrapper that counts the call under its category, checks it against a
+// shadow of the state set through the wrappers and counts it as redundant when it changes nothing (binding what is
+// bound, uploading the value a uniform already has), then makes the real call. Include after <GL/glew.h> and before
+// the code to trace; the wrappers only see calls compiled after this header. GL_TRACE_END_FRAME closes a frame's
+// counts, GL_TRACE_PRINT prints calls per frame by category. Used from the GL thread only.
+
+#ifdef GL_TRACE
+
+// Std. Includes
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+
+#include <GL/glew.h>
+
+// Frames kept for the statistics and the per frame CSV
+const size_t GL_TRACE_MAX_FRAMES = 36000;
+
+enum GLCallCategory
+{
+    GL_CALL_DRAW,
+    GL_CALL_PROGRAM,
+    GL_CALL_VERTEX_ARRAY,
+    GL_CALL_BUFFER,
+    GL_CALL_TEXTURE,
+    GL_CALL_TEXTURE_UNIT,
+    GL_CALL_UNIFORM,
+    GL_CALL_UNIFORM_LOOKUP,
+    GL_CALL_STATE,
+    GL_CALL_QUERY,
+    GL_CALL_CATEGORIES
+};
+
+const char *const GL_CALL_CATEGORY_NAMES[GL_CALL_CATEGORIES] =
+{
+    "draw", "program", "vertex_array", "buffer", "texture", "texture_unit", "uniform", "uniform_lookup", "state", "query"
+};
+
+class GLTrace
+{
+public:
+    // Per frame counts are written here at exit if set, one CSV row per frame
+    std::string outputPath;
+
+    static GLTrace &Get( )
+    {
+        static GLTrace instance;
+
+        return instance;
+    }
+
+    void Count( GLCallCategory category, bool redundant = false )
+    {
+        current.calls[category]++;
+
+        if ( redundant )
+        {
+            current.redundant[category]++;
+        }
+    }
+
+    // Records value as the state under key and returns whether it was already set to it
+    bool Same( GLenum name, GLuint index, uint64_t value )
+    {
+        uint64_t key = ( uint64_t )name << 32 | index;
+        std::unordered_map<uint64_t, uint64_t>::iterator found = state.find( key );
+
+        if ( found != state.end( ) && found->second == value )
+        {
+            return true;
+        }
+
+        state[key] = value;
+
+        return false;
+    }
+
+    // Same, for binding object to target (and index): remembered as a binding of its category, for Deleted
+    bool SameBinding( GLCallCategory category, GLenum target, GLuint index, GLuint object )
+    {
+        uint64_t key = ( uint64_t )target << 32 | index;
+        std::vector<uint64_t> &keys = bindings[category];
+
+        if ( keys.end( ) == std::find( keys.begin( ), keys.end( ), key ) )
+        {
+            keys.push_back( key );
+        }
+
+        return Same( target, index, object );
+    }
+
+    // Deleted objects are unbound wherever they were bound, so binding a new object that reuses the name isn't
+    // redundant. A deleted vertex array also takes its element array binding along
+    void Deleted( GLCallCategory category, GLsizei count, const GLuint *objects )
+    {
+        for ( GLsizei i = 0; i < count; i++ )
+        {
+            if ( 0 == objects[i] )
+            {
+                continue;
+            }
+
+            for ( uint64_t key : bindings[category] )
+            {
+                std::unordered_map<uint64_t, uint64_t>::iterator found = state.find( key );
+
+                if ( found != state.end( ) && found->second == objects[i] )
+                {
+                    found->second = 0;
+                }
+            }
+
+            if ( GL_CALL_VERTEX_ARRAY == category )
+            {
+                state.erase( ( uint64_t )GL_ELEMENT_ARRAY_BUFFER << 32 | objects[i] );
+            }
+        }
+    }
+
+    GLuint State( GLenum name, GLuint index = 0 ) const
+    {
+        std::unordered_map<uint64_t, uint64_t>::const_iterator found = state.find( ( uint64_t )name << 32 | index );
+
+        return found != state.end( ) ? ( GLuint )found->second : 0;
+    }
+
+    // Records an upload of size bytes to a uniform of the current program and returns whether it held them already.
+    // form tells apart uploads of the same bytes that mean different values (type, transposed matrices)
+    bool SameUniform( GLint location, uint64_t form, const void *data, size_t size )
+    {
+        if ( location < 0 )
+        {
+            return false;
+        }
+
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ull ^ form;
+        const unsigned char *bytes = ( const unsigned char * )data;
+
+        for ( size_t i = 0; i < size; i++ )
+        {
+            hash = ( hash ^ bytes[i] ) * 1099511628211ull;
+        }
+
+        uint64_t key = ( uint64_t )State( GL_CURRENT_PROGRAM ) << 32 | ( uint32_t )location;
+        std::unordered_map<uint64_t, uint64_t>::iterator found = uniforms.find( key );
+
+        if ( found != uniforms.end( ) && found->second == hash )
+        {
+            return true;
+        }
+
+        uniforms[key] = hash;
+
+        return false;
+    }
+
+    // Calls of the frame so far in every category, and how many of them changed nothing
+    unsigned FrameCalls( ) const
+    {
+        unsigned calls = 0;
+
+        for ( int category = 0; category < GL_CALL_CATEGORIES; category++ )
+        {
+            calls += current.calls[category];
+        }
+
+        return calls;
+    }
+
+    unsigned FrameRedundant( ) const
+    {
+        unsigned redundant = 0;
+
+        for ( int category = 0; category < GL_CALL_CATEGORIES; category++ )
+        {
+            redundant += current.redundant[category];
+        }
+
+        return redundant;
+    }
+
+    unsigned FrameDraws( ) const
+    {
+        return current.calls[GL_CALL_DRAW];
+    }
+
+    // Closes the counts of a frame. The first one also holds everything before the render loop
+    void EndFrame( )
+    {
+        if ( frames.size( ) < GL_TRACE_MAX_FRAMES )
+        {
+            frames.push_back( current );
+        }
+
+        current = Frame( );
+    }
+
+    void PrintStats( )
+    {
+        // Skips the loading frame
+        if ( frames.size( ) < 2 )
+        {
+            return;
+        }
+
+        size_t count = frames.size( ) - 1;
+        std::cout << "GL calls per frame over " << count << " frames:" << std::endl;
+
+        for ( int category = 0; category < GL_CALL_CATEGORIES; category++ )
+        {
+            std::vector<unsigned> calls;
+            unsigned long long total = 0, redundant = 0;
+
+            for ( size_t i = 1; i < frames.size( ); i++ )
+            {
+                calls.push_back( frames[i].calls[category] );
+                total += frames[i].calls[category];
+                redundant += frames[i].redundant[category];
+            }
+
+            if ( 0 == total )
+            {
+                continue;
+            }
+
+            std::sort( calls.begin( ), calls.end( ) );
+
+            char line[160];
+            snprintf( line, sizeof( line ), "  %-15s mean %8.1f  min %6u  p50 %6u  p95 %6u  max %6u  redundant %5.1f%%",
+                      GL_CALL_CATEGORY_NAMES[category], ( double )total / count, calls.front( ), calls[count / 2],
+                      calls[std::min( count - 1, count * 95 / 100 )], calls.back( ), 100.0 * redundant / total );
+            std::cout << line << std::endl;
+        }
+    }
+
+    void Write( )
+    {
+        if ( outputPath.empty( ) )
+        {
+            return;
+        }
+
+        std::ofstream file( outputPath );
+
+        if ( !file )
+        {
+            std::cerr << "ERROR: Can't write the GL call counts to " << outputPath << std::endl;
+            return;
+        }
+
+        file << "frame";
+
+        for ( int category = 0; category < GL_CALL_CATEGORIES; category++ )
+        {
+            file << "," << GL_CALL_CATEGORY_NAMES[category] << "," << GL_CALL_CATEGORY_NAMES[category] << "_redundant";
+        }
+
+        file << "\n";
+
+        for ( size_t i = 0; i < frames.size( ); i++ )
+        {
+            file << i;
+
+            for ( int category = 0; category < GL_CALL_CATEGORIES; category++ )
+            {
+                file << "," << frames[i].calls[category] << "," << frames[i].redundant[category];
+            }
+
+            file << "\n";
+        }
+    }
+
+    ~GLTrace( )
+    {
+        Write( );
+    }
+
+private:
+    struct Frame
+    {
+        unsigned calls[GL_CALL_CATEGORIES] = { };
+        unsigned redundant[GL_CALL_CATEGORIES] = { };
+    };
+
+    Frame current;
+    std::vector<Frame> frames;
+
+    // Shadow of the state set through the wrappers, by GL name and index (texture unit, vertex array)
+    std::unordered_map<uint64_t, uint64_t> state;
+
+    // Keys of the state above that hold bindings, by category
+    std::vector<uint64_t> bindings[GL_CALL_CATEGORIES];
+
+    // Hash of the last value uploaded, by program and location
+    std::unordered_map<uint64_t, uint64_t> uniforms;
+
+    GLTrace( )
+    {
+    }
+};
+
+// The wrappers call the real entry points, which are still the GLEW definitions here
+
+inline void GLTraceDrawArrays( GLenum mode, GLint first, GLsizei count )
+{
+    GLTrace::Get( ).Count( GL_CALL_DRAW );
+    glDrawArrays( mode, first, count );
+}
+
+inline void GLTraceDrawElements( GLenum mode, GLsizei count, GLenum type, const void *indices )
+{
+    GLTrace::Get( ).Count( GL_CALL_DRAW );
+    glDrawElements( mode, count, type, indices );
+}
+
+inline void GLTraceMultiDrawArrays( GLenum mode, const GLint *first, const GLsizei *count, GLsizei drawCount )
+{
+    GLTrace::Get( ).Count( GL_CALL_DRAW );
+    glMultiDrawArrays( mode, first, count, drawCount );
+}
+
+inline void GLTraceUseProgram( GLuint program )
+{
+    GLTrace::Get( ).Count( GL_CALL_PROGRAM, GLTrace::Get( ).Same( GL_CURRENT_PROGRAM, 0, program ) );
+    glUseProgram( program );
+}
+
+inline void GLTraceBindVertexArray( GLuint array )
+{
+    GLTrace::Get( ).Count( GL_CALL_VERTEX_ARRAY, GLTrace::Get( ).SameBinding( GL_CALL_VERTEX_ARRAY, GL_VERTEX_ARRAY_BINDING, 0, array ) );
+    glBindVertexArray( array );
+}
+
+inline void GLTraceBindBuffer( GLenum target, GLuint buffer )
+{
+    // The element array binding belongs to the bound vertex array
+    GLuint index = GL_ELEMENT_ARRAY_BUFFER == target ? GLTrace::Get( ).State( GL_VERTEX_ARRAY_BINDING ) : 0;
+    GLTrace::Get( ).Count( GL_CALL_BUFFER, GLTrace::Get( ).SameBinding( GL_CALL_BUFFER, target, index, buffer ) );
+    glBindBuffer( target, buffer );
+}
+
+// Deletes aren't counted, they only keep the shadow state right
+inline void GLTraceDeleteVertexArrays( GLsizei n, const GLuint *arrays )
+{
+    GLTrace::Get( ).Deleted( GL_CALL_VERTEX_ARRAY, n, arrays );
+    glDeleteVertexArrays( n, arrays );
+}
+
+inline void GLTraceDeleteBuffers( GLsizei n, const GLuint *buffers )
+{
+    GLTrace::Get( ).Deleted( GL_CALL_BUFFER, n, buffers );
+    glDeleteBuffers( n, buffers );
+}
+
+inline void GLTraceDeleteTextures( GLsizei n, const GLuint *textures )
+{
+    GLTrace::Get( ).Deleted( GL_CALL_TEXTURE, n, textures );
+    glDeleteTextures( n, textures );
+}
+
+inline void GLTraceActiveTexture( GLenum texture )
+{
+    GLTrace::Get( ).Count( GL_CALL_TEXTURE_UNIT, GLTrace::Get( ).Same( GL_ACTIVE_TEXTURE, 0, texture - GL_TEXTURE0 ) );
+    glActiveTexture( texture );
+}
+
+inline void GLTraceBindTexture( GLenum target, GLuint texture )
+{
+    GLTrace::Get( ).Count( GL_CALL_TEXTURE, GLTrace::Get( ).SameBinding( GL_CALL_TEXTURE, target, GLTrace::Get( ).State( GL_ACTIVE_TEXTURE ), texture ) );
+    glBindTexture( target, texture );
+}
+
+inline GLint GLTraceGetUniformLocation( GLuint program, const GLchar *name )
+{
+    GLTrace::Get( ).Count( GL_CALL_UNIFORM_LOOKUP );
+
+    return glGetUniformLocation( program, name );
+}
+
+inline void GLTraceUniform1i( GLint location, GLint v0 )
+{
+    GLTrace::Get( ).Count( GL_CALL_UNIFORM, GLTrace::Get( ).SameUniform( location, GL_INT, &v0, sizeof( v0 ) ) );
+    glUniform1i( location, v0 );
+}
+
+inline void GLTraceUniform1f( GLint location, GLfloat v0 )
+{
+    GLTrace::Get( ).Count( GL_CALL_UNIFORM, GLTrace::Get( ).SameUniform( location, GL_FLOAT, &v0, sizeof( v0 ) ) );
+    glUniform1f( location, v0 );
+}
+
+inline void GLTraceUniform2f( GLint location, GLfloat v0, GLfloat v1 )
+{
+    GLfloat value[2] = { v0, v1 };
+    GLTrace::Get( ).Count( GL_CALL_UNIFORM, GLTrace::Get( ).SameUniform( location, GL_FLOAT_VEC2, value, sizeof( value ) ) );
+    glUniform2f( location, v0, v1 );
+}
+
+inline void GLTraceUniform3f( GLint location, GLfloat v0, GLfloat v1, GLfloat v2 )
+{
+    GLfloat value[3] = { v0, v1, v2 };
+    GLTrace::Get( ).Count( GL_CALL_UNIFORM, GLTrace::Get( ).SameUniform( location, GL_FLOAT_VEC3, value, sizeof( value ) ) );
+    glUniform3f( location, v0, v1, v2 );
+}
+
+inline void GLTraceUniform4f( GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3 )
+{
+    GLfloat value[4] = { v0, v1, v2, v3 };
+    GLTrace::Get( ).Count( GL_CALL_UNIFORM, GLTrace::Get( ).SameUniform( location, GL_FLOAT_VEC4, value, sizeof( value ) ) );
+    glUniform4f( location, v0, v1, v2, v3 );
+}
+
+inline void GLTraceUniform2fv( GLint location, GLsizei count, const GLfloat *value )
+{
+    GLTrace::Get( ).Count( GL_CALL_UNIFORM, GLTrace::Get( ).SameUniform( location, GL_FLOAT_VEC2, value, count * 2 * sizeof( GLfloat ) ) );
+    glUniform2fv( location, count, value );
+}
+
+inline void GLTraceUniform3fv( GLint location, GLsizei count, const GLfloat *value )
+{
+    GLTrace::Get( ).Count( GL_CALL_UNIFORM, GLTrace::Get( ).SameUniform( location, GL_FLOAT_VEC3, value, count * 3 * sizeof( GLfloat ) ) );
+    glUniform3fv( location, count, value );
+}
+
+inline void GLTraceUniform4fv( GLint location, GLsizei count, const GLfloat *value )
+{
+    GLTrace::Get( ).Count( GL_CALL_UNIFORM, GLTrace::Get( ).SameUniform( location, GL_FLOAT_VEC4, value, count * 4 * sizeof( GLfloat ) ) );
+    glUniform4fv( location, count, value );
+}
+
+inline void GLTraceUniformMatrix2fv( GLint location, GLsizei count, GLboolean transpose, const GLfloat *value )
+{
+    uint64_t form = ( uint64_t )transpose << 32 | GL_FLOAT_MAT2;
+    GLTrace::Get( ).Count( GL_CALL_UNIFORM, GLTrace::Get( ).SameUniform( location, form, value, count * 4 * sizeof( GLfloat ) ) );
+    glUniformMatrix2fv( location, count, transpose, value );
+}
+
+inline void GLTraceUniformMatrix3fv( GLint location, GLsizei count, GLboolean transpose, const GLfloat *value )
+{
+    uint64_t form = ( uint64_t )transpose << 32 | GL_FLOAT_MAT3;
+    GLTrace::Get( ).Count( GL_CALL_UNIFORM, GLTrace::Get( ).SameUniform( location, form, value, count * 9 * sizeof( GLfloat ) ) );
+    glUniformMatrix3fv( location, count, transpose, value );
+}
+
+inline void GLTraceUniformMatrix4fv( GLint location, GLsizei count, GLboolean transpose, const GLfloat *value )
+{
+    uint64_t form = ( uint64_t )transpose << 32 | GL_FLOAT_MAT4;
+    GLTrace::Get( ).Count( GL_CALL_UNIFORM, GLTrace::Get( ).SameUniform( location, form, value, count * 16 * sizeof( GLfloat ) ) );
+    glUniformMatrix4fv( location, count, transpose, value );
+}
+
+inline void GLTraceEnable( GLenum cap )
+{
+    GLTrace::Get( ).Count( GL_CALL_STATE, GLTrace::Get( ).Same( cap, 0, GL_TRUE ) );
+    glEnable( cap );
+}
+
+inline void GLTraceDisable( GLenum cap )
+{
+    GLTrace::Get( ).Count( GL_CALL_STATE, GLTrace::Get( ).Same( cap, 0, GL_FALSE ) );
+    glDisable( cap );
+}
+
+inline void GLTraceDepthFunc( GLenum func )
+{
+    GLTrace::Get( ).Count( GL_CALL_STATE, GLTrace::Get( ).Same( GL_DEPTH_FUNC, 0, func ) );
+    glDepthFunc( func );
+}
+
+inline void GLTraceDepthMask( GLboolean flag )
+{
+    GLTrace::Get( ).Count( GL_CALL_STATE, GLTrace::Get( ).Same( GL_DEPTH_WRITEMASK, 0, flag ) );
+    glDepthMask( flag );
+}
+
+inline void GLTraceBlendFunc( GLenum sfactor, GLenum dfactor )
+{
+    GLTrace::Get( ).Count( GL_CALL_STATE, GLTrace::Get( ).Same( GL_BLEND_SRC, 0, ( uint64_t )sfactor << 32 | dfactor ) );
+    glBlendFunc( sfactor, dfactor );
+}
+
+// Queries that may have to wait for the driver to catch up
+inline void GLTraceGetIntegerv( GLenum pname, GLint *data )
+{
+    GLTrace::Get( ).Count( GL_CALL_QUERY );
+    glGetIntegerv( pname, data );
+}
+
+inline GLboolean GLTraceIsEnabled( GLenum cap )
+{
+    GLTrace::Get( ).Count( GL_CALL_QUERY );
+
+    return glIsEnabled( cap );
+}
+
+#undef glDrawArrays
+#undef glDrawElements
+#undef glMultiDrawArrays
+#undef glUseProgram
+#undef glBindVertexArray
+#undef glBindBuffer
+#undef glDeleteVertexArrays
+#undef glDeleteBuffers
+#undef glDeleteTextures
+#undef glActiveTexture
+#undef glBindTexture
+#undef glGetUniformLocation
+#undef glUniform1i
+#undef glUniform1f
+#undef glUniform2f
+#undef glUniform3f
+#undef glUniform4f
+#undef glUniform2fv
+#undef glUniform3fv
+#undef glUniform4fv
+#undef glUniformMatrix2fv
+#undef glUniformMatrix3fv
+#undef glUniformMatrix4fv
+#undef glEnable
+#undef glDisable
+#undef glDepthFunc
+#undef glDepthMask
+#undef glBlendFunc
+#undef glGetIntegerv
+#undef glIsEnabled
+
+#define glDrawArrays GLTraceDrawArrays
+#define glDrawElements GLTraceDrawElements
+#define glMultiDrawArrays GLTraceMultiDrawArrays
+#define glUseProgram GLTraceUseProgram
+#define glBindVertexArray GLTraceBindVertexArray
+#define glBindBuffer GLTraceBindBuffer
+#define glDeleteVertexArrays GLTraceDeleteVertexArrays
+#define glDeleteBuffers GLTraceDeleteBuffers
+#define glDeleteTextures GLTraceDeleteTextures
+#define glActiveTexture GLTraceActiveTexture
+#define glBindTexture GLTraceBindTexture
+#define glGetUniformLocation GLTraceGetUniformLocation
+#define glUniform1i GLTraceUniform1i
+#define glUniform1f GLTraceUniform1f
+#define glUniform2f GLTraceUniform2f
+#define glUniform3f GLTraceUniform3f
+#define glUniform4f GLTraceUniform4f
+#define glUniform2fv GLTraceUniform2fv
+#define glUniform3fv GLTraceUniform3fv
+#define glUniform4fv GLTraceUniform4fv
+#define glUniformMatrix2fv GLTraceUniformMatrix2fv
+#define glUniformMatrix3fv GLTraceUniformMatrix3fv
+#define glUniformMatrix4fv GLTraceUniformMatrix4fv
+#define glEnable GLTraceEnable
+#define glDisable GLTraceDisable
+#define glDepthFunc GLTraceDepthFunc
+#define glDepthMask GLTraceDepthMask
+#define glBlendFunc GLTraceBlendFunc
+#define glGetIntegerv GLTraceGetIntegerv
+#define glIsEnabled GLTraceIsEnabled
+
+#define GL_TRACE_END_FRAME( ) GLTrace::Get( ).EndFrame( )
+#define GL_TRACE_PRINT( ) GLTrace::Get( ).PrintStats( )
+
+#else
+
+#define GL_TRACE_END_FRAME( )
+#define GL_TRACE_PRINT( )
+
+#endif
@@ -0,0 +1,454 @@
+#pragma once
+
+// Std. Includes
+#include <mutex>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+
+#include <GL/glew.h>
+
+#include "stb_image.h"
+#include "block_compression.h"
+#include "job_system.h"
+
+// Camera poses captured along the benchmark's path, in the middle of each equal stretch of it
+const int GOLDEN_IMAGE_POSES = 4;
+
+// Readbacks in flight at once. Capturing while all of them are waits for the oldest
+const int GOLDEN_IMAGE_READBACKS = 3;
+
+// Default tolerances: an image matches its golden one when both the PSNR and the mean SSIM are at least these
+const double GOLDEN_IMAGE_MIN_PSNR = 40.0;
+const double GOLDEN_IMAGE_MIN_SSIM = 0.98;
+
+// Side of the square luma windows SSIM is computed over
+const int GOLDEN_IMAGE_SSIM_WINDOW = 8;
+
+// Golden image check (--golden): frames drawn at fixed camera poses are read back and compared with stored images, so
+// a render path change that alters the picture shows up next to its timings. The readback goes into pixel pack buffers
+// with a fence and is only mapped once the GPU is done, a frame or more later, so capturing doesn't stall the frame;
+// the comparison (PSNR over RGB, and mean SSIM over luma for structure the PSNR averages away) runs on the job system.
+// An image without a golden one becomes it. One that doesn't match is written next to it with _actual and a _diff
+// image (differences times 4). Golden images are RLE TGA files, top row first. Used from the GL thread only.
+class GoldenImages
+{
+public:
+    static inline bool enabled = false;
+
+    std::string directory = "golden";
+    double minPsnr = GOLDEN_IMAGE_MIN_PSNR;
+    double minSsim = GOLDEN_IMAGE_MIN_SSIM;
+
+    // Replace the golden images with this run's
+    bool update = false;
+
+    // What came of one image
+    struct Outcome
+    {
+        std::string name;
+        std::string status; // "match", "mismatch", "recorded" or "error"
+        double psnr = 0.0;
+        double ssim = 0.0;
+    };
+
+    static GoldenImages &Get( )
+    {
+        static GoldenImages instance;
+
+        return instance;
+    }
+
+    // Starts reading back the colour of framebuffer as image name, without waiting for it. Call once the frame is drawn
+    void Capture( const std::string &name, GLuint framebuffer, int width, int height )
+    {
+        Readback &slot = slots[next];
+        next = ( next + 1 ) % GOLDEN_IMAGE_READBACKS;
+
+        if ( slot.pending )
+        {
+            Collect( slot, true );
+        }
+
+        size_t size = ( size_t )width * height * 4;
+        GLint previousFramebuffer, previousAlignment;
+        glGetIntegerv( GL_READ_FRAMEBUFFER_BINDING, &previousFramebuffer );
+        glGetIntegerv( GL_PACK_ALIGNMENT, &previousAlignment );
+
+        if ( 0 == slot.buffer )
+        {
+            glGenBuffers( 1, &slot.buffer );
+        }
+
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, slot.buffer );
+
+        if ( slot.size != size )
+        {
+            glBufferData( GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ );
+            slot.size = size;
+        }
+
+        glBindFramebuffer( GL_READ_FRAMEBUFFER, framebuffer );
+        glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+        glReadPixels( 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, ( GLvoid * )0 );
+        slot.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+
+        glPixelStorei( GL_PACK_ALIGNMENT, previousAlignment );
+        glBindFramebuffer( GL_READ_FRAMEBUFFER, previousFramebuffer );
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+
+        slot.name = name;
+        slot.width = width;
+        slot.height = height;
+        slot.pending = true;
+    }
+
+    // Hands the readbacks the GPU has finished to the comparison, without waiting for the others
+    void Update( )
+    {
+        for ( Readback &slot : slots )
+        {
+            if ( slot.pending && GL_TIMEOUT_EXPIRED != glClientWaitSync( slot.fence, 0, 0 ) )
+            {
+                Collect( slot, false );
+            }
+        }
+    }
+
+    // Waits for every readback and comparison. For the end of a run
+    void Finish( )
+    {
+        for ( Readback &slot : slots )
+        {
+            if ( slot.pending )
+            {
+                Collect( slot, true );
+            }
+        }
+
+        JobSystem::Get( ).Wait( comparing );
+    }
+
+    std::vector<Outcome> Outcomes( )
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+
+        return outcomes;
+    }
+
+    // Images that didn't match, or couldn't be compared
+    int Failures( )
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+
+        return ( int )std::count_if( outcomes.begin( ), outcomes.end( ), []( const Outcome &outcome )
+        {
+            return "mismatch" == outcome.status || "error" == outcome.status;
+        } );
+    }
+
+    void PrintStats( )
+    {
+        std::vector<Outcome> results = Outcomes( );
+
+        if ( results.empty( ) )
+        {
+            return;
+        }
+
+        std::cout << "Golden images in " << directory << " (PSNR >= " << minPsnr << " dB, SSIM >= " << minSsim << "):" << std::endl;
+
+        for ( const Outcome &outcome : results )
+        {
+            std::cout << "  " << outcome.name << ": " << outcome.status;
+
+            if ( "match" == outcome.status || "mismatch" == outcome.status )
+            {
+                std::cout << ", PSNR " << outcome.psnr << " dB, SSIM " << outcome.ssim;
+            }
+
+            std::cout << std::endl;
+        }
+    }
+
+    // Every image's outcome as a JSON object
+    std::string Json( )
+    {
+        std::vector<Outcome> results = Outcomes( );
+        std::ostringstream out;
+        out << std::fixed << std::setprecision( 4 ) << "{ \"min_psnr_db\": " << minPsnr << ", \"min_ssim\": " << minSsim << ", \"images\": {";
+
+        for ( size_t i = 0; i < results.size( ); i++ )
+        {
+            out << ( i > 0 ? ", " : " " ) << "\"" << results[i].name << "\": { \"status\": \"" << results[i].status << "\", \"psnr_db\": "
+                << results[i].psnr << ", \"ssim\": " << results[i].ssim << " }";
+        }
+
+        out << ( results.empty( ) ? "" : " " ) << "} }";
+
+        return out.str( );
+    }
+
+private:
+    struct Readback
+    {
+        GLuint buffer = 0;
+        size_t size = 0;
+        GLsync fence = nullptr;
+        std::string name;
+        int width = 0;
+        int height = 0;
+        bool pending = false;
+    };
+
+    Readback slots[GOLDEN_IMAGE_READBACKS];
+    int next = 0;
+
+    std::mutex mutex;
+    std::vector<Outcome> outcomes;
+    JobSystem::Counter comparing;
+
+    // The job system must outlive the comparisons
+    GoldenImages( )
+    {
+        JobSystem::Get( );
+    }
+
+    ~GoldenImages( )
+    {
+        JobSystem::Get( ).Wait( comparing );
+    }
+
+    // Copies a finished readback out as RGB, top row first, and compares it in the background
+    void Collect( Readback &slot, bool wait )
+    {
+        if ( wait )
+        {
+            while ( GL_TIMEOUT_EXPIRED == glClientWaitSync( slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 ) )
+            {
+            }
+        }
+
+        glDeleteSync( slot.fence );
+        slot.fence = nullptr;
+        slot.pending = false;
+
+        std::shared_ptr<std::vector<unsigned char>> pixels = std::make_shared<std::vector<unsigned char>>( ( size_t )slot.width * slot.height * 3 );
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, slot.buffer );
+        const unsigned char *mapped = ( const unsigned char * )glMapBufferRange( GL_PIXEL_PACK_BUFFER, 0, slot.size, GL_MAP_READ_BIT );
+
+        if ( mapped )
+        {
+            // GL's rows start at the bottom
+            for ( int y = 0; y < slot.height; y++ )
+            {
+                const unsigned char *src = mapped + ( size_t )( slot.height - 1 - y ) * slot.width * 4;
+                unsigned char *dst = pixels->data( ) + ( size_t )y * slot.width * 3;
+
+                for ( int x = 0; x < slot.width; x++ )
+                {
+                    dst[3 * x + 0] = src[4 * x + 0];
+                    dst[3 * x + 1] = src[4 * x + 1];
+                    dst[3 * x + 2] = src[4 * x + 2];
+                }
+            }
+
+            glUnmapBuffer( GL_PIXEL_PACK_BUFFER );
+        }
+
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+
+        if ( !mapped )
+        {
+            std::cerr << "ERROR: Can't map the readback of golden image " << slot.name << std::endl;
+            Record( { slot.name, "error" } );
+            return;
+        }
+
+        std::string name = slot.name;
+        int width = slot.width, height = slot.height;
+        JobSystem::Get( ).Submit( [this, name, width, height, pixels]( ) { Compare( name, width, height, *pixels ); }, comparing );
+    }
+
+    void Record( const Outcome &outcome )
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        outcomes.push_back( outcome );
+    }
+
+    void Compare( const std::string &name, int width, int height, const std::vector<unsigned char> &pixels )
+    {
+        std::string path = directory + "/" + name + ".tga";
+        std::error_code error;
+        std::filesystem::create_directories( directory, error );
+
+        Outcome outcome;
+        outcome.name = name;
+
+        int goldenWidth = 0, goldenHeight = 0, goldenChannels = 0;
+        unsigned char *golden = update ? nullptr : stbi_load( path.c_str( ), &goldenWidth, &goldenHeight, &goldenChannels, 3 );
+
+        if ( nullptr == golden )
+        {
+            outcome.status = WriteTga( path, width, height, pixels.data( ) ) ? "recorded" : "error";
+            Record( outcome );
+            return;
+        }
+
+        if ( goldenWidth != width || goldenHeight != height )
+        {
+            std::cerr << "ERROR: Golden image " << path << " is " << goldenWidth << "x" << goldenHeight << ", the frame " << width << "x" << height << std::endl;
+            stbi_image_free( golden );
+            outcome.status = "error";
+            Record( outcome );
+            return;
+        }
+
+        outcome.psnr = BlockCompressor::Psnr( golden, pixels.data( ), pixels.size( ) );
+        outcome.ssim = Ssim( golden, pixels.data( ), width, height );
+        outcome.status = outcome.psnr >= minPsnr && outcome.ssim >= minSsim ? "match" : "mismatch";
+
+        if ( "mismatch" == outcome.status )
+        {
+            std::vector<unsigned char> difference( pixels.size( ) );
+
+            for ( size_t i = 0; i < pixels.size( ); i++ )
+            {
+                difference[i] = ( unsigned char )std::min( 255, 4 * std::abs( ( int )golden[i] - ( int )pixels[i] ) );
+            }
+
+            WriteTga( directory + "/" + name + "_actual.tga", width, height, pixels.data( ) );
+            WriteTga( directory + "/" + name + "_diff.tga", width, height, difference.data( ) );
+            std::cerr << "ERROR: Frame " << name << " differs from " << path << ": PSNR " << outcome.psnr << " dB, SSIM " << outcome.ssim << std::endl;
+        }
+
+        stbi_image_free( golden );
+        Record( outcome );
+    }
+
+    // Mean SSIM of the luma over square windows, each compared on its own (1 for identical images)
+    static double Ssim( const unsigned char *a, const unsigned char *b, int width, int height )
+    {
+        const double c1 = ( 0.01 * 255.0 ) * ( 0.01 * 255.0 );
+        const double c2 = ( 0.03 * 255.0 ) * ( 0.03 * 255.0 );
+        const int window = GOLDEN_IMAGE_SSIM_WINDOW;
+        double sum = 0.0;
+        int windows = 0;
+
+        for ( int y0 = 0; y0 + window <= height; y0 += window )
+        {
+            for ( int x0 = 0; x0 + window <= width; x0 += window )
+            {
+                double meanA = 0.0, meanB = 0.0, squaresA = 0.0, squaresB = 0.0, products = 0.0;
+
+                for ( int y = y0; y < y0 + window; y++ )
+                {
+                    for ( int x = x0; x < x0 + window; x++ )
+                    {
+                        size_t i = 3 * ( ( size_t )y * width + x );
+                        double lumaA = 0.299 * a[i] + 0.587 * a[i + 1] + 0.114 * a[i + 2];
+                        double lumaB = 0.299 * b[i] + 0.587 * b[i + 1] + 0.114 * b[i + 2];
+                        meanA += lumaA;
+                        meanB += lumaB;
+                        squaresA += lumaA * lumaA;
+                        squaresB += lumaB * lumaB;
+                        products += lumaA * lumaB;
+                    }
+                }
+
+                double n = window * window;
+                meanA /= n;
+                meanB /= n;
+                double varianceA = squaresA / n - meanA * meanA;
+                double varianceB = squaresB / n - meanB * meanB;
+                double covariance = products / n - meanA * meanB;
+
+                sum += ( 2.0 * meanA * meanB + c1 ) * ( 2.0 * covariance + c2 ) / ( ( meanA * meanA + meanB * meanB + c1 ) * ( varianceA + varianceB + c2 ) );
+                windows++;
+            }
+        }
+
+        return windows > 0 ? sum / windows : 1.0;
+    }
+
+    // Run length encoded 24 bit TGA of RGB pixels, top row first. The scene is mostly black, so runs are long
+    static bool WriteTga( const std::string &path, int width, int height, const unsigned char *pixels )
+    {
+        std::ofstream file( path, std::ios::binary );
+
+        if ( !file )
+        {
+            std::cerr << "ERROR: Can't write golden image " << path << std::endl;
+            return false;
+        }
+
+        // RLE true colour, 24 bits, origin at the top left
+        unsigned char header[18] = { 0, 0, 10 };
+        header[12] = ( unsigned char )( width & 0xFF );
+        header[13] = ( unsigned char )( width >> 8 );
+        header[14] = ( unsigned char )( height & 0xFF );
+        header[15] = ( unsigned char )( height >> 8 );
+        header[16] = 24;
+        header[17] = 0x20;
+        file.write( ( const char * )header, sizeof( header ) );
+
+        std::vector<unsigned char> packets;
+        packets.reserve( ( size_t )width * 4 );
+
+        // Packets never cross rows
+        for ( int y = 0; y < height; y++ )
+        {
+            const unsigned char *row = pixels + ( size_t )y * width * 3;
+            packets.clear( );
+            int x = 0;
+
+            while ( x < width )
+            {
+                int run = 1;
+
+                while ( x + run < width && run < 128 && 0 == memcmp( row + 3 * x, row + 3 * ( x + run ), 3 ) )
+                {
+                    run++;
+                }
+
+                if ( run > 1 )
+                {
+                    packets.push_back( ( unsigned char )( 0x80 | ( run - 1 ) ) );
+                    packets.insert( packets.end( ), { row[3 * x + 2], row[3 * x + 1], row[3 * x] } );
+                    x += run;
+                    continue;
+                }
+
+                // Raw packet up to the next run of two equal pixels
+                int count = 1;
+
+                while ( x + count < width && count < 128 && ( x + count + 1 >= width || 0 != memcmp( row + 3 * ( x + count ), row + 3 * ( x + count + 1 ), 3 ) ) )
+                {
+                    count++;
+                }
+
+                packets.push_back( ( unsigned char )( count - 1 ) );
+
+                for ( int i = x; i < x + count; i++ )
+                {
+                    packets.insert( packets.end( ), { row[3 * i + 2], row[3 * i + 1], row[3 * i] } );
+                }
+
+                x += count;
+            }
+
+            file.write( ( const char * )packets.data( ), packets.size( ) );
+        }
+
+        return ( bool )file;
+    }
+};
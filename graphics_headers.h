@@ -24,4 +24,7 @@
 
 #define INVALID_UNIFORM_LOCATION 0x7fffffff
 
+// GL call counters, in -DGL_TRACE builds only
+#include "gl_trace.h"
+
 #endif /* GRAPHICS_HEADERS_H */
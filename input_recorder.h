@@ -0,0 +1,354 @@
+#pragma once
+
+// Std. Includes
+#include <thread>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "mapped_file.h"
+
+// Identifies the file and its layout
+const char INPUT_RECORDING_MAGIC[4] = { 'S', 'S', 'I', 'R' };
+const uint32_t INPUT_RECORDING_VERSION = 1;
+
+// Record types: a frame starts, with the frame time the loop used; a key event; a cursor position
+enum InputRecordType : uint8_t
+{
+    INPUT_RECORD_FRAME = 0,
+    INPUT_RECORD_KEY = 1,
+    INPUT_RECORD_CURSOR = 2
+};
+
+// Records an interactive session (--record) and plays it back (--replay): the time every frame started at, as the
+// render loop saw it, followed by the key and cursor events delivered during that frame. Replaying hands each frame
+// its recorded time and events in the same order, so the camera moves the same way and, with the simulation stepped
+// by the frame time on the render thread in both cases, the simulation takes the same steps. Playback goes at the
+// recorded pace or as fast as frames can be drawn; the frame times are the recorded ones either way. What drew on
+// which frame can still differ where loading depends on real time (the frame scheduler), and the session has to be
+// replayed with the options it was recorded with.
+//
+// The file is a magic number and version, then one type byte per record followed by its fields in the machine's own
+// byte order: the frame time as a float, a key as two int16 and two bytes, a cursor position as two doubles. Used from
+// the GL thread only.
+class InputRecorder
+{
+public:
+    static InputRecorder &Get( )
+    {
+        static InputRecorder instance;
+
+        return instance;
+    }
+
+    bool Record( const std::string &path )
+    {
+        file.open( path, std::ios::binary | std::ios::trunc );
+
+        if ( !file )
+        {
+            std::cerr << "ERROR: Can't write the input recording " << path << std::endl;
+            return false;
+        }
+
+        file.write( INPUT_RECORDING_MAGIC, sizeof( INPUT_RECORDING_MAGIC ) );
+        Put( INPUT_RECORDING_VERSION );
+        recordPath = path;
+        recording = true;
+
+        return true;
+    }
+
+    // Loads the whole recording. realTime keeps to the recorded frame times, otherwise frames follow each other at once
+    bool Replay( const std::string &path, bool realTime )
+    {
+        MappedFile source( path );
+        const unsigned char *data = source.Data( );
+        size_t size = source.Size( );
+        uint32_t version = 0;
+
+        if ( !source.IsOpen( ) || size < sizeof( INPUT_RECORDING_MAGIC ) + sizeof( version ) || 0 != memcmp( data, INPUT_RECORDING_MAGIC, sizeof( INPUT_RECORDING_MAGIC ) ) )
+        {
+            std::cerr << "ERROR: Not an input recording: " << path << std::endl;
+            return false;
+        }
+
+        memcpy( &version, data + sizeof( INPUT_RECORDING_MAGIC ), sizeof( version ) );
+
+        if ( INPUT_RECORDING_VERSION != version )
+        {
+            std::cerr << "ERROR: Input recording " << path << " is version " << version << ", not " << INPUT_RECORDING_VERSION << std::endl;
+            return false;
+        }
+
+        size_t offset = sizeof( INPUT_RECORDING_MAGIC ) + sizeof( version );
+        events.clear( );
+        frames = 0;
+
+        while ( offset < size )
+        {
+            Event event;
+            event.type = data[offset++];
+            bool complete = true;
+
+            switch ( event.type )
+            {
+            case INPUT_RECORD_FRAME:
+                complete = Get( data, size, offset, event.time );
+                break;
+
+            case INPUT_RECORD_KEY:
+                complete = Get( data, size, offset, event.key ) && Get( data, size, offset, event.scancode ) && Get( data, size, offset, event.action )
+                        && Get( data, size, offset, event.mods );
+                break;
+
+            case INPUT_RECORD_CURSOR:
+                complete = Get( data, size, offset, event.x ) && Get( data, size, offset, event.y );
+                break;
+
+            default:
+                std::cerr << "ERROR: Unknown record " << ( int )event.type << " in input recording " << path << std::endl;
+                return false;
+            }
+
+            // A session that ended without closing the file cleanly is played up to its last whole record
+            if ( !complete )
+            {
+                break;
+            }
+
+            frames += INPUT_RECORD_FRAME == event.type ? 1 : 0;
+            events.push_back( event );
+        }
+
+        position = 0;
+        replaying = true;
+        this->realTime = realTime;
+
+        std::cout << "Replaying " << path << ": " << frames << " frames, " << events.size( ) - frames << " input events"
+                  << ", " << LastFrameTime( ) - FirstFrameTime( ) << " s" << std::endl;
+
+        return true;
+    }
+
+    // Recording or replaying: the frame loop steps the simulation itself
+    bool Active( ) const
+    {
+        return recording || replaying;
+    }
+
+    bool Replaying( ) const
+    {
+        return replaying;
+    }
+
+    // A replay whose frames have all been played
+    bool Finished( ) const
+    {
+        return replaying && position >= events.size( );
+    }
+
+    long long FrameCount( ) const
+    {
+        return frames;
+    }
+
+    // At the start of a frame, with the time the loop would use. Recording keeps it and returns it; replaying returns
+    // the recorded one instead, after waiting for it in real time
+    double BeginFrame( double now )
+    {
+        if ( recording )
+        {
+            uint8_t type = INPUT_RECORD_FRAME;
+            float time = ( float )now;
+            Put( type );
+            Put( time );
+            recordedFrames++;
+
+            return time;
+        }
+
+        if ( !replaying || Finished( ) )
+        {
+            return now;
+        }
+
+        double time = events[position++].time;
+
+        if ( realTime )
+        {
+            if ( 0 == playedFrames )
+            {
+                playStart = Clock::now( );
+            }
+
+            std::chrono::duration<double> due( time - FirstFrameTime( ) );
+            std::this_thread::sleep_until( playStart + std::chrono::duration_cast<Clock::duration>( due ) );
+        }
+
+        playedFrames++;
+
+        return time;
+    }
+
+    // Replaying: delivers this frame's recorded events, in order, to onKey( key, scancode, action, mods ) and
+    // onCursor( x, y )
+    template <typename KeyHandler, typename CursorHandler>
+    void Dispatch( KeyHandler onKey, CursorHandler onCursor )
+    {
+        dispatching = true;
+
+        while ( replaying && position < events.size( ) && INPUT_RECORD_FRAME != events[position].type )
+        {
+            const Event &event = events[position++];
+
+            if ( INPUT_RECORD_KEY == event.type )
+            {
+                onKey( event.key, event.scancode, event.action, event.mods );
+            }
+            else
+            {
+                onCursor( event.x, event.y );
+            }
+        }
+
+        dispatching = false;
+    }
+
+    // From the key callback: records the event, and returns whether to act on it. Live input is ignored in a replay
+    bool Key( int key, int scancode, int action, int mods )
+    {
+        if ( replaying )
+        {
+            return dispatching;
+        }
+
+        if ( recording )
+        {
+            Put( ( uint8_t )INPUT_RECORD_KEY );
+            Put( ( int16_t )key );
+            Put( ( int16_t )scancode );
+            Put( ( uint8_t )action );
+            Put( ( uint8_t )mods );
+            recordedEvents++;
+        }
+
+        return true;
+    }
+
+    bool Cursor( double x, double y )
+    {
+        if ( replaying )
+        {
+            return dispatching;
+        }
+
+        if ( recording )
+        {
+            Put( ( uint8_t )INPUT_RECORD_CURSOR );
+            Put( x );
+            Put( y );
+            recordedEvents++;
+        }
+
+        return true;
+    }
+
+    // Closes the recording. For the end of a run
+    void Finish( )
+    {
+        if ( file.is_open( ) )
+        {
+            file.close( );
+        }
+    }
+
+    void PrintStats( )
+    {
+        if ( recordedFrames > 0 )
+        {
+            std::cout << "Input recording: " << recordedFrames << " frames, " << recordedEvents << " input events written to " << recordPath << std::endl;
+        }
+
+        if ( replaying )
+        {
+            std::cout << "Input replay: " << playedFrames << " of " << frames << " frames played" << std::endl;
+        }
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Event
+    {
+        uint8_t type = INPUT_RECORD_FRAME;
+        float time = 0.0f;
+        int16_t key = 0;
+        int16_t scancode = 0;
+        uint8_t action = 0;
+        uint8_t mods = 0;
+        double x = 0.0;
+        double y = 0.0;
+    };
+
+    std::ofstream file;
+    std::string recordPath;
+    bool recording = false;
+    long long recordedFrames = 0;
+    long long recordedEvents = 0;
+
+    std::vector<Event> events;
+    size_t position = 0;
+    long long frames = 0;
+    long long playedFrames = 0;
+    bool replaying = false;
+    bool realTime = true;
+    bool dispatching = false;
+    Clock::time_point playStart;
+
+    InputRecorder( )
+    {
+    }
+
+    template <typename T>
+    void Put( const T &value )
+    {
+        file.write( ( const char * )&value, sizeof( value ) );
+    }
+
+    template <typename T>
+    static bool Get( const unsigned char *data, size_t size, size_t &offset, T &value )
+    {
+        if ( offset + sizeof( value ) > size )
+        {
+            return false;
+        }
+
+        memcpy( &value, data + offset, sizeof( value ) );
+        offset += sizeof( value );
+
+        return true;
+    }
+
+    double FirstFrameTime( ) const
+    {
+        return events.empty( ) ? 0.0 : events.front( ).time;
+    }
+
+    double LastFrameTime( ) const
+    {
+        for ( size_t i = events.size( ); i > 0; i-- )
+        {
+            if ( INPUT_RECORD_FRAME == events[i - 1].type )
+            {
+                return events[i - 1].time;
+            }
+        }
+
+        return 0.0;
+    }
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+// A fixed pool of worker threads, one task queue per worker. Workers take work from the front of their own queue and,
+// when it runs dry, steal from the back of the other queues, so uneven tasks (dense octree regions, big textures)
+// balance themselves out. The thread that waits on a batch helps run it instead of sleeping.
+class JobSystem
+{
+public:
+    typedef std::function<void( )> Task;
+
+    // Tracks completion of a group of tasks
+    struct Counter
+    {
+        std::atomic<int> pending;
+
+        Counter( ) : pending( 0 ) { }
+    };
+
+    // Shared pool sized to the machine, created on first use
+    static JobSystem &Get( )
+    {
+        static JobSystem instance( std::max( 1u, std::thread::hardware_concurrency( ) ) - 1 );
+        return instance;
+    }
+
+    explicit JobSystem( unsigned int workerCount ) : queues( workerCount + 1 ), running( true ), nextQueue( 0 ), queuedTasks( 0 )
+    {
+        // Queue 0 belongs to whoever submits work from outside the pool
+        for ( unsigned int i = 0; i < workerCount; i++ )
+        {
+            workers.push_back( std::thread( &JobSystem::WorkerLoop, this, i + 1 ) );
+        }
+    }
+
+    ~JobSystem( )
+    {
+        {
+            std::lock_guard<std::mutex> lock( sleepMutex );
+            running = false;
+        }
+        wake.notify_all( );
+
+        for ( std::thread &worker : workers )
+        {
+            worker.join( );
+        }
+    }
+
+    unsigned int ThreadCount( ) const
+    {
+        return ( unsigned int )workers.size( ) + 1;
+    }
+
+    // Queues a task. Tasks are spread round-robin over the queues so idle workers start on them immediately
+    void Submit( Task task, Counter &counter )
+    {
+        counter.pending++;
+        unsigned int index = nextQueue++ % queues.size( );
+
+        {
+            std::lock_guard<std::mutex> lock( queues[index].mutex );
+            queues[index].tasks.push_back( [task, &counter]( ) { task( ); counter.pending--; } );
+        }
+
+        {
+            // Taken so a worker can't miss the wake up between checking for work and going to sleep
+            std::lock_guard<std::mutex> lock( sleepMutex );
+            queuedTasks++;
+        }
+        wake.notify_one( );
+    }
+
+    // Runs queued tasks on the calling thread until every task of the counter has finished
+    void Wait( Counter &counter )
+    {
+        while ( counter.pending > 0 )
+        {
+            if ( !RunOne( 0 ) )
+            {
+                std::this_thread::yield( );
+            }
+        }
+    }
+
+    // Runs one queued task on the calling thread if there is one. For threads that poll counters instead of waiting on
+    // them, so work still gets done when the pool has no workers
+    bool RunPending( )
+    {
+        return RunOne( 0 );
+    }
+
+    // Calls func(begin, end) over [0, count) in chunks of at most grain items and waits for all of them.
+    // Chunk boundaries only depend on count and grain, never on the number of threads
+    void ParallelFor( size_t count, size_t grain, const std::function<void( size_t, size_t )> &func )
+    {
+        if ( count <= grain || workers.empty( ) )
+        {
+            if ( count > 0 )
+            {
+                func( 0, count );
+            }
+            return;
+        }
+
+        Counter counter;
+
+        for ( size_t begin = grain; begin < count; begin += grain )
+        {
+            size_t end = std::min( count, begin + grain );
+            Submit( [&func, begin, end]( ) { func( begin, end ); }, counter );
+        }
+
+        func( 0, grain );
+        Wait( counter );
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<Queue> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool running;
+
+    std::atomic<unsigned int> nextQueue;
+    std::atomic<int> queuedTasks;
+
+    // Pops from our own queue first, then steals from the others. Returns false if there was nothing to do
+    bool RunOne( size_t self )
+    {
+        Task task;
+
+        for ( size_t i = 0; i < queues.size( ) && !task; i++ )
+        {
+            Queue &queue = queues[( self + i ) % queues.size( )];
+            std::lock_guard<std::mutex> lock( queue.mutex );
+
+            if ( !queue.tasks.empty( ) )
+            {
+                if ( 0 == i )
+                {
+                    task = std::move( queue.tasks.front( ) );
+                    queue.tasks.pop_front( );
+                }
+                else
+                {
+                    task = std::move( queue.tasks.back( ) );
+                    queue.tasks.pop_back( );
+                }
+            }
+        }
+
+        if ( !task )
+        {
+            return false;
+        }
+
+        queuedTasks--;
+        task( );
+
+        return true;
+    }
+
+    void WorkerLoop( size_t self )
+    {
+        while ( true )
+        {
+            if ( RunOne( self ) )
+            {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock( sleepMutex );
+            wake.wait( lock, [this]( ) { return !running || queuedTasks > 0; } );
+
+            if ( !running )
+            {
+                return;
+            }
+        }
+    }
+};
@@ -1,7 +1,12 @@
+// Counts the frames' heap allocations by replacing the global operator new (--alloc-track)
+#define ALLOCATION_TRACKER_IMPLEMENTATION
+#include "allocation_tracker.h"
+
 // Std. Includes
 #include <string>
 #include <cmath>
 #include <vector>
+#include <sstream>
 #include <iostream>
 #include <filesystem>
 
@@ -13,6 +18,22 @@
 #include "Texture.h"
 #include "circle.h"
 #include "skybox.h"
+#include "orbit.h"
+#include "nbody.h"
+#include "ephemeris.h"
+#include "sim_thread.h"
+#include "virtual_texture.h"
+#include "star_field.h"
+#include "benchmark.h"
+#include "bench_suite.h"
+#include "golden_image.h"
+#include "profiler.h"
+#include "pipeline_statistics.h"
+#include "overdraw.h"
+#include "startup_trace.h"
+#include "frame_arena.h"
+#include "flight_recorder.h"
+#include "input_recorder.h"
 
 using Circle = Learus_Circle::Circle;
 using Skybox = Learus_Skybox::Skybox;
@@ -38,6 +59,45 @@ glm::vec3 earthPos = sunPos + glm::vec3(sin(frameToggled) * earthOrbitRadius, 0.
 // Globals
 bool animation = false;
 
+// Orbits of the rendered bodies
+OrbitElements sceneOrbits;
+OrbitPositions scenePositions;
+int earthBody, rockBody;
+
+// Precomputed orbit tables for time scrubbing, used instead of the propagator for times they cover (--ephemeris)
+Ephemeris sceneEphemeris;
+std::string ephemerisPath;
+double ephemerisSpan = 86400.0;
+
+// Very large Earth surface image paged in on demand, replacing the model's own texture (--virtual-texture)
+VirtualTexture earthSurface;
+std::string earthSurfacePath;
+
+// Star catalog drawn as point sprites instead of the cubemap skybox (--stars)
+StarField starField;
+std::string starCatalogPath;
+
+// Scripted offscreen run measuring frame times instead of the interactive window (--bench)
+Benchmark benchmark;
+
+// Timed cases compared with a stored baseline, run before the scripted frames (--bench-suite)
+BenchSuite benchSuite;
+
+// Gravity mode replaces the scripted orbits with an N-body simulation seeded from them (toggled with G)
+enum SimulationMode
+{
+    SIMULATION_ORBITS,
+    SIMULATION_GRAVITY
+};
+
+SimulationMode simulationMode = SIMULATION_ORBITS;
+NBodySystem gravity;
+
+// The simulation runs on its own thread at a fixed rate, independent of the frame rate. previousState and
+// currentState belong to that thread; frames draw renderState, interpolated between the last two published states
+SimulationThread simulationThread;
+SimulationState previousState, currentState, renderState;
+
 // Camera
 float cameraOrbitRadius = 30.0f;
 float rotateAngle = 1.0f;
@@ -61,6 +121,11 @@ void MouseCallback(GLFWwindow* window, double xPos, double yPos);
 void DoMovement();
 void SphereVertices();
 void Sphere();
+void StartGravitySimulation();
+void CaptureSimulationState(SimulationState& state, double time, long long step);
+void StepSimulation(int steps);
+void RecordFrameCounters(int simulationSteps);
+void MeasureBenchSuite();
 
 // Camera
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
@@ -80,48 +145,373 @@ std::vector<glm::vec3> normals;
 std::vector<glm::vec3> colors;
 
 
-int main()
+int main(int argc, char** argv)
 {
-    // Init GLFW
-    glfwInit();
-    // Set all the required options for GLFW
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+    StartupTrace::Get().NameThread("Main");
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--orbit-bench")
+        {
+            OrbitPropagator::RunBenchmark();
+            return 0;
+        }
+
+        if (std::string(argv[i]) == "--ephemeris-bench")
+        {
+            OrbitElements belt;
+            for (int body = 0; body < 64; body++)
+                belt.Add(2.0f + 0.05f * body, 0.1f, 0.05f, body, 2.0f * body, body, 100.0 + 10.0 * body);
+            Ephemeris::RunBenchmark(belt);
+            return 0;
+        }
+
+        // Decode cost against mapping the converted files, for every texture the scene loads
+        if (std::string(argv[i]) == "--texture-cache-report")
+        {
+            TextureCache::RunReport({ "res/images/skybox1/right", "res/images/skybox1/left",
+                                      "res/images/skybox1/top", "res/images/skybox1/bottom",
+                                      "res/images/skybox1/front", "res/images/skybox1/back" }, false);
+            TextureCache::RunReport({ "res/images/container2.png" });
+            return 0;
+        }
+
+        // --nbody-bench [particles] [opening angle]
+        if (std::string(argv[i]) == "--nbody-bench")
+        {
+            size_t particles = i + 1 < argc ? std::stoul(argv[i + 1]) : 100000;
+            double theta = i + 2 < argc ? std::stod(argv[i + 2]) : NBODY_THETA;
+            NBodySystem::RunBenchmark(particles, 20, theta);
+            return 0;
+        }
+
+        // --ephemeris <file> [span in seconds]: loads the tables, building them first if the file doesn't exist
+        if (std::string(argv[i]) == "--ephemeris" && i + 1 < argc)
+        {
+            ephemerisPath = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                ephemerisSpan = std::stod(argv[++i]);
+        }
+
+        if (std::string(argv[i]) == "--sim-hz" && i + 1 < argc)
+        {
+            simulationThread.clock.SetRate(std::stod(argv[++i]));
+        }
+
+        // --texture-budget <MB>: texture memory for streamed mip levels, or 0 to load every level up front
+        if (std::string(argv[i]) == "--texture-budget" && i + 1 < argc)
+        {
+            double megabytes = std::stod(argv[++i]);
+            TextureStreamer::enabled = megabytes > 0.0;
+            TextureStreamer::Get().budget = (size_t)(megabytes * 1024 * 1024);
+        }
+
+        // --upload-budget <MB>: texture data handed to GL per frame by the upload queue
+        if (std::string(argv[i]) == "--upload-budget" && i + 1 < argc)
+        {
+            UploadQueue::Get().frameBudget = (size_t)(std::stod(argv[++i]) * 1024 * 1024);
+        }
+
+        // --frame-task-budget <ms>: create model buffers and upload textures in the render loop, this long per frame
+        if (std::string(argv[i]) == "--frame-task-budget" && i + 1 < argc)
+        {
+            double milliseconds = std::stod(argv[++i]);
+            FrameScheduler::enabled = milliseconds > 0.0;
+            FrameScheduler::Get().budget = milliseconds;
+        }
 
-    // Create a GLFWwindow object that we can use for GLFW's functions
-    GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Solar System - Term Project", nullptr, nullptr);
+        // Keep converted textures uncompressed (the cache is rebuilt when this changes)
+        if (std::string(argv[i]) == "--no-texture-compression")
+        {
+            TextureCache::compression = false;
+        }
+
+        // --virtual-texture <image>: draw Earth with this image through the virtual texture page cache
+        if (std::string(argv[i]) == "--virtual-texture" && i + 1 < argc)
+        {
+            earthSurfacePath = argv[++i];
+        }
+
+        // --stars <catalog.csv>: star catalog background; --star-count <N> and --star-magnitude <m> limit what is drawn
+        if (std::string(argv[i]) == "--stars" && i + 1 < argc)
+        {
+            starCatalogPath = argv[++i];
+        }
+
+        if (std::string(argv[i]) == "--star-count" && i + 1 < argc)
+        {
+            starField.maxStars = std::stoul(argv[++i]);
+        }
+
+        if (std::string(argv[i]) == "--star-magnitude" && i + 1 < argc)
+        {
+            starField.limitingMagnitude = std::stof(argv[++i]);
+        }
+
+        // --bench [frames] [results.json]: flies a scripted camera path offscreen (EGL, no window) with a fixed simulation
+        // step per frame and writes frame time percentiles, time per phase and triangle counts as JSON
+        if (std::string(argv[i]) == "--bench")
+        {
+            benchmark.enabled = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                benchmark.frames = std::max(1, std::stoi(argv[++i]));
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                benchmark.outputPath = argv[++i];
+        }
+
+        // --bench-suite [baseline.json] [threshold %]: --bench, preceded by model import, texture decode, shader
+        // compile, Sphere(), star culling and orbit propagation timed over repeated runs; those and the frames along
+        // the camera path are compared with the baseline and any regression fails the run (exit status). Without the
+        // baseline file, this run is written as it
+        if (std::string(argv[i]) == "--bench-suite")
+        {
+            benchmark.enabled = true;
+            benchSuite.enabled = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                benchSuite.baselinePath = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                benchSuite.thresholdPercent = std::stod(argv[++i]);
+        }
 
-    if (nullptr == window)
+        // --bench-suite-runs <runs> [warm-up runs]: measured and unmeasured repetitions of every suite case
+        if (std::string(argv[i]) == "--bench-suite-runs" && i + 1 < argc)
+        {
+            benchSuite.runs = std::max(1, std::stoi(argv[++i]));
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                benchSuite.warmupRuns = std::max(0, std::stoi(argv[++i]));
+        }
+
+        // --bench-suite-update: replace the baseline with this run's numbers
+        if (std::string(argv[i]) == "--bench-suite-update")
+        {
+            benchSuite.updateBaseline = true;
+        }
+
+        // --golden [directory] [min PSNR dB] [min SSIM]: --bench, reading back frames at fixed poses along the camera
+        // path and comparing them with the golden images in the directory; a mismatch fails the run (exit status), and
+        // with --bench-suite is one of its checks. Missing golden images are recorded. Not with streamed textures
+        if (std::string(argv[i]) == "--golden")
+        {
+            benchmark.enabled = true;
+            GoldenImages::enabled = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                GoldenImages::Get().directory = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                GoldenImages::Get().minPsnr = std::stod(argv[++i]);
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                GoldenImages::Get().minSsim = std::stod(argv[++i]);
+        }
+
+        // --golden-update: record this run's frames as the golden images
+        if (std::string(argv[i]) == "--golden-update")
+        {
+            GoldenImages::Get().update = true;
+        }
+
+        // --record <session.rec>: write every frame's time and the key and mouse input to a file for --replay. The
+        // simulation is stepped on the render thread by the frame time instead of on its own, as it is in the replay
+        if (std::string(argv[i]) == "--record" && i + 1 < argc)
+        {
+            if (!InputRecorder::Get().Record(argv[++i]))
+                return EXIT_FAILURE;
+        }
+
+        // --replay <session.rec> [fast]: play a recorded session back in place of live input, at the recorded pace or as
+        // fast as the frames draw, with the options it was recorded with. With --bench the session is drawn offscreen
+        // instead of the camera path, and measured
+        if (std::string(argv[i]) == "--replay" && i + 1 < argc)
+        {
+            std::string path = argv[++i];
+            bool realTime = true;
+            if (i + 1 < argc && std::string(argv[i + 1]) == "fast")
+            {
+                realTime = false;
+                i++;
+            }
+            if (!InputRecorder::Get().Replay(path, realTime))
+                return EXIT_FAILURE;
+        }
+
+        // --profile [trace.json|trace.csv]: time every frame's scopes on the CPU and the GPU, shown with P; the trace is
+        // written at exit (Chrome trace JSON, or CSV by the extension)
+        if (std::string(argv[i]) == "--profile")
+        {
+            Profiler::enabled = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                Profiler::Get().tracePath = argv[++i];
+        }
+
+        // --pipeline-stats: vertex and fragment shader invocations per pass, printed with M (always on with --bench)
+        if (std::string(argv[i]) == "--pipeline-stats")
+        {
+            PipelineStatistics::enabled = true;
+        }
+
+        // --overdraw: start with the overdraw heatmap on (O toggles it); with --bench its histogram goes in the results
+        if (std::string(argv[i]) == "--overdraw")
+        {
+            OverdrawView::enabled = true;
+        }
+
+        // --startup-trace [trace.json]: timeline of the load phases and background work up to the first frame with
+        // nothing left to load, as Chrome trace JSON
+        if (std::string(argv[i]) == "--startup-trace")
+        {
+            StartupTrace::enabled = true;
+            StartupTrace::Get().outputPath = "startup_trace.json";
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                StartupTrace::Get().outputPath = argv[++i];
+        }
+
+        // --flight-recorder [threshold ms] [path prefix]: keep the last frames' scopes and counters and write the window
+        // around any frame slower than the threshold as a Chrome trace (prefix + frame number + .json)
+        if (std::string(argv[i]) == "--flight-recorder")
+        {
+            FlightRecorder::enabled = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                FlightRecorder::Get().thresholdMs = std::stod(argv[++i]);
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                FlightRecorder::Get().pathPrefix = argv[++i];
+        }
+
+        // --alloc-track: count the heap allocations of every frame and where they come from, printed with M
+        if (std::string(argv[i]) == "--alloc-track")
+        {
+            AllocationTracker::enabled = true;
+        }
+
+        // --alloc-check [warm-up frames]: fail the run (exit status) if any frame allocates once loading is done and the
+        // warm-up frames have passed, printing the call sites of the first one that does. Meant for --bench
+        if (std::string(argv[i]) == "--alloc-check")
+        {
+            AllocationTracker::enabled = true;
+            AllocationTracker::check = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                AllocationTracker::warmupFrames = std::max(0, std::stoi(argv[++i]));
+        }
+
+        // --gl-trace <calls.csv>: GL calls and redundant state changes per frame, by category (builds with GL_TRACE)
+        if (std::string(argv[i]) == "--gl-trace" && i + 1 < argc)
+        {
+#ifdef GL_TRACE
+            GLTrace::Get().outputPath = argv[++i];
+#else
+            std::cerr << "ERROR: --gl-trace needs a build with GL_TRACE defined" << std::endl;
+            i++;
+#endif
+        }
+
+        // Pack same size Model textures into array pages, bound once per shader
+        if (std::string(argv[i]) == "--texture-arrays")
+        {
+            TextureArrayAllocator::enabled = true;
+        }
+    }
+
+    // Which texture levels and pages are resident at a pose depends on I/O timing while streaming, golden images need
+    // every frame to come out the same
+    if (GoldenImages::enabled && (TextureStreamer::enabled || !earthSurfacePath.empty()))
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
+        std::cerr << "ERROR: --golden can't be used with --texture-budget or --virtual-texture, streamed textures make the frames depend on I/O timing" << std::endl;
+        return EXIT_FAILURE;
+    }
 
+    if (benchmark.enabled && InputRecorder::Get().Replaying())
+    {
+        benchmark.frames = (int)std::max(1ll, InputRecorder::Get().FrameCount());
+    }
+    else if (benchmark.enabled && InputRecorder::Get().Active())
+    {
+        std::cerr << "ERROR: --record needs the interactive window, there is no input with --bench" << std::endl;
         return EXIT_FAILURE;
     }
 
-    glfwMakeContextCurrent(window);
+    GLFWwindow* window = nullptr;
+    HeadlessContext headless;
 
-    glfwGetFramebufferSize(window, &SCREEN_WIDTH, &SCREEN_HEIGHT);
+    if (benchmark.enabled)
+    {
+        PipelineStatistics::enabled = true;
+        StartupTrace::enabled = true;
 
-    // Set the required callback functions
-    glfwSetKeyCallback(window, KeyCallback);
-    glfwSetCursorPosCallback(window, MouseCallback);
+        // No window system at all, the frames are drawn into a framebuffer the size of the window
+        StartupTrace::Get().Begin("Headless context");
+        if (!headless.Create(WIDTH, HEIGHT))
+        {
+            return EXIT_FAILURE;
+        }
 
-    // GLFW Options
-  //  glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        SCREEN_WIDTH = WIDTH;
+        SCREEN_HEIGHT = HEIGHT;
+        StartupTrace::Get().End();
+
+        // Deferred loading depends on how long frames take, the benchmark loads everything up front
+        FrameScheduler::enabled = false;
+    }
+    else
+    {
+        // Init GLFW
+        StartupTrace::Get().Begin("Window");
+        glfwInit();
+        // Set all the required options for GLFW
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+        // The overdraw view counts fragments in the stencil buffer
+        glfwWindowHint(GLFW_STENCIL_BITS, 8);
+
+        // Create a GLFWwindow object that we can use for GLFW's functions
+        window = glfwCreateWindow(WIDTH, HEIGHT, "Solar System - Term Project", nullptr, nullptr);
+
+        if (nullptr == window)
+        {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+
+            return EXIT_FAILURE;
+        }
+
+        glfwMakeContextCurrent(window);
+
+        glfwGetFramebufferSize(window, &SCREEN_WIDTH, &SCREEN_HEIGHT);
+
+        // Set the required callback functions
+        glfwSetKeyCallback(window, KeyCallback);
+        glfwSetCursorPosCallback(window, MouseCallback);
+        StartupTrace::Get().End();
+
+        // GLFW Options
+      //  glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    }
 
     // Set this to true so GLEW knows to use a modern approach to retrieving function pointers and extensions
     glewExperimental = GL_TRUE;
-    // Initialize GLEW to setup the OpenGL Function pointers
-    if (GLEW_OK != glewInit())
+    StartupTrace::Get().Begin("GLEW init");
+    // Initialize GLEW to setup the OpenGL Function pointers. Headless there is no GLX display to query, but the GL
+    // functions are loaded before GLEW finds that out
+    GLenum glewStatus = glewInit();
+
+    if (GLEW_OK != glewStatus && !(benchmark.enabled && GLEW_ERROR_NO_GLX_DISPLAY == glewStatus))
     {
         std::cout << "Failed to initialize GLEW" << std::endl;
         return EXIT_FAILURE;
     }
 
+    if (benchmark.enabled && !headless.CreateFramebuffer())
+    {
+        return EXIT_FAILURE;
+    }
+
+    StartupTrace::Get().End();
+
+    // Block compressed textures need S3TC (RGTC is core)
+    if (!GLEW_EXT_texture_compression_s3tc)
+    {
+        TextureCache::compression = false;
+    }
+
     // Define the viewport dimensions
     glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 
@@ -131,18 +521,86 @@ int main()
    
     // Setup and compile our shaders
      //   Shader shader("res/shaders/cube.vs", "res/shaders/cube.frag");
+    StartupTrace::Get().Begin("Shaders");
     Shader planetShader("res/shaders/planet.vs", "res/shaders/planet.frag");
     Shader sunShader("res/shaders/sun.vs", "res/shaders/sun.frag");
     Shader skyboxShader("res/shaders/skybox.vs", "res/shaders/skybox.frag");
+    Shader feedbackShader("res/shaders/planet.vs", "res/shaders/virtual_feedback.frag");
+    Shader starShader("res/shaders/star.vs", "res/shaders/star.frag");
+    Shader textShader("res/shaders/text.vs", "res/shaders/text.frag");
+    Shader overdrawShader("res/shaders/overdraw.vs", "res/shaders/overdraw.frag");
+    StartupTrace::Get().End();
+
+    if (!earthSurfacePath.empty())
+    {
+        STARTUP_SCOPE("Virtual texture");
+        earthSurface.Open(earthSurfacePath, SCREEN_WIDTH, SCREEN_HEIGHT);
+    }
+
+    // With a star catalog the cubemap faces are never loaded
+    if (!starCatalogPath.empty())
+    {
+        STARTUP_SCOPE("Star catalog");
+        starField.Open(starCatalogPath);
+    }
+
+    // Start preparing the skybox faces and the cube texture now, so they load while the models below are imported.
+    // The faces are logical names, each resolved to the cheapest of its TGA/JPG/PNG versions
+    std::shared_ptr<CacheBatch> cubemapFaces;
+
+    if (!starField.Valid())
+    {
+        cubemapFaces = TextureCache::PrepareAsync({ "res/images/skybox1/right", "res/images/skybox1/left",
+                                                    "res/images/skybox1/top", "res/images/skybox1/bottom",
+                                                    "res/images/skybox1/front", "res/images/skybox1/back" }, 3, false);
+    }
+    std::shared_ptr<CacheBatch> cubeImage = TextureCache::PrepareAsync({ "res/images/container2.png" }, 3);
 
     // Load the models
+    StartupTrace::Get().Begin("Models");
     Model Sun("res/Planet/planet.obj");
     Model Earth("res/Earth/Globe.obj");
     Model Mercury("res/Planet/SpaceShip-1.obj");
     Model Moon("res/Rock/rock.obj");
+    StartupTrace::Get().End();
+
+    StartupTrace::Get().Begin("Simulation");
+
+    // Both bodies start where the scene used to place them by hand: Earth at (-1, 0, 1), the rock at (-1.1, 0, -1.1)
+    earthBody = sceneOrbits.Add(sqrt(2.0f), 0.0f, 0.0f, 0.0f, 0.0f, -0.75 * M_PI, 60.0);
+    rockBody = sceneOrbits.Add(1.1f * sqrt(2.0f), 0.0f, 0.0f, 0.0f, 0.0f, 0.75 * M_PI, 90.0);
+
+    if (!ephemerisPath.empty())
+    {
+        if (!sceneEphemeris.Open(ephemerisPath, sceneOrbits, 0.0, ephemerisSpan)
+            && (!Ephemeris::Build(sceneOrbits, 0.0, ephemerisSpan, ephemerisPath) || !sceneEphemeris.Open(ephemerisPath)))
+        {
+            std::cerr << "ERROR: Can't build the ephemeris " << ephemerisPath << ", propagating the orbits instead" << std::endl;
+            ephemerisPath.clear();
+        }
+    }
+
+    // The scripted orbits at the step before the first, so the first interpolation spans a whole step
+    CaptureSimulationState(previousState, -simulationThread.clock.StepSize(), simulationThread.clock.StepCount() - 1);
+    CaptureSimulationState(currentState, 0.0, simulationThread.clock.StepCount());
+
+    // The benchmark steps the simulation itself, once per frame, and recording or replaying input by the frame time
+    if (!benchmark.enabled && !InputRecorder::Get().Active())
+    {
+        simulationThread.Start([](int steps, SimulationFrame& frame)
+        {
+            StepSimulation(steps);
+            frame.previous = previousState;
+            frame.current = currentState;
+        });
+    }
 
+    StartupTrace::Get().End();
+
+    StartupTrace::Get().Begin("Circles");
     Circle EarthOrbitCircle(sunPos, earthOrbitRadius, glm::vec3(1.0f, 1.0f, 1.0f), 3000);
     Circle MoonOrbitCircle(earthPos, moonOrbitRadius, glm::vec3(1.0f, 1.0f, 1.0f), 3000);
+    StartupTrace::Get().End();
 
     GLfloat cubeVertices[] =
     {
@@ -235,8 +693,12 @@ int main()
         1.0f, -1.0f,  1.0f
     };
 
+    StartupTrace::Get().Begin("Sphere");
     Sphere();
 //    SphereVertices();
+    StartupTrace::Get().End();
+
+    StartupTrace::Get().Begin("Buffers");
 
     // Setup cube VAO
     GLuint cubeVAO, cubeVBO;
@@ -261,19 +723,31 @@ int main()
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
     glBindVertexArray(0);
+    StartupTrace::Get().End();
 
-    // Load textures
-    GLuint cubeTexture = TextureLoading::LoadTexture("res/images/container2.png");
+    // Load textures (decoding started before the models were loaded). With the frame scheduler they are uploaded in
+    // the render loop instead; the skybox covers the screen, so it goes before anything else
+    StartupTrace::Get().Begin("Textures");
+    GLuint cubeTexture = TextureLoading::ScheduleTexture(cubeImage, nullptr);
+    cubeImage.reset();
 
     // Cubemap (Skybox)
-    vector<const GLchar*> faces;
-    faces.push_back("res/images/skybox1/right.png");
-    faces.push_back("res/images/skybox1/left.png");
-    faces.push_back("res/images/skybox1/top.png");
-    faces.push_back("res/images/skybox1/bottom.png");
-    faces.push_back("res/images/skybox1/front.png");
-    faces.push_back("res/images/skybox1/back.png");
-    GLuint cubemapTexture = TextureLoading::LoadCubemap(faces);
+    GLuint cubemapTexture = 0;
+
+    if (cubemapFaces)
+    {
+        if (!FrameScheduler::enabled)
+            cubemapFaces->PrintTimings("Cubemap");
+        cubemapTexture = TextureLoading::ScheduleCubemap(cubemapFaces, []() { return (float)std::hypot(SCREEN_WIDTH, SCREEN_HEIGHT); });
+        cubemapFaces.reset();
+    }
+
+    StartupTrace::Get().End();
+
+    if (benchSuite.enabled)
+    {
+        MeasureBenchSuite();
+    }
 
 /*
     // Render Loop
@@ -373,17 +847,77 @@ int main()
 
     */
 
+    int benchmarkFrame = 0;
+    long long lastStepsRun = 0;
+
     // Game loop
-    while (!glfwWindowShouldClose(window))
+    while (benchmark.enabled ? benchmarkFrame < benchmark.frames : !glfwWindowShouldClose(window))
     {
-        // Set frame time
-        GLfloat currentFrame = glfwGetTime();
+        // A replay stops after its last recorded frame
+        if (InputRecorder::Get().Finished())
+            break;
+
+        // Set frame time. A recording keeps it, a replay uses the recorded one
+        GLfloat frameStart = benchmark.enabled ? (GLfloat)(benchmarkFrame * BENCHMARK_FRAME_SECONDS) : glfwGetTime();
+        GLfloat currentFrame = InputRecorder::Get().Active() ? (GLfloat)InputRecorder::Get().BeginFrame(frameStart) : frameStart;
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
-        // Check and call events
-        glfwPollEvents();
-        DoMovement();
+        // Last frame's scratch memory is free again
+        FrameArena::Get().Reset();
+        AllocationTracker::BeginFrame();
+        FlightRecorder::Get().BeginFrame();
+        Profiler::Get().BeginFrame();
+        Profiler::Get().Push("Simulation");
+
+        // Simulation steps taken since the last frame
+        int simulationSteps = 0;
+
+        if (InputRecorder::Get().Active())
+        {
+            // Live or recorded input, then the simulation stepped here by the frame time so a replay takes the same steps
+            benchmark.BeginFrame();
+
+            if (window)
+                glfwPollEvents();
+            InputRecorder::Get().Dispatch([window](int key, int scancode, int action, int mods) { KeyCallback(window, key, scancode, action, mods); },
+                                          [window](double xPos, double yPos) { MouseCallback(window, xPos, yPos); });
+            DoMovement();
+
+            simulationSteps = simulationThread.StepInline(deltaTime);
+            StepSimulation(simulationSteps);
+            SimulationState::Interpolate(previousState, currentState, simulationThread.clock.Alpha(), renderState);
+        }
+        else if (benchmark.enabled)
+        {
+            // Scripted camera and one fixed simulation step per frame on this thread, so every run draws the same frames
+            benchmark.BeginFrame();
+
+            glm::vec3 eye, target;
+            Benchmark::CameraPath((float)benchmarkFrame / benchmark.frames, eye, target);
+            camera.LookAt(eye, target);
+
+            simulationSteps = simulationThread.clock.Advance(BENCHMARK_FRAME_SECONDS);
+            StepSimulation(simulationSteps);
+            SimulationState::Interpolate(previousState, currentState, simulationThread.clock.Alpha(), renderState);
+        }
+        else
+        {
+            // Check and call events
+            glfwPollEvents();
+            DoMovement();
+
+            long long stepsRun = simulationThread.StepsRun();
+            simulationSteps = (int)(stepsRun - lastStepsRun);
+            lastStepsRun = stepsRun;
+
+            const SimulationFrame& simulationFrame = simulationThread.Latest();
+            SimulationState::Interpolate(simulationFrame.previous, simulationFrame.current, simulationThread.Alpha(simulationFrame), renderState);
+        }
+
+        frameToggled = renderState.time;
+        Profiler::Get().Pop();
+        benchmark.Mark("simulation");
 
         // Clear the colorbuffer
         glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
@@ -393,6 +927,7 @@ int main()
         glm::mat4 model = glm::mat4(1.0f);
         glm::mat4 view = camera.GetViewMatrix();
         glm::mat4 projection = glm::perspective(camera.GetZoom(), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.1f, 1000.0f);
+        benchmark.AddWorkload(&view, sizeof(view));
 
 
         //// Draw our first triangle
@@ -420,23 +955,42 @@ int main()
         //glBindVertexArray(0);
 
 
-        // Draw skybox as last
-        glDepthFunc(GL_LEQUAL);  // Change depth function so depth test passes when values are equal to depth buffer's content
-        skyboxShader.Use();
-        view = glm::mat4(glm::mat3(camera.GetViewMatrix()));	// Remove any translation component of the view matrix
+        OverdrawView::Get().Begin();
+        PipelineStatistics::Get().BeginFrame();
 
-        glUniformMatrix4fv(glGetUniformLocation(skyboxShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(skyboxShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        Profiler::Get().Push("Background");
+        PipelineStatistics::Get().Begin("background");
 
-        // skybox cube
-        glBindVertexArray(skyboxVAO);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
+        if (starField.Valid())
+        {
+            starField.Draw(starShader.Program, camera.GetViewMatrix(), projection, camera.GetZoom(), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT);
+        }
+        else
+        {
+            // Draw skybox as last
+            glDepthFunc(GL_LEQUAL);  // Change depth function so depth test passes when values are equal to depth buffer's content
+            skyboxShader.Use();
+            view = glm::mat4(glm::mat3(camera.GetViewMatrix()));	// Remove any translation component of the view matrix
+
+            glUniformMatrix4fv(glGetUniformLocation(skyboxShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+            glUniformMatrix4fv(glGetUniformLocation(skyboxShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+
+            // skybox cube
+            glBindVertexArray(skyboxVAO);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            glBindVertexArray(0);
+            benchmark.AddTriangles(12);
+
+            glDepthFunc(GL_LESS); // Set depth function back to default
+        }
 
-        glDepthFunc(GL_LESS); // Set depth function back to default
+        Profiler::Get().Pop();
+        benchmark.Mark("background");
 
         // Render the sun object
+        Profiler::Get().Push("Sun");
+        PipelineStatistics::Get().Begin("sun");
         sunShader.Use();
         model = glm::mat4(1.0f);
         view = camera.GetViewMatrix();
@@ -444,15 +998,23 @@ int main()
 
         sunShader.setMat4("projection", projection);
         sunShader.setMat4("view", view);
+        TextureArrayAllocator::Get().Bind(sunShader.Program);
 
         model = glm::translate(model, sunPos); // Center it (kinda)l
         model *= glm::scale(glm::vec3(0.10, 0.10, 0.10));
         sunShader.setMat4("model", model);
+        Sun.StreamTextures(TextureStreamer::ProjectedDiameter(sunPos, Sun.BoundingRadius() * 0.10f, camera.position, projection[1][1], SCREEN_HEIGHT));
         Sun.Draw(sunShader);
+        benchmark.AddTriangles(Sun.TriangleCount());
+        Profiler::Get().Pop();
+        benchmark.Mark("sun");
 
 
 
+        Profiler::Get().Push("Earth");
+        PipelineStatistics::Get().Begin("planets");
         planetShader.Use();
+        TextureArrayAllocator::Get().Bind(planetShader.Program);
 
         // Set the lighting
         planetShader.setVec3("viewPos", camera.position);
@@ -476,54 +1038,231 @@ int main()
         // Orbit around the sun
 
         model = glm::mat4(1.0f);
-        earthPos = glm::vec3(-1.0f, 0.0f, 1.0f);
- //       earthPos = sunPos + glm::vec3(sin(frameToggled) * earthOrbitRadius, 0.0f, cos(frameToggled) * earthOrbitRadius);
+        earthPos = sunPos + glm::vec3(renderState.x[earthBody], renderState.y[earthBody], renderState.z[earthBody]);
+        benchmark.AddWorkload(&earthPos, sizeof(earthPos));
         model = glm::translate(model, earthPos);
         model *= glm::scale(glm::vec3(0.01, 0.01, 0.01));
         // Rotate around itself
         model = glm::rotate(model, frameToggled * 1.5f * glm::radians(-50.0f), glm::vec3(0.1f, -1.0f, 0.0f));
 
+        if (earthSurface.Valid())
+        {
+            // Low resolution pass recording which pages of the surface Earth needs, read back by Update next frame.
+            // Counted on its own, it isn't planet shading
+            PipelineStatistics::Get().Begin("feedback");
+            earthSurface.BeginFeedback(feedbackShader.Program);
+            feedbackShader.setMat4("projection", projection);
+            feedbackShader.setMat4("view", view);
+            feedbackShader.setMat4("model", model);
+            Earth.Draw(feedbackShader);
+            benchmark.AddTriangles(Earth.TriangleCount());
+            earthSurface.EndFeedback();
+            PipelineStatistics::Get().Begin("planets");
+
+            planetShader.Use();
+            earthSurface.Bind(planetShader.Program);
+        }
+
         planetShader.setMat4("model", model);
+        Earth.StreamTextures(TextureStreamer::ProjectedDiameter(earthPos, Earth.BoundingRadius() * 0.01f, camera.position, projection[1][1], SCREEN_HEIGHT));
         Earth.Draw(planetShader);
+        benchmark.AddTriangles(Earth.TriangleCount());
+
+        if (earthSurface.Valid())
+        {
+            earthSurface.Unbind(planetShader.Program);
+        }
+
+        Profiler::Get().Pop();
+        benchmark.Mark("earth");
 
         // Draw a circle showing the earth's orbit around the sun
+        Profiler::Get().Push("Orbits");
+        PipelineStatistics::Get().Begin("circles");
         EarthOrbitCircle.setUniforms(projection, view);
         EarthOrbitCircle.scale(glm::vec3(0.05f, 0.05f, 0.05f));
         EarthOrbitCircle.translate(earthPos);
         EarthOrbitCircle.rotate(glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
         EarthOrbitCircle.Draw();
+        Profiler::Get().Pop();
+        benchmark.Mark("orbits");
 
         // Orbit around the sun
-
+        Profiler::Get().Push("Rock");
+        PipelineStatistics::Get().Begin("planets");
         planetShader.Use();
 
         model = glm::mat4(1.0f);
-        earthPos = glm::vec3(-1.1f, 0.0f, -1.1f);
-        //       earthPos = sunPos + glm::vec3(sin(frameToggled) * earthOrbitRadius, 0.0f, cos(frameToggled) * earthOrbitRadius);
+        earthPos = sunPos + glm::vec3(renderState.x[rockBody], renderState.y[rockBody], renderState.z[rockBody]);
+        benchmark.AddWorkload(&earthPos, sizeof(earthPos));
         model = glm::translate(model, earthPos);
         model *= glm::scale(glm::vec3(0.05, 0.05, 0.05));
         // Rotate around itself
         model = glm::rotate(model, frameToggled * 1.5f * glm::radians(-50.0f), glm::vec3(0.1f, -1.0f, 0.0f));
 
         planetShader.setMat4("model", model);
+        Moon.StreamTextures(TextureStreamer::ProjectedDiameter(earthPos, Moon.BoundingRadius() * 0.05f, camera.position, projection[1][1], SCREEN_HEIGHT));
         Moon.Draw(planetShader);
+        benchmark.AddTriangles(Moon.TriangleCount());
+        Profiler::Get().Pop();
+        benchmark.Mark("rock");
 
         // Draw a circle showing the moon's orbit around the earth
+        Profiler::Get().Push("Orbits");
+        PipelineStatistics::Get().Begin("circles");
         MoonOrbitCircle.setUniforms(projection, view);
         MoonOrbitCircle.scale(glm::vec3(0.1f, 0.1f, 0.1f));
         MoonOrbitCircle.translate(earthPos);
         MoonOrbitCircle.rotate(glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
         MoonOrbitCircle.Draw();
+        PipelineStatistics::Get().EndFrame();
+        OverdrawView::Get().Resolve(overdrawShader.Program);
+        Profiler::Get().Pop();
+        benchmark.Mark("orbits");
+
+        Profiler::Get().Push("Streaming");
+
+        // The benchmark lets background copies and page loads finish first, so they land on the same frame every run
+        if (benchmark.enabled)
+        {
+            UploadQueue::Get().WaitForCopies();
+            earthSurface.WaitForPages();
+        }
+
+        // Issue the texture uploads copied since last frame, run this frame's share of the deferred GL work, then
+        // stream texture detail for what was drawn this frame
+        UploadQueue::Get().Update();
+        FrameScheduler::Get().Update();
+        TextureStreamer::Get().Update();
+        earthSurface.Update();
+        Profiler::Get().Pop();
+        benchmark.Mark("streaming");
+
+        // The virtual texture's residency and feedback go on the same page
+        char overlayNotes[256];
+        earthSurface.OverlayText(overlayNotes, sizeof(overlayNotes));
+        Profiler::Get().DrawOverlay(textShader.Program, SCREEN_WIDTH, SCREEN_HEIGHT, overlayNotes);
+
+        if (benchmark.enabled)
+        {
+            // Nothing to present, wait for the frame to be drawn instead
+            Profiler::Get().Push("Finish");
+            glFinish();
+            Profiler::Get().Pop();
+            Profiler::Get().EndFrame();
+            RecordFrameCounters(simulationSteps);
+            FlightRecorder::Get().EndFrame();
+            GL_TRACE_END_FRAME();
+            bool loading = FrameScheduler::Get().Pending() > 0 || UploadQueue::Get().Pending() > 0;
+            StartupTrace::Get().FramePresented(loading);
+            benchmark.Mark("finish");
+            benchmark.EndFrame();
+            AllocationTracker::EndFrame(loading);
+
+            // The frame is still in the framebuffer. Read back outside the frame's measurements, compared later
+            if (GoldenImages::enabled)
+            {
+                for (int pose = 0; pose < GOLDEN_IMAGE_POSES; pose++)
+                {
+                    if (benchmarkFrame == benchmark.frames * (2 * pose + 1) / (2 * GOLDEN_IMAGE_POSES))
+                        GoldenImages::Get().Capture((InputRecorder::Get().Replaying() ? "replay" : "bench") + std::to_string(benchmark.frames) + "_pose" + std::to_string(pose),
+                                                    headless.Framebuffer(), SCREEN_WIDTH, SCREEN_HEIGHT);
+                }
+
+                GoldenImages::Get().Update();
+            }
+
+            benchmarkFrame++;
+            continue;
+        }
+
+        GLfloat renderEnd = glfwGetTime();
 
         // Swap the buffers
+        Profiler::Get().Push("Swap");
         glfwSwapBuffers(window);
+        Profiler::Get().Pop();
+        Profiler::Get().EndFrame();
+        RecordFrameCounters(simulationSteps);
+        FlightRecorder::Get().EndFrame();
+        GL_TRACE_END_FRAME();
+        bool loading = FrameScheduler::Get().Pending() > 0 || UploadQueue::Get().Pending() > 0;
+        StartupTrace::Get().FramePresented(loading);
+
+        simulationThread.RecordRenderFrame(renderEnd - frameStart, glfwGetTime() - frameStart);
+        AllocationTracker::EndFrame(loading);
+    }
 
+    if (benchmark.enabled)
+    {
+        benchmark.AddSection("startup", StartupTrace::Get().Json());
+        benchmark.AddSection("pipeline_statistics", PipelineStatistics::Get().Json(SCREEN_WIDTH, SCREEN_HEIGHT));
+        if (OverdrawView::enabled)
+            benchmark.AddSection("overdraw", OverdrawView::Get().Json());
+        if (AllocationTracker::enabled)
+            benchmark.AddSection("allocations", AllocationTracker::Json());
+        if (GoldenImages::enabled)
+        {
+            GoldenImages::Get().Finish();
+            benchmark.AddSection("golden_images", GoldenImages::Get().Json());
+        }
+        benchmark.Write((const char*)glGetString(GL_RENDERER), SCREEN_WIDTH, SCREEN_HEIGHT);
     }
 
-   
+    int regressions = 0;
+
+    if (benchSuite.enabled)
+    {
+        // The frames after the warm-up, by quarter of the camera path, each a different view of the scene
+        const std::vector<double>& frameMs = benchmark.FrameMs();
+
+        for (int quarter = 0; quarter < 4; quarter++)
+        {
+            size_t begin = std::max((size_t)BENCHMARK_WARMUP_FRAMES, frameMs.size() * quarter / 4);
+            size_t end = frameMs.size() * (quarter + 1) / 4;
+            if (begin < end)
+                benchSuite.AddSamples("frame, camera path " + std::to_string(25 * quarter) + "-" + std::to_string(25 * quarter + 25) + "%",
+                                      std::vector<double>(frameMs.begin() + begin, frameMs.begin() + end));
+        }
+
+        if (GoldenImages::enabled)
+        {
+            for (const GoldenImages::Outcome& outcome : GoldenImages::Get().Outcomes())
+            {
+                std::ostringstream detail;
+                detail << outcome.status << ", PSNR " << outcome.psnr << " dB, SSIM " << outcome.ssim;
+                benchSuite.AddCheck("golden image " + outcome.name, "match" == outcome.status || "recorded" == outcome.status, detail.str());
+            }
+        }
+
+        regressions = benchSuite.Compare((const char*)glGetString(GL_RENDERER));
+    }
+
+    Profiler::Get().WriteTrace();
+    FlightRecorder::Get().Finish();
+    InputRecorder::Get().Finish();
+    simulationThread.Stop();
+    simulationThread.PrintMetrics();
+    TextureStreamer::Get().PrintStats();
+    UploadQueue::Get().PrintStats();
+    FrameScheduler::Get().PrintStats();
+    TextureArrayAllocator::Get().PrintStats();
+    earthSurface.PrintStats();
+    starField.PrintStats();
+    Profiler::Get().PrintStats();
+    PipelineStatistics::Get().PrintStats(SCREEN_WIDTH, SCREEN_HEIGHT);
+    OverdrawView::Get().PrintStats();
+    StartupTrace::Get().PrintStats();
+    FrameArena::Get().PrintStats();
+    AllocationTracker::PrintStats();
+    FlightRecorder::Get().PrintStats();
+    if (GoldenImages::enabled)
+        GoldenImages::Get().PrintStats();
+    InputRecorder::Get().PrintStats();
+    GL_TRACE_PRINT();
 
     glfwTerminate();
-    return 0;
+    return AllocationTracker::Failed() || regressions > 0 || (GoldenImages::enabled && GoldenImages::Get().Failures() > 0) ? EXIT_FAILURE : 0;
 }
 
 
@@ -556,11 +1295,112 @@ void DoMovement()
 // Is called whenever a key is pressed/released via GLFW
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mode)
 {
-    if (GLFW_KEY_ESCAPE == key && GLFW_PRESS == action)
+    // Live or replayed, so a replay can be left early
+    if (GLFW_KEY_ESCAPE == key && GLFW_PRESS == action && window)
     {
         glfwSetWindowShouldClose(window, GL_TRUE);
     }
 
+    // Recorded with --record; a replay ignores live input and calls this with the recorded one
+    if (!InputRecorder::Get().Key(key, scancode, action, mode))
+        return;
+
+    // Pause / Start the orbits
+    if (GLFW_KEY_ENTER == key && GLFW_PRESS == action)
+    {
+        animation = !animation;
+        bool paused = !animation;
+        simulationThread.Post([paused]() { simulationThread.SetPaused(paused); });
+    }
+
+    // Switch between scripted orbits and the gravity simulation
+    if (GLFW_KEY_G == key && GLFW_PRESS == action)
+    {
+        simulationThread.Post([]()
+        {
+            double time = simulationThread.clock.Time();
+            long long step = simulationThread.clock.StepCount();
+
+            // Gravity has no state a step back, the previous state is always the scripted orbits': the gravity
+            // simulation starts from where they are now
+            if (SIMULATION_ORBITS == simulationMode)
+            {
+                CaptureSimulationState(previousState, time - simulationThread.clock.StepSize(), step - 1);
+                StartGravitySimulation();
+                simulationMode = SIMULATION_GRAVITY;
+            }
+            else
+            {
+                simulationMode = SIMULATION_ORBITS;
+                CaptureSimulationState(previousState, time - simulationThread.clock.StepSize(), step - 1);
+            }
+
+            CaptureSimulationState(currentState, time, step);
+        });
+    }
+
+    // Time warp
+    if (GLFW_KEY_EQUAL == key && GLFW_PRESS == action)
+    {
+        simulationThread.Post([]() { simulationThread.clock.timeWarp *= 2.0; });
+    }
+
+    if (GLFW_KEY_MINUS == key && GLFW_PRESS == action)
+    {
+        simulationThread.Post([]() { simulationThread.clock.timeWarp *= 0.5; });
+    }
+
+    // Scrub the scripted orbits backwards / forwards by a minute of simulation time per press
+    if ((GLFW_KEY_LEFT_BRACKET == key || GLFW_KEY_RIGHT_BRACKET == key) && GLFW_PRESS == action)
+    {
+        double offset = GLFW_KEY_LEFT_BRACKET == key ? -60.0 : 60.0;
+
+        simulationThread.Post([offset]()
+        {
+            // Gravity positions can only be stepped forwards, not sought
+            if (SIMULATION_ORBITS != simulationMode)
+                return;
+
+            double time = std::max(0.0, simulationThread.clock.Time() + offset);
+            simulationThread.clock.Seek(time);
+            long long step = simulationThread.clock.StepCount();
+            CaptureSimulationState(previousState, time - simulationThread.clock.StepSize(), step - 1);
+            CaptureSimulationState(currentState, time, step);
+        });
+    }
+
+    // Simulation and render thread metrics
+    if (GLFW_KEY_M == key && GLFW_PRESS == action)
+    {
+        simulationThread.PrintMetrics();
+        TextureStreamer::Get().PrintStats();
+        UploadQueue::Get().PrintStats();
+        FrameScheduler::Get().PrintStats();
+        TextureArrayAllocator::Get().PrintStats();
+        earthSurface.PrintStats();
+        starField.PrintStats();
+        Profiler::Get().PrintStats();
+        PipelineStatistics::Get().PrintStats(SCREEN_WIDTH, SCREEN_HEIGHT);
+        OverdrawView::Get().PrintStats();
+        FrameArena::Get().PrintStats();
+        AllocationTracker::PrintStats();
+        FlightRecorder::Get().PrintStats();
+        InputRecorder::Get().PrintStats();
+        GL_TRACE_PRINT();
+    }
+
+    // Overdraw heatmap
+    if (GLFW_KEY_O == key && GLFW_PRESS == action)
+    {
+        OverdrawView::enabled = !OverdrawView::enabled;
+    }
+
+    // Profiler table (--profile)
+    if (GLFW_KEY_P == key && GLFW_PRESS == action)
+    {
+        Profiler::Get().showOverlay = !Profiler::Get().showOverlay;
+    }
+
     if (key >= 0 && key < 1024)
     {
         if (action == GLFW_PRESS)
@@ -576,6 +1416,9 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mode
 
 void MouseCallback(GLFWwindow* window, double xPos, double yPos)
 {
+    if (!InputRecorder::Get().Cursor(xPos, yPos))
+        return;
+
     if (firstMouse)
     {
         lastX = xPos;
@@ -593,6 +1436,198 @@ void MouseCallback(GLFWwindow* window, double xPos, double yPos)
 }
 
 
+// Seeds the N-body simulation with the sun and every scripted body at its current position and velocity
+void StartGravitySimulation()
+{
+    // The sun's mass is chosen so the first body keeps its scripted period: mu = n^2 * a^3 (with G = 1)
+    double a = sceneOrbits.semiMajorAxis[0];
+    double sunMass = sceneOrbits.meanMotion[0] * sceneOrbits.meanMotion[0] * a * a * a;
+
+    gravity = NBodySystem(1.0, 1e-4);
+    gravity.AddParticle(0.0, 0.0, 0.0, 0.0, 0.0, 0.0, sunMass);
+
+    // Velocities from a central difference of the scripted orbits
+    const double h = 1e-3;
+    OrbitPositions before, after;
+    OrbitPropagator::Propagate(sceneOrbits, simulationThread.clock.Time() - h, before);
+    OrbitPropagator::Propagate(sceneOrbits, simulationThread.clock.Time() + h, after);
+    OrbitPropagator::ResolveToRootFrame(sceneOrbits, before);
+    OrbitPropagator::ResolveToRootFrame(sceneOrbits, after);
+
+    for (size_t i = 0; i < sceneOrbits.Size(); i++)
+    {
+        gravity.AddParticle(currentState.x[i], currentState.y[i], currentState.z[i],
+                            (after.x[i] - before.x[i]) / (2.0 * h), (after.y[i] - before.y[i]) / (2.0 * h), (after.z[i] - before.z[i]) / (2.0 * h),
+                            sunMass * 1e-6);
+    }
+}
+// Fills state with the body positions of the active simulation mode at the given time and step. Simulation thread only
+void CaptureSimulationState(SimulationState& state, double time, long long step)
+{
+    state.time = time;
+    state.step = step;
+    state.Resize(sceneOrbits.Size());
+
+    if (SIMULATION_GRAVITY == simulationMode)
+    {
+        // Particle 0 is the sun, the rest follow the order of sceneOrbits
+        for (size_t i = 0; i < sceneOrbits.Size(); i++)
+        {
+            state.x[i] = gravity.x[i + 1] - gravity.x[0];
+            state.y[i] = gravity.y[i + 1] - gravity.y[0];
+            state.z[i] = gravity.z[i + 1] - gravity.z[0];
+        }
+    }
+    else
+    {
+        if (sceneEphemeris.Covers(time))
+        {
+            sceneEphemeris.Evaluate(time, scenePositions);
+        }
+        else
+        {
+            OrbitPropagator::Propagate(sceneOrbits, time, scenePositions);
+            OrbitPropagator::ResolveToRootFrame(sceneOrbits, scenePositions);
+        }
+
+        state.x = scenePositions.x;
+        state.y = scenePositions.y;
+        state.z = scenePositions.z;
+    }
+}
+
+// Runs the fixed steps due this frame as one batch. Only the last two states are ever interpolated, so only
+// those are captured: gravity integrates every step back to back, scripted orbits jump straight to the end
+void StepSimulation(int steps)
+{
+    if (0 == steps)
+        return;
+
+    double dt = simulationThread.clock.StepSize();
+    double endTime = simulationThread.clock.Time();
+    long long endStep = simulationThread.clock.StepCount();
+
+    if (SIMULATION_GRAVITY == simulationMode)
+    {
+        for (int i = 0; i < steps - 1; i++)
+            gravity.Step(dt);
+
+        CaptureSimulationState(previousState, endTime - dt, endStep - 1);
+        gravity.Step(dt);
+    }
+    else
+    {
+        CaptureSimulationState(previousState, endTime - dt, endStep - 1);
+    }
+
+    CaptureSimulationState(currentState, endTime, endStep);
+}
+
+// Per frame counters for the flight recorder, after the frame was presented
+void RecordFrameCounters(int simulationSteps)
+{
+    FlightRecorder::Get().Record("simulation_steps", simulationSteps);
+    FlightRecorder::Get().Record("upload_bytes", (double)UploadQueue::Get().FrameBytes());
+    FlightRecorder::Get().Record("scheduler_ms", FrameScheduler::Get().FrameWorkMs());
+#ifdef GL_TRACE
+    FlightRecorder::Get().Record("gl_calls", GLTrace::Get().FrameCalls());
+    FlightRecorder::Get().Record("gl_draws", GLTrace::Get().FrameDraws());
+    FlightRecorder::Get().Record("gl_redundant", GLTrace::Get().FrameRedundant());
+#endif
+}
+
+// The suite's cases besides the frames (--bench-suite). Run once everything is loaded, before the first frame
+void MeasureBenchSuite()
+{
+    for (const char* path : { "res/Planet/planet.obj", "res/Earth/Globe.obj", "res/Planet/SpaceShip-1.obj", "res/Rock/rock.obj" })
+    {
+        benchSuite.Measure(std::string("import ") + path, [path]()
+        {
+            Assimp::Importer importer;
+            if (!Model::Import(importer, path))
+                std::cerr << "ERROR: Can't import " << path << std::endl;
+        });
+    }
+
+    // Every source format there is of the scene's textures, decoded from memory so the disk isn't timed
+    for (const char* name : { "res/images/container2.png", "res/images/skybox1/right" })
+    {
+        std::string base = std::filesystem::path(name).replace_extension().string();
+
+        for (const char* extension : TEXTURE_SOURCE_EXTENSIONS)
+        {
+            MappedFile file(base + extension);
+            if (!file.IsOpen())
+                continue;
+
+            benchSuite.Measure("decode " + base + extension, [&file]()
+            {
+                int width, height, channels;
+                stbi_image_free(stbi_load_from_memory(file.Data(), (int)file.Size(), &width, &height, &channels, 3));
+            });
+        }
+    }
+
+    // Includes reading the sources. A driver shader cache (Mesa's) turns the runs after the first into cache hits, run
+    // with MESA_SHADER_CACHE_DISABLE=true to time the compiler itself
+    const char* shaders[][2] = { { "res/shaders/planet.vs", "res/shaders/planet.frag" }, { "res/shaders/sun.vs", "res/shaders/sun.frag" },
+                                 { "res/shaders/skybox.vs", "res/shaders/skybox.frag" }, { "res/shaders/star.vs", "res/shaders/star.frag" } };
+
+    for (const auto& pair : shaders)
+    {
+        benchSuite.Measure(std::string("compile ") + pair[1], [&pair]()
+        {
+            Shader shader(pair[0], pair[1]);
+            glDeleteProgram(shader.Program);
+        });
+    }
+
+    // Sphere() adds to the global mesh and prints its sizes: it starts from empty every run, without the output
+    benchSuite.Measure("Sphere()", []()
+    {
+        std::streambuf* output = std::cout.rdbuf(nullptr);
+        Sphere();
+        std::cout.rdbuf(output);
+    }, []()
+    {
+        vertices.clear();
+        texCoords.clear();
+        normals.clear();
+        indices.clear();
+    });
+
+    // The star cells culled to the view from points all along the camera path (needs a catalog, --stars)
+    if (starField.Valid())
+    {
+        std::vector<glm::mat4> views;
+
+        for (int view = 0; view < 360; view++)
+        {
+            glm::vec3 eye, target;
+            Benchmark::CameraPath(view / 360.0f, eye, target);
+            views.push_back(glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f)));
+        }
+
+        benchSuite.Measure("star field culling, 360 views", [&views]()
+        {
+            for (const glm::mat4& view : views)
+                starField.Select(view, camera.GetZoom(), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT);
+        });
+    }
+    else
+    {
+        // Otherwise it would only show up as missing against a baseline recorded with a catalog
+        std::cout << "Benchmark suite: star field culling skipped, no star catalog (--stars)" << std::endl;
+    }
+
+    OrbitElements belt;
+    OrbitPositions positions;
+    OrbitPropagator::RandomBelt(100000, belt);
+    benchSuite.Measure("orbit propagation, 100000 bodies", [&belt, &positions]()
+    {
+        OrbitPropagator::Propagate(belt, 1234.5, positions);
+    });
+}
 
 //// Handles user keyboard input. Supposed to be used every frame, so deltaTime can be calculated appropriately.
 //void keyboardInput(GLFWwindow* window, float deltaTime)
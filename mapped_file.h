@@ -0,0 +1,144 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <cstddef>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+// Read-only memory mapping of a whole file. Pages are loaded by the OS on first touch and shared with the page cache,
+// so opening a large asset costs nothing until it is read
+class MappedFile
+{
+public:
+    MappedFile( ) : data( nullptr ), size( 0 )
+    {
+    }
+
+    explicit MappedFile( const std::string &path ) : data( nullptr ), size( 0 )
+    {
+        Open( path );
+    }
+
+    ~MappedFile( )
+    {
+        Close( );
+    }
+
+    MappedFile( const MappedFile & ) = delete;
+    MappedFile &operator=( const MappedFile & ) = delete;
+
+    MappedFile( MappedFile &&other ) : data( other.data ), size( other.size )
+    {
+        other.data = nullptr;
+        other.size = 0;
+    }
+
+    MappedFile &operator=( MappedFile &&other )
+    {
+        if ( this != &other )
+        {
+            Close( );
+            data = other.data;
+            size = other.size;
+            other.data = nullptr;
+            other.size = 0;
+        }
+
+        return *this;
+    }
+
+    // Returns false if the file doesn't exist or is empty
+    bool Open( const std::string &path )
+    {
+        Close( );
+
+#ifdef _WIN32
+        HANDLE file = CreateFileA( path.c_str( ), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+        if ( INVALID_HANDLE_VALUE == file )
+        {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx( file, &fileSize );
+        HANDLE mapping = fileSize.QuadPart > 0 ? CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL ) : NULL;
+
+        if ( mapping )
+        {
+            data = ( const unsigned char * )MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+            size = data ? ( size_t )fileSize.QuadPart : 0;
+            CloseHandle( mapping );
+        }
+
+        CloseHandle( file );
+#else
+        int file = open( path.c_str( ), O_RDONLY );
+
+        if ( file < 0 )
+        {
+            return false;
+        }
+
+        struct stat info;
+
+        if ( 0 == fstat( file, &info ) && info.st_size > 0 )
+        {
+            void *mapped = mmap( nullptr, ( size_t )info.st_size, PROT_READ, MAP_PRIVATE, file, 0 );
+
+            if ( MAP_FAILED != mapped )
+            {
+                data = ( const unsigned char * )mapped;
+                size = ( size_t )info.st_size;
+            }
+        }
+
+        close( file );
+#endif
+
+        return nullptr != data;
+    }
+
+    void Close( )
+    {
+        if ( data )
+        {
+#ifdef _WIN32
+            UnmapViewOfFile( data );
+#else
+            munmap( ( void * )data, size );
+#endif
+        }
+
+        data = nullptr;
+        size = 0;
+    }
+
+    bool IsOpen( ) const
+    {
+        return nullptr != data;
+    }
+
+    const unsigned char *Data( ) const
+    {
+        return data;
+    }
+
+    size_t Size( ) const
+    {
+        return size;
+    }
+
+private:
+    const unsigned char *data;
+    size_t size;
+};
@@ -0,0 +1,417 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+
+#include "job_system.h"
+
+// Default Barnes-Hut opening angle. A cell is used as a single point mass when size / distance < theta
+const double NBODY_THETA = 0.5;
+
+// Particles per octree leaf. Leaves are summed directly
+const int NBODY_LEAF_SIZE = 8;
+
+// Particles per force task. Fixed, so tasks are the same whatever the thread count
+const size_t NBODY_TASK_SIZE = 1024;
+
+// Result of a simulation run
+struct NBodyReport
+{
+    size_t particles = 0;
+    int steps = 0;
+    double msPerStep = 0.0;
+    double particlesPerSecond = 0.0;
+    double initialEnergy = 0.0;
+    double finalEnergy = 0.0;
+
+    double EnergyDrift( ) const
+    {
+        return fabs( ( finalEnergy - initialEnergy ) / initialEnergy );
+    }
+
+    void Print( ) const
+    {
+        std::cout << "N-body: " << particles << " particles, " << steps << " steps, " << msPerStep << " ms/step, "
+                  << particlesPerSecond << " particle-steps/s, energy drift " << EnergyDrift( ) << std::endl;
+    }
+};
+
+// Gravitational simulation of point masses. Forces come from a Barnes-Hut octree rebuilt every step and the state is
+// advanced with a kick-drift-kick leapfrog, which is symplectic so the energy error stays bounded over long runs.
+// Every particle sums its forces in the same tree order and the tree only depends on the particle positions, so the
+// result is bit-for-bit the same whatever the number of threads.
+class NBodySystem
+{
+public:
+    // Particle state, structure of arrays
+    std::vector<double> x, y, z;
+    std::vector<double> vx, vy, vz;
+    std::vector<double> ax, ay, az;
+    std::vector<double> mass;
+
+    double gravitationalConstant;
+    double softening;
+    double theta;
+
+    NBodySystem( double G = 1.0, double _softening = 1e-3, double _theta = NBODY_THETA )
+    : gravitationalConstant( G ), softening( _softening ), theta( _theta ), accelerationsValid( false )
+    {
+    }
+
+    int AddParticle( double px, double py, double pz, double velX, double velY, double velZ, double m )
+    {
+        x.push_back( px ); y.push_back( py ); z.push_back( pz );
+        vx.push_back( velX ); vy.push_back( velY ); vz.push_back( velZ );
+        ax.push_back( 0.0 ); ay.push_back( 0.0 ); az.push_back( 0.0 );
+        potential.push_back( 0.0 );
+        mass.push_back( m );
+        accelerationsValid = false;
+
+        return ( int )mass.size( ) - 1;
+    }
+
+    size_t Size( ) const
+    {
+        return mass.size( );
+    }
+
+    // Advances the system by dt with one kick-drift-kick step
+    void Step( double dt )
+    {
+        if ( !accelerationsValid )
+        {
+            ComputeForces( );
+        }
+
+        size_t n = Size( );
+        double halfDt = 0.5 * dt;
+
+        JobSystem::Get( ).ParallelFor( n, NBODY_TASK_SIZE * 16, [&]( size_t begin, size_t end )
+        {
+            for ( size_t i = begin; i < end; i++ )
+            {
+                vx[i] += ax[i] * halfDt; vy[i] += ay[i] * halfDt; vz[i] += az[i] * halfDt;
+                x[i] += vx[i] * dt; y[i] += vy[i] * dt; z[i] += vz[i] * dt;
+            }
+        } );
+
+        ComputeForces( );
+
+        JobSystem::Get( ).ParallelFor( n, NBODY_TASK_SIZE * 16, [&]( size_t begin, size_t end )
+        {
+            for ( size_t i = begin; i < end; i++ )
+            {
+                vx[i] += ax[i] * halfDt; vy[i] += ay[i] * halfDt; vz[i] += az[i] * halfDt;
+            }
+        } );
+    }
+
+    // Total kinetic plus potential energy. The potential comes from the same tree walk as the forces
+    double TotalEnergy( )
+    {
+        if ( !accelerationsValid )
+        {
+            ComputeForces( );
+        }
+
+        // Partial sums per fixed block, added up in block order so the total doesn't depend on scheduling
+        size_t blockCount = ( Size( ) + NBODY_TASK_SIZE - 1 ) / NBODY_TASK_SIZE;
+        std::vector<double> partial( blockCount, 0.0 );
+
+        JobSystem::Get( ).ParallelFor( Size( ), NBODY_TASK_SIZE, [&]( size_t begin, size_t end )
+        {
+            double sum = 0.0;
+
+            for ( size_t i = begin; i < end; i++ )
+            {
+                double v2 = vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i];
+                sum += 0.5 * mass[i] * v2 + 0.5 * mass[i] * potential[i];
+            }
+
+            partial[begin / NBODY_TASK_SIZE] = sum;
+        } );
+
+        double energy = 0.0;
+
+        for ( double sum : partial )
+        {
+            energy += sum;
+        }
+
+        return energy;
+    }
+
+    // Runs steps steps of dt and reports throughput and energy drift
+    NBodyReport Run( int steps, double dt )
+    {
+        NBodyReport report;
+        report.particles = Size( );
+        report.steps = steps;
+        report.initialEnergy = TotalEnergy( );
+
+        auto start = std::chrono::high_resolution_clock::now( );
+
+        for ( int i = 0; i < steps; i++ )
+        {
+            Step( dt );
+        }
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now( ) - start;
+
+        report.msPerStep = elapsed.count( ) / std::max( 1, steps );
+        report.particlesPerSecond = report.particles * 1000.0 / std::max( report.msPerStep, 1e-9 );
+        report.finalEnergy = TotalEnergy( );
+
+        return report;
+    }
+
+    // Simulates a central mass with a disc of particleCount asteroids on roughly circular orbits and prints the report
+    static void RunBenchmark( size_t particleCount = 100000, int steps = 20, double openingAngle = NBODY_THETA )
+    {
+        NBodySystem system( 1.0, 1e-3, openingAngle );
+        system.AddParticle( 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0 );
+
+        unsigned int seed = 4321;
+        auto random = [&seed]( ) { seed = seed * 1664525u + 1013904223u; return ( seed >> 8 ) / 16777216.0; };
+
+        for ( size_t i = 0; i < particleCount; i++ )
+        {
+            double r = 1.0 + 2.0 * random( );
+            double angle = 6.283185307179586 * random( );
+            double v = sqrt( 1.0 / r );
+
+            system.AddParticle( r * cos( angle ), 0.02 * ( random( ) - 0.5 ), r * sin( angle ),
+                                -v * sin( angle ), 0.0, v * cos( angle ), 1e-9 );
+        }
+
+        NBodyReport report = system.Run( steps, 1e-3 );
+        std::cout << "Opening angle " << openingAngle << ", " << JobSystem::Get( ).ThreadCount( ) << " threads" << std::endl;
+        report.Print( );
+    }
+
+private:
+    // Octree nodes are stored depth first. Skipping a subtree is a jump to next, descending is a step to the following
+    // node, so the walk needs no stack
+    struct Node
+    {
+        double comX, comY, comZ;
+        double mass;
+        double size;
+        uint32_t begin, end;    // Range in the sorted particle order
+        uint32_t next;
+        bool leaf;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> rank;     // Inverse of order
+    std::vector<uint64_t> keys;
+    std::vector<double> potential;
+    bool accelerationsValid;
+
+    double rootX, rootY, rootZ, rootSize;
+
+    // Spreads the low 21 bits of v so there are two zero bits between each
+    static uint64_t SpreadBits( uint64_t v )
+    {
+        v &= 0x1fffff;
+        v = ( v | v << 32 ) & 0x1f00000000ffffULL;
+        v = ( v | v << 16 ) & 0x1f0000ff0000ffULL;
+        v = ( v | v << 8 ) & 0x100f00f00f00f00fULL;
+        v = ( v | v << 4 ) & 0x10c30c30c30c30c3ULL;
+        v = ( v | v << 2 ) & 0x1249249249249249ULL;
+
+        return v;
+    }
+
+    // Sorts the particles along a Morton curve and builds the tree over the sorted order
+    void BuildTree( )
+    {
+        size_t n = Size( );
+
+        double minX = x[0], minY = y[0], minZ = z[0];
+        double maxX = x[0], maxY = y[0], maxZ = z[0];
+
+        for ( size_t i = 1; i < n; i++ )
+        {
+            minX = std::min( minX, x[i] ); maxX = std::max( maxX, x[i] );
+            minY = std::min( minY, y[i] ); maxY = std::max( maxY, y[i] );
+            minZ = std::min( minZ, z[i] ); maxZ = std::max( maxZ, z[i] );
+        }
+
+        rootSize = std::max( { maxX - minX, maxY - minY, maxZ - minZ, 1e-12 } ) * 1.0001;
+        rootX = minX; rootY = minY; rootZ = minZ;
+
+        keys.resize( n );
+        order.resize( n );
+        double scale = ( double )( 1 << 21 ) / rootSize;
+
+        JobSystem::Get( ).ParallelFor( n, NBODY_TASK_SIZE * 16, [&]( size_t begin, size_t end )
+        {
+            for ( size_t i = begin; i < end; i++ )
+            {
+                uint64_t ix = std::min<uint64_t>( ( uint64_t )( ( x[i] - rootX ) * scale ), ( 1 << 21 ) - 1 );
+                uint64_t iy = std::min<uint64_t>( ( uint64_t )( ( y[i] - rootY ) * scale ), ( 1 << 21 ) - 1 );
+                uint64_t iz = std::min<uint64_t>( ( uint64_t )( ( z[i] - rootZ ) * scale ), ( 1 << 21 ) - 1 );
+                keys[i] = SpreadBits( ix ) << 2 | SpreadBits( iy ) << 1 | SpreadBits( iz );
+                order[i] = ( uint32_t )i;
+            }
+        } );
+
+        // Ties broken by index so the order is fully determined by the positions
+        std::sort( order.begin( ), order.end( ), [this]( uint32_t a, uint32_t b )
+        {
+            return keys[a] < keys[b] || ( keys[a] == keys[b] && a < b );
+        } );
+
+        rank.resize( n );
+
+        for ( size_t k = 0; k < n; k++ )
+        {
+            rank[order[k]] = ( uint32_t )k;
+        }
+
+        nodes.clear( );
+        BuildNode( 0, ( uint32_t )n, 0 );
+    }
+
+    uint32_t BuildNode( uint32_t begin, uint32_t end, int level )
+    {
+        uint32_t index = ( uint32_t )nodes.size( );
+        nodes.push_back( Node( ) );
+
+        Node node;
+        node.begin = begin;
+        node.end = end;
+        node.size = rootSize / ( double )( 1 << level );
+        node.leaf = ( end - begin <= ( uint32_t )NBODY_LEAF_SIZE ) || level >= 21;
+        node.mass = 0.0;
+        node.comX = node.comY = node.comZ = 0.0;
+
+        if ( node.leaf )
+        {
+            for ( uint32_t k = begin; k < end; k++ )
+            {
+                uint32_t i = order[k];
+                node.mass += mass[i];
+                node.comX += mass[i] * x[i]; node.comY += mass[i] * y[i]; node.comZ += mass[i] * z[i];
+            }
+        }
+        else
+        {
+            // Children are the runs of equal 3-bit Morton digits at this level
+            int shift = 3 * ( 20 - level );
+            uint32_t childBegin = begin;
+
+            while ( childBegin < end )
+            {
+                uint64_t digit = keys[order[childBegin]] >> shift & 7;
+                uint32_t childEnd = childBegin + 1;
+
+                while ( childEnd < end && ( keys[order[childEnd]] >> shift & 7 ) == digit )
+                {
+                    childEnd++;
+                }
+
+                uint32_t child = BuildNode( childBegin, childEnd, level + 1 );
+                node.mass += nodes[child].mass;
+                node.comX += nodes[child].mass * nodes[child].comX;
+                node.comY += nodes[child].mass * nodes[child].comY;
+                node.comZ += nodes[child].mass * nodes[child].comZ;
+                childBegin = childEnd;
+            }
+        }
+
+        if ( node.mass > 0.0 )
+        {
+            node.comX /= node.mass; node.comY /= node.mass; node.comZ /= node.mass;
+        }
+
+        node.next = ( uint32_t )nodes.size( );
+        nodes[index] = node;
+
+        return index;
+    }
+
+    void ComputeForces( )
+    {
+        if ( 0 == Size( ) )
+        {
+            return;
+        }
+
+        BuildTree( );
+
+        JobSystem::Get( ).ParallelFor( Size( ), NBODY_TASK_SIZE, [this]( size_t begin, size_t end )
+        {
+            for ( size_t i = begin; i < end; i++ )
+            {
+                AccumulateForce( i );
+            }
+        } );
+
+        accelerationsValid = true;
+    }
+
+    void AccumulateForce( size_t i )
+    {
+        double px = x[i], py = y[i], pz = z[i];
+        double eps2 = softening * softening;
+        double theta2 = theta * theta;
+        double accX = 0.0, accY = 0.0, accZ = 0.0, phi = 0.0;
+        uint32_t self = rank[i];
+
+        uint32_t index = 0;
+
+        while ( index < nodes.size( ) )
+        {
+            const Node &node = nodes[index];
+            double dx = node.comX - px, dy = node.comY - py, dz = node.comZ - pz;
+            double d2 = dx * dx + dy * dy + dz * dz;
+
+            if ( node.leaf )
+            {
+                for ( uint32_t k = node.begin; k < node.end; k++ )
+                {
+                    uint32_t j = order[k];
+
+                    if ( j == i )
+                    {
+                        continue;
+                    }
+
+                    double ex = x[j] - px, ey = y[j] - py, ez = z[j] - pz;
+                    double invR = 1.0 / sqrt( ex * ex + ey * ey + ez * ez + eps2 );
+                    double mInvR3 = mass[j] * invR * invR * invR;
+                    accX += ex * mInvR3; accY += ey * mInvR3; accZ += ez * mInvR3;
+                    phi -= mass[j] * invR;
+                }
+
+                index = node.next;
+            }
+            else if ( node.size * node.size < theta2 * d2 && ( self < node.begin || self >= node.end ) )
+            {
+                double invR = 1.0 / sqrt( d2 + eps2 );
+                double mInvR3 = node.mass * invR * invR * invR;
+                accX += dx * mInvR3; accY += dy * mInvR3; accZ += dz * mInvR3;
+                phi -= node.mass * invR;
+
+                index = node.next;
+            }
+            else
+            {
+                index++;
+            }
+        }
+
+        ax[i] = gravitationalConstant * accX;
+        ay[i] = gravitationalConstant * accY;
+        az[i] = gravitationalConstant * accZ;
+        potential[i] = gravitationalConstant * phi;
+    }
+};
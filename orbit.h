@@ -0,0 +1,364 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <cmath>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+#include "job_system.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define ORBIT_USE_SSE2
+#endif
+
+// Number of Newton steps used when solving Kepler's equation. Fixed so every lane does the same work (no branches).
+// Five steps from the E0 = M + e*sin(M) starting guess are enough for float precision up to e ~ 0.9
+const int KEPLER_ITERATIONS = 5;
+
+const double ORBIT_TWO_PI = 6.283185307179586;
+
+// Simulation time at which the benchmark's accuracy check is repeated: past 2^31 revolutions for every body of the
+// benchmark belt, as reached by long time warped runs
+const double ORBIT_VERIFY_LARGE_TIME = 1e12;
+
+// Orbital elements of N bodies stored as a structure of arrays so they can be propagated 4 at a time.
+// Angles are in radians, time in seconds of simulation time. Positions are produced in the parent's frame
+// using the same convention as the rest of the scene: the reference plane is XZ and +Y is up.
+class OrbitElements
+{
+public:
+    // Classical elements
+    std::vector<float> semiMajorAxis;
+    std::vector<float> eccentricity;
+    std::vector<double> meanAnomalyAtEpoch;
+    std::vector<double> meanMotion;
+
+    // Orientation derived from inclination, longitude of ascending node and argument of periapsis.
+    // P points to the periapsis, Q is 90 degrees ahead of it in the direction of motion
+    std::vector<float> px, py, pz;
+    std::vector<float> qx, qy, qz;
+
+    // Semi-minor axis, cached as a * sqrt(1 - e^2)
+    std::vector<float> semiMinorAxis;
+
+    // Index of the body this one orbits, -1 for bodies fixed at the origin. Parents must be added before their children
+    std::vector<int> parent;
+
+    // Adds a body and returns its index
+    int Add( float a, float e, float inclination, float ascendingNode, float argPeriapsis, double meanAnomaly, double period, int parentIndex = -1 )
+    {
+        double cO = cos( ascendingNode ), sO = sin( ascendingNode );
+        double cw = cos( argPeriapsis ), sw = sin( argPeriapsis );
+        double ci = cos( inclination ), si = sin( inclination );
+
+        // Perifocal to reference frame (z up), then swizzled to y up: (x, y, z) -> (x, z, -y)
+        double Px = cO * cw - sO * sw * ci;
+        double Py = sO * cw + cO * sw * ci;
+        double Pz = sw * si;
+        double Qx = -cO * sw - sO * cw * ci;
+        double Qy = -sO * sw + cO * cw * ci;
+        double Qz = cw * si;
+
+        semiMajorAxis.push_back( a );
+        eccentricity.push_back( e );
+        meanAnomalyAtEpoch.push_back( meanAnomaly );
+        meanMotion.push_back( ORBIT_TWO_PI / period );
+        px.push_back( ( float )Px ); py.push_back( ( float )Pz ); pz.push_back( ( float )-Py );
+        qx.push_back( ( float )Qx ); qy.push_back( ( float )Qz ); qz.push_back( ( float )-Qy );
+        semiMinorAxis.push_back( ( float )( a * sqrt( 1.0 - ( double )e * e ) ) );
+        parent.push_back( parentIndex );
+
+        return ( int )parent.size( ) - 1;
+    }
+
+    size_t Size( ) const
+    {
+        return parent.size( );
+    }
+};
+
+// Output positions of a propagation, also structure of arrays
+struct OrbitPositions
+{
+    std::vector<float> x, y, z;
+
+    void Resize( size_t n )
+    {
+        x.resize( n );
+        y.resize( n );
+        z.resize( n );
+    }
+};
+
+class OrbitPropagator
+{
+public:
+    // Computes parent-relative positions of every body at time t. Large batches are split over the job system
+    static void Propagate( const OrbitElements &elements, double t, OrbitPositions &out )
+    {
+        out.Resize( elements.Size( ) );
+
+        // Below this a task costs more than it saves. Kept a multiple of 4 so only the last chunk has a scalar tail
+        const size_t bodiesPerTask = 16384;
+
+        JobSystem::Get( ).ParallelFor( elements.Size( ), bodiesPerTask, [&]( size_t begin, size_t end )
+        {
+            PropagateRange( elements, t, begin, end, out );
+        } );
+    }
+
+    // Adds each parent's position to its children so the output is in the frame of the root body.
+    // Relies on parents being stored before their children
+    static void ResolveToRootFrame( const OrbitElements &elements, OrbitPositions &positions )
+    {
+        for ( size_t i = 0; i < elements.Size( ); i++ )
+        {
+            int p = elements.parent[i];
+
+            if ( p >= 0 )
+            {
+                positions.x[i] += positions.x[p];
+                positions.y[i] += positions.y[p];
+                positions.z[i] += positions.z[p];
+            }
+        }
+    }
+
+    // Propagates bodies [begin, end)
+    static void PropagateRange( const OrbitElements &elements, double t, size_t begin, size_t end, OrbitPositions &out )
+    {
+        size_t i = begin;
+
+#ifdef ORBIT_USE_SSE2
+        for ( ; i + 4 <= end; i += 4 )
+        {
+            PropagateLanes( elements, t, i, &out.x[i], &out.y[i], &out.z[i] );
+        }
+#endif
+
+        for ( ; i < end; i++ )
+        {
+            PropagateScalar( elements, t, i, out.x[i], out.y[i], out.z[i] );
+        }
+    }
+
+    // Double precision reference solution of Kepler's equation, iterated until it stops changing
+    static double SolveKeplerReference( double M, double e )
+    {
+        double E = e < 0.8 ? M : M_PI;
+
+        for ( int i = 0; i < 100; i++ )
+        {
+            double dE = ( E - e * sin( E ) - M ) / ( 1.0 - e * cos( E ) );
+            E -= dE;
+
+            if ( fabs( dE ) < 1e-15 )
+            {
+                break;
+            }
+        }
+
+        return E;
+    }
+
+    // Double precision reference position of a single body relative to its parent
+    static void PositionReference( const OrbitElements &elements, size_t i, double t, double &x, double &y, double &z )
+    {
+        double M = fmod( elements.meanAnomalyAtEpoch[i] + elements.meanMotion[i] * t, ORBIT_TWO_PI );
+        double e = elements.eccentricity[i];
+        double E = SolveKeplerReference( M, e );
+        double u = elements.semiMajorAxis[i] * ( cos( E ) - e );
+        double v = elements.semiMinorAxis[i] * sin( E );
+
+        x = u * elements.px[i] + v * elements.qx[i];
+        y = u * elements.py[i] + v * elements.qy[i];
+        z = u * elements.pz[i] + v * elements.qz[i];
+    }
+
+    // Returns the largest position error relative to the orbit's semi-major axis against the double precision reference
+    static double VerifyAccuracy( const OrbitElements &elements, double t )
+    {
+        OrbitPositions positions;
+        Propagate( elements, t, positions );
+
+        double maxError = 0.0;
+
+        for ( size_t i = 0; i < elements.Size( ); i++ )
+        {
+            double x, y, z;
+            PositionReference( elements, i, t, x, y, z );
+
+            double dx = x - positions.x[i], dy = y - positions.y[i], dz = z - positions.z[i];
+            double error = sqrt( dx * dx + dy * dy + dz * dz ) / elements.semiMajorAxis[i];
+
+            // A NaN position is reported, not skipped
+            if ( !( error <= maxError ) )
+            {
+                maxError = error;
+            }
+        }
+
+        return maxError;
+    }
+
+    // Adds bodyCount bodies on random orbits, the same ones every time
+    static void RandomBelt( size_t bodyCount, OrbitElements &elements )
+    {
+        unsigned int seed = 12345;
+        auto random = [&seed]( ) { seed = seed * 1664525u + 1013904223u; return ( seed >> 8 ) / 16777216.0f; };
+
+        for ( size_t i = 0; i < bodyCount; i++ )
+        {
+            float a = 50.0f + 100.0f * random( );
+            elements.Add( a, 0.9f * random( ), 0.3f * random( ), 6.28f * random( ), 6.28f * random( ), 6.28 * random( ), 10.0 + 100.0 * random( ) );
+        }
+    }
+
+    // Builds a random belt of bodyCount bodies and reports the propagation time per frame and the accuracy
+    static void RunBenchmark( size_t bodyCount = 1000000, int frames = 100 )
+    {
+        OrbitElements elements;
+        RandomBelt( bodyCount, elements );
+
+        OrbitPositions positions;
+        Propagate( elements, 0.0, positions ); // Warm up
+
+        auto start = std::chrono::high_resolution_clock::now( );
+
+        for ( int frame = 0; frame < frames; frame++ )
+        {
+            Propagate( elements, frame / 60.0, positions );
+        }
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now( ) - start;
+
+        std::cout << "Orbit propagation: " << bodyCount << " bodies, " << elapsed.count( ) / frames << " ms/frame on "
+                  << JobSystem::Get( ).ThreadCount( ) << " threads" << std::endl;
+        std::cout << "Max error vs double precision reference: " << VerifyAccuracy( elements, 1234.5 ) << " (relative to a), "
+                  << VerifyAccuracy( elements, ORBIT_VERIFY_LARGE_TIME ) << " past 2^31 revolutions" << std::endl;
+    }
+
+private:
+    // Mean anomaly at time t reduced to [-pi, pi). Done in double because n * t grows without bound under time warp
+    static float ReducedMeanAnomaly( const OrbitElements &elements, size_t i, double t )
+    {
+        double M = elements.meanAnomalyAtEpoch[i] + elements.meanMotion[i] * t;
+        M -= ORBIT_TWO_PI * floor( M / ORBIT_TWO_PI + 0.5 );
+
+        return ( float )M;
+    }
+
+    static void PropagateScalar( const OrbitElements &elements, double t, size_t i, float &x, float &y, float &z )
+    {
+        float M = ReducedMeanAnomaly( elements, i, t );
+        float e = elements.eccentricity[i];
+        float E = M + e * sinf( M );
+
+        for ( int k = 0; k < KEPLER_ITERATIONS; k++ )
+        {
+            E -= ( E - e * sinf( E ) - M ) / ( 1.0f - e * cosf( E ) );
+        }
+
+        float u = elements.semiMajorAxis[i] * ( cosf( E ) - e );
+        float v = elements.semiMinorAxis[i] * sinf( E );
+
+        x = u * elements.px[i] + v * elements.qx[i];
+        y = u * elements.py[i] + v * elements.qy[i];
+        z = u * elements.pz[i] + v * elements.qz[i];
+    }
+
+#ifdef ORBIT_USE_SSE2
+    // sin and cos of 4 angles in roughly [-2pi, 2pi]. Reduces by quadrant (Cody-Waite) and evaluates minimax
+    // polynomials on [-pi/4, pi/4], accurate to a couple of ulp
+    static inline void SinCos4( __m128 x, __m128 &s, __m128 &c )
+    {
+        const __m128 twoOverPi = _mm_set1_ps( 0.636619772f );
+        const __m128 piOver2Hi = _mm_set1_ps( 1.5703125f );
+        const __m128 piOver2Mid = _mm_set1_ps( 4.83751296997e-4f );
+        const __m128 piOver2Lo = _mm_set1_ps( 7.54978995489e-8f );
+
+        __m128i q = _mm_cvtps_epi32( _mm_mul_ps( x, twoOverPi ) );
+        __m128 qf = _mm_cvtepi32_ps( q );
+
+        __m128 r = _mm_sub_ps( x, _mm_mul_ps( qf, piOver2Hi ) );
+        r = _mm_sub_ps( r, _mm_mul_ps( qf, piOver2Mid ) );
+        r = _mm_sub_ps( r, _mm_mul_ps( qf, piOver2Lo ) );
+        __m128 r2 = _mm_mul_ps( r, r );
+
+        // sin(r) = r + r^3 * (s1 + r^2 * (s2 + r^2 * s3))
+        __m128 ps = _mm_set1_ps( -1.9515295891e-4f );
+        ps = _mm_add_ps( _mm_mul_ps( ps, r2 ), _mm_set1_ps( 8.3321608736e-3f ) );
+        ps = _mm_add_ps( _mm_mul_ps( ps, r2 ), _mm_set1_ps( -1.6666654611e-1f ) );
+        ps = _mm_add_ps( _mm_mul_ps( _mm_mul_ps( ps, r2 ), r ), r );
+
+        // cos(r) = 1 - r^2 / 2 + r^4 * (c1 + r^2 * (c2 + r^2 * c3))
+        __m128 pc = _mm_set1_ps( 2.443315711809948e-5f );
+        pc = _mm_add_ps( _mm_mul_ps( pc, r2 ), _mm_set1_ps( -1.388731625493765e-3f ) );
+        pc = _mm_add_ps( _mm_mul_ps( pc, r2 ), _mm_set1_ps( 4.166664568298827e-2f ) );
+        pc = _mm_mul_ps( _mm_mul_ps( pc, r2 ), r2 );
+        pc = _mm_add_ps( _mm_sub_ps( pc, _mm_mul_ps( r2, _mm_set1_ps( 0.5f ) ) ), _mm_set1_ps( 1.0f ) );
+
+        // Quadrant 1 and 3 swap sin and cos, quadrant 1 and 2 negate cos, quadrant 2 and 3 negate sin
+        __m128 swap = _mm_castsi128_ps( _mm_cmpeq_epi32( _mm_and_si128( q, _mm_set1_epi32( 1 ) ), _mm_set1_epi32( 1 ) ) );
+        __m128 sinVal = _mm_or_ps( _mm_and_ps( swap, pc ), _mm_andnot_ps( swap, ps ) );
+        __m128 cosVal = _mm_or_ps( _mm_and_ps( swap, ps ), _mm_andnot_ps( swap, pc ) );
+
+        __m128 sinSign = _mm_castsi128_ps( _mm_slli_epi32( _mm_and_si128( q, _mm_set1_epi32( 2 ) ), 30 ) );
+        __m128 cosSign = _mm_castsi128_ps( _mm_slli_epi32( _mm_and_si128( _mm_add_epi32( q, _mm_set1_epi32( 1 ) ), _mm_set1_epi32( 2 ) ), 30 ) );
+
+        s = _mm_xor_ps( sinVal, sinSign );
+        c = _mm_xor_ps( cosVal, cosSign );
+    }
+
+    // Same as ReducedMeanAnomaly for two bodies, returned in the low half of the register. The turns are rounded in
+    // double by adding and subtracting 1.5 * 2^52, so they don't saturate past 2^31 like an int32 conversion would;
+    // from 2^51 on a double is a whole number already and is kept as it is
+    static inline __m128 ReducedMeanAnomaly2( const OrbitElements &elements, size_t i, double t )
+    {
+        const __m128d magic = _mm_set1_pd( 6755399441055744.0 );
+        const __m128d whole = _mm_set1_pd( 2251799813685248.0 );
+        const __m128d absMask = _mm_castsi128_pd( _mm_set1_epi64x( 0x7fffffffffffffffLL ) );
+
+        __m128d M = _mm_add_pd( _mm_loadu_pd( &elements.meanAnomalyAtEpoch[i] ), _mm_mul_pd( _mm_loadu_pd( &elements.meanMotion[i] ), _mm_set1_pd( t ) ) );
+        __m128d x = _mm_mul_pd( M, _mm_set1_pd( 1.0 / ORBIT_TWO_PI ) );
+        __m128d rounded = _mm_sub_pd( _mm_add_pd( x, magic ), magic );
+        __m128d large = _mm_cmpge_pd( _mm_and_pd( x, absMask ), whole );
+        __m128d turns = _mm_or_pd( _mm_and_pd( large, x ), _mm_andnot_pd( large, rounded ) );
+        M = _mm_sub_pd( M, _mm_mul_pd( turns, _mm_set1_pd( ORBIT_TWO_PI ) ) );
+
+        return _mm_cvtpd_ps( M );
+    }
+
+    static inline void PropagateLanes( const OrbitElements &elements, double t, size_t i, float *x, float *y, float *z )
+    {
+        __m128 M = _mm_movelh_ps( ReducedMeanAnomaly2( elements, i, t ), ReducedMeanAnomaly2( elements, i + 2, t ) );
+        __m128 e = _mm_loadu_ps( &elements.eccentricity[i] );
+        __m128 one = _mm_set1_ps( 1.0f );
+        __m128 sinE, cosE;
+
+        SinCos4( M, sinE, cosE );
+        __m128 E = _mm_add_ps( M, _mm_mul_ps( e, sinE ) );
+
+        for ( int k = 0; k < KEPLER_ITERATIONS; k++ )
+        {
+            SinCos4( E, sinE, cosE );
+            __m128 f = _mm_sub_ps( _mm_sub_ps( E, _mm_mul_ps( e, sinE ) ), M );
+            __m128 df = _mm_sub_ps( one, _mm_mul_ps( e, cosE ) );
+            E = _mm_sub_ps( E, _mm_div_ps( f, df ) );
+        }
+
+        SinCos4( E, sinE, cosE );
+
+        __m128 u = _mm_mul_ps( _mm_loadu_ps( &elements.semiMajorAxis[i] ), _mm_sub_ps( cosE, e ) );
+        __m128 v = _mm_mul_ps( _mm_loadu_ps( &elements.semiMinorAxis[i] ), sinE );
+
+        _mm_storeu_ps( x, _mm_add_ps( _mm_mul_ps( u, _mm_loadu_ps( &elements.px[i] ) ), _mm_mul_ps( v, _mm_loadu_ps( &elements.qx[i] ) ) ) );
+        _mm_storeu_ps( y, _mm_add_ps( _mm_mul_ps( u, _mm_loadu_ps( &elements.py[i] ) ), _mm_mul_ps( v, _mm_loadu_ps( &elements.qy[i] ) ) ) );
+        _mm_storeu_ps( z, _mm_add_ps( _mm_mul_ps( u, _mm_loadu_ps( &elements.pz[i] ) ), _mm_mul_ps( v, _mm_loadu_ps( &elements.qz[i] ) ) ) );
+    }
+#endif
+};
@@ -0,0 +1,10 @@
+#version 330 core
+out vec4 FragColor;
+
+// Heatmap colour of the fragment count being drawn
+uniform vec4 color;
+
+void main()
+{
+    FragColor = color;
+}
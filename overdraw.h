@@ -0,0 +1,245 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+
+#include <GL/glew.h>
+
+// Fragment counts shown with their own colour. The last level stands for that many or more
+const int OVERDRAW_LEVELS = 9;
+
+// Heatmap colours by fragment count: nothing drawn, then blue through red to white
+const GLfloat OVERDRAW_PALETTE[OVERDRAW_LEVELS][3] =
+{
+    { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.6f }, { 0.0f, 0.5f, 1.0f }, { 0.0f, 0.8f, 0.3f }, { 0.6f, 0.9f, 0.0f },
+    { 1.0f, 0.8f, 0.0f }, { 1.0f, 0.4f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f }
+};
+
+// Frames of occlusion queries in flight, read when their slot comes round again or dropped if not done
+const int OVERDRAW_FRAMES_IN_FLIGHT = 3;
+
+// Overdraw heatmap (--overdraw, O). Between Begin and Resolve every fragment rasterized adds one to the stencil value of
+// its pixel, whether it then passes the depth test or not, so the stencil buffer ends up holding how many times each
+// pixel was drawn with the current depth setup and draw order. Resolve replaces the frame with a colour per count, one
+// full screen triangle per level with the stencil test picking its pixels, and an occlusion query on each gives how
+// many pixels have that count: a histogram of the depth complexity without reading the frame back. Needs a stencil
+// buffer. Used from the GL thread only.
+class OverdrawView
+{
+public:
+    static inline bool enabled = false;
+
+    static OverdrawView &Get( )
+    {
+        static OverdrawView instance;
+
+        return instance;
+    }
+
+    // Starts counting. Call after the frame is cleared, before the first pass
+    void Begin( )
+    {
+        counting = enabled;
+
+        if ( !counting )
+        {
+            return;
+        }
+
+        glClearStencil( 0 );
+        glStencilMask( 0xFF );
+        glClear( GL_STENCIL_BUFFER_BIT );
+        glEnable( GL_STENCIL_TEST );
+        glStencilFunc( GL_ALWAYS, 0, 0xFF );
+        glStencilOp( GL_KEEP, GL_INCR, GL_INCR );
+    }
+
+    // Draws the counts over the frame with a shader like overdraw.vs/overdraw.frag and stops counting
+    void Resolve( GLuint program )
+    {
+        if ( !counting )
+        {
+            return;
+        }
+
+        counting = false;
+
+        if ( 0 == vao )
+        {
+            // The full screen triangle comes from gl_VertexID, but core profile draws need a vertex array bound
+            glGenVertexArrays( 1, &vao );
+        }
+
+        current = ( current + 1 ) % OVERDRAW_FRAMES_IN_FLIGHT;
+        Slot &slot = slots[current];
+
+        if ( slot.pending )
+        {
+            Collect( slot, false );
+        }
+
+        if ( 0 == slot.queries[0] )
+        {
+            glGenQueries( OVERDRAW_LEVELS, slot.queries );
+        }
+
+        GLboolean depthTest = glIsEnabled( GL_DEPTH_TEST );
+        glDisable( GL_DEPTH_TEST );
+        glStencilOp( GL_KEEP, GL_KEEP, GL_KEEP );
+        glUseProgram( program );
+        glBindVertexArray( vao );
+
+        GLint colorLocation = glGetUniformLocation( program, "color" );
+
+        for ( int level = 0; level < OVERDRAW_LEVELS; level++ )
+        {
+            // The last level takes every count from there up: level <= stencil
+            glStencilFunc( level + 1 < OVERDRAW_LEVELS ? GL_EQUAL : GL_LEQUAL, level, 0xFF );
+            glUniform4f( colorLocation, OVERDRAW_PALETTE[level][0], OVERDRAW_PALETTE[level][1], OVERDRAW_PALETTE[level][2], 1.0f );
+
+            glBeginQuery( GL_SAMPLES_PASSED, slot.queries[level] );
+            glDrawArrays( GL_TRIANGLES, 0, 3 );
+            glEndQuery( GL_SAMPLES_PASSED );
+        }
+
+        glBindVertexArray( 0 );
+        glDisable( GL_STENCIL_TEST );
+
+        if ( depthTest )
+        {
+            glEnable( GL_DEPTH_TEST );
+        }
+
+        slot.pending = true;
+    }
+
+    // Reads the frames still in flight, waiting for them. For the end of a run
+    void Finish( )
+    {
+        for ( Slot &slot : slots )
+        {
+            if ( slot.pending )
+            {
+                Collect( slot, true );
+            }
+        }
+    }
+
+    void PrintStats( )
+    {
+        if ( 0 == frames )
+        {
+            return;
+        }
+
+        std::cout << "Overdraw over " << frames << " frames (" << dropped << " dropped): " << FragmentsPerCoveredPixel( )
+                  << " fragments per covered pixel, " << 100.0 * Share( OVERDRAW_LEVELS - 1 ) << "% of the screen drawn "
+                  << OVERDRAW_LEVELS - 1 << "+ times" << std::endl;
+        std::cout << "  share of pixels by count:";
+
+        for ( int level = 0; level < OVERDRAW_LEVELS; level++ )
+        {
+            std::cout << " " << level << ( level + 1 < OVERDRAW_LEVELS ? "" : "+" ) << ": " << std::fixed << std::setprecision( 1 )
+                      << 100.0 * Share( level ) << "%";
+        }
+
+        std::cout << std::defaultfloat << std::endl;
+    }
+
+    // Histogram of fragments per pixel as a JSON object
+    std::string Json( )
+    {
+        Finish( );
+
+        std::ostringstream out;
+        out << std::fixed << std::setprecision( 4 ) << "{ \"frames\": " << frames << ", \"dropped\": " << dropped
+            << ", \"fragments_per_covered_pixel\": " << FragmentsPerCoveredPixel( ) << ", \"pixel_share_by_count\": [";
+
+        for ( int level = 0; level < OVERDRAW_LEVELS; level++ )
+        {
+            out << ( level > 0 ? ", " : " " ) << Share( level );
+        }
+
+        out << " ] }";
+
+        return out.str( );
+    }
+
+private:
+    struct Slot
+    {
+        GLuint queries[OVERDRAW_LEVELS] = { };
+        bool pending = false;
+    };
+
+    bool counting = false;
+    GLuint vao = 0;
+
+    Slot slots[OVERDRAW_FRAMES_IN_FLIGHT];
+    int current = 0;
+
+    // Pixels with each count, summed over the frames read
+    double pixels[OVERDRAW_LEVELS] = { };
+    long long frames = 0;
+    long long dropped = 0;
+
+    OverdrawView( )
+    {
+    }
+
+    void Collect( Slot &slot, bool wait )
+    {
+        slot.pending = false;
+
+        if ( !wait )
+        {
+            GLint available = 0;
+            glGetQueryObjectiv( slot.queries[OVERDRAW_LEVELS - 1], GL_QUERY_RESULT_AVAILABLE, &available );
+
+            if ( GL_TRUE != available )
+            {
+                dropped++;
+                return;
+            }
+        }
+
+        for ( int level = 0; level < OVERDRAW_LEVELS; level++ )
+        {
+            GLuint64 count = 0;
+            glGetQueryObjectui64v( slot.queries[level], GL_QUERY_RESULT, &count );
+            pixels[level] += ( double )count;
+        }
+
+        frames++;
+    }
+
+    double Share( int level ) const
+    {
+        double total = 0.0;
+
+        for ( double count : pixels )
+        {
+            total += count;
+        }
+
+        return total > 0.0 ? pixels[level] / total : 0.0;
+    }
+
+    // Counts at the last level are taken as exactly that level, so this is a lower bound when any pixel is there
+    double FragmentsPerCoveredPixel( ) const
+    {
+        double fragments = 0.0, covered = 0.0;
+
+        for ( int level = 1; level < OVERDRAW_LEVELS; level++ )
+        {
+            fragments += level * pixels[level];
+            covered += pixels[level];
+        }
+
+        return covered > 0.0 ? fragments / covered : 0.0;
+    }
+};
@@ -0,0 +1,312 @@
+#pragma once
+
+// Std. Includes
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+// Frames of queries in flight. A frame's results are read when its slot comes round again; if they aren't there yet
+// the frame is dropped rather than waited for
+const int PIPELINE_STATISTICS_FRAMES_IN_FLIGHT = 3;
+
+// What each pass counts: ARB_pipeline_statistics_query counters plus the samples that passed the depth test
+const int PIPELINE_STATISTICS_COUNTERS = 7;
+
+const GLenum PIPELINE_STATISTICS_TARGETS[PIPELINE_STATISTICS_COUNTERS] =
+{
+    GL_VERTICES_SUBMITTED_ARB, GL_PRIMITIVES_SUBMITTED_ARB, GL_VERTEX_SHADER_INVOCATIONS_ARB, GL_CLIPPING_INPUT_PRIMITIVES_ARB,
+    GL_CLIPPING_OUTPUT_PRIMITIVES_ARB, GL_FRAGMENT_SHADER_INVOCATIONS_ARB, GL_SAMPLES_PASSED
+};
+
+const char *const PIPELINE_STATISTICS_NAMES[PIPELINE_STATISTICS_COUNTERS] =
+{
+    "vertices_submitted", "primitives_submitted", "vertex_shader_invocations", "clipping_input_primitives",
+    "clipping_output_primitives", "fragment_shader_invocations", "samples_passed"
+};
+
+// Indices of the counters the derived numbers are made of
+const int PIPELINE_STATISTICS_VERTICES = 0;
+const int PIPELINE_STATISTICS_VERTEX_INVOCATIONS = 2;
+const int PIPELINE_STATISTICS_FRAGMENT_INVOCATIONS = 5;
+const int PIPELINE_STATISTICS_SAMPLES_PASSED = 6;
+
+// Vertex and fragment work per render pass, from pipeline statistics queries around each pass. Passes are named by
+// Begin and may run several times a frame (the planets), their counts add up. Besides the raw counters this gives
+// fragments shaded per screen pixel, which is the overdraw of the pass, the share of shaded fragments that survived the
+// depth test, and vertex shader invocations per submitted vertex (post transform cache misses). Results are read a few
+// frames late so nothing waits on the GPU. Used from the GL thread only.
+class PipelineStatistics
+{
+public:
+    // Takes effect at the next BeginFrame
+    static inline bool enabled = false;
+
+    static PipelineStatistics &Get( )
+    {
+        static PipelineStatistics instance;
+
+        return instance;
+    }
+
+    void BeginFrame( )
+    {
+        inFrame = false;
+
+        if ( !enabled )
+        {
+            return;
+        }
+
+        if ( !GLEW_ARB_pipeline_statistics_query )
+        {
+            std::cerr << "ERROR: Pipeline statistics need ARB_pipeline_statistics_query" << std::endl;
+            enabled = false;
+            return;
+        }
+
+        current = ( current + 1 ) % PIPELINE_STATISTICS_FRAMES_IN_FLIGHT;
+        Slot &slot = slots[current];
+
+        if ( slot.pending )
+        {
+            Collect( slot, false );
+        }
+
+        slot.records.clear( );
+        slot.queriesUsed = 0;
+        inFrame = true;
+    }
+
+    // Starts counting for a pass, ending the previous one. Queries of a kind can't nest, so neither can passes
+    void Begin( const char *pass )
+    {
+        if ( !inFrame )
+        {
+            return;
+        }
+
+        End( );
+
+        Slot &slot = slots[current];
+        Record record;
+        record.pass = FindPass( pass );
+
+        for ( int counter = 0; counter < PIPELINE_STATISTICS_COUNTERS; counter++ )
+        {
+            record.queries[counter] = NextQuery( slot );
+            glBeginQuery( PIPELINE_STATISTICS_TARGETS[counter], slot.queries[record.queries[counter]] );
+        }
+
+        slot.records.push_back( record );
+        passOpen = true;
+    }
+
+    void End( )
+    {
+        if ( !inFrame || !passOpen )
+        {
+            return;
+        }
+
+        for ( int counter = 0; counter < PIPELINE_STATISTICS_COUNTERS; counter++ )
+        {
+            glEndQuery( PIPELINE_STATISTICS_TARGETS[counter] );
+        }
+
+        passOpen = false;
+    }
+
+    void EndFrame( )
+    {
+        if ( !inFrame )
+        {
+            return;
+        }
+
+        End( );
+        slots[current].pending = true;
+        inFrame = false;
+    }
+
+    // Reads the frames still in flight, waiting for them. For the end of a run
+    void Finish( )
+    {
+        for ( Slot &slot : slots )
+        {
+            if ( slot.pending )
+            {
+                Collect( slot, true );
+            }
+        }
+    }
+
+    void PrintStats( int screenWidth, int screenHeight )
+    {
+        if ( 0 == frames )
+        {
+            return;
+        }
+
+        std::cout << "Pipeline statistics per frame over " << frames << " frames (" << dropped << " dropped):" << std::endl;
+
+        for ( const Pass &pass : passes )
+        {
+            char line[256];
+            snprintf( line, sizeof( line ), "  %-12s %10.0f vertices, %10.0f vs invocations (%.2f per vertex), %12.0f fs invocations "
+                      "(%.2f per pixel, %.0f%% passed depth)", pass.name, Mean( pass, PIPELINE_STATISTICS_VERTICES ),
+                      Mean( pass, PIPELINE_STATISTICS_VERTEX_INVOCATIONS ), VertexReuse( pass ), Mean( pass, PIPELINE_STATISTICS_FRAGMENT_INVOCATIONS ),
+                      FragmentsPerPixel( pass, screenWidth, screenHeight ), 100.0 * DepthPassRatio( pass ) );
+            std::cout << line << std::endl;
+        }
+    }
+
+    // Means per frame of every counter of every pass, with the derived numbers, as a JSON object
+    std::string Json( int screenWidth, int screenHeight )
+    {
+        Finish( );
+
+        std::ostringstream out;
+        out << std::fixed << std::setprecision( 4 ) << "{ \"frames\": " << frames << ", \"dropped\": " << dropped << ", \"passes\": {";
+
+        for ( size_t i = 0; i < passes.size( ); i++ )
+        {
+            const Pass &pass = passes[i];
+            out << ( i > 0 ? "," : "" ) << "\n    \"" << pass.name << "\": { ";
+
+            for ( int counter = 0; counter < PIPELINE_STATISTICS_COUNTERS; counter++ )
+            {
+                out << "\"" << PIPELINE_STATISTICS_NAMES[counter] << "\": " << Mean( pass, counter ) << ", ";
+            }
+
+            out << "\"fragments_per_pixel\": " << FragmentsPerPixel( pass, screenWidth, screenHeight ) << ", \"depth_pass_ratio\": "
+                << DepthPassRatio( pass ) << ", \"vertex_shader_invocations_per_vertex\": " << VertexReuse( pass ) << " }";
+        }
+
+        out << "\n  } }";
+
+        return out.str( );
+    }
+
+private:
+    struct Record
+    {
+        int pass;
+        size_t queries[PIPELINE_STATISTICS_COUNTERS];
+    };
+
+    struct Slot
+    {
+        std::vector<Record> records;
+        std::vector<GLuint> queries;
+        size_t queriesUsed = 0;
+        bool pending = false;
+    };
+
+    struct Pass
+    {
+        const char *name;
+        double totals[PIPELINE_STATISTICS_COUNTERS] = { };
+    };
+
+    Slot slots[PIPELINE_STATISTICS_FRAMES_IN_FLIGHT];
+    int current = 0;
+    bool inFrame = false;
+    bool passOpen = false;
+
+    std::vector<Pass> passes;
+    long long frames = 0;
+    long long dropped = 0;
+
+    PipelineStatistics( )
+    {
+    }
+
+    int FindPass( const char *name )
+    {
+        for ( size_t i = 0; i < passes.size( ); i++ )
+        {
+            if ( 0 == strcmp( passes[i].name, name ) )
+            {
+                return ( int )i;
+            }
+        }
+
+        Pass pass;
+        pass.name = name;
+        passes.push_back( pass );
+
+        return ( int )passes.size( ) - 1;
+    }
+
+    size_t NextQuery( Slot &slot )
+    {
+        if ( slot.queriesUsed == slot.queries.size( ) )
+        {
+            size_t previous = slot.queries.size( );
+            slot.queries.resize( previous + 8 * PIPELINE_STATISTICS_COUNTERS );
+            glGenQueries( ( GLsizei )( slot.queries.size( ) - previous ), slot.queries.data( ) + previous );
+        }
+
+        return slot.queriesUsed++;
+    }
+
+    void Collect( Slot &slot, bool wait )
+    {
+        slot.pending = false;
+
+        if ( !wait && slot.queriesUsed > 0 )
+        {
+            GLint available = 0;
+            glGetQueryObjectiv( slot.queries[slot.queriesUsed - 1], GL_QUERY_RESULT_AVAILABLE, &available );
+
+            if ( GL_TRUE != available )
+            {
+                dropped++;
+                return;
+            }
+        }
+
+        for ( const Record &record : slot.records )
+        {
+            for ( int counter = 0; counter < PIPELINE_STATISTICS_COUNTERS; counter++ )
+            {
+                GLuint64 value = 0;
+                glGetQueryObjectui64v( slot.queries[record.queries[counter]], GL_QUERY_RESULT, &value );
+                passes[record.pass].totals[counter] += ( double )value;
+            }
+        }
+
+        frames++;
+    }
+
+    double Mean( const Pass &pass, int counter ) const
+    {
+        return frames > 0 ? pass.totals[counter] / frames : 0.0;
+    }
+
+    double FragmentsPerPixel( const Pass &pass, int screenWidth, int screenHeight ) const
+    {
+        return Mean( pass, PIPELINE_STATISTICS_FRAGMENT_INVOCATIONS ) / std::max( 1, screenWidth * screenHeight );
+    }
+
+    double DepthPassRatio( const Pass &pass ) const
+    {
+        double fragments = pass.totals[PIPELINE_STATISTICS_FRAGMENT_INVOCATIONS];
+
+        return fragments > 0.0 ? pass.totals[PIPELINE_STATISTICS_SAMPLES_PASSED] / fragments : 0.0;
+    }
+
+    double VertexReuse( const Pass &pass ) const
+    {
+        double vertices = pass.totals[PIPELINE_STATISTICS_VERTICES];
+
+        return vertices > 0.0 ? pass.totals[PIPELINE_STATISTICS_VERTEX_INVOCATIONS] / vertices : 0.0;
+    }
+};
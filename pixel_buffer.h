@@ -0,0 +1,269 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+// Starting size of the staging buffer. It grows to the largest single upload if needed
+const size_t PIXEL_BUFFER_SIZE = 16 * 1024 * 1024;
+
+// Staging pixel unpack buffer for texture uploads, used from the GL thread only. With ARB_buffer_storage the buffer is
+// mapped once, persistently and coherently, so source pixels (usually straight out of a memory-mapped file) are copied
+// into it with a single memcpy and the driver reads them from there without another copy of its own. Space is handed
+// out front to back; when it runs out the buffer waits on a fence for the GPU to finish reading and starts over.
+// Without buffer storage it falls back to orphaning and mapping the buffer for each upload.
+class PixelUnpackBuffer
+{
+public:
+    static PixelUnpackBuffer &Get( )
+    {
+        static PixelUnpackBuffer instance;
+
+        return instance;
+    }
+
+    // Uploads rows of pixels into level of target (the currently bound texture). rowBytes is the tightly packed size
+    // of a row; bottomUp flips the rows while copying (TGA stores the bottom row first)
+    void Upload( GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLenum format,
+                 const unsigned char *pixels, size_t rowBytes, bool bottomUp = false )
+    {
+        const void *staged = Stage( pixels, rowBytes, height, bottomUp );
+
+        GLint previousAlignment;
+        glGetIntegerv( GL_UNPACK_ALIGNMENT, &previousAlignment );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+        glTexImage2D( target, level, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, staged );
+
+        glPixelStorei( GL_UNPACK_ALIGNMENT, previousAlignment );
+        Finish( );
+    }
+
+    // Uploads one level of block compressed data
+    void UploadCompressed( GLenum target, GLint level, GLenum format, GLsizei width, GLsizei height, const unsigned char *data, size_t size )
+    {
+        const void *staged = Stage( data, size, 1, false );
+        glCompressedTexImage2D( target, level, format, width, height, 0, ( GLsizei )size, staged );
+        Finish( );
+    }
+
+    // Uploads rows of pixels into one layer of level of an array texture, whose storage already exists
+    void UploadLayer( GLenum target, GLint level, GLint layer, GLsizei width, GLsizei height, GLenum format,
+                      const unsigned char *pixels, size_t rowBytes, bool bottomUp = false )
+    {
+        const void *staged = Stage( pixels, rowBytes, height, bottomUp );
+
+        GLint previousAlignment;
+        glGetIntegerv( GL_UNPACK_ALIGNMENT, &previousAlignment );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+        glTexSubImage3D( target, level, 0, 0, layer, width, height, 1, format, GL_UNSIGNED_BYTE, staged );
+
+        glPixelStorei( GL_UNPACK_ALIGNMENT, previousAlignment );
+        Finish( );
+    }
+
+    void UploadCompressedLayer( GLenum target, GLint level, GLint layer, GLenum format, GLsizei width, GLsizei height,
+                                const unsigned char *data, size_t size )
+    {
+        const void *staged = Stage( data, size, 1, false );
+        glCompressedTexSubImage3D( target, level, 0, 0, layer, width, height, 1, format, ( GLsizei )size, staged );
+        Finish( );
+    }
+
+    // Uploads rows of pixels into a region of level of target, whose storage already exists
+    void UploadSubImage( GLenum target, GLint level, GLint x, GLint y, GLsizei width, GLsizei height, GLenum format,
+                         const unsigned char *pixels, size_t rowBytes )
+    {
+        const void *staged = Stage( pixels, rowBytes, height, false );
+
+        GLint previousAlignment;
+        glGetIntegerv( GL_UNPACK_ALIGNMENT, &previousAlignment );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+        glTexSubImage2D( target, level, x, y, width, height, format, GL_UNSIGNED_BYTE, staged );
+
+        glPixelStorei( GL_UNPACK_ALIGNMENT, previousAlignment );
+        Finish( );
+    }
+
+    // x and y must be multiples of 4
+    void UploadCompressedSubImage( GLenum target, GLint level, GLint x, GLint y, GLenum format, GLsizei width, GLsizei height,
+                                   const unsigned char *data, size_t size )
+    {
+        const void *staged = Stage( data, size, 1, false );
+        glCompressedTexSubImage2D( target, level, x, y, width, height, format, ( GLsizei )size, staged );
+        Finish( );
+    }
+
+    bool Persistent( ) const
+    {
+        return persistent;
+    }
+
+private:
+    GLuint buffer = 0;
+    unsigned char *mapped = nullptr;
+    size_t capacity = 0;
+    size_t offset = 0;
+    size_t stagedSize = 0;
+    bool persistent = false;
+    GLsync fence = nullptr;
+
+    // Flipped rows, for an upload from client memory when the buffer can't be mapped
+    std::vector<unsigned char> fallback;
+
+    // The GL objects are left to the context, which is already gone when this is destroyed at exit
+    PixelUnpackBuffer( )
+    {
+    }
+
+    // Copies the rows into the buffer, leaves it bound and returns the offset to pass as the pixel pointer. If the
+    // buffer can't be mapped, nothing is bound and the pixels (flipped if need be) are uploaded from client memory
+    const void *Stage( const unsigned char *pixels, size_t rowBytes, GLsizei rows, bool bottomUp )
+    {
+        size_t size = rowBytes * rows;
+        unsigned char *destination = Allocate( size );
+        stagedSize = 0;
+
+        if ( !destination )
+        {
+            glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+            if ( !bottomUp )
+            {
+                return pixels;
+            }
+
+            fallback.resize( size );
+            destination = fallback.data( );
+        }
+
+        if ( bottomUp )
+        {
+            for ( GLsizei row = 0; row < rows; row++ )
+            {
+                memcpy( destination + row * rowBytes, pixels + ( rows - 1 - row ) * rowBytes, rowBytes );
+            }
+        }
+        else
+        {
+            memcpy( destination, pixels, size );
+        }
+
+        if ( destination == fallback.data( ) )
+        {
+            return destination;
+        }
+
+        if ( !persistent )
+        {
+            glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+        }
+
+        stagedSize = size;
+
+        return ( const void * )offset;
+    }
+
+    void Finish( )
+    {
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+        offset = ( offset + stagedSize + 15 ) & ~( size_t )15;
+
+        // One fence after the latest upload covers all the earlier ones
+        if ( fence )
+        {
+            glDeleteSync( fence );
+        }
+
+        fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+    }
+
+    // Binds the buffer and returns where size bytes can be written, at the current offset
+    unsigned char *Allocate( size_t size )
+    {
+        if ( 0 == buffer || size > capacity )
+        {
+            Create( std::max( std::max( size, capacity ), PIXEL_BUFFER_SIZE ) );
+        }
+        else if ( persistent && offset + size > capacity )
+        {
+            // Only the persistent ring writes where the GPU may still be reading, a plain buffer is orphaned below
+            WaitForGpu( );
+            offset = 0;
+        }
+
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, buffer );
+
+        if ( persistent )
+        {
+            return mapped + offset;
+        }
+
+        // Orphan the old storage so the map doesn't wait for uploads still reading it
+        offset = 0;
+        glBufferData( GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, GL_STREAM_DRAW );
+
+        return ( unsigned char * )glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT );
+    }
+
+    void Create( size_t size )
+    {
+        if ( buffer )
+        {
+            WaitForGpu( );
+            glDeleteBuffers( 1, &buffer );
+        }
+
+        capacity = size;
+        offset = 0;
+        persistent = GLEW_ARB_buffer_storage;
+
+        glGenBuffers( 1, &buffer );
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, buffer );
+
+        if ( persistent )
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage( GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, flags );
+            mapped = ( unsigned char * )glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, capacity, flags );
+            persistent = nullptr != mapped;
+
+            // Immutable storage can't be respecified, start over with a plain buffer
+            if ( !persistent )
+            {
+                glDeleteBuffers( 1, &buffer );
+                glGenBuffers( 1, &buffer );
+                glBindBuffer( GL_PIXEL_UNPACK_BUFFER, buffer );
+            }
+        }
+
+        if ( !persistent )
+        {
+            glBufferData( GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, GL_STREAM_DRAW );
+        }
+
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+    }
+
+    void WaitForGpu( )
+    {
+        if ( !fence )
+        {
+            return;
+        }
+
+        while ( GL_TIMEOUT_EXPIRED == glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 ) )
+        {
+        }
+
+        glDeleteSync( fence );
+        fence = nullptr;
+    }
+};
@@ -31,8 +31,56 @@ uniform vec3 viewPos;
 
 uniform sampler2D texture_diffuse1;
 
+// Set when the Model textures live in array pages instead (see texture_array.h)
+uniform sampler2DArray textureArrays[4];
+uniform int texture_diffuse1_page = -1;
+uniform float texture_diffuse1_layer;
+uniform int texture_specular1_page = -1;
+uniform float texture_specular1_layer;
+
+// Virtual texture replacing the diffuse map (see virtual_texture.h)
+uniform bool virtualTexturing = false;
+uniform usampler2D virtualIndirection;
+uniform sampler2D virtualPages;
+uniform vec2 virtualSize;
+uniform int virtualLevels;
+uniform float virtualLodBias;
+uniform float virtualPageSize;
+uniform float virtualBorder;
+uniform float virtualCacheSize;
+
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 
+vec4 SampleArray(int page, float layer, vec2 uv)
+{
+    // Sampler arrays only take constant indices in 3.30
+    switch (page)
+    {
+        case 0: return texture(textureArrays[0], vec3(uv, layer));
+        case 1: return texture(textureArrays[1], vec3(uv, layer));
+        case 2: return texture(textureArrays[2], vec3(uv, layer));
+        default: return texture(textureArrays[3], vec3(uv, layer));
+    }
+}
+
+vec4 SampleVirtual(vec2 uv)
+{
+    // Level from the texel footprint, as in virtual_feedback.frag
+    vec2 dx = dFdx(uv * virtualSize);
+    vec2 dy = dFdy(uv * virtualSize);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + virtualLodBias;
+    int level = int(clamp(floor(lod), 0.0, float(virtualLevels - 1)));
+
+    // The indirection entry is the slot of the page, or of the closest resident ancestor, and that page's level
+    ivec2 pages = textureSize(virtualIndirection, level);
+    uvec4 entry = texelFetch(virtualIndirection, clamp(ivec2(fract(uv) * vec2(pages)), ivec2(0), pages - ivec2(1)), level);
+
+    vec2 inPage = fract(uv * vec2(textureSize(virtualIndirection, int(entry.b))));
+    vec2 texel = vec2(entry.rg) * (virtualPageSize + 2.0 * virtualBorder) + virtualBorder + inPage * virtualPageSize;
+
+    return textureLod(virtualPages, texel / virtualCacheSize, 0.0);
+}
+
 void main()
 {    
     vec3 result = CalcPointLight(light, normalize(Normal), FragPos, normalize(viewPos - FragPos));
@@ -60,9 +108,17 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
 
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 diffuseColor = texture_diffuse1_page >= 0 ? vec3(SampleArray(texture_diffuse1_page, texture_diffuse1_layer, TexCoords))
+                                                   : vec3(texture(material.diffuse, TexCoords));
+
+    if (virtualTexturing)
+        diffuseColor = vec3(SampleVirtual(TexCoords));
+    vec3 specularColor = texture_specular1_page >= 0 ? vec3(SampleArray(texture_specular1_page, texture_specular1_layer, TexCoords))
+                                                     : vec3(texture(material.specular, TexCoords));
+
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
 
 
     // ambient *= attenuation;
@@ -0,0 +1,595 @@
+#pragma once
+
+// Std. Includes
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "text_overlay.h"
+#include "flight_recorder.h"
+
+// Frames of GPU timestamps in flight. A frame's queries are read when its slot comes round again, by which time the
+// GPU has normally finished them; if not, that frame's GPU times are dropped rather than waited for. Drivers commonly
+// queue 3 frames ahead, so one more than that
+const int PROFILER_FRAMES_IN_FLIGHT = 4;
+
+// Weight of the newest frame in the averages shown on screen
+const double PROFILER_SMOOTHING = 0.1;
+
+// Scopes not seen for this many frames are left out of the table
+const long long PROFILER_STALE_FRAMES = 120;
+
+// Frames kept for the trace written at exit, from the first profiled frame on
+const long long PROFILER_TRACE_FRAMES = 3600;
+
+// Hierarchical CPU and GPU frame profiler. Push/Pop (or PROFILE_SCOPE) nest named scopes within BeginFrame/EndFrame;
+// each records its CPU time and a pair of GL_TIMESTAMP queries around its GL commands, and shows up as a KHR_debug
+// group in GPU captures under the same name. Timer queries of the GL_TIME_ELAPSED kind can't nest, timestamps can.
+// Scopes are merged by their path from the frame root and averaged over recent frames for the on-screen table
+// (DrawOverlay) and PrintStats; every scope of every frame can also be written out as a Chrome trace or CSV.
+// Scopes are also handed to the FlightRecorder, which keeps their CPU times whether the profiler is on or not.
+// Used from the GL thread only. Scopes outside a frame, or while disabled, cost a branch.
+class Profiler
+{
+public:
+    // Takes effect at the next BeginFrame
+    static inline bool enabled = false;
+
+    bool showOverlay = false;
+
+    // Written at exit: CSV if it ends in .csv, otherwise Chrome trace JSON (chrome://tracing, Perfetto)
+    std::string tracePath;
+
+    static Profiler &Get( )
+    {
+        static Profiler instance;
+
+        return instance;
+    }
+
+    void BeginFrame( )
+    {
+        inFrame = false;
+
+        if ( !enabled )
+        {
+            return;
+        }
+
+        if ( !created )
+        {
+            Create( );
+        }
+
+        current = ( current + 1 ) % PROFILER_FRAMES_IN_FLIGHT;
+        Slot &slot = slots[current];
+
+        if ( slot.pending )
+        {
+            Collect( slot );
+        }
+
+        slot.records.clear( );
+        slot.queriesUsed = 0;
+        slot.frame = frame++;
+        inFrame = true;
+
+        Open( "Frame" );
+    }
+
+    void EndFrame( )
+    {
+        if ( !inFrame )
+        {
+            return;
+        }
+
+        while ( !open.empty( ) )
+        {
+            Close( );
+        }
+
+        slots[current].pending = true;
+        inFrame = false;
+    }
+
+    // Opens a scope under the innermost open one. name must outlive the profiler (a string literal). Returns whether
+    // the scope was opened here or by the flight recorder, i.e. whether the matching Pop is needed
+    bool Push( const char *name )
+    {
+        bool recorded = FlightRecorder::Get( ).Push( name );
+
+        return Open( name ) || recorded;
+    }
+
+    void Pop( )
+    {
+        FlightRecorder::Get( ).Pop( );
+        Close( );
+    }
+
+    // Draws the table of scopes over the current framebuffer with a shader like text.vs/text.frag
+    // notes are more lines for the same page, under the scopes (other subsystems' stats)
+    void DrawOverlay( GLuint program, int screenWidth, int screenHeight, const char *notes = nullptr )
+    {
+        if ( !showOverlay || nodes.empty( ) )
+        {
+            return;
+        }
+
+        bool opened = Push( "Profiler overlay" );
+
+        std::vector<int> rows;
+        VisibleRows( rows );
+
+        float lineHeight = ( float )overlay.LineHeight( );
+        float x = 10.0f;
+        float y = 10.0f;
+        float width = 72.0f * overlay.CharWidth( );
+        float barX = x + 50.0f * overlay.CharWidth( );
+        float barWidth = width - ( barX - x ) - 5.0f;
+        double frameMs = std::max( std::max( nodes[0].cpuMs, nodes[0].gpuMs ), 1e-3 );
+
+        size_t noteLines = 0;
+
+        if ( notes && '\0' != notes[0] )
+        {
+            noteLines = 1 + std::count( notes, notes + strlen( notes ), '\n' );
+        }
+
+        overlay.Rect( x - 5.0f, y - 5.0f, width + 10.0f, ( rows.size( ) + 2 + noteLines ) * lineHeight + 10.0f, glm::vec4( 0.0f, 0.0f, 0.0f, 0.7f ) );
+
+        char line[128];
+        snprintf( line, sizeof( line ), "%-24s %8s %8s %5s", "SCOPE", "CPU MS", "GPU MS", "CALLS" );
+        overlay.Print( x, y, line, glm::vec4( 1.0f, 1.0f, 0.6f, 1.0f ) );
+
+        for ( size_t i = 0; i < rows.size( ); i++ )
+        {
+            const Node &node = nodes[rows[i]];
+            float rowY = y + ( i + 1 ) * lineHeight;
+
+            std::string name = std::string( 2 * node.depth, ' ' ) + node.name;
+            snprintf( line, sizeof( line ), "%-24.24s %8.3f %8.3f %5d", name.c_str( ), node.cpuMs, node.gpuMs, node.calls );
+            overlay.Print( x, rowY, line );
+
+            // CPU above GPU, as a share of the whole frame
+            float barHeight = 0.5f * ( lineHeight - overlay.scale );
+            overlay.Rect( barX, rowY, barWidth * ( float )std::min( 1.0, node.cpuMs / frameMs ), barHeight, glm::vec4( 1.0f, 0.6f, 0.2f, 0.9f ) );
+            overlay.Rect( barX, rowY + barHeight, barWidth * ( float )std::min( 1.0, node.gpuMs / frameMs ), barHeight, glm::vec4( 0.3f, 0.6f, 1.0f, 0.9f ) );
+        }
+
+        snprintf( line, sizeof( line ), "GPU RESULTS DROPPED: %lld OF %lld FRAMES", gpuDropped, collected );
+        overlay.Print( x, y + ( rows.size( ) + 1 ) * lineHeight, line, glm::vec4( 0.7f, 0.7f, 0.7f, 1.0f ) );
+
+        for ( size_t i = 0; i < noteLines; i++ )
+        {
+            const char *end = strchr( notes, '\n' );
+            size_t length = std::min( end ? ( size_t )( end - notes ) : strlen( notes ), sizeof( line ) - 1 );
+            memcpy( line, notes, length );
+            line[length] = '\0';
+            overlay.Print( x, y + ( rows.size( ) + 2 + i ) * lineHeight, line, glm::vec4( 0.6f, 0.9f, 0.6f, 1.0f ) );
+            notes = end ? end + 1 : notes + strlen( notes );
+        }
+
+        overlay.Draw( program, screenWidth, screenHeight );
+
+        if ( opened )
+        {
+            Pop( );
+        }
+    }
+
+    void PrintStats( )
+    {
+        if ( nodes.empty( ) )
+        {
+            return;
+        }
+
+        std::vector<int> rows;
+        VisibleRows( rows );
+
+        std::cout << "Profiler: " << collected << " frames, GPU results dropped for " << gpuDropped << std::endl;
+
+        for ( int index : rows )
+        {
+            const Node &node = nodes[index];
+            char line[128];
+            std::string name = std::string( 2 * node.depth, ' ' ) + node.name;
+            snprintf( line, sizeof( line ), "  %-32s cpu %8.3f ms  gpu %8.3f ms  %5d calls", name.c_str( ), node.cpuMs, node.gpuMs, node.calls );
+            std::cout << line << std::endl;
+        }
+    }
+
+    // Writes the scopes of the profiled frames to tracePath. The GPU scopes go on their own track, moved onto the CPU
+    // clock by the offset measured when the profiler started
+    void WriteTrace( )
+    {
+        if ( tracePath.empty( ) || trace.empty( ) )
+        {
+            return;
+        }
+
+        std::ofstream file( tracePath );
+
+        if ( !file )
+        {
+            std::cerr << "ERROR: Can't write the profiler trace to " << tracePath << std::endl;
+            return;
+        }
+
+        bool csv = tracePath.size( ) >= 4 && 0 == tracePath.compare( tracePath.size( ) - 4, 4, ".csv" );
+        char line[256];
+
+        if ( csv )
+        {
+            file << "frame,scope,depth,cpu_begin_ms,cpu_ms,gpu_begin_ms,gpu_ms\n";
+
+            for ( const TraceEvent &event : trace )
+            {
+                snprintf( line, sizeof( line ), "%lld,%s,%d,%.4f,%.4f,%.4f,%.4f\n", event.frame, event.name, nodes[event.node].depth,
+                          event.cpuBegin, event.cpuMs, event.gpuMs >= 0.0 ? event.gpuBegin : 0.0, std::max( event.gpuMs, 0.0 ) );
+                file << line;
+            }
+        }
+        else
+        {
+            file << "{\"traceEvents\":[\n";
+            file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+            file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+
+            for ( const TraceEvent &event : trace )
+            {
+                snprintf( line, sizeof( line ), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%lld}}",
+                          event.name, event.cpuBegin * 1000.0, event.cpuMs * 1000.0, event.frame );
+                file << line;
+
+                if ( event.gpuMs >= 0.0 )
+                {
+                    snprintf( line, sizeof( line ), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%lld}}",
+                              event.name, event.gpuBegin * 1000.0, event.gpuMs * 1000.0, event.frame );
+                    file << line;
+                }
+            }
+
+            file << "\n]}\n";
+        }
+
+        std::cout << "Profiler: " << trace.size( ) << " scopes written to " << tracePath << std::endl;
+    }
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    // One scope of one frame. Times in ms since the profiler started
+    struct Record
+    {
+        const char *name;
+        int node;
+        double cpuBegin;
+        double cpuEnd;
+        size_t queryBegin;
+        size_t queryEnd;
+    };
+
+    struct Slot
+    {
+        std::vector<Record> records;
+        std::vector<GLuint> queries;
+        size_t queriesUsed = 0;
+        long long frame = 0;
+        bool pending = false;
+    };
+
+    // A scope path merged over frames
+    struct Node
+    {
+        const char *name;
+        int parent;
+        int depth;
+        std::vector<int> children;
+        double cpuMs = 0.0;
+        double gpuMs = 0.0;
+        int calls = 0;
+        double frameCpuMs = 0.0;
+        double frameGpuMs = 0.0;
+        int frameCalls = 0;
+        long long lastSeen = 0;
+    };
+
+    struct TraceEvent
+    {
+        const char *name;
+        int node;
+        long long frame;
+        double cpuBegin;
+        double cpuMs;
+        double gpuBegin;
+        double gpuMs;
+    };
+
+    bool created = false;
+    bool debugGroups = false;
+    bool inFrame = false;
+    Clock::time_point origin;
+    double gpuOffsetMs = 0.0;
+
+    Slot slots[PROFILER_FRAMES_IN_FLIGHT];
+    int current = 0;
+    long long frame = 0;
+    std::vector<size_t> open;
+
+    std::vector<Node> nodes;
+    std::vector<TraceEvent> trace;
+    long long collected = 0;
+    long long gpuDropped = 0;
+    long long latestCollected = 0;
+
+    TextOverlay overlay;
+
+    Profiler( )
+    {
+    }
+
+    void Create( )
+    {
+        created = true;
+        debugGroups = GLEW_KHR_debug;
+        origin = Clock::now( );
+
+        // GPU timestamps count from an arbitrary point, line them up with the CPU clock
+        GLint64 gpuNow = 0;
+        glGetInteger64v( GL_TIMESTAMP, &gpuNow );
+        gpuOffsetMs = Now( ) - gpuNow / 1e6;
+    }
+
+    double Now( ) const
+    {
+        return std::chrono::duration<double, std::milli>( Clock::now( ) - origin ).count( );
+    }
+
+    size_t NextQuery( Slot &slot )
+    {
+        if ( slot.queriesUsed == slot.queries.size( ) )
+        {
+            size_t previous = slot.queries.size( );
+            slot.queries.resize( std::max( ( size_t )64, 2 * previous ) );
+            glGenQueries( ( GLsizei )( slot.queries.size( ) - previous ), slot.queries.data( ) + previous );
+        }
+
+        return slot.queriesUsed++;
+    }
+
+    // The profiler's own half of Push and Pop. The frame's root scope only goes through these
+    bool Open( const char *name )
+    {
+        if ( !inFrame )
+        {
+            return false;
+        }
+
+        Slot &slot = slots[current];
+
+        Record record;
+        record.name = name;
+        record.node = FindNode( open.empty( ) ? -1 : slot.records[open.back( )].node, name );
+        record.queryBegin = NextQuery( slot );
+        glQueryCounter( slot.queries[record.queryBegin], GL_TIMESTAMP );
+
+        if ( debugGroups )
+        {
+            glPushDebugGroup( GL_DEBUG_SOURCE_APPLICATION, 0, -1, name );
+        }
+
+        record.cpuBegin = Now( );
+        open.push_back( slot.records.size( ) );
+        slot.records.push_back( record );
+
+        return true;
+    }
+
+    void Close( )
+    {
+        if ( !inFrame || open.empty( ) )
+        {
+            return;
+        }
+
+        Slot &slot = slots[current];
+        Record &record = slot.records[open.back( )];
+        open.pop_back( );
+
+        record.cpuEnd = Now( );
+        record.queryEnd = NextQuery( slot );
+        glQueryCounter( slot.queries[record.queryEnd], GL_TIMESTAMP );
+
+        if ( debugGroups )
+        {
+            glPopDebugGroup( );
+        }
+    }
+
+    int FindNode( int parent, const char *name )
+    {
+        const std::vector<int> *siblings = nullptr;
+
+        if ( parent >= 0 )
+        {
+            siblings = &nodes[parent].children;
+        }
+
+        if ( siblings )
+        {
+            for ( int child : *siblings )
+            {
+                if ( nodes[child].name == name || 0 == strcmp( nodes[child].name, name ) )
+                {
+                    return child;
+                }
+            }
+        }
+        else
+        {
+            for ( size_t i = 0; i < nodes.size( ); i++ )
+            {
+                if ( nodes[i].parent < 0 && 0 == strcmp( nodes[i].name, name ) )
+                {
+                    return ( int )i;
+                }
+            }
+        }
+
+        Node node;
+        node.name = name;
+        node.parent = parent;
+        node.depth = parent >= 0 ? nodes[parent].depth + 1 : 0;
+        nodes.push_back( node );
+
+        if ( parent >= 0 )
+        {
+            nodes[parent].children.push_back( ( int )nodes.size( ) - 1 );
+        }
+
+        return ( int )nodes.size( ) - 1;
+    }
+
+    // Reads a finished frame's timings into the averages (and the trace). The GPU times are only used if the last
+    // query of the frame is available, which means all of them are, so this never waits on the GPU
+    void Collect( Slot &slot )
+    {
+        bool gpuReady = false;
+
+        if ( slot.queriesUsed > 0 )
+        {
+            GLint available = 0;
+            glGetQueryObjectiv( slot.queries[slot.queriesUsed - 1], GL_QUERY_RESULT_AVAILABLE, &available );
+            gpuReady = GL_TRUE == available;
+        }
+
+        if ( !gpuReady )
+        {
+            gpuDropped++;
+        }
+
+        for ( Node &node : nodes )
+        {
+            node.frameCpuMs = 0.0;
+            node.frameGpuMs = 0.0;
+            node.frameCalls = 0;
+        }
+
+        bool tracing = !tracePath.empty( ) && slot.frame < PROFILER_TRACE_FRAMES;
+
+        for ( const Record &record : slot.records )
+        {
+            double cpuMs = record.cpuEnd - record.cpuBegin;
+            double gpuBegin = 0.0;
+            double gpuMs = -1.0;
+
+            if ( gpuReady )
+            {
+                GLuint64 begin = 0, end = 0;
+                glGetQueryObjectui64v( slot.queries[record.queryBegin], GL_QUERY_RESULT, &begin );
+                glGetQueryObjectui64v( slot.queries[record.queryEnd], GL_QUERY_RESULT, &end );
+                gpuBegin = begin / 1e6 + gpuOffsetMs;
+                gpuMs = ( end - begin ) / 1e6;
+            }
+
+            Node &node = nodes[record.node];
+            node.frameCpuMs += cpuMs;
+            node.frameGpuMs += std::max( gpuMs, 0.0 );
+            node.frameCalls++;
+
+            if ( tracing )
+            {
+                TraceEvent event = { record.name, record.node, slot.frame, record.cpuBegin, cpuMs, gpuBegin, gpuMs };
+                trace.push_back( event );
+            }
+        }
+
+        for ( Node &node : nodes )
+        {
+            node.cpuMs += PROFILER_SMOOTHING * ( node.frameCpuMs - node.cpuMs );
+
+            if ( gpuReady )
+            {
+                node.gpuMs += PROFILER_SMOOTHING * ( node.frameGpuMs - node.gpuMs );
+            }
+
+            node.calls = node.frameCalls;
+
+            if ( node.frameCalls > 0 )
+            {
+                node.lastSeen = slot.frame;
+            }
+        }
+
+        slot.pending = false;
+        latestCollected = slot.frame;
+        collected++;
+    }
+
+    // Depth first from the roots, skipping scopes that haven't run lately
+    void VisibleRows( std::vector<int> &rows )
+    {
+        std::vector<int> stack;
+
+        for ( int i = ( int )nodes.size( ) - 1; i >= 0; i-- )
+        {
+            if ( nodes[i].parent < 0 )
+            {
+                stack.push_back( i );
+            }
+        }
+
+        while ( !stack.empty( ) )
+        {
+            int index = stack.back( );
+            stack.pop_back( );
+
+            if ( latestCollected - nodes[index].lastSeen > PROFILER_STALE_FRAMES )
+            {
+                continue;
+            }
+
+            rows.push_back( index );
+
+            for ( int i = ( int )nodes[index].children.size( ) - 1; i >= 0; i-- )
+            {
+                stack.push_back( nodes[index].children[i] );
+            }
+        }
+    }
+};
+
+// Profiles the rest of the enclosing block
+class ProfileScope
+{
+public:
+    explicit ProfileScope( const char *name ) : opened( Profiler::Get( ).Push( name ) )
+    {
+    }
+
+    ~ProfileScope( )
+    {
+        if ( opened )
+        {
+            Profiler::Get( ).Pop( );
+        }
+    }
+
+private:
+    bool opened;
+};
+
+#define PROFILE_CONCATENATE_( a, b ) a##b
+#define PROFILE_CONCATENATE( a, b ) PROFILE_CONCATENATE_( a, b )
+#define PROFILE_SCOPE( name ) ProfileScope PROFILE_CONCATENATE( profileScope, __LINE__ )( name )
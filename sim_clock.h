@@ -0,0 +1,124 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+
+// Default simulation rate
+const double SIMULATION_HZ = 120.0;
+
+// Most fixed steps run in a single frame. If the simulation can't keep up the extra time is dropped instead of
+// piling up (otherwise every slow frame makes the next one slower)
+const int SIMULATION_MAX_STEPS_PER_FRAME = 4096;
+
+// Fixed timestep clock. Real frame time, scaled by the time warp, goes into an accumulator that is drained in whole
+// steps of 1 / hz, so the simulation always advances by the same dt no matter how fast frames are drawn.
+// What is left in the accumulator is how far the renderer is between the last two steps.
+class SimulationClock
+{
+public:
+    // Time warp factor: simulated seconds per real second
+    double timeWarp;
+    int maxStepsPerFrame;
+
+    SimulationClock( double hz = SIMULATION_HZ, double warp = 1.0 )
+    : timeWarp( warp ), maxStepsPerFrame( SIMULATION_MAX_STEPS_PER_FRAME ), stepSize( 1.0 / hz ), accumulator( 0.0 ), time( 0.0 ), stepCount( 0 )
+    {
+    }
+
+    void SetRate( double hz )
+    {
+        stepSize = 1.0 / hz;
+    }
+
+    double StepSize( ) const
+    {
+        return stepSize;
+    }
+
+    // Adds elapsed real time and returns how many fixed steps are now due. The caller must run exactly that many
+    int Advance( double realSeconds )
+    {
+        accumulator += std::max( 0.0, realSeconds ) * timeWarp;
+
+        int steps = ( int )( accumulator / stepSize );
+
+        if ( steps > maxStepsPerFrame )
+        {
+            steps = maxStepsPerFrame;
+            accumulator = 0.0;
+        }
+        else
+        {
+            accumulator -= steps * stepSize;
+        }
+
+        time += steps * stepSize;
+        stepCount += steps;
+
+        return steps;
+    }
+
+    // Jumps straight to a simulation time, e.g. when scrubbing through precomputed orbits
+    void Seek( double t )
+    {
+        time = t;
+        accumulator = 0.0;
+    }
+
+    // Fraction of a step the renderer is past the latest state, in [0, 1)
+    double Alpha( ) const
+    {
+        return std::min( 1.0, accumulator / stepSize );
+    }
+
+    // Simulation time of the latest step
+    double Time( ) const
+    {
+        return time;
+    }
+
+    long long StepCount( ) const
+    {
+        return stepCount;
+    }
+
+private:
+    double stepSize;
+    double accumulator;
+    double time;
+    long long stepCount;
+};
+
+// Positions of all simulated bodies at one simulation time, in the root frame
+struct SimulationState
+{
+    double time = 0.0;
+    long long step = 0;
+    std::vector<float> x, y, z;
+
+    void Resize( size_t n )
+    {
+        x.resize( n );
+        y.resize( n );
+        z.resize( n );
+    }
+
+    // Blends two consecutive states for rendering. out = a + (b - a) * alpha
+    static void Interpolate( const SimulationState &a, const SimulationState &b, double alpha, SimulationState &out )
+    {
+        size_t n = std::min( a.x.size( ), b.x.size( ) );
+        float t = ( float )alpha;
+
+        out.Resize( n );
+        out.time = a.time + ( b.time - a.time ) * alpha;
+        out.step = b.step;
+
+        for ( size_t i = 0; i < n; i++ )
+        {
+            out.x[i] = a.x[i] + ( b.x[i] - a.x[i] ) * t;
+            out.y[i] = a.y[i] + ( b.y[i] - a.y[i] ) * t;
+            out.z[i] = a.z[i] + ( b.z[i] - a.z[i] ) * t;
+        }
+    }
+};
@@ -0,0 +1,236 @@
+#pragma once
+
+// Std. Includes
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <functional>
+#include <iostream>
+#include <algorithm>
+
+#include "sim_clock.h"
+#include "triple_buffer.h"
+
+// What the simulation thread hands to the renderer: the last two states plus enough timing to interpolate between them
+struct SimulationFrame
+{
+    SimulationState previous;
+    SimulationState current;
+
+    // Real time (seconds on the simulation thread's clock) when current was published, and the clock settings then
+    double publishedAt = 0.0;
+    double alphaAtPublish = 0.0;
+    double stepSize = 1.0 / SIMULATION_HZ;
+    double timeWarp = 1.0;
+    bool paused = true;
+};
+
+// Runs a SimulationClock on its own thread. Each iteration the due steps are handed to the step function, which
+// advances the simulation and fills in the frame; the frame is then published through a triple buffer. Anything that
+// changes simulation state from another thread (input, mode switches) must go through Post so it runs between steps.
+class SimulationThread
+{
+public:
+    typedef std::function<void( int steps, SimulationFrame &frame )> StepFunction;
+
+    SimulationClock clock;
+
+    SimulationThread( ) : started( false ), running( false ), paused( true ), stepsRun( 0 ), busySeconds( 0.0 ), renderBusySeconds( 0.0 ), renderSeconds( 0.0 ), renderFrames( 0 ), staleFrames( 0 )
+    {
+    }
+
+    ~SimulationThread( )
+    {
+        Stop( );
+    }
+
+    // Publishes an initial frame (steps = 0) and starts stepping
+    void Start( StepFunction _step )
+    {
+        step = _step;
+        start = std::chrono::steady_clock::now( );
+
+        Publish( 0 );
+        buffer.Acquire( );
+
+        started = true;
+        running = true;
+        worker = std::thread( &SimulationThread::Loop, this );
+    }
+
+    void Stop( )
+    {
+        if ( running )
+        {
+            running = false;
+            worker.join( );
+        }
+    }
+
+    // Queues a command to run on the simulation thread before its next step
+    void Post( std::function<void( )> command )
+    {
+        std::lock_guard<std::mutex> lock( commandMutex );
+        commands.push_back( command );
+    }
+
+    // Through Post, so the change is published with the next frame
+    void SetPaused( bool value )
+    {
+        paused = value;
+    }
+
+    // Render thread: the newest published frame. Never blocks
+    const SimulationFrame &Latest( )
+    {
+        if ( !buffer.Acquire( ) )
+        {
+            staleFrames++;
+        }
+
+        return buffer.ReadBuffer( );
+    }
+
+    // Render thread: how far past frame.current the renderer is right now, in steps, for interpolation
+    double Alpha( const SimulationFrame &frame ) const
+    {
+        if ( frame.paused )
+        {
+            return 1.0;
+        }
+
+        double alpha = frame.alphaAtPublish + ( Now( ) - frame.publishedAt ) * frame.timeWarp / frame.stepSize;
+
+        return std::min( 1.0, std::max( 0.0, alpha ) );
+    }
+
+    // Instead of Start: runs the queued commands and steps by seconds on the calling thread, for frame loops that step
+    // the simulation themselves to be repeatable (benchmarks, input replay). Returns the steps due
+    int StepInline( double seconds )
+    {
+        RunCommands( );
+
+        int steps = clock.Advance( paused ? 0.0 : seconds );
+        stepsRun += steps;
+
+        return steps;
+    }
+
+    // Steps run so far
+    long long StepsRun( ) const
+    {
+        return stepsRun;
+    }
+
+    // Render thread: time spent working (excluding the buffer swap) and total time of a frame
+    void RecordRenderFrame( double busy, double total )
+    {
+        renderBusySeconds += busy;
+        renderSeconds += total;
+        renderFrames++;
+    }
+
+    // Utilisation only for a thread that ran; stepped inline, only the steps count
+    void PrintMetrics( ) const
+    {
+        if ( !started )
+        {
+            std::cout << "Simulation: " << stepsRun << " steps, run inline by the frame loop" << std::endl;
+            return;
+        }
+
+        double elapsed = std::max( Now( ), 1e-9 );
+
+        std::cout << "Simulation thread: " << stepsRun << " steps, " << 100.0 * busySeconds / elapsed << "% busy" << std::endl;
+        std::cout << "Render thread: " << renderFrames << " frames, " << 100.0 * renderBusySeconds / std::max( renderSeconds, 1e-9 ) << "% busy" << std::endl;
+        std::cout << "Handoffs: " << buffer.Overwritten( ) << " states dropped before rendering, "
+                  << staleFrames << " frames without a new state" << std::endl;
+    }
+
+private:
+    StepFunction step;
+    TripleBuffer<SimulationFrame> buffer;
+
+    std::thread worker;
+    bool started;
+    std::atomic<bool> running;
+    std::atomic<bool> paused;
+
+    std::mutex commandMutex;
+    std::vector<std::function<void( )>> commands;
+
+    std::chrono::steady_clock::time_point start;
+
+    // Written by the simulation thread, read for the report
+    std::atomic<long long> stepsRun;
+    std::atomic<double> busySeconds;
+
+    // Render thread only
+    double renderBusySeconds;
+    double renderSeconds;
+    unsigned long long renderFrames;
+    unsigned long long staleFrames;
+
+    double Now( ) const
+    {
+        return std::chrono::duration<double>( std::chrono::steady_clock::now( ) - start ).count( );
+    }
+
+    void Publish( int steps )
+    {
+        SimulationFrame &frame = buffer.WriteBuffer( );
+        step( steps, frame );
+        frame.publishedAt = Now( );
+        frame.alphaAtPublish = clock.Alpha( );
+        frame.stepSize = clock.StepSize( );
+        frame.timeWarp = clock.timeWarp;
+        frame.paused = paused;
+        buffer.Publish( );
+    }
+
+    // Returns whether there were any
+    bool RunCommands( )
+    {
+        std::vector<std::function<void( )>> pending;
+        {
+            std::lock_guard<std::mutex> lock( commandMutex );
+            pending.swap( commands );
+        }
+
+        for ( std::function<void( )> &command : pending )
+        {
+            command( );
+        }
+
+        return !pending.empty( );
+    }
+
+    void Loop( )
+    {
+        double last = Now( );
+
+        while ( running )
+        {
+            double begin = Now( );
+
+            bool commandsRun = RunCommands( );
+            int steps = clock.Advance( paused ? 0.0 : begin - last );
+            stepsRun += steps;
+            last = begin;
+
+            if ( steps > 0 || commandsRun )
+            {
+                Publish( steps );
+            }
+
+            double end = Now( );
+            busySeconds = busySeconds + ( end - begin );
+
+            // Sleep until the next step is due
+            double untilNextStep = paused ? 0.005 : ( 1.0 - clock.Alpha( ) ) * clock.StepSize( ) / std::max( clock.timeWarp, 1e-9 );
+            std::this_thread::sleep_for( std::chrono::duration<double>( std::min( std::max( untilNextStep, 0.0002 ), 0.005 ) ) );
+        }
+    }
+};
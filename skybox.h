@@ -2,6 +2,8 @@
 #include <string>
 #include "shader.h"
 #include "stb_image.h"
+#include "texture_cache.h"
+#include "profiler.h"
 
 
 namespace Learus_Skybox
@@ -95,16 +97,20 @@ namespace Learus_Skybox
                 glBindVertexArray(0);
 
 
+                // Prepare all six faces at once, then upload them here on the GL thread
+                std::shared_ptr<CacheBatch> faces = TextureCache::PrepareAll({ front, back, top, bottom, right, left }, 0, false);
+                faces->PrintTimings("Skybox");
+
                 // Bind Textures
                 glGenTextures(1, &textureID);
                 glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-                loadTexture(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, front);
-                loadTexture(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, back);
-                loadTexture(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, top);
-                loadTexture(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, bottom);
-                loadTexture(GL_TEXTURE_CUBE_MAP_POSITIVE_X, right);
-                loadTexture(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, left);
+                loadTexture(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, faces->textures[0]);
+                loadTexture(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, faces->textures[1]);
+                loadTexture(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, faces->textures[2]);
+                loadTexture(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, faces->textures[3]);
+                loadTexture(GL_TEXTURE_CUBE_MAP_POSITIVE_X, faces->textures[4]);
+                loadTexture(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, faces->textures[5]);
                 
                 glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
                 glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -115,6 +121,8 @@ namespace Learus_Skybox
 
             void Draw()
             {
+                PROFILE_SCOPE("Skybox::Draw");
+
                 glDepthMask(GL_FALSE);
 
                 shader.Use();
@@ -141,21 +149,16 @@ namespace Learus_Skybox
             glm::mat4 projection;
             glm::mat4 view;
 
-            void loadTexture(GLenum target, std::string path)
+            void loadTexture(GLenum target, const CachedTexture & texture)
             {
-                int width, height, nrChannels;
-                unsigned char * data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
-
-                if (data)
+                if (texture.Valid())
                 {
-                    glTexImage2D(target, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+                    TextureCache::Upload(texture, target);
                 }
                 else
                 {
-                    std::cerr << "ERROR: Cubemap texture failed to load at path: " << path << std::endl;
+                    std::cerr << "ERROR: Cubemap texture failed to load at path: " << texture.source << std::endl;
                 }
-
-                stbi_image_free(data);
             }
     };
 }
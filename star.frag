@@ -0,0 +1,15 @@
+#version 330 core
+in vec3 StarColor;
+out vec4 color;
+
+void main()
+{
+    // Round sprite with a soft edge
+    vec2 offset = gl_PointCoord * 2.0 - 1.0;
+    float distanceSquared = dot(offset, offset);
+
+    if (distanceSquared > 1.0)
+        discard;
+
+    color = vec4(StarColor * exp(-4.0 * distanceSquared), 1.0);
+}
@@ -0,0 +1,21 @@
+#version 330 core
+layout (location = 0) in vec4 star;
+layout (location = 1) in vec4 color;
+out vec3 StarColor;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform float pointScale;
+uniform float minimumPointSize;
+
+void main()
+{
+    // Direction only, drawn at the far plane like the skybox
+    vec4 pos = projection * view * vec4(star.xyz, 1.0);
+    gl_Position = pos.xyww;
+
+    // The sprite area follows the flux relative to magnitude 0 (star.w). Stars too faint for the smallest sprite get dimmer instead
+    float size = pointScale * pow(10.0, -0.2 * star.w);
+    gl_PointSize = max(size, minimumPointSize);
+    StarColor = color.rgb * min(1.0, (size * size) / (minimumPointSize * minimumPointSize));
+}
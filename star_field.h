@@ -0,0 +1,580 @@
+#pragma once
+
+// Std. Includes
+#include <cmath>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "job_system.h"
+#include "mapped_file.h"
+#include "texture_cache.h"
+
+const char STAR_FIELD_MAGIC[4] = { 'R', 'S', 'T', 'R' };
+const uint32_t STAR_FIELD_VERSION = 1;
+
+// Stars are bucketed by direction on a cube: each face is cut into this many cells per side
+const int STAR_FIELD_CELLS_PER_FACE = 8;
+const int STAR_FIELD_CELL_COUNT = 6 * STAR_FIELD_CELLS_PER_FACE * STAR_FIELD_CELLS_PER_FACE;
+
+// Default number of stars drawn per frame, the brightest visible ones
+const size_t STAR_FIELD_MAX_STARS = 100000;
+
+// One star as stored in the vertex buffer: unit direction, apparent magnitude, color
+struct StarVertex
+{
+    float x;
+    float y;
+    float z;
+    float magnitude;
+    uint8_t color[4];
+};
+
+// Header of a converted catalog. Followed by STAR_FIELD_CELL_COUNT StarFieldCell entries, then (16 byte aligned) the
+// stars of every cell in turn, brightest first within a cell
+struct StarFieldHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t starCount;
+    uint32_t cellCount;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+};
+
+struct StarFieldCell
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+// Background of point sprites from a star catalog, an alternative to the cubemap skybox. The catalog is a CSV of
+// right ascension and declination in degrees, apparent magnitude and optionally the B-V color index, one star per
+// line. It is converted once into a binary file in the texture cache directory, which later runs map and copy into a
+// single vertex buffer as is. Each frame only the cells of the sky in view are considered, and the brightest stars
+// among them, up to maxStars and limitingMagnitude, are drawn in one glMultiDrawArrays call: since each cell is sorted
+// by magnitude, that is a prefix of every visible cell, found by a binary search on the magnitude cutoff.
+class StarField
+{
+public:
+    size_t maxStars = STAR_FIELD_MAX_STARS;
+    float limitingMagnitude = 99.0f;
+
+    // Sprite size in pixels of a magnitude 0 star, and the smallest sprite drawn
+    float pointScale = 6.0f;
+    float minimumPointSize = 1.5f;
+
+    StarField( )
+    {
+    }
+
+    // The GL objects are left to the context, like the texture managers
+    StarField( const StarField & ) = delete;
+    StarField &operator=( const StarField & ) = delete;
+
+    static std::string CachePath( const std::string &catalog )
+    {
+        std::string name = catalog;
+        std::replace( name.begin( ), name.end( ), '/', '_' );
+        std::replace( name.begin( ), name.end( ), '\\', '_' );
+
+        return TEXTURE_CACHE_DIRECTORY + name + ".rstar";
+    }
+
+    // Maps the converted catalog, converting it first if needed, and uploads every star into the vertex buffer
+    bool Open( const std::string &catalogPath )
+    {
+        auto start = std::chrono::high_resolution_clock::now( );
+
+        catalog = catalogPath;
+        std::string path = CachePath( catalog );
+        uint64_t sourceSize;
+        int64_t sourceTime;
+
+        if ( !TextureCache::SourceInfo( catalog, sourceSize, sourceTime ) )
+        {
+            std::cerr << "ERROR: Star catalog not found: " << catalog << std::endl;
+            return false;
+        }
+
+        if ( !Map( path, sourceSize, sourceTime ) )
+        {
+            if ( !Build( catalog, path, sourceSize, sourceTime ) || !Map( path, sourceSize, sourceTime ) )
+            {
+                std::cerr << "ERROR: Could not convert star catalog: " << catalog << std::endl;
+                return false;
+            }
+        }
+
+        glGenVertexArrays( 1, &VAO );
+        glGenBuffers( 1, &VBO );
+        glBindVertexArray( VAO );
+        glBindBuffer( GL_ARRAY_BUFFER, VBO );
+        glBufferData( GL_ARRAY_BUFFER, ( size_t )header.starCount * sizeof( StarVertex ), stars, GL_STATIC_DRAW );
+
+        // Direction and magnitude, then the color
+        glEnableVertexAttribArray( 0 );
+        glVertexAttribPointer( 0, 4, GL_FLOAT, GL_FALSE, sizeof( StarVertex ), ( GLvoid * )0 );
+        glEnableVertexAttribArray( 1 );
+        glVertexAttribPointer( 1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof( StarVertex ), ( GLvoid * )offsetof( StarVertex, color ) );
+        glBindVertexArray( 0 );
+
+        CellBounds( );
+
+        // The per frame lists never grow past one entry per cell
+        visibleCells.reserve( STAR_FIELD_CELL_COUNT );
+        firsts.reserve( STAR_FIELD_CELL_COUNT );
+        counts.reserve( STAR_FIELD_CELL_COUNT );
+
+        std::cout << "Star catalog " << catalog << ": " << header.starCount << " stars in "
+                  << std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now( ) - start ).count( ) << " ms" << std::endl;
+
+        return true;
+    }
+
+    bool Valid( ) const
+    {
+        return nullptr != stars;
+    }
+
+    // Draws the visible stars behind everything else (depth at the far plane). fovY in radians
+    void Draw( GLuint program, const glm::mat4 &view, const glm::mat4 &projection, float fovY, float aspect )
+    {
+        if ( !Valid( ) )
+        {
+            return;
+        }
+
+        Select( view, fovY, aspect );
+
+        if ( firsts.empty( ) )
+        {
+            return;
+        }
+
+        glUseProgram( program );
+        glm::mat4 rotation = glm::mat4( glm::mat3( view ) );
+        glUniformMatrix4fv( glGetUniformLocation( program, "view" ), 1, GL_FALSE, &rotation[0][0] );
+        glUniformMatrix4fv( glGetUniformLocation( program, "projection" ), 1, GL_FALSE, &projection[0][0] );
+        glUniform1f( glGetUniformLocation( program, "pointScale" ), pointScale );
+        glUniform1f( glGetUniformLocation( program, "minimumPointSize" ), minimumPointSize );
+
+        // Additive sprites at the far plane, not writing depth
+        glEnable( GL_PROGRAM_POINT_SIZE );
+        glEnable( GL_BLEND );
+        glBlendFunc( GL_ONE, GL_ONE );
+        glDepthMask( GL_FALSE );
+        glDepthFunc( GL_LEQUAL );
+
+        glBindVertexArray( VAO );
+        glMultiDrawArrays( GL_POINTS, firsts.data( ), counts.data( ), ( GLsizei )firsts.size( ) );
+        glBindVertexArray( 0 );
+
+        glDepthFunc( GL_LESS );
+        glDepthMask( GL_TRUE );
+        glDisable( GL_BLEND );
+        glDisable( GL_PROGRAM_POINT_SIZE );
+    }
+
+    // Culls the cells to the view and picks how many of each one's brightest stars Draw submits, without drawing
+    void Select( const glm::mat4 &view, float fovY, float aspect )
+    {
+        if ( !Valid( ) )
+        {
+            return;
+        }
+
+        // Cells whose cone overlaps the cone around the view direction that contains the frustum
+        glm::vec3 forward = -glm::vec3( view[0][2], view[1][2], view[2][2] );
+        float viewRadius = atanf( tanf( 0.5f * fovY ) * sqrtf( 1.0f + aspect * aspect ) );
+        visibleCells.clear( );
+
+        for ( int cell = 0; cell < STAR_FIELD_CELL_COUNT; cell++ )
+        {
+            float angle = acosf( std::min( 1.0f, std::max( -1.0f, glm::dot( forward, cellCenters[cell] ) ) ) );
+
+            if ( cells[cell].count > 0 && angle <= viewRadius + cellRadii[cell] )
+            {
+                visibleCells.push_back( cell );
+            }
+        }
+
+        float cutoff = Cutoff( );
+        firsts.clear( );
+        counts.clear( );
+        drawnStars = 0;
+
+        for ( int cell : visibleCells )
+        {
+            GLsizei count = CountBrighter( cell, cutoff );
+
+            if ( count > 0 )
+            {
+                firsts.push_back( cells[cell].first );
+                counts.push_back( count );
+                drawnStars += count;
+            }
+        }
+
+        drawnCutoff = cutoff;
+    }
+
+    void PrintStats( )
+    {
+        if ( !Valid( ) )
+        {
+            return;
+        }
+
+        std::cout << "Star field: " << drawnStars << " of " << header.starCount << " stars drawn from " << visibleCells.size( )
+                  << "/" << STAR_FIELD_CELL_COUNT << " visible cells, down to magnitude " << drawnCutoff << std::endl;
+    }
+
+    // Parses the CSV catalog and writes the converted file to path. Lines not starting with a number (headers,
+    // comments) are skipped
+    static bool Build( const std::string &catalog, const std::string &path, uint64_t sourceSize, int64_t sourceTime )
+    {
+        auto start = std::chrono::high_resolution_clock::now( );
+
+        MappedFile source( catalog );
+
+        if ( !source.Data( ) )
+        {
+            std::cerr << "ERROR: Could not read star catalog: " << catalog << std::endl;
+            return false;
+        }
+
+        // Split at line boundaries, one chunk per thread
+        const char *text = ( const char * )source.Data( );
+        size_t size = source.Size( );
+        size_t chunkCount = JobSystem::Get( ).ThreadCount( );
+        std::vector<size_t> bounds( chunkCount + 1, size );
+        bounds[0] = 0;
+
+        for ( size_t i = 1; i < chunkCount; i++ )
+        {
+            size_t at = std::max( bounds[i - 1], size * i / chunkCount );
+
+            while ( at > 0 && at < size && '\n' != text[at - 1] )
+            {
+                at++;
+            }
+
+            bounds[i] = at;
+        }
+
+        std::vector<std::vector<StarVertex>> parsed( chunkCount );
+        JobSystem::Get( ).ParallelFor( chunkCount, 1, [&]( size_t begin, size_t end )
+        {
+            for ( size_t chunk = begin; chunk < end; chunk++ )
+            {
+                ParseLines( text + bounds[chunk], text + bounds[chunk + 1], parsed[chunk] );
+            }
+        } );
+
+        // Bucket by cell, brightest first within a cell
+        std::vector<std::pair<uint32_t, StarVertex>> keyed;
+
+        for ( const std::vector<StarVertex> &chunk : parsed )
+        {
+            for ( const StarVertex &star : chunk )
+            {
+                keyed.push_back( std::make_pair( ( uint32_t )CellOf( glm::vec3( star.x, star.y, star.z ) ), star ) );
+            }
+        }
+
+        std::sort( keyed.begin( ), keyed.end( ), []( const std::pair<uint32_t, StarVertex> &a, const std::pair<uint32_t, StarVertex> &b )
+        {
+            return a.first != b.first ? a.first < b.first : a.second.magnitude < b.second.magnitude;
+        } );
+
+        StarFieldHeader header;
+        memcpy( header.magic, STAR_FIELD_MAGIC, 4 );
+        header.version = STAR_FIELD_VERSION;
+        header.starCount = ( uint32_t )keyed.size( );
+        header.cellCount = STAR_FIELD_CELL_COUNT;
+        header.sourceSize = sourceSize;
+        header.sourceTime = sourceTime;
+
+        std::vector<StarFieldCell> cells( STAR_FIELD_CELL_COUNT, StarFieldCell { 0, 0 } );
+        std::vector<StarVertex> stars( keyed.size( ) );
+
+        for ( size_t i = 0; i < keyed.size( ); i++ )
+        {
+            StarFieldCell &cell = cells[keyed[i].first];
+
+            if ( 0 == cell.count )
+            {
+                cell.first = ( uint32_t )i;
+            }
+
+            cell.count++;
+            stars[i] = keyed[i].second;
+        }
+
+        std::error_code error;
+        std::filesystem::create_directories( TEXTURE_CACHE_DIRECTORY, error );
+        std::string temporaryPath = path + ".tmp";
+
+        {
+            std::ofstream file( temporaryPath, std::ios::binary );
+            file.write( ( const char * )&header, sizeof( header ) );
+            file.write( ( const char * )cells.data( ), cells.size( ) * sizeof( StarFieldCell ) );
+
+            std::vector<char> padding( DataOffset( ) - sizeof( header ) - cells.size( ) * sizeof( StarFieldCell ), 0 );
+            file.write( padding.data( ), padding.size( ) );
+            file.write( ( const char * )stars.data( ), stars.size( ) * sizeof( StarVertex ) );
+
+            if ( !file )
+            {
+                std::cerr << "ERROR: Could not write star catalog: " << path << std::endl;
+                return false;
+            }
+        }
+
+        std::filesystem::rename( temporaryPath, path, error );
+
+        std::cout << "Converted star catalog " << path << ": " << stars.size( ) << " stars in "
+                  << std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now( ) - start ).count( ) << " ms" << std::endl;
+
+        return !error;
+    }
+
+private:
+    std::string catalog;
+    MappedFile file;
+    StarFieldHeader header;
+    const StarFieldCell *cells = nullptr;
+    const StarVertex *stars = nullptr;
+
+    GLuint VAO = 0;
+    GLuint VBO = 0;
+
+    glm::vec3 cellCenters[STAR_FIELD_CELL_COUNT];
+    float cellRadii[STAR_FIELD_CELL_COUNT];
+
+    // Per frame, kept to avoid allocating
+    std::vector<int> visibleCells;
+    std::vector<GLint> firsts;
+    std::vector<GLsizei> counts;
+    size_t drawnStars = 0;
+    float drawnCutoff = 0.0f;
+
+    static uint64_t DataOffset( )
+    {
+        return ( sizeof( StarFieldHeader ) + STAR_FIELD_CELL_COUNT * sizeof( StarFieldCell ) + 15 ) & ~( uint64_t )15;
+    }
+
+    // Cube face by largest axis, then the cell on that face
+    static int CellOf( const glm::vec3 &direction )
+    {
+        glm::vec3 magnitude = glm::abs( direction );
+        int axis = magnitude.x >= magnitude.y && magnitude.x >= magnitude.z ? 0 : ( magnitude.y >= magnitude.z ? 1 : 2 );
+        int face = 2 * axis + ( direction[axis] < 0.0f ? 1 : 0 );
+        float major = std::max( magnitude[axis], 1e-20f );
+        float u = direction[( axis + 1 ) % 3] / major;
+        float v = direction[( axis + 2 ) % 3] / major;
+
+        int column = std::min( STAR_FIELD_CELLS_PER_FACE - 1, ( int )( ( u + 1.0f ) * 0.5f * STAR_FIELD_CELLS_PER_FACE ) );
+        int row = std::min( STAR_FIELD_CELLS_PER_FACE - 1, ( int )( ( v + 1.0f ) * 0.5f * STAR_FIELD_CELLS_PER_FACE ) );
+
+        return ( face * STAR_FIELD_CELLS_PER_FACE + std::max( 0, row ) ) * STAR_FIELD_CELLS_PER_FACE + std::max( 0, column );
+    }
+
+    // Direction on the cube of face coordinates u, v in [-1, 1]
+    static glm::vec3 FacePoint( int face, float u, float v )
+    {
+        int axis = face / 2;
+        glm::vec3 point;
+        point[axis] = ( face & 1 ) ? -1.0f : 1.0f;
+        point[( axis + 1 ) % 3] = u;
+        point[( axis + 2 ) % 3] = v;
+
+        return glm::normalize( point );
+    }
+
+    // The cone around each cell: its center and the angle to its farthest corner
+    void CellBounds( )
+    {
+        for ( int cell = 0; cell < STAR_FIELD_CELL_COUNT; cell++ )
+        {
+            int face = cell / ( STAR_FIELD_CELLS_PER_FACE * STAR_FIELD_CELLS_PER_FACE );
+            int row = ( cell / STAR_FIELD_CELLS_PER_FACE ) % STAR_FIELD_CELLS_PER_FACE;
+            int column = cell % STAR_FIELD_CELLS_PER_FACE;
+            float step = 2.0f / STAR_FIELD_CELLS_PER_FACE;
+            float u0 = -1.0f + column * step;
+            float v0 = -1.0f + row * step;
+
+            cellCenters[cell] = FacePoint( face, u0 + 0.5f * step, v0 + 0.5f * step );
+            cellRadii[cell] = 0.0f;
+
+            for ( int corner = 0; corner < 4; corner++ )
+            {
+                glm::vec3 point = FacePoint( face, u0 + ( corner & 1 ) * step, v0 + ( corner >> 1 ) * step );
+                cellRadii[cell] = std::max( cellRadii[cell], acosf( std::min( 1.0f, glm::dot( point, cellCenters[cell] ) ) ) );
+            }
+        }
+    }
+
+    // Stars of cell with a magnitude up to cutoff, which are the first ones
+    GLsizei CountBrighter( int cell, float cutoff ) const
+    {
+        const StarVertex *begin = stars + cells[cell].first;
+        const StarVertex *end = begin + cells[cell].count;
+
+        return ( GLsizei )( std::upper_bound( begin, end, cutoff, []( float value, const StarVertex &star ) { return value < star.magnitude; } ) - begin );
+    }
+
+    // Faintest magnitude that keeps the visible stars within maxStars
+    float Cutoff( ) const
+    {
+        auto total = [this]( float cutoff )
+        {
+            size_t count = 0;
+
+            for ( int cell : visibleCells )
+            {
+                count += CountBrighter( cell, cutoff );
+            }
+
+            return count;
+        };
+
+        if ( total( limitingMagnitude ) <= maxStars )
+        {
+            return limitingMagnitude;
+        }
+
+        float low = -30.0f;
+        float high = std::min( limitingMagnitude, 30.0f );
+
+        for ( int i = 0; i < 24; i++ )
+        {
+            float middle = 0.5f * ( low + high );
+
+            if ( total( middle ) <= maxStars )
+            {
+                low = middle;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+
+        return low;
+    }
+
+    // Maps a converted catalog if it is complete and matches the source
+    bool Map( const std::string &path, uint64_t sourceSize, int64_t sourceTime )
+    {
+        if ( !file.Open( path ) || file.Size( ) < DataOffset( ) )
+        {
+            file.Close( );
+            return false;
+        }
+
+        memcpy( &header, file.Data( ), sizeof( header ) );
+
+        if ( 0 == memcmp( header.magic, STAR_FIELD_MAGIC, 4 ) && STAR_FIELD_VERSION == header.version && STAR_FIELD_CELL_COUNT == header.cellCount
+          && header.sourceSize == sourceSize && header.sourceTime == sourceTime
+          && file.Size( ) >= DataOffset( ) + ( uint64_t )header.starCount * sizeof( StarVertex ) )
+        {
+            cells = ( const StarFieldCell * )( file.Data( ) + sizeof( StarFieldHeader ) );
+            stars = ( const StarVertex * )( file.Data( ) + DataOffset( ) );
+            return true;
+        }
+
+        file.Close( );
+
+        return false;
+    }
+
+    // ra, dec (degrees), magnitude[, B-V] per line
+    static void ParseLines( const char *text, const char *end, std::vector<StarVertex> &out )
+    {
+        while ( text < end )
+        {
+            const char *lineEnd = ( const char * )memchr( text, '\n', end - text );
+            lineEnd = lineEnd ? lineEnd : end;
+
+            char first = *text;
+
+            if ( ( first >= '0' && first <= '9' ) || '-' == first || '+' == first || '.' == first )
+            {
+                // strtof stops at the comma; the line is copied so it can't run past the chunk
+                char line[256];
+                size_t length = std::min( ( size_t )( lineEnd - text ), sizeof( line ) - 1 );
+                memcpy( line, text, length );
+                line[length] = '\0';
+
+                float values[4] = { 0.0f, 0.0f, 0.0f, 0.65f };
+                char *cursor = line;
+                int found = 0;
+
+                for ( ; found < 4; found++ )
+                {
+                    char *next;
+                    float value = strtof( cursor, &next );
+
+                    if ( next == cursor )
+                    {
+                        break;
+                    }
+
+                    values[found] = value;
+                    cursor = next;
+
+                    while ( ',' == *cursor || ' ' == *cursor || '\t' == *cursor )
+                    {
+                        cursor++;
+                    }
+                }
+
+                if ( found >= 3 )
+                {
+                    float ra = glm::radians( values[0] );
+                    float dec = glm::radians( values[1] );
+
+                    StarVertex star;
+                    star.x = cosf( dec ) * cosf( ra );
+                    star.y = sinf( dec );
+                    star.z = -cosf( dec ) * sinf( ra );
+                    star.magnitude = values[2];
+                    ColorOf( values[3], star.color );
+                    out.push_back( star );
+                }
+            }
+
+            text = lineEnd + 1;
+        }
+    }
+
+    // Blackbody color for a B-V color index: temperature from Ballesteros' formula, then a fit of the Planckian locus
+    static void ColorOf( float bv, uint8_t *color )
+    {
+        bv = std::min( 2.0f, std::max( -0.4f, bv ) );
+        float kelvin = 4600.0f * ( 1.0f / ( 0.92f * bv + 1.7f ) + 1.0f / ( 0.92f * bv + 0.62f ) );
+        float t = kelvin / 100.0f;
+
+        float r = t <= 66.0f ? 255.0f : 329.7f * powf( t - 60.0f, -0.1332f );
+        float g = t <= 66.0f ? 99.47f * logf( t ) - 161.12f : 288.12f * powf( t - 60.0f, -0.0755f );
+        float b = t >= 66.0f ? 255.0f : ( t <= 19.0f ? 0.0f : 138.52f * logf( t - 10.0f ) - 305.04f );
+
+        color[0] = ( uint8_t )std::min( 255.0f, std::max( 0.0f, r ) );
+        color[1] = ( uint8_t )std::min( 255.0f, std::max( 0.0f, g ) );
+        color[2] = ( uint8_t )std::min( 255.0f, std::max( 0.0f, b ) );
+        color[3] = 255;
+    }
+};
@@ -0,0 +1,350 @@
+#pragma once
+
+// Std. Includes
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+// Timeline of everything that happens before the scene is fully on screen: load phases and their sub-phases on the
+// main thread, background work (texture preparation) on the job system's threads, then every frame drawn while
+// deferred loading is still going on. Phases are opened with Begin/End or STARTUP_SCOPE from any thread. Time counts
+// from the start of the process, so the time to the first frame includes everything before main too.
+//
+// The first frame and the first frame with nothing left to load (time to loaded) are always measured; the timeline
+// itself is only recorded when enabled (--startup-trace, --bench) and is written as Chrome trace JSON once loading is
+// done.
+class StartupTrace
+{
+public:
+    // Record the timeline
+    static inline bool enabled = false;
+
+    // Where the timeline is written, or nothing if empty
+    std::string outputPath;
+
+    static StartupTrace &Get( )
+    {
+        static StartupTrace instance;
+
+        return instance;
+    }
+
+    bool Recording( ) const
+    {
+        return enabled && !loaded;
+    }
+
+    // Milliseconds since the process started
+    static double Now( )
+    {
+        return std::chrono::duration<double, std::milli>( Clock::now( ) - processStart ).count( );
+    }
+
+    // Names the calling thread in the timeline
+    void NameThread( const std::string &name )
+    {
+        int thread = ThreadId( );
+        std::lock_guard<std::mutex> lock( mutex );
+
+        if ( ( size_t )thread >= threadNames.size( ) )
+        {
+            threadNames.resize( thread + 1 );
+        }
+
+        threadNames[thread] = name;
+    }
+
+    // Opens a phase on the calling thread, inside whatever phase it has open. Phases still open when loading is done
+    // are dropped
+    void Begin( const std::string &name )
+    {
+        if ( !enabled )
+        {
+            return;
+        }
+
+        OpenPhase phase = { name, Now( ) };
+        OpenPhases( ).push_back( phase );
+    }
+
+    void End( )
+    {
+        std::vector<OpenPhase> &open = OpenPhases( );
+
+        if ( open.empty( ) )
+        {
+            return;
+        }
+
+        OpenPhase phase = open.back( );
+        open.pop_back( );
+        Record( phase.name, phase.begin, Now( ), ( int )open.size( ) );
+    }
+
+    // Call once a frame after it is presented, with whether deferred loading still has work queued
+    void FramePresented( bool loading )
+    {
+        double now = Now( );
+
+        if ( firstFrameMs < 0.0 )
+        {
+            firstFrameMs = now;
+            Instant( "First frame", now );
+        }
+        else if ( Recording( ) )
+        {
+            Record( "Frame", lastFrameMs, now, 0 );
+        }
+
+        lastFrameMs = now;
+
+        if ( !loading && !loaded )
+        {
+            loadedMs = now;
+            Instant( "Loaded", now );
+            loaded = true;
+            Write( );
+        }
+    }
+
+    double TimeToFirstFrame( ) const
+    {
+        return firstFrameMs;
+    }
+
+    double TimeToLoaded( ) const
+    {
+        return loadedMs;
+    }
+
+    void PrintStats( )
+    {
+        if ( firstFrameMs < 0.0 )
+        {
+            return;
+        }
+
+        std::cout << "Startup: first frame after " << firstFrameMs << " ms, loaded after " << loadedMs << " ms" << std::endl;
+
+        std::vector<std::pair<std::string, double>> phases = MainPhases( );
+
+        for ( const std::pair<std::string, double> &phase : phases )
+        {
+            std::cout << "  " << phase.first << ": " << phase.second << " ms" << std::endl;
+        }
+    }
+
+    // Startup times, with the main thread's top level phases if the timeline was recorded, as a JSON object
+    std::string Json( )
+    {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision( 4 ) << "{ \"time_to_first_frame_ms\": " << firstFrameMs << ", \"time_to_loaded_ms\": "
+            << loadedMs << ", \"phases_ms\": {";
+
+        std::vector<std::pair<std::string, double>> phases = MainPhases( );
+
+        for ( size_t i = 0; i < phases.size( ); i++ )
+        {
+            out << ( i > 0 ? ", " : " " ) << "\"" << Escape( phases[i].first ) << "\": " << phases[i].second;
+        }
+
+        out << ( phases.empty( ) ? "" : " " ) << "} }";
+
+        return out.str( );
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // Set during static initialization, before main
+    static inline const Clock::time_point processStart = Clock::now( );
+
+    struct OpenPhase
+    {
+        std::string name;
+        double begin;
+    };
+
+    struct Event
+    {
+        std::string name;
+        int thread;
+        int depth;
+        double begin;
+        double end;
+        bool instant;
+    };
+
+    std::mutex mutex;
+    std::vector<Event> events;
+    std::vector<std::string> threadNames;
+    std::atomic<int> nextThread;
+
+    double firstFrameMs = -1.0;
+    double loadedMs = -1.0;
+    double lastFrameMs = 0.0;
+
+    // Set by the main thread, read by the job system's threads through Recording
+    std::atomic<bool> loaded;
+
+    StartupTrace( ) : nextThread( 1 ), loaded( false )
+    {
+    }
+
+    // Small ids in the order threads first show up
+    int ThreadId( )
+    {
+        thread_local int id = nextThread++;
+
+        return id;
+    }
+
+    static std::vector<OpenPhase> &OpenPhases( )
+    {
+        thread_local std::vector<OpenPhase> open;
+
+        return open;
+    }
+
+    void Record( const std::string &name, double begin, double end, int depth )
+    {
+        if ( !Recording( ) )
+        {
+            return;
+        }
+
+        Event event = { name, ThreadId( ), depth, begin, end, false };
+        std::lock_guard<std::mutex> lock( mutex );
+        events.push_back( event );
+    }
+
+    void Instant( const std::string &name, double time )
+    {
+        if ( !Recording( ) )
+        {
+            return;
+        }
+
+        Event event = { name, ThreadId( ), 0, time, time, true };
+        std::lock_guard<std::mutex> lock( mutex );
+        events.push_back( event );
+    }
+
+    // Time in each top level phase of the thread that named itself first (the main thread), in the order they ran
+    std::vector<std::pair<std::string, double>> MainPhases( )
+    {
+        std::vector<std::pair<std::string, double>> phases;
+        std::lock_guard<std::mutex> lock( mutex );
+
+        for ( const Event &event : events )
+        {
+            if ( 1 != event.thread || 0 != event.depth || event.instant || "Frame" == event.name )
+            {
+                continue;
+            }
+
+            phases.push_back( std::make_pair( event.name, event.end - event.begin ) );
+        }
+
+        return phases;
+    }
+
+    static std::string Escape( const std::string &text )
+    {
+        std::string escaped;
+
+        for ( char c : text )
+        {
+            if ( '"' == c || '\\' == c )
+            {
+                escaped += '\\';
+            }
+
+            // Control characters aren't allowed in JSON strings
+            escaped += ( unsigned char )c < 0x20 ? ' ' : c;
+        }
+
+        return escaped;
+    }
+
+    void Write( )
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+
+        if ( outputPath.empty( ) || events.empty( ) )
+        {
+            return;
+        }
+
+        std::ofstream file( outputPath );
+
+        if ( !file )
+        {
+            std::cerr << "ERROR: Can't write the startup trace to " << outputPath << std::endl;
+            return;
+        }
+
+        file << std::fixed << std::setprecision( 3 ) << "{\"traceEvents\":[\n";
+
+        for ( int thread = 1; thread < nextThread; thread++ )
+        {
+            std::string name = ( size_t )thread < threadNames.size( ) && !threadNames[thread].empty( ) ? threadNames[thread] : "Thread " + std::to_string( thread );
+            file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread << ",\"args\":{\"name\":\"" << Escape( name ) << "\"}},\n";
+        }
+
+        for ( size_t i = 0; i < events.size( ); i++ )
+        {
+            const Event &event = events[i];
+            file << "{\"name\":\"" << Escape( event.name ) << "\",\"pid\":1,\"tid\":" << event.thread << ",\"ts\":" << event.begin * 1000.0;
+
+            if ( event.instant )
+            {
+                file << ",\"ph\":\"i\",\"s\":\"g\"}";
+            }
+            else
+            {
+                file << ",\"ph\":\"X\",\"dur\":" << ( event.end - event.begin ) * 1000.0 << "}";
+            }
+
+            file << ( i + 1 < events.size( ) ? ",\n" : "\n" );
+        }
+
+        file << "]}\n";
+        std::cout << "Startup trace: " << events.size( ) << " events written to " << outputPath << std::endl;
+    }
+};
+
+// Records the rest of the enclosing block as a startup phase
+class StartupScope
+{
+public:
+    explicit StartupScope( const std::string &name ) : opened( StartupTrace::enabled )
+    {
+        if ( opened )
+        {
+            StartupTrace::Get( ).Begin( name );
+        }
+    }
+
+    ~StartupScope( )
+    {
+        if ( opened )
+        {
+            StartupTrace::Get( ).End( );
+        }
+    }
+
+private:
+    bool opened;
+};
+
+#define STARTUP_CONCATENATE_( a, b ) a##b
+#define STARTUP_CONCATENATE( a, b ) STARTUP_CONCATENATE_( a, b )
+#define STARTUP_SCOPE( name ) StartupScope STARTUP_CONCATENATE( startupScope, __LINE__ )( name )
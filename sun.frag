@@ -5,7 +5,27 @@ in vec2 TexCoords;
 
 uniform sampler2D texture_diffuse1;
 
+// Set when the texture lives in an array page instead (see texture_array.h)
+uniform sampler2DArray textureArrays[4];
+uniform int texture_diffuse1_page = -1;
+uniform float texture_diffuse1_layer;
+
+vec4 SampleArray(int page, float layer, vec2 uv)
+{
+    // Sampler arrays only take constant indices in 3.30
+    switch (page)
+    {
+        case 0: return texture(textureArrays[0], vec3(uv, layer));
+        case 1: return texture(textureArrays[1], vec3(uv, layer));
+        case 2: return texture(textureArrays[2], vec3(uv, layer));
+        default: return texture(textureArrays[3], vec3(uv, layer));
+    }
+}
+
 void main()
 {    
-    FragColor = texture(texture_diffuse1, TexCoords);
+    if (texture_diffuse1_page >= 0)
+        FragColor = SampleArray(texture_diffuse1_page, texture_diffuse1_layer, TexCoords);
+    else
+        FragColor = texture(texture_diffuse1, TexCoords);
 }
\ No newline at end of file
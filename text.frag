@@ -0,0 +1,11 @@
+#version 330 core
+in vec2 GlyphCoords;
+in vec4 TextColor;
+out vec4 color;
+
+uniform sampler2D glyphs;
+
+void main()
+{
+    color = vec4(TextColor.rgb, TextColor.a * texture(glyphs, GlyphCoords).r);
+}
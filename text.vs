@@ -0,0 +1,16 @@
+#version 330 core
+layout (location = 0) in vec4 vertex;
+layout (location = 1) in vec4 color;
+out vec2 GlyphCoords;
+out vec4 TextColor;
+
+// Pixels, origin at the top left
+uniform vec2 screenSize;
+
+void main()
+{
+    vec2 ndc = vertex.xy / screenSize * 2.0 - 1.0;
+    gl_Position = vec4(ndc.x, -ndc.y, 0.0, 1.0);
+    GlyphCoords = vertex.zw;
+    TextColor = color;
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Glyph cells in screen pixels at scale 1: a 3x5 glyph plus a column and a row of spacing
+const int TEXT_OVERLAY_GLYPH_WIDTH = 3;
+const int TEXT_OVERLAY_GLYPH_HEIGHT = 5;
+const int TEXT_OVERLAY_CELL_WIDTH = 4;
+const int TEXT_OVERLAY_CELL_HEIGHT = 6;
+
+// Printable ASCII from space to underscore (lower case is drawn as upper case), then a solid block used for rectangles
+const int TEXT_OVERLAY_FIRST_CHAR = 32;
+const int TEXT_OVERLAY_GLYPH_COUNT = 65;
+
+// Rows of each glyph from the top, 3 bits per row with the left pixel in bit 2
+const uint8_t TEXT_OVERLAY_FONT[TEXT_OVERLAY_GLYPH_COUNT][TEXT_OVERLAY_GLYPH_HEIGHT] =
+{
+    { 0, 0, 0, 0, 0 }, { 2, 2, 2, 0, 2 }, { 5, 5, 0, 0, 0 }, { 5, 7, 5, 7, 5 }, // space ! " #
+    { 3, 6, 2, 3, 6 }, { 5, 1, 2, 4, 5 }, { 2, 5, 2, 5, 3 }, { 2, 2, 0, 0, 0 }, // $ % & '
+    { 1, 2, 2, 2, 1 }, { 4, 2, 2, 2, 4 }, { 0, 5, 2, 5, 0 }, { 0, 2, 7, 2, 0 }, // ( ) * +
+    { 0, 0, 0, 2, 4 }, { 0, 0, 7, 0, 0 }, { 0, 0, 0, 0, 2 }, { 1, 1, 2, 4, 4 }, // , - . /
+    { 7, 5, 5, 5, 7 }, { 2, 6, 2, 2, 7 }, { 7, 1, 7, 4, 7 }, { 7, 1, 7, 1, 7 }, // 0 1 2 3
+    { 5, 5, 7, 1, 1 }, { 7, 4, 7, 1, 7 }, { 7, 4, 7, 5, 7 }, { 7, 1, 1, 1, 1 }, // 4 5 6 7
+    { 7, 5, 7, 5, 7 }, { 7, 5, 7, 1, 7 }, { 0, 2, 0, 2, 0 }, { 0, 2, 0, 2, 4 }, // 8 9 : ;
+    { 1, 2, 4, 2, 1 }, { 0, 7, 0, 7, 0 }, { 4, 2, 1, 2, 4 }, { 6, 1, 2, 0, 2 }, // < = > ?
+    { 7, 5, 7, 4, 7 }, { 2, 5, 7, 5, 5 }, { 6, 5, 6, 5, 6 }, { 3, 4, 4, 4, 3 }, // @ A B C
+    { 6, 5, 5, 5, 6 }, { 7, 4, 6, 4, 7 }, { 7, 4, 6, 4, 4 }, { 3, 4, 5, 5, 3 }, // D E F G
+    { 5, 5, 7, 5, 5 }, { 7, 2, 2, 2, 7 }, { 1, 1, 1, 5, 2 }, { 5, 5, 6, 5, 5 }, // H I J K
+    { 4, 4, 4, 4, 7 }, { 5, 7, 7, 5, 5 }, { 6, 5, 5, 5, 5 }, { 2, 5, 5, 5, 2 }, // L M N O
+    { 6, 5, 6, 4, 4 }, { 2, 5, 5, 6, 3 }, { 6, 5, 6, 5, 5 }, { 3, 4, 2, 1, 6 }, // P Q R S
+    { 7, 2, 2, 2, 2 }, { 5, 5, 5, 5, 7 }, { 5, 5, 5, 5, 2 }, { 5, 5, 7, 7, 5 }, // T U V W
+    { 5, 5, 2, 5, 5 }, { 5, 5, 2, 2, 2 }, { 7, 1, 2, 4, 7 }, { 3, 2, 2, 2, 3 }, // X Y Z [
+    { 4, 4, 2, 1, 1 }, { 6, 2, 2, 2, 6 }, { 2, 5, 0, 0, 0 }, { 0, 0, 0, 0, 7 }, // \ ] ^ _
+    { 7, 7, 7, 7, 7 }
+};
+
+// Screen space text and rectangles for debug displays, drawn on top of the frame in one call. Lines and boxes are
+// queued with Print and Rect, in pixels from the top left corner, and Draw blends them all in with a shader like
+// text.vs/text.frag. The font is built in, so nothing is loaded from disk. Used from the GL thread
+class TextOverlay
+{
+public:
+    // Size of a font pixel in screen pixels
+    int scale = 2;
+
+    int LineHeight( ) const
+    {
+        return TEXT_OVERLAY_CELL_HEIGHT * scale;
+    }
+
+    int CharWidth( ) const
+    {
+        return TEXT_OVERLAY_CELL_WIDTH * scale;
+    }
+
+    void Print( float x, float y, const std::string &text, const glm::vec4 &color = glm::vec4( 1.0f ) )
+    {
+        for ( char c : text )
+        {
+            int glyph = ( c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c ) - TEXT_OVERLAY_FIRST_CHAR;
+
+            if ( glyph > 0 && glyph < TEXT_OVERLAY_GLYPH_COUNT - 1 )
+            {
+                Quad( x, y, ( float )( TEXT_OVERLAY_GLYPH_WIDTH * scale ), ( float )( TEXT_OVERLAY_GLYPH_HEIGHT * scale ), glyph, color );
+            }
+
+            x += CharWidth( );
+        }
+    }
+
+    void Rect( float x, float y, float width, float height, const glm::vec4 &color )
+    {
+        Quad( x, y, width, height, TEXT_OVERLAY_GLYPH_COUNT - 1, color );
+    }
+
+    // Draws everything queued since the last call over the current framebuffer
+    void Draw( GLuint program, int screenWidth, int screenHeight )
+    {
+        if ( vertices.empty( ) )
+        {
+            return;
+        }
+
+        if ( 0 == vao )
+        {
+            Create( );
+        }
+
+        GLboolean depthTest = glIsEnabled( GL_DEPTH_TEST );
+        GLboolean blend = glIsEnabled( GL_BLEND );
+        glDisable( GL_DEPTH_TEST );
+        glEnable( GL_BLEND );
+        glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+
+        glUseProgram( program );
+        glUniform2f( glGetUniformLocation( program, "screenSize" ), ( float )screenWidth, ( float )screenHeight );
+        glUniform1i( glGetUniformLocation( program, "glyphs" ), 0 );
+        glActiveTexture( GL_TEXTURE0 );
+        glBindTexture( GL_TEXTURE_2D, texture );
+
+        glBindVertexArray( vao );
+        glBindBuffer( GL_ARRAY_BUFFER, vbo );
+        glBufferData( GL_ARRAY_BUFFER, vertices.size( ) * sizeof( Vertex ), vertices.data( ), GL_STREAM_DRAW );
+        glDrawArrays( GL_TRIANGLES, 0, ( GLsizei )vertices.size( ) );
+        glBindVertexArray( 0 );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+
+        if ( depthTest )
+        {
+            glEnable( GL_DEPTH_TEST );
+        }
+
+        if ( !blend )
+        {
+            glDisable( GL_BLEND );
+        }
+
+        vertices.clear( );
+    }
+
+private:
+    struct Vertex
+    {
+        float x;
+        float y;
+        float u;
+        float v;
+        glm::vec4 color;
+    };
+
+    std::vector<Vertex> vertices;
+    GLuint vao = 0;
+    GLuint vbo = 0;
+    GLuint texture = 0;
+
+    void Quad( float x, float y, float width, float height, int glyph, const glm::vec4 &color )
+    {
+        // Texel edges of the glyph in the atlas, which holds every glyph side by side with a column between them
+        float atlasWidth = ( float )( TEXT_OVERLAY_GLYPH_COUNT * TEXT_OVERLAY_CELL_WIDTH );
+        float u0 = glyph * TEXT_OVERLAY_CELL_WIDTH / atlasWidth;
+        float u1 = ( glyph * TEXT_OVERLAY_CELL_WIDTH + TEXT_OVERLAY_GLYPH_WIDTH ) / atlasWidth;
+
+        Vertex topLeft = { x, y, u0, 0.0f, color };
+        Vertex topRight = { x + width, y, u1, 0.0f, color };
+        Vertex bottomLeft = { x, y + height, u0, 1.0f, color };
+        Vertex bottomRight = { x + width, y + height, u1, 1.0f, color };
+
+        vertices.push_back( topLeft );
+        vertices.push_back( bottomLeft );
+        vertices.push_back( topRight );
+        vertices.push_back( topRight );
+        vertices.push_back( bottomLeft );
+        vertices.push_back( bottomRight );
+    }
+
+    // The GL objects are left to the context
+    void Create( )
+    {
+        int width = TEXT_OVERLAY_GLYPH_COUNT * TEXT_OVERLAY_CELL_WIDTH;
+        std::vector<uint8_t> atlas( ( size_t )width * TEXT_OVERLAY_GLYPH_HEIGHT, 0 );
+
+        for ( int glyph = 0; glyph < TEXT_OVERLAY_GLYPH_COUNT; glyph++ )
+        {
+            for ( int row = 0; row < TEXT_OVERLAY_GLYPH_HEIGHT; row++ )
+            {
+                for ( int column = 0; column < TEXT_OVERLAY_GLYPH_WIDTH; column++ )
+                {
+                    if ( TEXT_OVERLAY_FONT[glyph][row] & ( 4 >> column ) )
+                    {
+                        atlas[( size_t )row * width + glyph * TEXT_OVERLAY_CELL_WIDTH + column] = 255;
+                    }
+                }
+            }
+        }
+
+        glGenTextures( 1, &texture );
+        glBindTexture( GL_TEXTURE_2D, texture );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+        glTexImage2D( GL_TEXTURE_2D, 0, GL_R8, width, TEXT_OVERLAY_GLYPH_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, atlas.data( ) );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+
+        glGenVertexArrays( 1, &vao );
+        glGenBuffers( 1, &vbo );
+        glBindVertexArray( vao );
+        glBindBuffer( GL_ARRAY_BUFFER, vbo );
+        glEnableVertexAttribArray( 0 );
+        glVertexAttribPointer( 0, 4, GL_FLOAT, GL_FALSE, sizeof( Vertex ), ( GLvoid * )0 );
+        glEnableVertexAttribArray( 1 );
+        glVertexAttribPointer( 1, 4, GL_FLOAT, GL_FALSE, sizeof( Vertex ), ( GLvoid * )offsetof( Vertex, color ) );
+        glBindVertexArray( 0 );
+    }
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <iostream>
+
+#include <GL/glew.h>
+
+#include "texture_cache.h"
+#include "pixel_buffer.h"
+
+// Layers in each array page
+const GLint TEXTURE_ARRAY_LAYERS = 8;
+
+// Pages that can be bound at once, on consecutive units from TEXTURE_ARRAY_FIRST_UNIT. GLSL 3.30 can only index
+// sampler arrays with constants, so the shaders select the page with a fixed-size switch of this many cases
+const int TEXTURE_ARRAY_MAX_PAGES = 4;
+const GLint TEXTURE_ARRAY_FIRST_UNIT = 8;
+
+// Where a texture lives in the array pages
+struct TextureArraySlot
+{
+    GLuint array = 0;
+    GLint page = -1;
+    GLint layer = -1;
+};
+
+// Packs textures of the same size, format and mip count into GL_TEXTURE_2D_ARRAY pages, so materials become a
+// (page, layer) pair instead of a texture object. With every page bound once (Bind), meshes of different models only
+// differ in a couple of uniforms and share one set of texture bindings. Used from the GL thread.
+class TextureArrayAllocator
+{
+public:
+    // Put Model textures in array pages. Those textures are fully resident, not streamed
+    static inline bool enabled = false;
+
+    static TextureArrayAllocator &Get( )
+    {
+        static TextureArrayAllocator instance;
+
+        return instance;
+    }
+
+    // Copies every level of texture into a free layer. Returns an empty slot (page -1) if every page is taken and no
+    // new one can be bound, in which case the caller keeps a plain 2D texture
+    TextureArraySlot Allocate( const CachedTexture &texture )
+    {
+        TextureArraySlot slot;
+        Page *page = nullptr;
+
+        for ( size_t i = 0; i < pages.size( ) && !page; i++ )
+        {
+            if ( pages[i].used < TEXTURE_ARRAY_LAYERS && Matches( pages[i], texture ) )
+            {
+                page = &pages[i];
+            }
+        }
+
+        if ( !page )
+        {
+            if ( TEXTURE_ARRAY_MAX_PAGES == ( int )pages.size( ) )
+            {
+                return slot;
+            }
+
+            pages.push_back( CreatePage( texture ) );
+            page = &pages.back( );
+        }
+
+        slot.array = page->id;
+        slot.page = ( GLint )( page - pages.data( ) );
+        slot.layer = page->used++;
+
+        glBindTexture( GL_TEXTURE_2D_ARRAY, page->id );
+
+        for ( uint32_t level = 0; level < texture.header.mipCount; level++ )
+        {
+            const TextureCacheLevel &info = texture.levels[level];
+
+            if ( texture.header.format )
+            {
+                PixelUnpackBuffer::Get( ).UploadCompressedLayer( GL_TEXTURE_2D_ARRAY, level, slot.layer, texture.header.format,
+                                                                 info.width, info.height, texture.LevelData( level ), info.size );
+            }
+            else
+            {
+                PixelUnpackBuffer::Get( ).UploadLayer( GL_TEXTURE_2D_ARRAY, level, slot.layer, info.width, info.height, texture.Format( ),
+                                                       texture.LevelData( level ), ( size_t )info.width * texture.header.channels, texture.bottomUp );
+            }
+        }
+
+        glBindTexture( GL_TEXTURE_2D_ARRAY, 0 );
+
+        return slot;
+    }
+
+    // Binds every page and points the shader's textureArrays samplers at them. Once per shader per frame
+    void Bind( GLuint program )
+    {
+        for ( int i = 0; i < TEXTURE_ARRAY_MAX_PAGES; i++ )
+        {
+            static const char *names[TEXTURE_ARRAY_MAX_PAGES] = { "textureArrays[0]", "textureArrays[1]", "textureArrays[2]", "textureArrays[3]" };
+
+            glActiveTexture( GL_TEXTURE0 + TEXTURE_ARRAY_FIRST_UNIT + i );
+            glBindTexture( GL_TEXTURE_2D_ARRAY, i < ( int )pages.size( ) ? pages[i].id : 0 );
+            glUniform1i( glGetUniformLocation( program, names[i] ), TEXTURE_ARRAY_FIRST_UNIT + i );
+        }
+
+        glActiveTexture( GL_TEXTURE0 );
+    }
+
+    void PrintStats( )
+    {
+        std::cout << "Texture arrays: " << pages.size( ) << " pages" << std::endl;
+
+        for ( const Page &page : pages )
+        {
+            std::cout << "  " << page.width << "x" << page.height << " " << BlockCompressor::FormatName( page.format ) << ", "
+                      << page.used << "/" << TEXTURE_ARRAY_LAYERS << " layers" << std::endl;
+        }
+    }
+
+private:
+    struct Page
+    {
+        GLuint id;
+        uint32_t width;
+        uint32_t height;
+        uint32_t mipCount;
+        GLenum format;
+        GLenum pixelFormat;
+        GLint used;
+    };
+
+    std::vector<Page> pages;
+
+    TextureArrayAllocator( )
+    {
+    }
+
+    static bool Matches( const Page &page, const CachedTexture &texture )
+    {
+        return page.width == texture.header.width && page.height == texture.header.height && page.mipCount == texture.header.mipCount
+            && page.format == ( texture.header.format ? texture.header.format : ( GLenum )texture.InternalFormat( ) )
+            && page.pixelFormat == texture.Format( );
+    }
+
+    // Allocates the storage of every level for all layers
+    static Page CreatePage( const CachedTexture &texture )
+    {
+        Page page;
+        page.width = texture.header.width;
+        page.height = texture.header.height;
+        page.mipCount = texture.header.mipCount;
+        page.format = texture.header.format ? texture.header.format : ( GLenum )texture.InternalFormat( );
+        page.pixelFormat = texture.Format( );
+        page.used = 0;
+
+        glGenTextures( 1, &page.id );
+        glBindTexture( GL_TEXTURE_2D_ARRAY, page.id );
+
+        for ( uint32_t level = 0; level < page.mipCount; level++ )
+        {
+            const TextureCacheLevel &info = texture.levels[level];
+
+            if ( texture.header.format )
+            {
+                glCompressedTexImage3D( GL_TEXTURE_2D_ARRAY, level, page.format, info.width, info.height, TEXTURE_ARRAY_LAYERS, 0,
+                                        ( GLsizei )( info.size * TEXTURE_ARRAY_LAYERS ), nullptr );
+            }
+            else
+            {
+                glTexImage3D( GL_TEXTURE_2D_ARRAY, level, page.format, info.width, info.height, TEXTURE_ARRAY_LAYERS, 0,
+                              page.pixelFormat, GL_UNSIGNED_BYTE, nullptr );
+            }
+        }
+
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, page.mipCount - 1 );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+
+        return page;
+    }
+};
@@ -0,0 +1,758 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <chrono>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+#endif
+
+#include "stb_image.h"
+#include "job_system.h"
+#include "mapped_file.h"
+#include "pixel_buffer.h"
+#include "upload_queue.h"
+#include "block_compression.h"
+#include "startup_trace.h"
+
+// Converted textures are kept here, one file per source image and channel count
+const std::string TEXTURE_CACHE_DIRECTORY = "res/cache/";
+
+const char TEXTURE_CACHE_MAGIC[4] = { 'R', 'T', 'E', 'X' };
+const uint32_t TEXTURE_CACHE_VERSION = 3;
+
+// Source formats in order of decode cost, cheapest first. An uncompressed TGA is read in place and never decoded
+const char *const TEXTURE_SOURCE_EXTENSIONS[] = { ".tga", ".jpg", ".png" };
+
+// Header of a cached texture file. Followed by mipCount TextureCacheLevel entries, then the data of each level
+// (16 byte aligned): tightly packed rows, or 4x4 blocks if format is a compressed GL format (0 for uncompressed).
+// sourceSize and sourceTime detect a changed source image
+struct TextureCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t mipCount;
+    uint32_t format;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+};
+
+struct TextureCacheLevel
+{
+    uint64_t offset;
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+};
+
+// A cached texture mapped into memory. Nothing is read from disk until the levels are uploaded. If the cache can't be
+// written (read-only install) the converted file is kept in memory instead. An uncompressed TGA is mapped as is: one
+// level of BGR rows, usually bottom row first
+struct CachedTexture
+{
+    std::string source;
+    std::string path;
+    MappedFile file;
+    std::vector<unsigned char> memory;
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    TextureCacheHeader header;
+    const TextureCacheLevel *levels = nullptr;
+    std::vector<TextureCacheLevel> targaLevel;
+    bool bgr = false;
+    bool bottomUp = false;
+
+    // How the file was obtained: decoded and converted this run, or just mapped
+    bool built = false;
+    double decodeMs = 0.0;
+    double encodeMs = 0.0;
+    double prepareMs = 0.0;
+
+    bool Valid( ) const
+    {
+        return nullptr != data;
+    }
+
+    const unsigned char *LevelData( uint32_t level ) const
+    {
+        return data + levels[level].offset;
+    }
+
+    GLenum Format( ) const
+    {
+        if ( 1 == header.channels )
+            return GL_RED;
+        else if ( 4 == header.channels )
+            return bgr ? GL_BGRA : GL_RGBA;
+
+        return bgr ? GL_BGR : GL_RGB;
+    }
+
+    GLint InternalFormat( ) const
+    {
+        if ( 1 == header.channels )
+            return GL_RED;
+        else if ( 4 == header.channels )
+            return GL_RGBA;
+
+        return GL_RGB;
+    }
+};
+
+// Textures being prepared in the background. Preparing starts as soon as the batch is created, the GL thread only has
+// to Wait and upload
+class CacheBatch
+{
+public:
+    std::vector<CachedTexture> textures;
+
+    ~CacheBatch( )
+    {
+        Wait( );
+    }
+
+    void Wait( )
+    {
+        JobSystem::Get( ).Wait( counter );
+    }
+
+    // Every texture is prepared, Wait won't block
+    bool Ready( ) const
+    {
+        return 0 == counter.pending;
+    }
+
+    void PrintTimings( const std::string &name )
+    {
+        Wait( );
+
+        for ( const CachedTexture &texture : textures )
+        {
+            if ( texture.built )
+                std::cout << name << ": " << texture.source << " converted, decode " << texture.decodeMs << " ms, encode "
+                          << texture.encodeMs << " ms" << std::endl;
+            else
+                std::cout << name << ": " << texture.source << " mapped, " << texture.prepareMs << " ms" << std::endl;
+        }
+    }
+
+private:
+    friend class TextureCache;
+
+    JobSystem::Counter counter;
+};
+
+// Offline/first-run conversion of PNG/JPG textures into a raw, mmap-able container holding every mip level. The first
+// time an image is used it is decoded, its mip chain is built on the CPU and the result written to the cache; after
+// that, loading is a mmap plus one upload per level through the persistently mapped PixelUnpackBuffer, with no decoding
+// and no glGenerateMipmap. With compression on (the default) every level is stored BC1/BC3 encoded and uploaded
+// with glCompressedTexImage2D. Otherwise, uncompressed TGAs needing no mipmaps skip the cache and are uploaded from
+// their own mapping.
+class TextureCache
+{
+public:
+    // Block compress textures when they are converted. Turn off before preparing anything if the GL lacks S3TC
+    static inline bool compression = true;
+
+    static std::string CachePath( const std::string &source, int channels )
+    {
+        std::string name = source;
+        std::replace( name.begin( ), name.end( ), '/', '_' );
+        std::replace( name.begin( ), name.end( ), '\\', '_' );
+
+        return TEXTURE_CACHE_DIRECTORY + name + "." + std::to_string( channels ) + ".rtex";
+    }
+
+    // Picks the cheapest file to load for a logical texture name (with or without extension) among the formats present
+    // next to it: an uncompressed TGA that can be used in place, then a source that is already cached, then the source
+    // that is fastest to decode. Returns name unchanged if no alternative exists
+    static std::string Resolve( const std::string &name, int channels, bool mipmaps )
+    {
+        std::string base = std::filesystem::path( name ).replace_extension( ).string( );
+        std::vector<std::string> present;
+
+        for ( const char *extension : TEXTURE_SOURCE_EXTENSIONS )
+        {
+            std::error_code error;
+
+            if ( std::filesystem::is_regular_file( base + extension, error ) )
+            {
+                present.push_back( base + extension );
+            }
+        }
+
+        if ( present.empty( ) )
+        {
+            return name;
+        }
+
+        if ( !mipmaps && !compression )
+        {
+            for ( const std::string &candidate : present )
+            {
+                CachedTexture texture;
+
+                if ( MapTarga( texture, candidate, channels ) )
+                {
+                    return candidate;
+                }
+            }
+        }
+
+        for ( const std::string &candidate : present )
+        {
+            uint64_t sourceSize;
+            int64_t sourceTime;
+            int fileChannels = CachedChannels( candidate, channels );
+            CachedTexture texture;
+
+            if ( SourceInfo( candidate, sourceSize, sourceTime ) && Map( texture, CachePath( candidate, fileChannels ), sourceSize, sourceTime, fileChannels )
+              && ( !mipmaps || texture.header.mipCount > 1 ) )
+            {
+                return candidate;
+            }
+        }
+
+        return present[0];
+    }
+
+    // Maps the cached version of every path, converting the ones that are missing or stale, on the job system.
+    // channels = 0 keeps each image's own channel count. mipmaps = false stores only the base level (cubemaps)
+    static std::shared_ptr<CacheBatch> PrepareAsync( const std::vector<std::string> &paths, int channels = 0, bool mipmaps = true )
+    {
+        std::shared_ptr<CacheBatch> batch = std::make_shared<CacheBatch>( );
+        batch->textures.resize( paths.size( ) );
+
+        for ( size_t i = 0; i < paths.size( ); i++ )
+        {
+            batch->textures[i].source = paths[i];
+
+            // The raw pointer is safe: the batch waits for its tasks before it is destroyed
+            CachedTexture *texture = &batch->textures[i];
+            JobSystem::Get( ).Submit( [texture, channels, mipmaps]( ) { Prepare( *texture, channels, mipmaps ); }, batch->counter );
+        }
+
+        return batch;
+    }
+
+    static std::shared_ptr<CacheBatch> PrepareAll( const std::vector<std::string> &paths, int channels = 0, bool mipmaps = true )
+    {
+        std::shared_ptr<CacheBatch> batch = PrepareAsync( paths, channels, mipmaps );
+        batch->Wait( );
+
+        return batch;
+    }
+
+    // Uploads every level of a cached texture to target of the currently bound texture. Returns the number of levels
+    static GLuint Upload( const CachedTexture &texture, GLenum target )
+    {
+        if ( !texture.Valid( ) )
+        {
+            return 0;
+        }
+
+        for ( uint32_t level = 0; level < texture.header.mipCount; level++ )
+        {
+            UploadLevel( texture, target, level );
+        }
+
+        return texture.header.mipCount;
+    }
+
+    // Uploads a single level, straight from the mapped file into the staging buffer with no intermediate copy
+    static void UploadLevel( const CachedTexture &texture, GLenum target, uint32_t level )
+    {
+        const TextureCacheLevel &info = texture.levels[level];
+
+        if ( texture.header.format )
+        {
+            PixelUnpackBuffer::Get( ).UploadCompressed( target, level, texture.header.format, info.width, info.height,
+                                                        texture.LevelData( level ), info.size );
+        }
+        else
+        {
+            PixelUnpackBuffer::Get( ).Upload( target, level, texture.InternalFormat( ), info.width, info.height, texture.Format( ),
+                                              texture.LevelData( level ), ( size_t )info.width * texture.header.channels, texture.bottomUp );
+        }
+    }
+
+    // Queues a single level of texture id on the UploadQueue. texture must stay valid until done is called
+    static void QueueLevel( const CachedTexture &texture, GLuint id, GLenum target, uint32_t level, std::function<void( )> done )
+    {
+        const TextureCacheLevel &info = texture.levels[level];
+        TextureUpload upload;
+        upload.texture = id;
+        upload.target = target;
+        upload.level = level;
+        upload.width = info.width;
+        upload.height = info.height;
+        upload.pixels = texture.LevelData( level );
+        upload.done = std::move( done );
+
+        if ( texture.header.format )
+        {
+            upload.format = texture.header.format;
+            upload.compressed = true;
+            upload.rowBytes = info.size;
+            upload.rows = 1;
+        }
+        else
+        {
+            upload.internalFormat = texture.InternalFormat( );
+            upload.format = texture.Format( );
+            upload.rowBytes = ( size_t )info.width * texture.header.channels;
+            upload.rows = info.height;
+            upload.bottomUp = texture.bottomUp;
+        }
+
+        UploadQueue::Get( ).Enqueue( std::move( upload ) );
+    }
+
+    // Prints, per asset, what decoding the source costs compared to mapping (and touching) the file actually used, the
+    // texture memory it takes against uncompressed levels and, if block compressed, the PSNR of the top level
+    static void RunReport( const std::vector<std::string> &paths, bool mipmaps = true )
+    {
+        std::shared_ptr<CacheBatch> batch = PrepareAll( paths, 0, mipmaps );
+        size_t totalRaw = 0, totalStored = 0;
+
+        for ( const CachedTexture &texture : batch->textures )
+        {
+            if ( !texture.Valid( ) )
+            {
+                continue;
+            }
+
+            auto start = std::chrono::high_resolution_clock::now( );
+            int width, height, fileChannels;
+            unsigned char *pixels = stbi_load( texture.source.c_str( ), &width, &height, &fileChannels, texture.header.channels );
+            auto middle = std::chrono::high_resolution_clock::now( );
+
+            // Touch every page so the mapping cost includes actually reading the file
+            MappedFile file( texture.path );
+            volatile unsigned char sink = 0;
+
+            for ( size_t i = 0; i < file.Size( ); i += 4096 )
+            {
+                sink = sink + file.Data( )[i];
+            }
+
+            auto end = std::chrono::high_resolution_clock::now( );
+
+            size_t raw = 0, stored = 0;
+
+            for ( uint32_t level = 0; level < texture.header.mipCount; level++ )
+            {
+                raw += ( size_t )texture.levels[level].width * texture.levels[level].height * texture.header.channels;
+                stored += texture.levels[level].size;
+            }
+
+            totalRaw += raw;
+            totalStored += stored;
+
+            std::cout << texture.source << ": decode " << std::chrono::duration<double, std::milli>( middle - start ).count( )
+                      << " ms, mmap " << std::chrono::duration<double, std::milli>( end - middle ).count( ) << " ms ("
+                      << file.Size( ) / 1024 << " KB, " << texture.header.mipCount << " levels), "
+                      << BlockCompressor::FormatName( texture.header.format ) << " " << stored / 1024 << " KB of texture memory vs "
+                      << raw / 1024 << " KB raw";
+
+            if ( texture.header.format && pixels && ( uint32_t )width == texture.header.width && ( uint32_t )height == texture.header.height )
+            {
+                std::vector<unsigned char> decoded( raw );
+                BlockCompressor::Decompress( texture.header.format, texture.LevelData( 0 ), width, height, texture.header.channels, decoded.data( ) );
+                std::cout << ", PSNR " << BlockCompressor::Psnr( pixels, decoded.data( ), ( size_t )width * height * texture.header.channels ) << " dB";
+            }
+
+            std::cout << std::endl;
+            stbi_image_free( pixels );
+        }
+
+        std::cout << "Texture memory: " << totalStored / 1024 << " KB vs " << totalRaw / 1024 << " KB uncompressed" << std::endl;
+    }
+
+    // 2x2 box filter of one mip level into the next. Odd edges repeat their last row/column
+    static void Downsample( const unsigned char *src, int width, int height, int channels, unsigned char *dst )
+    {
+        int dstWidth = std::max( 1, width / 2 );
+        int dstHeight = std::max( 1, height / 2 );
+        int rowLength = width * channels;
+        std::vector<uint16_t> rowSum( rowLength );
+
+        for ( int y = 0; y < dstHeight; y++ )
+        {
+            const unsigned char *row0 = src + ( size_t )std::min( 2 * y, height - 1 ) * rowLength;
+            const unsigned char *row1 = src + ( size_t )std::min( 2 * y + 1, height - 1 ) * rowLength;
+            int i = 0;
+
+            // Vertical pairs, 16 bytes at a time widened to 16 bits
+#if defined(__SSE2__) || defined(_M_X64)
+            __m128i zero = _mm_setzero_si128( );
+
+            for ( ; i + 16 <= rowLength; i += 16 )
+            {
+                __m128i a = _mm_loadu_si128( ( const __m128i * )( row0 + i ) );
+                __m128i b = _mm_loadu_si128( ( const __m128i * )( row1 + i ) );
+                __m128i low = _mm_add_epi16( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( b, zero ) );
+                __m128i high = _mm_add_epi16( _mm_unpackhi_epi8( a, zero ), _mm_unpackhi_epi8( b, zero ) );
+                _mm_storeu_si128( ( __m128i * )&rowSum[i], low );
+                _mm_storeu_si128( ( __m128i * )&rowSum[i + 8], high );
+            }
+#endif
+
+            for ( ; i < rowLength; i++ )
+            {
+                rowSum[i] = row0[i] + row1[i];
+            }
+
+            // Horizontal pairs of pixels
+            unsigned char *out = dst + ( size_t )y * dstWidth * channels;
+
+            for ( int x = 0; x < dstWidth; x++ )
+            {
+                int x0 = 2 * x * channels;
+                int x1 = std::min( 2 * x + 1, width - 1 ) * channels;
+
+                for ( int c = 0; c < channels; c++ )
+                {
+                    out[x * channels + c] = ( unsigned char )( ( rowSum[x0 + c] + rowSum[x1 + c] + 2 ) >> 2 );
+                }
+            }
+        }
+    }
+
+    // Size and modification time of a source, stored in converted files to notice when it changes
+    static bool SourceInfo( const std::string &path, uint64_t &size, int64_t &time )
+    {
+        std::error_code error;
+        size = std::filesystem::file_size( path, error );
+
+        if ( error )
+        {
+            return false;
+        }
+
+        time = ( int64_t )std::filesystem::last_write_time( path, error ).time_since_epoch( ).count( );
+
+        return !error;
+    }
+
+private:
+    // Maps a cache file if it exists and matches the source and channel count
+    static bool Map( CachedTexture &texture, const std::string &cachePath, uint64_t sourceSize, int64_t sourceTime, int channels )
+    {
+        if ( !texture.file.Open( cachePath ) )
+        {
+            return false;
+        }
+
+        if ( Attach( texture, texture.file.Data( ), texture.file.Size( ), sourceSize, sourceTime, channels ) )
+        {
+            texture.path = cachePath;
+            return true;
+        }
+
+        texture.file.Close( );
+
+        return false;
+    }
+
+    // Maps an uncompressed true-color or grayscale TGA whose channel count matches, to be uploaded without decoding
+    static bool MapTarga( CachedTexture &texture, const std::string &path, int channels )
+    {
+        std::string extension = std::filesystem::path( path ).extension( ).string( );
+
+        if ( ( ".tga" != extension && ".TGA" != extension ) || !texture.file.Open( path ) || texture.file.Size( ) < 18 )
+        {
+            texture.file.Close( );
+            return false;
+        }
+
+        // 18 byte header: id length, color map type, image type, color map spec, origin, size, depth, descriptor
+        const unsigned char *tga = texture.file.Data( );
+        uint32_t width = tga[12] | ( tga[13] << 8 );
+        uint32_t height = tga[14] | ( tga[15] << 8 );
+        uint32_t fileChannels = tga[16] / 8;
+        size_t pixelOffset = 18 + tga[0];
+        bool trueColor = 2 == tga[2] && ( 3 == fileChannels || 4 == fileChannels );
+        bool grayscale = 3 == tga[2] && 1 == fileChannels;
+
+        // Right-to-left rows (descriptor bit 4) are left to the decoder
+        if ( 0 != tga[1] || !( trueColor || grayscale ) || ( tga[17] & 0x10 ) || ( 0 != channels && ( uint32_t )channels != fileChannels )
+          || 0 == width || 0 == height || texture.file.Size( ) < pixelOffset + ( size_t )width * height * fileChannels )
+        {
+            texture.file.Close( );
+            return false;
+        }
+
+        TextureCacheHeader &header = texture.header;
+        memcpy( header.magic, TEXTURE_CACHE_MAGIC, 4 );
+        header.version = TEXTURE_CACHE_VERSION;
+        header.width = width;
+        header.height = height;
+        header.channels = fileChannels;
+        header.mipCount = 1;
+        header.format = 0;
+        header.sourceSize = texture.file.Size( );
+        header.sourceTime = 0;
+
+        texture.targaLevel.assign( 1, TextureCacheLevel { pixelOffset, ( uint64_t )width * height * fileChannels, width, height } );
+        texture.levels = texture.targaLevel.data( );
+        texture.data = tga;
+        texture.size = texture.file.Size( );
+        texture.path = path;
+        texture.bgr = trueColor;
+        texture.bottomUp = 0 == ( tga[17] & 0x20 );
+
+        return true;
+    }
+
+    // Points the texture at a cache file image after checking it is complete and matches the source
+    static bool Attach( CachedTexture &texture, const unsigned char *data, size_t size, uint64_t sourceSize, int64_t sourceTime, int channels )
+    {
+        if ( size < sizeof( TextureCacheHeader ) )
+        {
+            return false;
+        }
+
+        memcpy( &texture.header, data, sizeof( TextureCacheHeader ) );
+        const TextureCacheHeader &header = texture.header;
+
+        bool valid = 0 == memcmp( header.magic, TEXTURE_CACHE_MAGIC, 4 ) && TEXTURE_CACHE_VERSION == header.version
+                  && header.sourceSize == sourceSize && header.sourceTime == sourceTime
+                  && ( 0 == channels || ( uint32_t )channels == header.channels ) && header.mipCount > 0
+                  && header.format == ( compression ? BlockCompressor::FormatFor( header.channels ) : 0 )
+                  && size >= sizeof( TextureCacheHeader ) + header.mipCount * sizeof( TextureCacheLevel );
+
+        if ( valid )
+        {
+            const TextureCacheLevel *levels = ( const TextureCacheLevel * )( data + sizeof( TextureCacheHeader ) );
+            const TextureCacheLevel &last = levels[header.mipCount - 1];
+            valid = last.offset + last.size <= size;
+
+            if ( valid )
+            {
+                texture.data = data;
+                texture.size = size;
+                texture.levels = levels;
+            }
+        }
+
+        return valid;
+    }
+
+    static void Prepare( CachedTexture &texture, int channels, bool mipmaps )
+    {
+        STARTUP_SCOPE( "Prepare " + texture.source );
+        auto start = std::chrono::high_resolution_clock::now( );
+
+        texture.source = Resolve( texture.source, channels, mipmaps );
+
+        if ( !mipmaps && !compression && MapTarga( texture, texture.source, channels ) )
+        {
+            texture.prepareMs = std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now( ) - start ).count( );
+            return;
+        }
+
+        uint64_t sourceSize;
+        int64_t sourceTime;
+
+        if ( !SourceInfo( texture.source, sourceSize, sourceTime ) )
+        {
+            std::cerr << "ERROR: Image failed to load at path: " << texture.source << std::endl;
+            return;
+        }
+
+        int fileChannels = CachedChannels( texture.source, channels );
+        std::string cachePath = CachePath( texture.source, fileChannels );
+
+        // A file cached without mipmaps (cubemap faces) is rebuilt the first time the image is wanted with them
+        bool cached = Map( texture, cachePath, sourceSize, sourceTime, fileChannels );
+
+        if ( cached && mipmaps && 1 == texture.header.mipCount && ( texture.header.width > 1 || texture.header.height > 1 ) )
+        {
+            texture.file.Close( );
+            texture.data = nullptr;
+            cached = false;
+        }
+
+        if ( !cached )
+        {
+            texture.built = true;
+            Convert( texture, channels, mipmaps, sourceSize, sourceTime );
+
+            if ( !texture.memory.empty( ) )
+            {
+                Write( texture.memory, cachePath );
+
+                if ( Map( texture, cachePath, sourceSize, sourceTime, fileChannels ) )
+                {
+                    std::vector<unsigned char>( ).swap( texture.memory );
+                }
+                else
+                {
+                    Attach( texture, texture.memory.data( ), texture.memory.size( ), sourceSize, sourceTime, fileChannels );
+                }
+            }
+        }
+
+        texture.prepareMs = std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now( ) - start ).count( );
+    }
+
+    // Channels the cache file of source holds when it is wanted with channels. Cached files for "keep the file's
+    // channels" are looked up under the decoded channel count, so peek at it. Grey + alpha is stored as RGBA
+    static int CachedChannels( const std::string &source, int channels )
+    {
+        int fileChannels = channels;
+
+        if ( 0 == fileChannels )
+        {
+            int w, h;
+            stbi_info( source.c_str( ), &w, &h, &fileChannels );
+        }
+
+        return 2 == fileChannels ? 4 : fileChannels;
+    }
+
+    // Decodes the source and builds the mip chain, producing the contents of the cache file in texture.memory
+    static void Convert( CachedTexture &texture, int channels, bool mipmaps, uint64_t sourceSize, int64_t sourceTime )
+    {
+        auto start = std::chrono::high_resolution_clock::now( );
+
+        int width, height, fileChannels;
+        unsigned char *pixels = stbi_load( texture.source.c_str( ), &width, &height, &fileChannels, channels );
+
+        texture.decodeMs = std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now( ) - start ).count( );
+
+        if ( !pixels )
+        {
+            std::cerr << "ERROR: Image failed to load at path: " << texture.source << std::endl;
+            return;
+        }
+
+        int pixelChannels = channels ? channels : fileChannels;
+
+        // Level 0 is the decoded image, every further level halves the previous one down to 1x1
+        std::vector<std::vector<unsigned char>> levels( 1 );
+        std::vector<TextureCacheLevel> info( 1 );
+        levels[0].assign( pixels, pixels + ( size_t )width * height * pixelChannels );
+
+        // GL has no grey + alpha format to upload from, it is stored as RGBA
+        if ( 2 == pixelChannels )
+        {
+            std::vector<unsigned char> rgba( ( size_t )width * height * 4 );
+
+            for ( size_t i = 0; i < ( size_t )width * height; i++ )
+            {
+                rgba[i * 4 + 0] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = levels[0][i * 2];
+                rgba[i * 4 + 3] = levels[0][i * 2 + 1];
+            }
+
+            levels[0].swap( rgba );
+            pixelChannels = 4;
+        }
+        info[0].width = width;
+        info[0].height = height;
+        stbi_image_free( pixels );
+
+        while ( mipmaps && ( info.back( ).width > 1 || info.back( ).height > 1 ) )
+        {
+            TextureCacheLevel next;
+            next.width = std::max( 1u, info.back( ).width / 2 );
+            next.height = std::max( 1u, info.back( ).height / 2 );
+
+            levels.push_back( std::vector<unsigned char>( ( size_t )next.width * next.height * pixelChannels ) );
+            Downsample( levels[levels.size( ) - 2].data( ), info.back( ).width, info.back( ).height, pixelChannels, levels.back( ).data( ) );
+            info.push_back( next );
+        }
+
+        // Zeroed, padding included, so the same source always gives the same file
+        TextureCacheHeader header = { };
+        memcpy( header.magic, TEXTURE_CACHE_MAGIC, 4 );
+        header.version = TEXTURE_CACHE_VERSION;
+        header.width = width;
+        header.height = height;
+        header.channels = pixelChannels;
+        header.mipCount = ( uint32_t )levels.size( );
+        header.format = compression ? BlockCompressor::FormatFor( pixelChannels ) : 0;
+        header.sourceSize = sourceSize;
+        header.sourceTime = sourceTime;
+
+        // Each level is encoded on its own, its blocks spread over the job system
+        if ( header.format )
+        {
+            auto encodeStart = std::chrono::high_resolution_clock::now( );
+
+            for ( size_t i = 0; i < levels.size( ); i++ )
+            {
+                std::vector<unsigned char> blocks( BlockCompressor::CompressedSize( header.format, info[i].width, info[i].height ) );
+                BlockCompressor::Compress( header.format, levels[i].data( ), info[i].width, info[i].height, pixelChannels, blocks.data( ) );
+                levels[i].swap( blocks );
+            }
+
+            texture.encodeMs = std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now( ) - encodeStart ).count( );
+        }
+
+        uint64_t offset = sizeof( TextureCacheHeader ) + info.size( ) * sizeof( TextureCacheLevel );
+
+        for ( size_t i = 0; i < info.size( ); i++ )
+        {
+            offset = ( offset + 15 ) & ~( uint64_t )15;
+            info[i].offset = offset;
+            info[i].size = levels[i].size( );
+            offset += info[i].size;
+        }
+
+        // Lay out the whole file in memory
+        std::vector<unsigned char> &file = texture.memory;
+        file.assign( offset, 0 );
+        memcpy( file.data( ), &header, sizeof( header ) );
+        memcpy( file.data( ) + sizeof( header ), info.data( ), info.size( ) * sizeof( TextureCacheLevel ) );
+
+        for ( size_t i = 0; i < info.size( ); i++ )
+        {
+            memcpy( file.data( ) + info[i].offset, levels[i].data( ), levels[i].size( ) );
+        }
+    }
+
+    // Written under a temporary name and renamed, so a reader never maps a half written file
+    static void Write( const std::vector<unsigned char> &contents, const std::string &cachePath )
+    {
+        std::error_code error;
+        std::filesystem::create_directories( TEXTURE_CACHE_DIRECTORY, error );
+        std::string temporaryPath = cachePath + ".tmp" + std::to_string( ( size_t )&contents );
+
+        {
+            std::ofstream file( temporaryPath, std::ios::binary );
+            file.write( ( const char * )contents.data( ), contents.size( ) );
+
+            if ( !file )
+            {
+                std::cerr << "ERROR: Could not write texture cache: " << cachePath << std::endl;
+                file.close( );
+                std::filesystem::remove( temporaryPath, error );
+                return;
+            }
+        }
+
+        std::filesystem::rename( temporaryPath, cachePath, error );
+
+        if ( error )
+        {
+            std::cerr << "ERROR: Could not write texture cache: " << cachePath << " (" << error.message( ) << ")" << std::endl;
+            std::filesystem::remove( temporaryPath, error );
+        }
+    }
+};
@@ -0,0 +1,284 @@
+#pragma once
+
+// Std. Includes
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "texture_cache.h"
+#include "upload_queue.h"
+
+// Default limit on the texture memory taken by streamed levels
+const size_t TEXTURE_STREAMING_BUDGET = 128 * 1024 * 1024;
+
+// Levels this size and smaller (the mip tail) are uploaded with the texture and never evicted
+const uint32_t TEXTURE_STREAMING_TAIL_SIZE = 128;
+
+// How fast a newly streamed level blends in, in levels per frame (through GL_TEXTURE_MIN_LOD)
+const float TEXTURE_STREAMING_FADE_RATE = 0.125f;
+
+// Residency manager for mipmapped textures, used from the GL thread. A texture starts with only its mip tail and each
+// frame the renderer says how large the object using it appears on screen. Levels up to the one that size calls for
+// are streamed in one at a time through the UploadQueue, which copies the level out of the mapped cache file on a
+// worker and uploads it within its frame budget; GL_TEXTURE_BASE_LEVEL is lowered once it is issued. Bringing in a level that would go over the budget first evicts
+// the finest level of the least recently used textures, by raising their base level and releasing the storage.
+class TextureStreamer
+{
+public:
+    // Stream Model textures. Off uploads every level at load as before
+    static inline bool enabled = true;
+
+    size_t budget = TEXTURE_STREAMING_BUDGET;
+
+    static TextureStreamer &Get( )
+    {
+        static TextureStreamer instance;
+
+        return instance;
+    }
+
+    // Copies still running read the levels of the textures
+    ~TextureStreamer( )
+    {
+        UploadQueue::Get( ).WaitForCopies( );
+    }
+
+    // Takes over a prepared texture and uploads just its mip tail into the GL texture id. Leaves id bound
+    void Add( GLuint id, CachedTexture &&source )
+    {
+        std::unique_ptr<StreamedTexture> texture( new StreamedTexture( ) );
+        texture->id = id;
+        texture->source = std::move( source );
+
+        uint32_t levels = texture->source.header.mipCount;
+        uint32_t tail = levels - 1;
+
+        while ( tail > 0 && std::max( texture->source.levels[tail - 1].width, texture->source.levels[tail - 1].height ) <= TEXTURE_STREAMING_TAIL_SIZE )
+        {
+            tail--;
+        }
+
+        texture->tail = tail;
+        texture->residentBase = tail;
+        texture->wantedBase = tail;
+        texture->lastUsed = frame;
+
+        glBindTexture( GL_TEXTURE_2D, id );
+
+        for ( uint32_t level = tail; level < levels; level++ )
+        {
+            TextureCache::UploadLevel( texture->source, GL_TEXTURE_2D, level );
+        }
+
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, tail );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1 );
+
+        textures[id] = std::move( texture );
+    }
+
+    // Asks for enough detail on texture id for an object covering this many pixels across on screen
+    void Request( GLuint id, float projectedPixels )
+    {
+        auto found = textures.find( id );
+
+        if ( found == textures.end( ) )
+        {
+            return;
+        }
+
+        StreamedTexture &texture = *found->second;
+
+        // The texture wraps all the way around a body, so the visible half spans the projected width
+        float texelsNeeded = std::max( 1.0f, 2.0f * projectedPixels );
+        float width = ( float )texture.source.header.width;
+        uint32_t level = ( uint32_t )std::max( 0.0f, floorf( log2f( width / texelsNeeded ) ) );
+
+        // Several users of one texture in a frame: the largest wins
+        if ( texture.lastUsed != frame )
+        {
+            texture.wantedBase = texture.tail;
+            texture.lastUsed = frame;
+        }
+
+        texture.wantedBase = std::min( texture.wantedBase, std::min( level, texture.tail ) );
+    }
+
+    // Starts loading the next levels and fades new levels in. Once per frame, after UploadQueue::Update
+    void Update( )
+    {
+        // The budget may have been lowered
+        while ( resident > budget && EvictOne( nullptr ) )
+        {
+        }
+
+        for ( auto &entry : textures )
+        {
+            StreamedTexture &texture = *entry.second;
+
+            if ( texture.loadingLevel < 0 && texture.wantedBase < texture.residentBase )
+            {
+                StartLoading( texture );
+            }
+
+            if ( texture.minLod > 0.0f )
+            {
+                texture.minLod = std::max( 0.0f, texture.minLod - TEXTURE_STREAMING_FADE_RATE );
+                glBindTexture( GL_TEXTURE_2D, texture.id );
+                glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, texture.minLod );
+            }
+        }
+
+        glBindTexture( GL_TEXTURE_2D, 0 );
+        frame++;
+    }
+
+    size_t ResidentBytes( ) const
+    {
+        return resident;
+    }
+
+    void PrintStats( )
+    {
+        std::cout << "Texture streaming: " << resident / 1024 << " KB resident of " << budget / 1024 << " KB budget, "
+                  << streamedLevels << " levels streamed in, " << evictedLevels << " evicted" << std::endl;
+
+        for ( auto &entry : textures )
+        {
+            const StreamedTexture &texture = *entry.second;
+            const TextureCacheLevel &base = texture.source.levels[texture.residentBase];
+            std::cout << "  " << texture.source.source << ": " << base.width << "x" << base.height << " resident (level "
+                      << texture.residentBase << ", wants " << texture.wantedBase << ")" << std::endl;
+        }
+    }
+
+    // Diameter in pixels of a sphere seen from eye, for the projection's vertical scale (projection[1][1]), so it
+    // matches whatever field of view the projection was actually built with
+    static float ProjectedDiameter( const glm::vec3 &center, float radius, const glm::vec3 &eye, float projectionScale, float screenHeight )
+    {
+        float distance = glm::length( center - eye );
+
+        if ( distance <= radius )
+        {
+            return screenHeight;
+        }
+
+        return radius * projectionScale / distance * screenHeight;
+    }
+
+private:
+    struct StreamedTexture
+    {
+        GLuint id = 0;
+        CachedTexture source;
+        uint32_t tail = 0;
+        uint32_t residentBase = 0;
+        uint32_t wantedBase = 0;
+        long long lastUsed = 0;
+        int loadingLevel = -1;
+        float minLod = 0.0f;
+    };
+
+    std::unordered_map<GLuint, std::unique_ptr<StreamedTexture>> textures;
+    long long frame = 0;
+    size_t resident = 0;
+    long long streamedLevels = 0;
+    long long evictedLevels = 0;
+
+    // The upload queue must outlive the streamer
+    TextureStreamer( )
+    {
+        UploadQueue::Get( );
+    }
+
+    // Makes room for the next finer level and queues its upload
+    void StartLoading( StreamedTexture &texture )
+    {
+        uint32_t level = texture.residentBase - 1;
+        size_t bytes = texture.source.levels[level].size;
+
+        while ( resident + bytes > budget )
+        {
+            if ( !EvictOne( &texture ) )
+            {
+                return;
+            }
+        }
+
+        resident += bytes;
+        texture.loadingLevel = ( int )level;
+
+        StreamedTexture *target = &texture;
+        TextureCache::QueueLevel( texture.source, texture.id, GL_TEXTURE_2D, level, [this, target]( ) { Uploaded( *target ); } );
+    }
+
+    // The level is issued and the texture bound
+    void Uploaded( StreamedTexture &texture )
+    {
+        uint32_t level = ( uint32_t )texture.loadingLevel;
+        texture.loadingLevel = -1;
+
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level );
+
+        // Start sampling at the previous detail and let Update blend the new level in
+        texture.residentBase = level;
+        texture.minLod = 1.0f;
+        glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, texture.minLod );
+
+        streamedLevels++;
+    }
+
+    // Drops the finest level of the least recently used texture that can spare one. Textures used this frame only give
+    // up levels finer than they asked for. Returns false if nothing can be evicted
+    bool EvictOne( const StreamedTexture *requester )
+    {
+        StreamedTexture *victim = nullptr;
+
+        for ( auto &entry : textures )
+        {
+            StreamedTexture &candidate = *entry.second;
+            bool spare = candidate.residentBase < candidate.tail && candidate.loadingLevel < 0 && &candidate != requester
+                      && ( candidate.lastUsed < frame || candidate.residentBase < candidate.wantedBase );
+
+            if ( spare && ( !victim || candidate.lastUsed < victim->lastUsed ) )
+            {
+                victim = &candidate;
+            }
+        }
+
+        if ( !victim )
+        {
+            return false;
+        }
+
+        uint32_t level = victim->residentBase;
+        const TextureCacheLevel &info = victim->source.levels[level];
+
+        victim->residentBase = level + 1;
+        victim->minLod = 0.0f;
+
+        // Stop sampling the level, then release its storage by making it empty
+        glBindTexture( GL_TEXTURE_2D, victim->id );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, victim->residentBase );
+        glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, 0.0f );
+
+        if ( victim->source.header.format )
+        {
+            glCompressedTexImage2D( GL_TEXTURE_2D, level, victim->source.header.format, 0, 0, 0, 0, nullptr );
+        }
+        else
+        {
+            glTexImage2D( GL_TEXTURE_2D, level, victim->source.InternalFormat( ), 0, 0, 0, victim->source.Format( ), GL_UNSIGNED_BYTE, nullptr );
+        }
+
+        resident -= info.size;
+        evictedLevels++;
+
+        return true;
+    }
+};
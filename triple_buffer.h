@@ -0,0 +1,77 @@
+#pragma once
+
+// Std. Includes
+#include <atomic>
+
+// Single producer, single consumer handoff of whole snapshots without locks. The producer always has a slot of its own
+// to write into and the consumer always has a slot of its own to read from; the third slot sits in the middle holding
+// the newest complete snapshot. Publishing and acquiring just swap a slot with the middle one, so neither side ever
+// waits for the other and the consumer never sees a half written snapshot.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer( ) : middle( 1 ), writeIndex( 0 ), readIndex( 2 ), overwritten( 0 )
+    {
+    }
+
+    // Producer: slot to fill with the next snapshot
+    T &WriteBuffer( )
+    {
+        return slots[writeIndex];
+    }
+
+    // Producer: makes the write slot the newest snapshot. If the consumer hadn't picked up the previous one it is
+    // dropped, which is counted as a missed handoff
+    void Publish( )
+    {
+        int previous = middle.exchange( writeIndex | FRESH, std::memory_order_acq_rel );
+
+        if ( previous & FRESH )
+        {
+            overwritten.fetch_add( 1, std::memory_order_relaxed );
+        }
+
+        writeIndex = previous & INDEX_MASK;
+    }
+
+    // Consumer: takes the newest snapshot if there is one. Returns false if nothing was published since the last call
+    bool Acquire( )
+    {
+        if ( !( middle.load( std::memory_order_relaxed ) & FRESH ) )
+        {
+            return false;
+        }
+
+        readIndex = middle.exchange( readIndex, std::memory_order_acq_rel ) & INDEX_MASK;
+
+        return true;
+    }
+
+    // Consumer: the snapshot taken by the last successful Acquire
+    const T &ReadBuffer( ) const
+    {
+        return slots[readIndex];
+    }
+
+    // Snapshots that were replaced before the consumer read them
+    unsigned long long Overwritten( ) const
+    {
+        return overwritten.load( std::memory_order_relaxed );
+    }
+
+private:
+    static const int FRESH = 4;
+    static const int INDEX_MASK = 3;
+
+    T slots[3];
+
+    // Index of the middle slot, plus FRESH when it holds a snapshot the consumer hasn't taken yet
+    std::atomic<int> middle;
+
+    // Each only touched by its own side
+    int writeIndex;
+    int readIndex;
+
+    std::atomic<unsigned long long> overwritten;
+};
@@ -0,0 +1,410 @@
+#pragma once
+
+// Std. Includes
+#include <deque>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <iostream>
+#include <functional>
+
+#include <GL/glew.h>
+
+#include "job_system.h"
+#include "pixel_buffer.h"
+
+// Staging slots in the ring and the size of each. Larger uploads go through PixelUnpackBuffer on the GL thread
+const int UPLOAD_QUEUE_SLOTS = 8;
+const size_t UPLOAD_QUEUE_SLOT_SIZE = 4 * 1024 * 1024;
+
+// Default bytes handed to GL per frame. At least one upload is issued per frame whatever its size
+const size_t UPLOAD_QUEUE_FRAME_BUDGET = 8 * 1024 * 1024;
+
+// One texture level to (re)specify from client memory, which must stay valid until done is called
+struct TextureUpload
+{
+    GLuint texture = 0;
+    GLenum target = GL_TEXTURE_2D;
+    GLint level = 0;
+    GLint internalFormat = GL_RGB;
+    GLsizei width = 0;
+    GLsizei height = 0;
+
+    // Pixel format of the rows, or the compressed internal format if compressed
+    GLenum format = GL_RGB;
+    bool compressed = false;
+
+    const unsigned char *pixels = nullptr;
+    size_t rowBytes = 0;
+    GLsizei rows = 0;
+    bool bottomUp = false;
+
+    // Called on the GL thread right after the upload is issued, with the texture still bound
+    std::function<void( )> done;
+
+    size_t Size( ) const
+    {
+        return rowBytes * rows;
+    }
+};
+
+// Asynchronous texture uploads through a ring of pixel unpack buffers, for work that happens while frames are being
+// drawn (streaming, assets loaded mid-session). Each slot is its own buffer, mapped persistently when
+// ARB_buffer_storage is there (else mapped while it is being filled) and guarded by its own fence. Queued uploads get
+// a free slot in Update and a worker copies the pixels in, faulting in the mapped source file on its own time. The
+// next Update hands the filled slots to GL, in order and within a byte budget per frame, then fences them; a slot is
+// reused once its fence has signalled, so neither the GL thread nor the driver ever waits on the other.
+class UploadQueue
+{
+public:
+    size_t frameBudget = UPLOAD_QUEUE_FRAME_BUDGET;
+
+    static UploadQueue &Get( )
+    {
+        static UploadQueue instance;
+
+        return instance;
+    }
+
+    // The copies read memory owned by the callers, finish them before anything is torn down. The GL objects are left
+    // to the context
+    ~UploadQueue( )
+    {
+        WaitForCopies( );
+    }
+
+    void Enqueue( TextureUpload &&upload )
+    {
+        queued.push_back( std::move( upload ) );
+    }
+
+    // Issues the uploads copied since the last call, then starts copying the next ones. Once per frame on the GL thread
+    void Update( )
+    {
+        if ( 0 == slots[0].buffer )
+        {
+            Create( );
+        }
+
+        // Single core: there are no workers to do the copies
+        if ( 1 == JobSystem::Get( ).ThreadCount( ) )
+        {
+            while ( JobSystem::Get( ).RunPending( ) )
+            {
+            }
+        }
+
+        Retire( );
+
+        size_t issuedBytes = 0;
+        int issued = 0;
+
+        while ( !filling.empty( ) )
+        {
+            Slot &slot = slots[filling.front( )];
+            size_t size = slot.upload.Size( );
+
+            if ( slot.copied.pending > 0 )
+            {
+                break;
+            }
+
+            if ( issued > 0 && issuedBytes + size > frameBudget )
+            {
+                deferredFrames++;
+                break;
+            }
+
+            Issue( slot );
+            filling.pop_front( );
+            issuedBytes += size;
+            issued++;
+        }
+
+        // Too large for a slot: staged on this thread, still within the budget
+        while ( !queued.empty( ) && queued.front( ).Size( ) > UPLOAD_QUEUE_SLOT_SIZE
+             && ( 0 == issued || issuedBytes + queued.front( ).Size( ) <= frameBudget ) )
+        {
+            issuedBytes += IssueBefore( queued.front( ).texture, issued );
+            IssueDirect( queued.front( ) );
+            issuedBytes += queued.front( ).Size( );
+            issued++;
+            queued.pop_front( );
+        }
+
+        Assign( issuedBytes, issued );
+
+        issuedTotal += issued;
+        bytesTotal += issuedBytes;
+        frameBytes = issuedBytes;
+        frames++;
+    }
+
+    void WaitForCopies( )
+    {
+        for ( Slot &slot : slots )
+        {
+            JobSystem::Get( ).Wait( slot.copied );
+        }
+    }
+
+    size_t Pending( ) const
+    {
+        return queued.size( ) + filling.size( );
+    }
+
+    // Bytes issued by the last Update
+    size_t FrameBytes( ) const
+    {
+        return frameBytes;
+    }
+
+    void PrintStats( )
+    {
+        std::cout << "Upload queue: " << issuedTotal << " uploads, " << bytesTotal / 1024 << " KB over " << frames << " frames ("
+                  << directTotal << " staged directly), " << deferredFrames << " frames at the budget of " << frameBudget / 1024
+                  << " KB, " << Pending( ) << " pending, " << ( persistent ? "persistent" : "mapped per use" ) << " slots" << std::endl;
+    }
+
+private:
+    enum SlotState
+    {
+        SLOT_FREE,
+        SLOT_FILLING,
+        SLOT_IN_FLIGHT
+    };
+
+    struct Slot
+    {
+        GLuint buffer = 0;
+        unsigned char *mapped = nullptr;
+        GLsync fence = nullptr;
+        SlotState state = SLOT_FREE;
+        TextureUpload upload;
+        JobSystem::Counter copied;
+    };
+
+    Slot slots[UPLOAD_QUEUE_SLOTS];
+    bool persistent = false;
+
+    // Waiting for a slot, then slots being filled in the order they were queued
+    std::deque<TextureUpload> queued;
+    std::deque<int> filling;
+
+    long long issuedTotal = 0;
+    long long directTotal = 0;
+    long long deferredFrames = 0;
+    long long frames = 0;
+    size_t bytesTotal = 0;
+    size_t frameBytes = 0;
+
+    // The job system must outlive the copies it runs
+    UploadQueue( )
+    {
+        JobSystem::Get( );
+    }
+
+    void Create( )
+    {
+        persistent = GLEW_ARB_buffer_storage;
+
+        if ( !CreateSlots( ) )
+        {
+            // Immutable storage can't be respecified, start over with plain buffers mapped per use
+            for ( Slot &slot : slots )
+            {
+                glDeleteBuffers( 1, &slot.buffer );
+                slot.mapped = nullptr;
+            }
+
+            persistent = false;
+            CreateSlots( );
+        }
+    }
+
+    // Returns false if a persistent slot couldn't be mapped
+    bool CreateSlots( )
+    {
+        bool mappedAll = true;
+
+        for ( Slot &slot : slots )
+        {
+            glGenBuffers( 1, &slot.buffer );
+            glBindBuffer( GL_PIXEL_UNPACK_BUFFER, slot.buffer );
+
+            if ( persistent )
+            {
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                glBufferStorage( GL_PIXEL_UNPACK_BUFFER, UPLOAD_QUEUE_SLOT_SIZE, nullptr, flags );
+                slot.mapped = ( unsigned char * )glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, UPLOAD_QUEUE_SLOT_SIZE, flags );
+                mappedAll = mappedAll && nullptr != slot.mapped;
+            }
+            else
+            {
+                glBufferData( GL_PIXEL_UNPACK_BUFFER, UPLOAD_QUEUE_SLOT_SIZE, nullptr, GL_STREAM_DRAW );
+            }
+        }
+
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+        return mappedAll;
+    }
+
+    // Frees the slots the GPU has finished reading, without waiting
+    void Retire( )
+    {
+        for ( Slot &slot : slots )
+        {
+            if ( SLOT_IN_FLIGHT == slot.state && GL_TIMEOUT_EXPIRED != glClientWaitSync( slot.fence, 0, 0 ) )
+            {
+                glDeleteSync( slot.fence );
+                slot.fence = nullptr;
+                slot.state = SLOT_FREE;
+            }
+        }
+    }
+
+    // Hands queued uploads that fit to free slots and copies them in on the job system. An upload whose slot can't be
+    // mapped is staged directly instead, counted in issuedBytes and issued
+    void Assign( size_t &issuedBytes, int &issued )
+    {
+        for ( int i = 0; i < UPLOAD_QUEUE_SLOTS && !queued.empty( ) && queued.front( ).Size( ) <= UPLOAD_QUEUE_SLOT_SIZE; i++ )
+        {
+            Slot &slot = slots[i];
+
+            if ( SLOT_FREE != slot.state )
+            {
+                continue;
+            }
+
+            if ( !persistent )
+            {
+                // The slot's fence has signalled, nothing reads it any more
+                glBindBuffer( GL_PIXEL_UNPACK_BUFFER, slot.buffer );
+                slot.mapped = ( unsigned char * )glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, UPLOAD_QUEUE_SLOT_SIZE,
+                                                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT );
+                glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+                if ( !slot.mapped )
+                {
+                    issuedBytes += IssueBefore( queued.front( ).texture, issued );
+                    IssueDirect( queued.front( ) );
+                    issuedBytes += queued.front( ).Size( );
+                    issued++;
+                    queued.pop_front( );
+                    i--;
+                    continue;
+                }
+            }
+
+            slot.upload = std::move( queued.front( ) );
+            queued.pop_front( );
+            slot.state = SLOT_FILLING;
+            filling.push_back( i );
+
+            unsigned char *destination = slot.mapped;
+            const TextureUpload *upload = &slot.upload;
+            JobSystem::Get( ).Submit( [destination, upload]( )
+            {
+                if ( upload->bottomUp )
+                {
+                    for ( GLsizei row = 0; row < upload->rows; row++ )
+                    {
+                        memcpy( destination + row * upload->rowBytes, upload->pixels + ( upload->rows - 1 - row ) * upload->rowBytes, upload->rowBytes );
+                    }
+                }
+                else
+                {
+                    memcpy( destination, upload->pixels, upload->Size( ) );
+                }
+            }, slot.copied );
+        }
+    }
+
+    static GLenum Binding( GLenum target )
+    {
+        return target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X && target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z ? GL_TEXTURE_CUBE_MAP : target;
+    }
+
+    void Issue( Slot &slot )
+    {
+        const TextureUpload &upload = slot.upload;
+
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, slot.buffer );
+
+        if ( !persistent )
+        {
+            glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+            slot.mapped = nullptr;
+        }
+
+        glBindTexture( Binding( upload.target ), upload.texture );
+
+        if ( upload.compressed )
+        {
+            glCompressedTexImage2D( upload.target, upload.level, upload.format, upload.width, upload.height, 0, ( GLsizei )upload.Size( ), nullptr );
+        }
+        else
+        {
+            GLint previousAlignment;
+            glGetIntegerv( GL_UNPACK_ALIGNMENT, &previousAlignment );
+            glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+            glTexImage2D( upload.target, upload.level, upload.internalFormat, upload.width, upload.height, 0, upload.format, GL_UNSIGNED_BYTE, nullptr );
+            glPixelStorei( GL_UNPACK_ALIGNMENT, previousAlignment );
+        }
+
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+        slot.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+        slot.state = SLOT_IN_FLIGHT;
+
+        if ( upload.done )
+        {
+            upload.done( );
+        }
+
+        glBindTexture( Binding( upload.target ), 0 );
+        slot.upload = TextureUpload( );
+    }
+
+    // Issues the slots queued ahead of a direct upload to texture, waiting for their copies, so an older level can't
+    // land on top of a newer one. Returns the bytes issued
+    size_t IssueBefore( GLuint texture, int &issued )
+    {
+        size_t bytes = 0;
+
+        while ( filling.end( ) != std::find_if( filling.begin( ), filling.end( ), [this, texture]( int i ) { return slots[i].upload.texture == texture; } ) )
+        {
+            Slot &slot = slots[filling.front( )];
+            JobSystem::Get( ).Wait( slot.copied );
+            bytes += slot.upload.Size( );
+            Issue( slot );
+            filling.pop_front( );
+            issued++;
+        }
+
+        return bytes;
+    }
+
+    void IssueDirect( const TextureUpload &upload )
+    {
+        glBindTexture( Binding( upload.target ), upload.texture );
+
+        if ( upload.compressed )
+        {
+            PixelUnpackBuffer::Get( ).UploadCompressed( upload.target, upload.level, upload.format, upload.width, upload.height, upload.pixels, upload.Size( ) );
+        }
+        else
+        {
+            PixelUnpackBuffer::Get( ).Upload( upload.target, upload.level, upload.internalFormat, upload.width, upload.height, upload.format,
+                                              upload.pixels, upload.rowBytes, upload.bottomUp );
+        }
+
+        if ( upload.done )
+        {
+            upload.done( );
+        }
+
+        glBindTexture( Binding( upload.target ), 0 );
+        directTotal++;
+    }
+};
@@ -0,0 +1,23 @@
+#version 330 core
+out uvec4 FragColor;
+
+in vec2 TexCoords;
+
+// Page of the virtual texture each pixel needs, picked like planet.frag does (see virtual_texture.h)
+uniform usampler2D virtualIndirection;
+uniform vec2 virtualSize;
+uniform int virtualLevels;
+uniform float virtualLodBias;
+
+void main()
+{
+    vec2 dx = dFdx(TexCoords * virtualSize);
+    vec2 dy = dFdy(TexCoords * virtualSize);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + virtualLodBias;
+    int level = int(clamp(floor(lod), 0.0, float(virtualLevels - 1)));
+
+    ivec2 pages = textureSize(virtualIndirection, level);
+    ivec2 page = clamp(ivec2(fract(TexCoords) * vec2(pages)), ivec2(0), pages - ivec2(1));
+
+    FragColor = uvec4(page, level, 1);
+}
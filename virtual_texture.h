@@ -0,0 +1,909 @@
+#pragma once
+
+// Std. Includes
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <limits>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <unordered_map>
+
+#include <GL/glew.h>
+
+#include "job_system.h"
+#include "mapped_file.h"
+#include "pixel_buffer.h"
+#include "texture_cache.h"
+#include "block_compression.h"
+#include "frame_arena.h"
+
+const char VIRTUAL_TEXTURE_MAGIC[4] = { 'R', 'V', 'T', 'X' };
+const uint32_t VIRTUAL_TEXTURE_VERSION = 1;
+
+// Texels of the image in a page, and the border repeated around them so bilinear filtering never reads a neighbouring
+// slot of the page cache. Page plus borders is a multiple of 4 so compressed pages land on block boundaries
+const uint32_t VIRTUAL_TEXTURE_PAGE_SIZE = 128;
+const uint32_t VIRTUAL_TEXTURE_BORDER = 4;
+
+// Pages are addressed with 12 bits per axis
+const uint32_t VIRTUAL_TEXTURE_MAX_PAGES = 4096;
+
+// The page cache texture is a square of this many slots per side
+const int VIRTUAL_TEXTURE_CACHE_SLOTS = 16;
+
+// Most pages uploaded per frame
+const size_t VIRTUAL_TEXTURE_UPLOADS_PER_FRAME = 16;
+
+// The feedback pass renders at this fraction of the screen size
+const int VIRTUAL_TEXTURE_FEEDBACK_SCALE = 8;
+
+// Units of the indirection and page cache textures, after the texture array pages
+const GLint VIRTUAL_TEXTURE_INDIRECTION_UNIT = 12;
+const GLint VIRTUAL_TEXTURE_CACHE_UNIT = 13;
+
+// Header of a page file. Followed by levelCount VirtualTextureLevel entries, then (16 byte aligned) every page of every
+// level, finest level first and row by row within a level. A page is (pageSize + 2 * border) texels square, RGB rows or
+// BC1 blocks if format is set
+struct VirtualTextureHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pageSize;
+    uint32_t border;
+    uint32_t levelCount;
+    uint32_t format;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+};
+
+struct VirtualTextureLevel
+{
+    uint32_t pagesX;
+    uint32_t pagesY;
+    uint64_t firstPage;
+};
+
+// Software virtual texturing for images too large to be resident, in plain GL 3.3. The image is cut once into a
+// mip-mapped page file, which is memory-mapped. Each frame a low resolution feedback pass renders the textured objects
+// with the page each pixel would sample (BeginFeedback/EndFeedback) and reads it back asynchronously. A frame later
+// Update turns that into page requests, keeps the pages still in use in an LRU cache texture of fixed slots and
+// uploads a few missing ones per frame, coarsest first. An indirection texture with one texel per page and a level per
+// mip maps every page to the slot holding it, or to the slot of its closest resident ancestor, so sampling falls back
+// to lower detail until the page arrives. The coarsest page is always resident. Used from the GL thread.
+class VirtualTexture
+{
+public:
+    VirtualTexture( )
+    {
+    }
+
+    // The GL objects are left to the context, like the other texture managers
+    VirtualTexture( const VirtualTexture & ) = delete;
+    VirtualTexture &operator=( const VirtualTexture & ) = delete;
+
+    static std::string PagePath( const std::string &source )
+    {
+        std::string name = source;
+        std::replace( name.begin( ), name.end( ), '/', '_' );
+        std::replace( name.begin( ), name.end( ), '\\', '_' );
+
+        return TEXTURE_CACHE_DIRECTORY + name + ".rvt";
+    }
+
+    // Maps the page file of source, building it first if it is missing or out of date, and creates the GL objects.
+    // screenWidth and screenHeight size the feedback pass
+    bool Open( const std::string &imagePath, int screenWidth, int screenHeight )
+    {
+        source = imagePath;
+        std::string path = PagePath( source );
+        uint64_t sourceSize;
+        int64_t sourceTime;
+
+        if ( !TextureCache::SourceInfo( source, sourceSize, sourceTime ) )
+        {
+            std::cerr << "ERROR: Virtual texture source not found: " << source << std::endl;
+            return false;
+        }
+
+        if ( !Map( path, sourceSize, sourceTime ) )
+        {
+            if ( !Build( source, path, sourceSize, sourceTime ) || !Map( path, sourceSize, sourceTime ) )
+            {
+                std::cerr << "ERROR: Could not build virtual texture: " << path << std::endl;
+                return false;
+            }
+        }
+
+        CreateTextures( );
+        CreateFeedback( std::max( 1, screenWidth / VIRTUAL_TEXTURE_FEEDBACK_SCALE ), std::max( 1, screenHeight / VIRTUAL_TEXTURE_FEEDBACK_SCALE ) );
+
+        // The coarsest level is the fallback for everything else
+        const VirtualTextureLevel &top = levels[header.levelCount - 1];
+
+        for ( uint32_t y = 0; y < top.pagesY; y++ )
+        {
+            for ( uint32_t x = 0; x < top.pagesX; x++ )
+            {
+                int slot = UploadPage( Key( header.levelCount - 1, x, y ) );
+
+                if ( slot >= 0 )
+                {
+                    slots[slot].lastUsed = std::numeric_limits<long long>::max( );
+                }
+            }
+        }
+
+        UpdateIndirection( );
+
+        return true;
+    }
+
+    bool Valid( ) const
+    {
+        return nullptr != pages;
+    }
+
+    // Starts the feedback pass: binds its framebuffer and program (a shader writing the page each pixel needs, see
+    // virtual_feedback.frag). Draw the objects using this texture with their usual matrices, then call EndFeedback
+    void BeginFeedback( GLuint program )
+    {
+        glGetIntegerv( GL_VIEWPORT, savedViewport );
+        glGetIntegerv( GL_FRAMEBUFFER_BINDING, &savedFramebuffer );
+        glBindFramebuffer( GL_FRAMEBUFFER, feedbackFramebuffer );
+        glViewport( 0, 0, feedbackWidth, feedbackHeight );
+
+        const GLuint none[4] = { 0, 0, 0, 0 };
+        glClearBufferuiv( GL_COLOR, 0, none );
+        glClear( GL_DEPTH_BUFFER_BIT );
+
+        // Derivatives are VIRTUAL_TEXTURE_FEEDBACK_SCALE times larger at this resolution
+        glUseProgram( program );
+        Bind( program, -log2f( ( float )VIRTUAL_TEXTURE_FEEDBACK_SCALE ) );
+    }
+
+    // Queues the readback of the feedback pass, which Update picks up next frame, and restores the framebuffer that was
+    // bound before
+    void EndFeedback( )
+    {
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, feedbackBuffers[feedbackWrite] );
+        glReadPixels( 0, 0, feedbackWidth, feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, nullptr );
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+
+        feedbackPending[feedbackWrite] = true;
+        feedbackWrite ^= 1;
+
+        glBindFramebuffer( GL_FRAMEBUFFER, savedFramebuffer );
+        glViewport( savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3] );
+    }
+
+    // Binds the indirection and page cache textures and turns virtual texturing on in program (see planet.frag).
+    // lodBias is added to the level chosen from texel derivatives
+    void Bind( GLuint program, float lodBias = 0.0f )
+    {
+        glActiveTexture( GL_TEXTURE0 + VIRTUAL_TEXTURE_INDIRECTION_UNIT );
+        glBindTexture( GL_TEXTURE_2D, indirection );
+        glActiveTexture( GL_TEXTURE0 + VIRTUAL_TEXTURE_CACHE_UNIT );
+        glBindTexture( GL_TEXTURE_2D, cache );
+        glActiveTexture( GL_TEXTURE0 );
+
+        SetUniforms( program, lodBias );
+    }
+
+    void Unbind( GLuint program )
+    {
+        glUniform1i( glGetUniformLocation( program, "virtualTexturing" ), 0 );
+    }
+
+    // Reads last frame's feedback, uploads the pages that finished loading, starts loading the next missing ones and
+    // refreshes the indirection texture. Once per frame
+    void Update( )
+    {
+        if ( !Valid( ) )
+        {
+            return;
+        }
+
+        // Single core: there are no workers to fault the pages in
+        if ( 1 == JobSystem::Get( ).ThreadCount( ) )
+        {
+            while ( JobSystem::Get( ).RunPending( ) )
+            {
+            }
+        }
+
+        bool changed = false;
+
+        if ( !loadingPages.empty( ) && 0 == loading.pending )
+        {
+            for ( uint32_t key : loadingPages )
+            {
+                if ( UploadPage( key ) < 0 )
+                {
+                    break;
+                }
+
+                changed = true;
+            }
+
+            loadingPages.clear( );
+        }
+
+        FrameVector<uint32_t> missing;
+        ReadFeedback( missing );
+
+        if ( loadingPages.empty( ) && !missing.empty( ) )
+        {
+            StartLoading( missing );
+        }
+
+        if ( changed )
+        {
+            UpdateIndirection( );
+        }
+
+        frame++;
+    }
+
+    // Finishes faulting in the pages being loaded, so the next Update uploads them whatever the timing of the workers
+    void WaitForPages( )
+    {
+        JobSystem::Get( ).Wait( loading );
+    }
+
+    void PrintStats( )
+    {
+        if ( !Valid( ) )
+        {
+            return;
+        }
+
+        size_t used = resident.size( );
+        double megabytes = uploadedBytes / ( 1024.0 * 1024.0 );
+        double cacheKilobytes = ( double )slots.size( ) * pageBytes / 1024.0;
+
+        std::cout << "Virtual texture: " << source << ", " << header.width << "x" << header.height << " in " << header.levelCount
+                  << " levels, " << used << "/" << slots.size( ) << " cache pages used (" << cacheKilobytes << " KB)" << std::endl;
+        std::cout << "  " << uploadedPages << " pages uploaded, " << megabytes << " MB at "
+                  << ( uploadSeconds > 0.0 ? megabytes / uploadSeconds : 0.0 ) << " MB/s, " << evictedPages << " evicted" << std::endl;
+        std::cout << "  Cache hit rate " << ( requestedPages ? 100.0 * hitPages / requestedPages : 100.0 ) << "% ("
+                  << hitPages << " of " << requestedPages << " page requests), last frame "
+                  << ( lastRequested ? 100.0 * lastHits / lastRequested : 100.0 ) << "% of " << lastRequested << std::endl;
+    }
+
+    // Residency and feedback as lines for the profiler overlay (see Profiler::DrawOverlay), empty if there is no
+    // virtual texture. Formats into text, so it doesn't allocate
+    void OverlayText( char *text, size_t size ) const
+    {
+        if ( !Valid( ) )
+        {
+            text[0] = '\0';
+            return;
+        }
+
+        snprintf( text, size, "VIRTUAL TEXTURE: %zu/%zu PAGES RESIDENT\n"
+                              "FEEDBACK: %lld PAGES, %.1f%% RESIDENT (ALL: %.1f%%)\n"
+                              "UPLOADED %lld PAGES, EVICTED %lld",
+                  resident.size( ), slots.size( ), lastRequested, lastRequested ? 100.0 * lastHits / lastRequested : 100.0,
+                  requestedPages ? 100.0 * hitPages / requestedPages : 100.0, uploadedPages, evictedPages );
+    }
+
+    // Cuts source into the page file at path: the image is scaled to power of two sides of at least a page, then
+    // every level, down to the one that fits a single page, is split into bordered pages. Wraps horizontally
+    // (longitude) and clamps vertically
+    static bool Build( const std::string &source, const std::string &path, uint64_t sourceSize, int64_t sourceTime )
+    {
+        auto start = std::chrono::high_resolution_clock::now( );
+
+        int width, height, fileChannels;
+        unsigned char *pixels = stbi_load( source.c_str( ), &width, &height, &fileChannels, 3 );
+
+        if ( !pixels )
+        {
+            std::cerr << "ERROR: Image failed to load at path: " << source << std::endl;
+            return false;
+        }
+
+        uint32_t levelWidth = PowerOfTwo( width );
+        uint32_t levelHeight = PowerOfTwo( height );
+
+        if ( levelWidth / VIRTUAL_TEXTURE_PAGE_SIZE > VIRTUAL_TEXTURE_MAX_PAGES || levelHeight / VIRTUAL_TEXTURE_PAGE_SIZE > VIRTUAL_TEXTURE_MAX_PAGES )
+        {
+            std::cerr << "ERROR: Virtual texture too large: " << source << std::endl;
+            stbi_image_free( pixels );
+            return false;
+        }
+
+        std::vector<unsigned char> image( ( size_t )levelWidth * levelHeight * 3 );
+        Resample( pixels, width, height, image.data( ), levelWidth, levelHeight );
+        stbi_image_free( pixels );
+
+        VirtualTextureHeader header;
+        memcpy( header.magic, VIRTUAL_TEXTURE_MAGIC, 4 );
+        header.version = VIRTUAL_TEXTURE_VERSION;
+        header.width = levelWidth;
+        header.height = levelHeight;
+        header.pageSize = VIRTUAL_TEXTURE_PAGE_SIZE;
+        header.border = VIRTUAL_TEXTURE_BORDER;
+        header.format = PageFormat( );
+        header.sourceSize = sourceSize;
+        header.sourceTime = sourceTime;
+
+        std::vector<VirtualTextureLevel> levels;
+        uint64_t pageCount = 0;
+
+        for ( uint32_t w = levelWidth, h = levelHeight; ; w = std::max( VIRTUAL_TEXTURE_PAGE_SIZE, w / 2 ), h = std::max( VIRTUAL_TEXTURE_PAGE_SIZE, h / 2 ) )
+        {
+            levels.push_back( VirtualTextureLevel { w / VIRTUAL_TEXTURE_PAGE_SIZE, h / VIRTUAL_TEXTURE_PAGE_SIZE, pageCount } );
+            pageCount += ( uint64_t )levels.back( ).pagesX * levels.back( ).pagesY;
+
+            if ( VIRTUAL_TEXTURE_PAGE_SIZE == w && VIRTUAL_TEXTURE_PAGE_SIZE == h )
+            {
+                break;
+            }
+        }
+
+        header.levelCount = ( uint32_t )levels.size( );
+
+        std::error_code error;
+        std::filesystem::create_directories( TEXTURE_CACHE_DIRECTORY, error );
+        std::string temporaryPath = path + ".tmp";
+
+        {
+            std::ofstream file( temporaryPath, std::ios::binary );
+            file.write( ( const char * )&header, sizeof( header ) );
+            file.write( ( const char * )levels.data( ), levels.size( ) * sizeof( VirtualTextureLevel ) );
+
+            std::vector<char> padding( DataOffset( header.levelCount ) - sizeof( header ) - levels.size( ) * sizeof( VirtualTextureLevel ), 0 );
+            file.write( padding.data( ), padding.size( ) );
+
+            size_t bytes = PageBytes( header.format );
+            std::vector<unsigned char> next;
+
+            for ( size_t level = 0; level < levels.size( ); level++ )
+            {
+                // One row of pages at a time, cut and encoded in parallel
+                std::vector<unsigned char> row( levels[level].pagesX * bytes );
+
+                for ( uint32_t y = 0; y < levels[level].pagesY; y++ )
+                {
+                    JobSystem::Get( ).ParallelFor( levels[level].pagesX, 1, [&]( size_t begin, size_t end )
+                    {
+                        for ( size_t x = begin; x < end; x++ )
+                        {
+                            CutPage( image.data( ), levelWidth, levelHeight, ( uint32_t )x, y, header.format, row.data( ) + x * bytes );
+                        }
+                    } );
+
+                    file.write( ( const char * )row.data( ), row.size( ) );
+                }
+
+                if ( level + 1 < levels.size( ) )
+                {
+                    uint32_t nextWidth = levels[level + 1].pagesX * VIRTUAL_TEXTURE_PAGE_SIZE;
+                    uint32_t nextHeight = levels[level + 1].pagesY * VIRTUAL_TEXTURE_PAGE_SIZE;
+                    next.resize( ( size_t )nextWidth * nextHeight * 3 );
+                    Resample( image.data( ), levelWidth, levelHeight, next.data( ), nextWidth, nextHeight );
+                    image.swap( next );
+                    levelWidth = nextWidth;
+                    levelHeight = nextHeight;
+                }
+            }
+
+            if ( !file )
+            {
+                std::cerr << "ERROR: Could not write virtual texture: " << path << std::endl;
+                return false;
+            }
+        }
+
+        std::filesystem::rename( temporaryPath, path, error );
+
+        std::cout << "Built virtual texture " << path << ": " << pageCount << " pages in "
+                  << std::chrono::duration<double>( std::chrono::high_resolution_clock::now( ) - start ).count( ) << " s" << std::endl;
+
+        return !error;
+    }
+
+private:
+    static constexpr uint32_t EMPTY = 0xFFFFFFFF;
+
+    struct Slot
+    {
+        uint32_t key = EMPTY;
+        long long lastUsed = 0;
+    };
+
+    std::string source;
+    MappedFile file;
+    VirtualTextureHeader header;
+    const VirtualTextureLevel *levels = nullptr;
+    const unsigned char *pages = nullptr;
+    size_t pageBytes = 0;
+
+    GLuint indirection = 0;
+    GLuint cache = 0;
+    std::vector<Slot> slots;
+    std::unordered_map<uint32_t, int> resident;
+
+    GLuint feedbackFramebuffer = 0;
+    GLuint feedbackColor = 0;
+    GLuint feedbackDepth = 0;
+    GLuint feedbackBuffers[2] = { 0, 0 };
+    bool feedbackPending[2] = { false, false };
+    int feedbackWrite = 0;
+    int feedbackWidth = 0;
+    int feedbackHeight = 0;
+    GLint savedViewport[4];
+    GLint savedFramebuffer = 0;
+
+    // Pages whose file pages are being faulted in, uploaded by the next Update
+    std::vector<uint32_t> loadingPages;
+    JobSystem::Counter loading;
+
+    long long frame = 0;
+    long long requestedPages = 0;
+    long long hitPages = 0;
+    long long lastRequested = 0;
+    long long lastHits = 0;
+    long long uploadedPages = 0;
+    long long evictedPages = 0;
+    double uploadedBytes = 0.0;
+    double uploadSeconds = 0.0;
+
+    static uint32_t Key( uint32_t level, uint32_t x, uint32_t y )
+    {
+        return level << 24 | y << 12 | x;
+    }
+
+    static GLenum PageFormat( )
+    {
+        return TextureCache::compression ? BlockCompressor::FormatFor( 3 ) : 0;
+    }
+
+    static uint32_t TileSize( )
+    {
+        return VIRTUAL_TEXTURE_PAGE_SIZE + 2 * VIRTUAL_TEXTURE_BORDER;
+    }
+
+    static size_t PageBytes( GLenum format )
+    {
+        return format ? BlockCompressor::CompressedSize( format, TileSize( ), TileSize( ) ) : ( size_t )TileSize( ) * TileSize( ) * 3;
+    }
+
+    static uint64_t DataOffset( uint32_t levelCount )
+    {
+        return ( sizeof( VirtualTextureHeader ) + levelCount * sizeof( VirtualTextureLevel ) + 15 ) & ~( uint64_t )15;
+    }
+
+    // Nearest power of two, at least a page
+    static uint32_t PowerOfTwo( int size )
+    {
+        uint32_t power = VIRTUAL_TEXTURE_PAGE_SIZE;
+
+        while ( power * 2 <= ( uint32_t )size )
+        {
+            power *= 2;
+        }
+
+        return ( ( uint32_t )size - power > power * 2 - ( uint32_t )size ) ? power * 2 : power;
+    }
+
+    // Bilinear resampling of RGB pixels. Sampling at the centre of each 2x2 footprint makes halving a box filter
+    static void Resample( const unsigned char *src, int srcWidth, int srcHeight, unsigned char *dst, int dstWidth, int dstHeight )
+    {
+        float scaleX = ( float )srcWidth / dstWidth;
+        float scaleY = ( float )srcHeight / dstHeight;
+
+        JobSystem::Get( ).ParallelFor( dstHeight, 16, [&]( size_t begin, size_t end )
+        {
+            for ( size_t y = begin; y < end; y++ )
+            {
+                float sy = std::max( 0.0f, ( y + 0.5f ) * scaleY - 0.5f );
+                int y0 = std::min( ( int )sy, srcHeight - 1 );
+                int y1 = std::min( y0 + 1, srcHeight - 1 );
+                float wy = sy - y0;
+
+                for ( int x = 0; x < dstWidth; x++ )
+                {
+                    float sx = std::max( 0.0f, ( x + 0.5f ) * scaleX - 0.5f );
+                    int x0 = std::min( ( int )sx, srcWidth - 1 );
+                    int x1 = std::min( x0 + 1, srcWidth - 1 );
+                    float wx = sx - x0;
+
+                    for ( int c = 0; c < 3; c++ )
+                    {
+                        float top = src[( ( size_t )y0 * srcWidth + x0 ) * 3 + c] * ( 1.0f - wx ) + src[( ( size_t )y0 * srcWidth + x1 ) * 3 + c] * wx;
+                        float bottom = src[( ( size_t )y1 * srcWidth + x0 ) * 3 + c] * ( 1.0f - wx ) + src[( ( size_t )y1 * srcWidth + x1 ) * 3 + c] * wx;
+                        dst[( y * dstWidth + x ) * 3 + c] = ( unsigned char )( top * ( 1.0f - wy ) + bottom * wy + 0.5f );
+                    }
+                }
+            }
+        } );
+    }
+
+    // Copies page (x, y) of a level image with its border and encodes it into out
+    static void CutPage( const unsigned char *image, uint32_t width, uint32_t height, uint32_t x, uint32_t y, GLenum format, unsigned char *out )
+    {
+        uint32_t tile = TileSize( );
+        std::vector<unsigned char> pixels( ( size_t )tile * tile * 3 );
+
+        for ( uint32_t row = 0; row < tile; row++ )
+        {
+            int sy = std::min( std::max( ( int )( y * VIRTUAL_TEXTURE_PAGE_SIZE + row ) - ( int )VIRTUAL_TEXTURE_BORDER, 0 ), ( int )height - 1 );
+
+            for ( uint32_t column = 0; column < tile; column++ )
+            {
+                int sx = ( int )( x * VIRTUAL_TEXTURE_PAGE_SIZE + column ) - ( int )VIRTUAL_TEXTURE_BORDER;
+                sx = ( sx + ( int )width ) % ( int )width;
+                memcpy( &pixels[( ( size_t )row * tile + column ) * 3], &image[( ( size_t )sy * width + sx ) * 3], 3 );
+            }
+        }
+
+        if ( format )
+        {
+            BlockCompressor::Compress( format, pixels.data( ), tile, tile, 3, out );
+        }
+        else
+        {
+            memcpy( out, pixels.data( ), pixels.size( ) );
+        }
+    }
+
+    // Maps a page file if it is complete and matches the source and the current page format
+    bool Map( const std::string &path, uint64_t sourceSize, int64_t sourceTime )
+    {
+        if ( !file.Open( path ) || file.Size( ) < sizeof( VirtualTextureHeader ) )
+        {
+            file.Close( );
+            return false;
+        }
+
+        memcpy( &header, file.Data( ), sizeof( header ) );
+
+        bool valid = 0 == memcmp( header.magic, VIRTUAL_TEXTURE_MAGIC, 4 ) && VIRTUAL_TEXTURE_VERSION == header.version
+                  && header.sourceSize == sourceSize && header.sourceTime == sourceTime && header.levelCount > 0
+                  && VIRTUAL_TEXTURE_PAGE_SIZE == header.pageSize && VIRTUAL_TEXTURE_BORDER == header.border
+                  && PageFormat( ) == header.format && file.Size( ) >= DataOffset( header.levelCount );
+
+        if ( valid )
+        {
+            const VirtualTextureLevel *table = ( const VirtualTextureLevel * )( file.Data( ) + sizeof( VirtualTextureHeader ) );
+            const VirtualTextureLevel &last = table[header.levelCount - 1];
+            pageBytes = PageBytes( header.format );
+            valid = DataOffset( header.levelCount ) + ( last.firstPage + 1 ) * pageBytes <= file.Size( );
+
+            if ( valid )
+            {
+                levels = table;
+                pages = file.Data( ) + DataOffset( header.levelCount );
+                return true;
+            }
+        }
+
+        file.Close( );
+
+        return false;
+    }
+
+    void CreateTextures( )
+    {
+        // One texel per page, one level per page level. Integer texels: slot x, slot y, level of the page the slot holds
+        glGenTextures( 1, &indirection );
+        glBindTexture( GL_TEXTURE_2D, indirection );
+
+        for ( uint32_t level = 0; level < header.levelCount; level++ )
+        {
+            glTexImage2D( GL_TEXTURE_2D, level, GL_RGBA8UI, levels[level].pagesX, levels[level].pagesY, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr );
+        }
+
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.levelCount - 1 );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+
+        GLsizei size = VIRTUAL_TEXTURE_CACHE_SLOTS * TileSize( );
+        glGenTextures( 1, &cache );
+        glBindTexture( GL_TEXTURE_2D, cache );
+
+        if ( header.format )
+        {
+            glCompressedTexImage2D( GL_TEXTURE_2D, 0, header.format, size, size, 0,
+                                    ( GLsizei )BlockCompressor::CompressedSize( header.format, size, size ), nullptr );
+        }
+        else
+        {
+            glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB8, size, size, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr );
+        }
+
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0 );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+
+        slots.assign( VIRTUAL_TEXTURE_CACHE_SLOTS * VIRTUAL_TEXTURE_CACHE_SLOTS, Slot( ) );
+    }
+
+    // Page ids are written to an unsigned integer target and read back through two pack buffers, so the map a frame
+    // later doesn't wait for the GPU
+    void CreateFeedback( int width, int height )
+    {
+        feedbackWidth = width;
+        feedbackHeight = height;
+
+        glGenRenderbuffers( 1, &feedbackColor );
+        glBindRenderbuffer( GL_RENDERBUFFER, feedbackColor );
+        glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA16UI, width, height );
+
+        glGenRenderbuffers( 1, &feedbackDepth );
+        glBindRenderbuffer( GL_RENDERBUFFER, feedbackDepth );
+        glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height );
+        glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+        GLint previousFramebuffer;
+        glGetIntegerv( GL_FRAMEBUFFER_BINDING, &previousFramebuffer );
+
+        glGenFramebuffers( 1, &feedbackFramebuffer );
+        glBindFramebuffer( GL_FRAMEBUFFER, feedbackFramebuffer );
+        glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackColor );
+        glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth );
+
+        if ( GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus( GL_FRAMEBUFFER ) )
+        {
+            std::cerr << "ERROR: Virtual texture feedback framebuffer is not complete" << std::endl;
+        }
+
+        glBindFramebuffer( GL_FRAMEBUFFER, previousFramebuffer );
+
+        glGenBuffers( 2, feedbackBuffers );
+
+        for ( GLuint buffer : feedbackBuffers )
+        {
+            glBindBuffer( GL_PIXEL_PACK_BUFFER, buffer );
+            glBufferData( GL_PIXEL_PACK_BUFFER, ( size_t )width * height * 4 * sizeof( uint16_t ), nullptr, GL_STREAM_READ );
+        }
+
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    }
+
+    void SetUniforms( GLuint program, float lodBias )
+    {
+        glUniform1i( glGetUniformLocation( program, "virtualTexturing" ), 1 );
+        glUniform1i( glGetUniformLocation( program, "virtualIndirection" ), VIRTUAL_TEXTURE_INDIRECTION_UNIT );
+        glUniform1i( glGetUniformLocation( program, "virtualPages" ), VIRTUAL_TEXTURE_CACHE_UNIT );
+        glUniform2f( glGetUniformLocation( program, "virtualSize" ), ( GLfloat )header.width, ( GLfloat )header.height );
+        glUniform1i( glGetUniformLocation( program, "virtualLevels" ), header.levelCount );
+        glUniform1f( glGetUniformLocation( program, "virtualLodBias" ), lodBias );
+        glUniform1f( glGetUniformLocation( program, "virtualPageSize" ), ( GLfloat )VIRTUAL_TEXTURE_PAGE_SIZE );
+        glUniform1f( glGetUniformLocation( program, "virtualBorder" ), ( GLfloat )VIRTUAL_TEXTURE_BORDER );
+        glUniform1f( glGetUniformLocation( program, "virtualCacheSize" ), ( GLfloat )( VIRTUAL_TEXTURE_CACHE_SLOTS * TileSize( ) ) );
+    }
+
+    // Collects the distinct pages of last frame's feedback and their ancestors, marks the resident ones as used and
+    // returns the others, coarsest first
+    void ReadFeedback( FrameVector<uint32_t> &missing )
+    {
+        int index = feedbackWrite;
+
+        if ( !feedbackPending[index] )
+        {
+            return;
+        }
+
+        feedbackPending[index] = false;
+
+        FrameVector<uint32_t> requests;
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, feedbackBuffers[index] );
+        const uint16_t *texels = ( const uint16_t * )glMapBufferRange( GL_PIXEL_PACK_BUFFER, 0, ( size_t )feedbackWidth * feedbackHeight * 4 * sizeof( uint16_t ), GL_MAP_READ_BIT );
+
+        if ( texels )
+        {
+            for ( int i = 0; i < feedbackWidth * feedbackHeight; i++ )
+            {
+                const uint16_t *texel = texels + 4 * i;
+
+                if ( texel[3] && texel[2] < header.levelCount && texel[0] < levels[texel[2]].pagesX && texel[1] < levels[texel[2]].pagesY )
+                {
+                    requests.push_back( Key( texel[2], texel[0], texel[1] ) );
+                }
+            }
+
+            glUnmapBuffer( GL_PIXEL_PACK_BUFFER );
+        }
+
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+
+        std::sort( requests.begin( ), requests.end( ) );
+        requests.erase( std::unique( requests.begin( ), requests.end( ) ), requests.end( ) );
+
+        lastRequested = ( long long )requests.size( );
+        lastHits = 0;
+
+        for ( uint32_t key : requests )
+        {
+            lastHits += resident.count( key );
+        }
+
+        requestedPages += lastRequested;
+        hitPages += lastHits;
+
+        // Ancestors keep the fallback for each page close in detail
+        for ( size_t i = 0, count = requests.size( ); i < count; i++ )
+        {
+            uint32_t level = requests[i] >> 24;
+            uint32_t x = requests[i] & 0xFFF;
+            uint32_t y = ( requests[i] >> 12 ) & 0xFFF;
+
+            for ( ; level + 1 < header.levelCount; level++ )
+            {
+                x = levels[level].pagesX > 1 ? x / 2 : x;
+                y = levels[level].pagesY > 1 ? y / 2 : y;
+                requests.push_back( Key( level + 1, x, y ) );
+            }
+        }
+
+        std::sort( requests.begin( ), requests.end( ) );
+        requests.erase( std::unique( requests.begin( ), requests.end( ) ), requests.end( ) );
+
+        // The level is in the top bits, so going backwards visits the coarsest pages first
+        for ( auto key = requests.rbegin( ); key != requests.rend( ); ++key )
+        {
+            auto found = resident.find( *key );
+
+            if ( found != resident.end( ) )
+            {
+                slots[found->second].lastUsed = std::max( slots[found->second].lastUsed, frame );
+            }
+            else
+            {
+                missing.push_back( *key );
+            }
+        }
+    }
+
+    const unsigned char *PageData( uint32_t key ) const
+    {
+        const VirtualTextureLevel &level = levels[key >> 24];
+        uint64_t index = level.firstPage + ( uint64_t )( ( key >> 12 ) & 0xFFF ) * level.pagesX + ( key & 0xFFF );
+
+        return pages + index * pageBytes;
+    }
+
+    // Takes the next few missing pages and faults their part of the mapped file in on the job system
+    void StartLoading( const FrameVector<uint32_t> &missing )
+    {
+        size_t count = std::min( missing.size( ), VIRTUAL_TEXTURE_UPLOADS_PER_FRAME );
+        loadingPages.assign( missing.begin( ), missing.begin( ) + count );
+
+        std::vector<const unsigned char *> data;
+
+        for ( uint32_t key : loadingPages )
+        {
+            data.push_back( PageData( key ) );
+        }
+
+        size_t bytes = pageBytes;
+        JobSystem::Get( ).Submit( [data, bytes]( )
+        {
+            volatile unsigned char sink = 0;
+
+            for ( const unsigned char *page : data )
+            {
+                for ( size_t i = 0; i < bytes; i += 4096 )
+                {
+                    sink = sink + page[i];
+                }
+
+                sink = sink + page[bytes - 1];
+            }
+        }, loading );
+    }
+
+    // Puts a page in a free slot or in place of the least recently used page not needed this frame. Returns the slot,
+    // or -1 if every slot is in use
+    int UploadPage( uint32_t key )
+    {
+        int slot = -1;
+
+        for ( int i = 0; i < ( int )slots.size( ); i++ )
+        {
+            if ( EMPTY == slots[i].key )
+            {
+                slot = i;
+                break;
+            }
+
+            if ( slots[i].lastUsed < frame && ( slot < 0 || slots[i].lastUsed < slots[slot].lastUsed ) )
+            {
+                slot = i;
+            }
+        }
+
+        if ( slot < 0 )
+        {
+            return -1;
+        }
+
+        if ( EMPTY != slots[slot].key )
+        {
+            resident.erase( slots[slot].key );
+            evictedPages++;
+        }
+
+        slots[slot].key = key;
+        slots[slot].lastUsed = frame;
+        resident[key] = slot;
+
+        auto start = std::chrono::high_resolution_clock::now( );
+
+        GLint x = ( slot % VIRTUAL_TEXTURE_CACHE_SLOTS ) * TileSize( );
+        GLint y = ( slot / VIRTUAL_TEXTURE_CACHE_SLOTS ) * TileSize( );
+        glBindTexture( GL_TEXTURE_2D, cache );
+
+        if ( header.format )
+        {
+            PixelUnpackBuffer::Get( ).UploadCompressedSubImage( GL_TEXTURE_2D, 0, x, y, header.format, TileSize( ), TileSize( ), PageData( key ), pageBytes );
+        }
+        else
+        {
+            PixelUnpackBuffer::Get( ).UploadSubImage( GL_TEXTURE_2D, 0, x, y, TileSize( ), TileSize( ), GL_RGB, PageData( key ), ( size_t )TileSize( ) * 3 );
+        }
+
+        glBindTexture( GL_TEXTURE_2D, 0 );
+
+        uploadSeconds += std::chrono::duration<double>( std::chrono::high_resolution_clock::now( ) - start ).count( );
+        uploadedBytes += pageBytes;
+        uploadedPages++;
+
+        return slot;
+    }
+
+    // Rebuilds every level of the indirection texture from the coarsest down: a resident page points at its own slot,
+    // any other page at whatever its parent points at
+    void UpdateIndirection( )
+    {
+        std::vector<std::vector<uint32_t>> table( header.levelCount );
+        glBindTexture( GL_TEXTURE_2D, indirection );
+
+        for ( int level = ( int )header.levelCount - 1; level >= 0; level-- )
+        {
+            const VirtualTextureLevel &info = levels[level];
+            table[level].assign( ( size_t )info.pagesX * info.pagesY, 0 );
+
+            for ( uint32_t y = 0; y < info.pagesY; y++ )
+            {
+                for ( uint32_t x = 0; x < info.pagesX; x++ )
+                {
+                    uint32_t &entry = table[level][( size_t )y * info.pagesX + x];
+                    auto found = resident.find( Key( level, x, y ) );
+
+                    if ( found != resident.end( ) )
+                    {
+                        uint32_t slotX = found->second % VIRTUAL_TEXTURE_CACHE_SLOTS;
+                        uint32_t slotY = found->second / VIRTUAL_TEXTURE_CACHE_SLOTS;
+                        entry = slotX | slotY << 8 | ( uint32_t )level << 16 | 0xFFu << 24;
+                    }
+                    else if ( level + 1 < ( int )header.levelCount )
+                    {
+                        const VirtualTextureLevel &parent = levels[level + 1];
+                        entry = table[level + 1][( size_t )( info.pagesY > 1 ? y / 2 : y ) * parent.pagesX + ( info.pagesX > 1 ? x / 2 : x )];
+                    }
+                }
+            }
+
+            PixelUnpackBuffer::Get( ).UploadSubImage( GL_TEXTURE_2D, level, 0, 0, info.pagesX, info.pagesY, GL_RGBA_INTEGER,
+                                                      ( const unsigned char * )table[level].data( ), ( size_t )info.pagesX * 4 );
+        }
+
+        glBindTexture( GL_TEXTURE_2D, 0 );
+    }
+};